@@ -0,0 +1,15 @@
+#include "Activation.h"
+#include "SimdKernels.h"
+
+namespace cnn
+{
+	void Activate(EActFn eActFn, data_t* x, size_t n)
+	{
+		DispatchSimd<ActivateKernel>(eActFn, x, n);
+	}
+
+	void ActivateBackward(EActFn eActFn, const data_t* out, const data_t* deltaIn, data_t* delta, size_t n)
+	{
+		DispatchSimd<ActivateBackwardKernel>(eActFn, out, deltaIn, delta, n);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Activation functions applied in bulk to contiguous arrays with the vector backend of GetSimd
+	// exp is a degree 6 polynomial after range reduction, its relative error is below 3e-7,
+	// sigmoid and tanh built on it stay within 1e-6 of the exact values.
+
+	// x[0, n) = f(x[0, n))
+	void Activate(EActFn eActFn, data_t* x, size_t n);
+
+	// delta[0, n) = deltaIn[0, n) * f'(x), computed from the outputs out = f(x)
+	// delta may alias deltaIn.
+	void ActivateBackward(EActFn eActFn, const data_t* out, const data_t* deltaIn, data_t* delta, size_t n);
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "Checkpoint.h"
+#include <cstdio>
+
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#endif
+
+namespace cnn
+{
+	CheckpointWriter::CheckpointWriter(const std::string& path)
+		: mPath(path)
+		, mBuffers()
+		, mCurr(0)
+		, mQueue()
+		, mbFailed(false)
+		, mbStop(false)
+		, mMutex()
+		, mChanged()
+		, mWriter()
+	{
+		mWriter = std::thread(&CheckpointWriter::writerLoop, this);
+	}
+
+	CheckpointWriter::~CheckpointWriter()
+	{
+		Flush();
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mbStop = true;
+		}
+		mChanged.notify_all();
+		mWriter.join();
+		for (Buffer& buffer : mBuffers)
+		{
+			if (buffer.Data != nullptr)
+			{
+				Free(buffer.Data);
+			}
+		}
+	}
+
+	uint8_t* CheckpointWriter::Acquire(size_t size)
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mChanged.wait(lock, [this] { return mBuffers[0].bQueued == false || mBuffers[1].bQueued == false; });
+		mCurr = mBuffers[0].bQueued ? 1 : 0;
+		Buffer& buffer = mBuffers[mCurr];
+		if (buffer.Capacity < size)
+		{
+			if (buffer.Data != nullptr)
+			{
+				Free(buffer.Data);
+			}
+			buffer.Data = Alloc<uint8_t>(size);
+			buffer.Capacity = size;
+		}
+		buffer.Size = size;
+		return buffer.Data;
+	}
+
+	void CheckpointWriter::Submit()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mBuffers[mCurr].bQueued = true;
+			mQueue.push_back(mCurr);
+		}
+		mChanged.notify_all();
+	}
+
+	bool CheckpointWriter::Flush()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		mChanged.wait(lock, [this] { return mBuffers[0].bQueued == false && mBuffers[1].bQueued == false; });
+		const bool bOk = mbFailed == false;
+		mbFailed = false;
+		return bOk;
+	}
+
+	void CheckpointWriter::writerLoop()
+	{
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (true)
+		{
+			mChanged.wait(lock, [this] { return mbStop || mQueue.empty() == false; });
+			if (mQueue.empty())
+			{
+				return;
+			}
+			// The buffer stays queued, Acquire leaves it alone until it is written
+			const Buffer& buffer = mBuffers[mQueue.front()];
+			lock.unlock();
+			const bool bOk = write(buffer.Data, buffer.Size);
+			lock.lock();
+			mbFailed = mbFailed || bOk == false;
+			mBuffers[mQueue.front()].bQueued = false;
+			mQueue.pop_front();
+			mChanged.notify_all();
+		}
+	}
+
+	bool CheckpointWriter::write(const uint8_t* data, size_t size) const
+	{
+		const std::string TMP_PATH = mPath + ".tmp";
+		FILE* file = fopen(TMP_PATH.c_str(), "wb");
+		if (file == nullptr)
+		{
+			return false;
+		}
+		bool bOk = fwrite(data, 1, size, file) == size && fflush(file) == 0;
+		// On the disk before it replaces the previous checkpoint
+#ifdef _MSC_VER
+		bOk = bOk && _commit(_fileno(file)) == 0;
+#elif defined(__linux__)
+		bOk = bOk && fsync(fileno(file)) == 0;
+#endif
+		bOk = fclose(file) == 0 && bOk;
+		if (bOk == false)
+		{
+			remove(TMP_PATH.c_str());
+			return false;
+		}
+#ifdef _MSC_VER
+		return MoveFileExA(TMP_PATH.c_str(), mPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		return rename(TMP_PATH.c_str(), mPath.c_str()) == 0;
+#endif
+	}
+}
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Training checkpoint file, see Network::SetCheckpoint
+	//	CheckpointHeader
+	//	data_t[ArenaSize]				parameters
+	//	data_t[NumStates * ArenaSize]	optimizer states
+	//	uint64_t[NumImages]				training images in their shuffled order, as indices into the data
+	//	char[RngSize]					the shuffle generator's state in std::mt19937 text form
+	// Values are in the writing host's byte order, files of other hosts are rejected.
+	constexpr uint32_t CHECKPOINT_MAGIC = 0x4B434E43;	// "CNCK"
+	constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+	struct CheckpointHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t ByteOrder;	// MODEL_BYTE_ORDER
+		uint32_t ValueSize;	// sizeof(data_t)
+		uint64_t NumLayers;
+		uint64_t ArenaSize;	// Values per region of the network's parameter arena
+		uint64_t NumStates;
+		uint64_t NumImages;
+		uint64_t Epoch;		// Epochs of Fit completed
+		uint64_t NumSteps;	// Optimizer steps taken, the t of the bias correction
+		uint64_t ValIdx;	// Validation fold of the next epoch
+		uint64_t RngSize;
+	};
+
+	// Writes checkpoints to one file from a background thread
+	// The training thread copies its state into one of two buffers and goes on while the other one may still be written.
+	// Every checkpoint is written to path.tmp and renamed over path, so a crash leaves the previous checkpoint.
+	class CheckpointWriter
+	{
+	public:
+		explicit CheckpointWriter(const std::string& path);
+		// Waits for the submitted checkpoints
+		~CheckpointWriter();
+		CheckpointWriter(const CheckpointWriter&) = delete;
+		CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+		// A buffer of size bytes no write uses, waits while both buffers are queued
+		uint8_t* Acquire(size_t size);
+		// Queue the buffer of the last Acquire for writing
+		void Submit();
+		// Returns once every submitted checkpoint is written, false if one of them failed since the last Flush
+		bool Flush();
+
+		const std::string& GetPath() const { return mPath; }
+	private:
+		struct Buffer
+		{
+			uint8_t* Data;
+			size_t Capacity;
+			size_t Size;
+			bool bQueued;	// Submitted and not written yet
+		};
+	private:
+		void writerLoop();
+		// Replace the file with size bytes of data
+		bool write(const uint8_t* data, size_t size) const;
+	private:
+		const std::string mPath;
+		Buffer mBuffers[2];
+		size_t mCurr;	// Buffer of the last Acquire
+		std::deque<size_t> mQueue;
+		bool mbFailed;
+		bool mbStop;
+		std::mutex mMutex;
+		std::condition_variable mChanged;
+		std::thread mWriter;
+	};
+}
\ No newline at end of file
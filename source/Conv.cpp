@@ -2,26 +2,312 @@
 #include <iostream>
 #include <cassert>
 #include "Conv.h"
+#include "Gemm.h"
+#include "SimdKernels.h"
+#include "Quant.h"
+#include <algorithm>
 
 namespace cnn
 {
-	Conv::Conv(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn)
-		: ILayer(kernelLen, inLen, inDepth, outLen, outDepth, eActFn)
+	Conv::Conv(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn,
+		ELayout eLayout)
+		: ILayer(kernelLen, inLen, inDepth, outLen, outDepth, eActFn, eLayout, eLayout)
+		, meAlgo(EConvAlgo::GEMM)
+		, mbPointwise(kernelLen == 1 && inLen == outLen && eLayout == ELayout::HWC)
+		, COL_SIZE(KERNEL_SIZE* INPUT_DEPTH)
+		, mCol()
+		, mGemmOut()
+		, mWinograd(nullptr)
+		, mNumTileLen(0)
+		, mWinoWgt()
+		, mWinoTile()
+		, mWinoIn()
+		, mWinoOut()
+		, mWinoWgtDiff()
+		, mFft(nullptr)
+		, mSpecSize(0)
+		, mFftWgt()
+		, mFftIn()
+		, mFftDelta()
+		, mFftAcc()
 	{
 
 	}
 
 	Conv::~Conv()
 	{
+		freeAlgoBuffers();
+		freeWgtCaches();
+	}
+
+	bool Conv::SetAlgo(EConvAlgo eAlgo)
+	{
+		size_t tileLen = 0;
+		size_t kernelLen = 0;
+		switch (eAlgo)
+		{
+		case EConvAlgo::WINOGRAD_2X2_3X3:
+			tileLen = 2;
+			kernelLen = 3;
+			break;
+		case EConvAlgo::WINOGRAD_4X4_3X3:
+			tileLen = 4;
+			kernelLen = 3;
+			break;
+		case EConvAlgo::WINOGRAD_2X2_5X5:
+			tileLen = 2;
+			kernelLen = 5;
+			break;
+		default:
+			break;
+		}
+		if (kernelLen != 0 && kernelLen != KERNEL_LEN)
+		{
+			return false;
+		}
+
+		// Drop the previous algorithm's transforms and caches
+		freeAlgoBuffers();
+		freeWgtCaches();
+		mWinograd.reset();
+		mFft.reset();
+		mNumTileLen = 0;
+		mSpecSize = 0;
 
+		if (tileLen != 0)
+		{
+			mWinograd = std::make_unique<Winograd>(tileLen, KERNEL_LEN);
+			mNumTileLen = (OUTPUT_LEN + tileLen - 1) / tileLen;
+		}
+		else if (eAlgo == EConvAlgo::FFT)
+		{
+			// Linear correlation of the padded input fits without wrapping around
+			mFft = std::make_unique<Fft>(Fft::GetLen(INPUT_PAD_LEN));
+			mSpecSize = 2 * mFft->LEN * mFft->LEN;
+		}
+		allocWgtCaches();
+		meAlgo = eAlgo;
+		if (mMiniBatch != 0)
+		{
+			allocAlgoBuffers();
+		}
+		onWeightsUpdated();
+		return true;
 	}
 
-	void Conv::Forward(size_t threadIdx)
+	void Conv::InitBuffers(size_t numImages)
 	{
-		data_t* inBuf = mIn[threadIdx];
-		data_t* outBuf = mOut[threadIdx];
-		data_t* wgtBuf = mWgt;
-		data_t* biasBuf = mBias;
+		ILayer::InitBuffers(numImages);
+		freeAlgoBuffers();
+		allocAlgoBuffers();
+	}
+
+	void Conv::setThreadCaches(bool b)
+	{
+		freeWgtCaches();
+		ILayer::setThreadCaches(b);
+		allocWgtCaches();
+		onWeightsUpdated();
+	}
+
+	void Conv::allocWgtCaches()
+	{
+		for (size_t copy = 0; copy < getNumCacheCopies(); ++copy)
+		{
+			if (mWinograd != nullptr)
+			{
+				mWinoWgt.push_back(Alloc<data_t>(mWinograd->ALPHA * mWinograd->ALPHA * INPUT_DEPTH * OUTPUT_DEPTH));
+			}
+			if (mFft != nullptr)
+			{
+				mFftWgt.push_back(Alloc<data_t>(INPUT_DEPTH * OUTPUT_DEPTH * mSpecSize));
+			}
+		}
+	}
+
+	void Conv::freeWgtCaches()
+	{
+		std::vector<data_t*>* caches[] = { &mWinoWgt, &mFftWgt };
+		for (std::vector<data_t*>* cache : caches)
+		{
+			for (size_t i = 0; i < cache->size(); ++i)
+			{
+				Free((*cache)[i]);
+			}
+			cache->clear();
+		}
+	}
+
+	void Conv::refreshCache(size_t copy)
+	{
+		if (mFft != nullptr)
+		{
+			// Kernel at the origin of a zero plane
+			const size_t LEN = mFft->LEN;
+			for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+			{
+				for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+				{
+					data_t* re = &mFftWgt[copy][(inD * OUTPUT_DEPTH + outD) * mSpecSize];
+					data_t* im = re + LEN * LEN;
+					memset(re, 0, sizeof(data_t) * mSpecSize);
+					for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+					{
+						for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
+						{
+							re[LEN * kY + kX] = mWgt[getWgtIdx(kX, kY, inD, outD)];
+						}
+					}
+					mFft->Forward2d(re, im);
+				}
+			}
+		}
+		if (mWinograd == nullptr)
+		{
+			return;
+		}
+		// Transform all output channels of one input channel at once
+		const Winograd& wino = *mWinograd;
+		const size_t NUM_FREQ = wino.ALPHA * wino.ALPHA;
+		std::vector<data_t> filter(KERNEL_SIZE * OUTPUT_DEPTH);
+		std::vector<data_t> trans(NUM_FREQ * OUTPUT_DEPTH);
+		for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+		{
+			for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+			{
+				for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
+				{
+					memcpy(&filter[(KERNEL_LEN * kY + kX) * OUTPUT_DEPTH], &mWgt[getWgtIdx(kX, kY, inD, 0)], sizeof(data_t) * OUTPUT_DEPTH);
+				}
+			}
+			wino.TransformFilter(filter.data(), trans.data(), OUTPUT_DEPTH);
+			for (size_t f = 0; f < NUM_FREQ; ++f)
+			{
+				memcpy(&mWinoWgt[copy][(f * INPUT_DEPTH + inD) * OUTPUT_DEPTH], &trans[f * OUTPUT_DEPTH], sizeof(data_t) * OUTPUT_DEPTH);
+			}
+		}
+	}
+
+	void Conv::allocAlgoBuffers()
+	{
+		const size_t NUM_PIXELS = OUTPUT_LEN * OUTPUT_LEN;
+		for (size_t i = 0; i < NUM_THREAD; ++i)
+		{
+			switch (meAlgo)
+			{
+			case EConvAlgo::GEMM:
+				mCol.push_back(mbPointwise ? nullptr : Alloc<data_t>(mMiniBatch * NUM_PIXELS * COL_SIZE));
+				mGemmOut.push_back(Alloc<data_t>(mMiniBatch * OUTPUT_SIZE));
+				break;
+			case EConvAlgo::WINOGRAD_2X2_3X3:
+			case EConvAlgo::WINOGRAD_4X4_3X3:
+			case EConvAlgo::WINOGRAD_2X2_5X5:
+			{
+				// Tiles of all images in the mini-batch are stacked
+				const size_t NUM_FREQ = mWinograd->ALPHA * mWinograd->ALPHA;
+				const size_t NUM_TILES = mMiniBatch * mNumTileLen * mNumTileLen;
+				mWinoTile.push_back(Alloc<data_t>(2 * NUM_FREQ * std::max(INPUT_DEPTH, OUTPUT_DEPTH)));
+				mWinoIn.push_back(Alloc<data_t>(NUM_FREQ * NUM_TILES * INPUT_DEPTH));
+				mWinoOut.push_back(Alloc<data_t>(NUM_FREQ * NUM_TILES * OUTPUT_DEPTH));
+				if (mbInference == false)
+				{
+					mWinoWgtDiff.push_back(Alloc<data_t>(NUM_FREQ * INPUT_DEPTH * OUTPUT_DEPTH));
+				}
+				break;
+			}
+			case EConvAlgo::FFT:
+				mFftIn.push_back(Alloc<data_t>(mMiniBatch * INPUT_DEPTH * mSpecSize));
+				if (mbInference == false)
+				{
+					mFftDelta.push_back(Alloc<data_t>(mMiniBatch * OUTPUT_DEPTH * mSpecSize));
+				}
+				mFftAcc.push_back(Alloc<data_t>(mSpecSize));
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	size_t Conv::getScratchBytes() const
+	{
+		const size_t NUM_PIXELS = OUTPUT_LEN * OUTPUT_LEN;
+		size_t size = 0;
+		switch (meAlgo)
+		{
+		case EConvAlgo::GEMM:
+			size = (mbPointwise ? 0 : mMiniBatch * NUM_PIXELS * COL_SIZE) + mMiniBatch * OUTPUT_SIZE;
+			break;
+		case EConvAlgo::WINOGRAD_2X2_3X3:
+		case EConvAlgo::WINOGRAD_4X4_3X3:
+		case EConvAlgo::WINOGRAD_2X2_5X5:
+		{
+			const size_t NUM_FREQ = mWinograd->ALPHA * mWinograd->ALPHA;
+			const size_t NUM_TILES = mMiniBatch * mNumTileLen * mNumTileLen;
+			size = 2 * NUM_FREQ * std::max(INPUT_DEPTH, OUTPUT_DEPTH) + NUM_FREQ * NUM_TILES * (INPUT_DEPTH + OUTPUT_DEPTH);
+			break;
+		}
+		case EConvAlgo::FFT:
+			size = mMiniBatch * INPUT_DEPTH * mSpecSize + (mbInference ? 0 : mMiniBatch * OUTPUT_DEPTH * mSpecSize) + mSpecSize;
+			break;
+		default:
+			break;
+		}
+		return sizeof(data_t) * size + ILayer::getScratchBytes();
+	}
+
+	void Conv::freeAlgoBuffers()
+	{
+		std::vector<data_t*>* buffers[] = { &mCol, &mGemmOut, &mWinoTile, &mWinoIn, &mWinoOut, &mWinoWgtDiff, &mFftIn, &mFftDelta, &mFftAcc };
+		for (std::vector<data_t*>* buf : buffers)
+		{
+			for (size_t i = 0; i < buf->size(); ++i)
+			{
+				if ((*buf)[i] != nullptr) { Free((*buf)[i]); }
+			}
+			buf->clear();
+		}
+	}
+
+	void Conv::Forward(size_t threadIdx, size_t numImages)
+	{
+		Assert(numImages <= mMiniBatch);
+		if (IsQuantized())
+		{
+			forwardInt8(threadIdx, numImages);
+			return;
+		}
+		switch (meAlgo)
+		{
+		case EConvAlgo::DIRECT:
+			for (size_t n = 0; n < numImages; ++n)
+			{
+				forwardDirect(threadIdx, n);
+			}
+			break;
+		case EConvAlgo::GEMM:
+			forwardGemm(threadIdx, numImages);
+			break;
+		case EConvAlgo::WINOGRAD_2X2_3X3:
+		case EConvAlgo::WINOGRAD_4X4_3X3:
+		case EConvAlgo::WINOGRAD_2X2_5X5:
+			forwardWinograd(threadIdx, numImages);
+			break;
+		case EConvAlgo::FFT:
+			forwardFft(threadIdx, numImages);
+			break;
+		default:
+			Assert(false);
+			break;
+		}
+	}
+
+	void Conv::forwardDirect(size_t threadIdx, size_t img)
+	{
+		data_t* inBuf = mIn[threadIdx] + INPUT_SIZE * img;
+		data_t* outBuf = mOut[threadIdx] + getOutPadSize() * img;
+		const data_t* wgtBuf = getWgt(threadIdx);
+		const data_t* biasBuf = getBias(threadIdx);
 		if (mbUseAvx == false)
 		{
 			for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
@@ -44,188 +330,635 @@ namespace cnn
 							}
 						}
 						sum += biasBuf[getBiasIdx(outD)];
-						outBuf[getOutIdx(outX, outY, outD)] = mActivate(sum);
+						outBuf[getOutIdx(outX, outY, outD)] = sum;
 					}
 				}
 			}
 		}
 		else
 		{
+			DispatchSimd<ConvDirectForwardKernel>(KERNEL_LEN, OUTPUT_LEN, INPUT_DEPTH, OUTPUT_DEPTH, inBuf, getInShape(),
+				wgtBuf, biasBuf, outBuf + getOutIdx(0, 0, 0), getOutShape());
+		}
+		activateOutput(outBuf);
+	}
+
+	void Conv::forwardGemm(size_t threadIdx, size_t numImages)
+	{
+		const data_t* wgtBuf = getWgt(threadIdx);
+		const data_t* biasBuf = getBias(threadIdx);
+		data_t* inBuf = mIn[threadIdx];
+		data_t* outBuf = mOut[threadIdx];
+		data_t* gemmOutBuf = mGemmOut[threadIdx];
+		const size_t NUM_PIXELS = OUTPUT_LEN * OUTPUT_LEN;
+		const size_t NUM_ROWS = numImages * NUM_PIXELS;
+
+		// Patch matrices of the images are stacked, so every weight is used for all of them
+		// out(NUM_ROWS x OUTPUT_DEPTH) = patch(NUM_ROWS x COL_SIZE) * wgt(COL_SIZE x OUTPUT_DEPTH)
+		if (mbPointwise)
+		{
+			Sgemm(false, false, NUM_ROWS, OUTPUT_DEPTH, COL_SIZE, inBuf, INPUT_DEPTH, wgtBuf, OUTPUT_DEPTH, 0.f, gemmOutBuf, OUTPUT_DEPTH);
+		}
+		else
+		{
+			data_t* colBuf = mCol[threadIdx];
+			for (size_t n = 0; n < numImages; ++n)
+			{
+				im2col(inBuf + INPUT_SIZE * n, colBuf + NUM_PIXELS * COL_SIZE * n, COL_SIZE);
+			}
+			Sgemm(false, false, NUM_ROWS, OUTPUT_DEPTH, COL_SIZE, colBuf, COL_SIZE, wgtBuf, OUTPUT_DEPTH, 0.f, gemmOutBuf, OUTPUT_DEPTH);
+		}
+		// Add bias and scatter into the (padded) output, then activate it
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			data_t* out = outBuf + getOutPadSize() * n;
 			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 			{
 				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
 				{
-					for (size_t outD = 0; outD < OUTPUT_DEPTH; outD += MM_BLOCK)
+					const data_t* src = &gemmOutBuf[(NUM_PIXELS * n + OUTPUT_LEN * outY + outX) * OUTPUT_DEPTH];
+					for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+					{
+						out[getOutIdx(outX, outY, outD)] = src[outD] + biasBuf[getBiasIdx(outD)];
+					}
+				}
+			}
+			activateOutput(out);
+		}
+	}
+
+	void Conv::forwardWinograd(size_t threadIdx, size_t numImages)
+	{
+		const data_t* biasBuf = getBias(threadIdx);
+		const Winograd& wino = *mWinograd;
+		const size_t M = wino.M;
+		const size_t ALPHA = wino.ALPHA;
+		const size_t NUM_FREQ = ALPHA * ALPHA;
+		// Tiles of all images are stacked, so every frequency is one GEMM for the mini-batch
+		const size_t TILES_PER_IMAGE = mNumTileLen * mNumTileLen;
+		const size_t NUM_TILES = numImages * TILES_PER_IMAGE;
+		data_t* winoInBuf = mWinoIn[threadIdx];
+		data_t* winoOutBuf = mWinoOut[threadIdx];
+		// Tiles hold every channel interleaved, see Winograd.h
+		data_t* tileBuf = mWinoTile[threadIdx];
+		data_t* transBuf = tileBuf + NUM_FREQ * std::max(INPUT_DEPTH, OUTPUT_DEPTH);
+
+		// Transform the overlapping ALPHA x ALPHA input tiles
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			const data_t* inBuf = mIn[threadIdx] + INPUT_SIZE * n;
+			for (size_t tY = 0; tY < mNumTileLen; ++tY)
+			{
+				for (size_t tX = 0; tX < mNumTileLen; ++tX)
+				{
+					const size_t t = TILES_PER_IMAGE * n + mNumTileLen * tY + tX;
+					for (size_t y = 0; y < ALPHA; ++y)
 					{
-						MM_TYPE mmSum = MM_SETZERO();
-						for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+						for (size_t x = 0; x < ALPHA; ++x)
 						{
-							for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
+							const size_t inX = tX * M + x;
+							const size_t inY = tY * M + y;
+							const bool bInside = inX < INPUT_PAD_LEN && inY < INPUT_PAD_LEN;
+							data_t* dest = &tileBuf[(ALPHA * y + x) * INPUT_DEPTH];
+							for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
 							{
-								for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
-								{
-									data_t in = inBuf[getInIdx(outX + kX, outY + kY, inD)];
-									MM_TYPE mmIn = MM_SET1(in);
-									MM_TYPE mmWgt = MM_LOAD(&wgtBuf[getWgtIdx(kX, kY, inD, outD)]);
-
-									MM_TYPE mmMul = MM_MUL(mmIn, mmWgt);
-									mmSum = MM_ADD(mmSum, mmMul);
-								}
+								dest[inD] = bInside ? inBuf[getInIdx(inX, inY, inD)] : 0.f;
 							}
 						}
-						MM_TYPE mmBias = MM_LOAD(&biasBuf[getBiasIdx(outD)]);
-						mmSum = MM_ADD(mmSum, mmBias);
+					}
+					wino.TransformInput(tileBuf, transBuf, INPUT_DEPTH);
+					for (size_t f = 0; f < NUM_FREQ; ++f)
+					{
+						memcpy(&winoInBuf[(f * NUM_TILES + t) * INPUT_DEPTH], &transBuf[f * INPUT_DEPTH], sizeof(data_t) * INPUT_DEPTH);
+					}
+				}
+			}
+		}
+		// Element-wise products summed over input channels
+		for (size_t f = 0; f < NUM_FREQ; ++f)
+		{
+			Sgemm(false, false, NUM_TILES, OUTPUT_DEPTH, INPUT_DEPTH,
+				&winoInBuf[f * NUM_TILES * INPUT_DEPTH], INPUT_DEPTH,
+				&mWinoWgt[getCacheCopy(threadIdx)][f * INPUT_DEPTH * OUTPUT_DEPTH], OUTPUT_DEPTH,
+				0.f, &winoOutBuf[f * NUM_TILES * OUTPUT_DEPTH], OUTPUT_DEPTH);
+		}
+		// Inverse transform and add bias, then activate every image
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			data_t* outBuf = mOut[threadIdx] + getOutPadSize() * n;
+			for (size_t tY = 0; tY < mNumTileLen; ++tY)
+			{
+				for (size_t tX = 0; tX < mNumTileLen; ++tX)
+				{
+					const size_t t = TILES_PER_IMAGE * n + mNumTileLen * tY + tX;
+					for (size_t f = 0; f < NUM_FREQ; ++f)
+					{
+						memcpy(&transBuf[f * OUTPUT_DEPTH], &winoOutBuf[(f * NUM_TILES + t) * OUTPUT_DEPTH], sizeof(data_t) * OUTPUT_DEPTH);
+					}
+					wino.TransformOutput(transBuf, tileBuf, OUTPUT_DEPTH);
+					for (size_t y = 0; y < M && tY * M + y < OUTPUT_LEN; ++y)
+					{
+						for (size_t x = 0; x < M && tX * M + x < OUTPUT_LEN; ++x)
+						{
+							const data_t* src = &tileBuf[(M * y + x) * OUTPUT_DEPTH];
+							for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+							{
+								outBuf[getOutIdx(tX * M + x, tY * M + y, outD)] = src[outD] + biasBuf[getBiasIdx(outD)];
+							}
+						}
+					}
+				}
+			}
+			activateOutput(outBuf);
+		}
+	}
+
+	void Conv::forwardFft(size_t threadIdx, size_t numImages)
+	{
+		const data_t* biasBuf = getBias(threadIdx);
+		const size_t LEN = mFft->LEN;
+		const size_t PLANE_SIZE = LEN * LEN;
+		data_t* accBuf = mFftAcc[threadIdx];
+		data_t* accRe = accBuf;
+		data_t* accIm = accBuf + PLANE_SIZE;
+
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			const data_t* inBuf = mIn[threadIdx] + INPUT_SIZE * n;
+			data_t* outBuf = mOut[threadIdx] + getOutPadSize() * n;
+			data_t* fftInBuf = mFftIn[threadIdx] + INPUT_DEPTH * mSpecSize * n;
+			// Input spectra, kept for the weight gradient
+			for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+			{
+				data_t* re = &fftInBuf[inD * mSpecSize];
+				data_t* im = re + PLANE_SIZE;
+				memset(re, 0, sizeof(data_t) * mSpecSize);
+				for (size_t y = 0; y < INPUT_PAD_LEN; ++y)
+				{
+					for (size_t x = 0; x < INPUT_PAD_LEN; ++x)
+					{
+						re[LEN * y + x] = inBuf[getInIdx(x, y, inD)];
+					}
+				}
+				mFft->Forward2d(re, im);
+			}
+			// Correlation with the kernel : out^ = sum over inD of in^ * conj(wgt^)
+			for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+			{
+				memset(accBuf, 0, sizeof(data_t) * mSpecSize);
+				for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+				{
+					const data_t* inRe = &fftInBuf[inD * mSpecSize];
+					const data_t* wgtRe = &mFftWgt[getCacheCopy(threadIdx)][(inD * OUTPUT_DEPTH + outD) * mSpecSize];
+					Fft::MulConjAcc(PLANE_SIZE, inRe, inRe + PLANE_SIZE, wgtRe, wgtRe + PLANE_SIZE, accRe, accIm);
+				}
+				mFft->Inverse2d(accRe, accIm);
+				const data_t bias = biasBuf[getBiasIdx(outD)];
+				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+				{
+					for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+					{
+						outBuf[getOutIdx(outX, outY, outD)] = accRe[LEN * outY + outX] + bias;
+					}
+				}
+			}
+			activateOutput(outBuf);
+		}
+	}
+
+	bool Conv::Quantize(data_t inMin, data_t inMax)
+	{
+		std::unique_ptr<QuantWeights> quantWgt(new QuantWeights(mWgt, COL_SIZE, OUTPUT_DEPTH, GetActQuant(inMin, inMax)));
+		const size_t NUM_PIXELS = OUTPUT_LEN * OUTPUT_LEN;
+		// Patch rows of every image, followed by the quantized images they are gathered from
+		const size_t Q_IN_SIZE = NUM_PIXELS * quantWgt->GetPadK() + INPUT_SIZE;
+		const size_t Q_ACC_SIZE = NUM_PIXELS * quantWgt->GetPadN();
+		initQuant(std::move(quantWgt), Q_IN_SIZE, Q_ACC_SIZE);
+		return true;
+	}
+
+	void Conv::forwardInt8(size_t threadIdx, size_t numImages)
+	{
+		const data_t* biasBuf = getBias(threadIdx);
+		const QuantWeights& quantWgt = *mQuantWgt;
+		const size_t PAD_K = quantWgt.GetPadK();
+		const size_t PAD_N = quantWgt.GetPadN();
+		const size_t NUM_PIXELS = OUTPUT_LEN * OUTPUT_LEN;
+		uint8_t* colBuf = mQIn[threadIdx];
+		int32_t* accBuf = mQAcc[threadIdx];
+
+		// Every input value is quantized once, the patch rows are gathered from the quantized images
+		// A pointwise HWC input with whole 4 byte groups is the patch matrix itself.
+		if (mbPointwise && PAD_K == COL_SIZE)
+		{
+			QuantizeActs(quantWgt.GetInQuant(), mIn[threadIdx], colBuf, INPUT_SIZE * numImages);
+		}
+		else
+		{
+			uint8_t* qInBuf = colBuf + NUM_PIXELS * PAD_K * mMiniBatch;
+			QuantizeActs(quantWgt.GetInQuant(), mIn[threadIdx], qInBuf, INPUT_SIZE * numImages);
+			for (size_t n = 0; n < numImages; ++n)
+			{
+				im2col(qInBuf + INPUT_SIZE * n, colBuf + NUM_PIXELS * PAD_K * n, PAD_K);
+			}
+		}
+		quantWgt.Gemm(numImages * NUM_PIXELS, colBuf, PAD_K, accBuf, PAD_N);
+		// Back to fp32 with the bias, straight into the (padded) output, a channel block at a time in BLOCKED layout
+		const size_t BLOCK_DEPTH = meOutLayout == ELayout::BLOCKED ? MM_BLOCK : OUTPUT_DEPTH;
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			data_t* out = mOut[threadIdx] + getOutPadSize() * n;
+			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+			{
+				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+				{
+					const int32_t* acc = &accBuf[(NUM_PIXELS * n + OUTPUT_LEN * outY + outX) * PAD_N];
+					for (size_t outD = 0; outD < OUTPUT_DEPTH; outD += BLOCK_DEPTH)
+					{
+						const size_t END = std::min(outD + BLOCK_DEPTH, OUTPUT_DEPTH);
+						quantWgt.Requantize(acc + outD, biasBuf, outD, END, &out[getOutIdx(outX, outY, outD)]);
+					}
+				}
+			}
+			activateOutput(out);
+		}
+	}
+
+	template <typename T>
+	void Conv::im2col(const T* inBuf, T* colBuf, size_t ldc) const
+	{
+		for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+		{
+			for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+			{
+				T* dest = &colBuf[(OUTPUT_LEN * outY + outX) * ldc];
+				for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+				{
+					for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+					{
+						for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
+						{
+							*dest++ = inBuf[getInIdx(outX + kX, outY + kY, inD)];
+						}
+					}
+				}
+			}
+		}
+	}
 
-						float* dest = &outBuf[getOutIdx(outX, outY, outD)];
-						MM_STORE(dest, mmSum);
-						for (size_t i = 0; i < MM_BLOCK; ++i)
+	void Conv::col2im(const data_t* colBuf, data_t* delOutBuf) const
+	{
+		const int IPAD = static_cast<int>(NUM_PAD);
+		const int ILEN = static_cast<int>(INPUT_LEN);
+		const int KLEN = static_cast<int>(KERNEL_LEN);
+		memset(delOutBuf, 0, sizeof(data_t) * DELTA_OUT_SIZE);
+		for (int outY = 0; outY < static_cast<int>(OUTPUT_LEN); ++outY)
+		{
+			// Kernel rows/cols which land inside the unpadded input
+			const int BY = std::max(IPAD - outY, 0);
+			const int EY = std::min(ILEN + IPAD - outY, KLEN);
+			for (int outX = 0; outX < static_cast<int>(OUTPUT_LEN); ++outX)
+			{
+				const int BX = std::max(IPAD - outX, 0);
+				const int EX = std::min(ILEN + IPAD - outX, KLEN);
+				const data_t* src = &colBuf[(OUTPUT_LEN * outY + outX) * COL_SIZE];
+				for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+				{
+					for (int kY = BY; kY < EY; ++kY)
+					{
+						for (int kX = BX; kX < EX; ++kX)
 						{
-							dest[i] = mActivate(dest[i]);
+							delOutBuf[getDOutIdx(outX + kX - IPAD, outY + kY - IPAD, inD)] += src[KERNEL_LEN * kY + kX];
 						}
 					}
+					src += KERNEL_SIZE;
 				}
 			}
 		}
 	}
 
-	void Conv::BackProp(size_t threadIdx)
+	void Conv::BackProp(size_t threadIdx, size_t numImages)
+	{
+		Assert(numImages <= mMiniBatch);
+		switch (meAlgo)
+		{
+		case EConvAlgo::DIRECT:
+			for (size_t n = 0; n < numImages; ++n)
+			{
+				backPropDirect(threadIdx, n);
+			}
+			break;
+		case EConvAlgo::GEMM:
+			backPropGemm(threadIdx, numImages);
+			break;
+		case EConvAlgo::WINOGRAD_2X2_3X3:
+		case EConvAlgo::WINOGRAD_4X4_3X3:
+		case EConvAlgo::WINOGRAD_2X2_5X5:
+			backPropWinograd(threadIdx, numImages);
+			break;
+		case EConvAlgo::FFT:
+			backPropFft(threadIdx, numImages);
+			break;
+		default:
+			Assert(false);
+			break;
+		}
+	}
+
+	void Conv::getGlobalDelta(size_t threadIdx, size_t numImages)
+	{
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			computeDelta(mOut[threadIdx] + getOutPadSize() * n, mDeltaIn[threadIdx] + DELTA_IN_SIZE * n, mDelta[threadIdx] + DELTA_SIZE * n);
+		}
+	}
+
+	void Conv::backPropGemm(size_t threadIdx, size_t numImages)
 	{
+		const data_t* wgtBuf = getWgt(threadIdx);
 		data_t* inBuf = mIn[threadIdx];
-		data_t* outBuf = mOut[threadIdx];
-		data_t* wgtBuf = mWgt;
-		data_t* delInBuf = mDeltaIn[threadIdx];
 		data_t* delBuf = mDelta[threadIdx];
 		data_t* delOutBuf = mDeltaOut[threadIdx];
 		data_t* wgtDiffBuf = mWgtDiff[threadIdx];
 		data_t* biasDiffBuf = mBiasDiff[threadIdx];
-		if (mbUseAvx == false)
+		const size_t NUM_PIXELS = OUTPUT_LEN * OUTPUT_LEN;
+		const size_t NUM_ROWS = numImages * NUM_PIXELS;
+
+		getGlobalDelta(threadIdx, numImages);
+
+		// delta of the mini-batch is a (NUM_ROWS x OUTPUT_DEPTH) matrix
+		// Get Weights' gradient : wgtDiff(COL_SIZE x OUTPUT_DEPTH) += patch^T * delta
+		const data_t* patchBuf = mbPointwise ? inBuf : mCol[threadIdx];
+		Sgemm(true, false, COL_SIZE, OUTPUT_DEPTH, NUM_ROWS, patchBuf, COL_SIZE, delBuf, OUTPUT_DEPTH, 1.f, wgtDiffBuf, OUTPUT_DEPTH);
+
+		// Get Biases' gradient
+		for (size_t i = 0; i < NUM_ROWS; ++i)
 		{
-			// Get global delta
+			const data_t* src = &delBuf[i * OUTPUT_DEPTH];
 			for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
 			{
-				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+				biasDiffBuf[outD] += src[outD];
+			}
+		}
+
+		// Get out gradient : prev layer's input gradient
+		// patchDiff(NUM_ROWS x COL_SIZE) = delta * wgt^T, then fold the patches back
+		if (mbPointwise)
+		{
+			Sgemm(false, true, NUM_ROWS, COL_SIZE, OUTPUT_DEPTH, delBuf, OUTPUT_DEPTH, wgtBuf, OUTPUT_DEPTH, 0.f, delOutBuf, INPUT_DEPTH);
+		}
+		else
+		{
+			// The patch matrix is consumed, reuse its buffer
+			data_t* colBuf = mCol[threadIdx];
+			Sgemm(false, true, NUM_ROWS, COL_SIZE, OUTPUT_DEPTH, delBuf, OUTPUT_DEPTH, wgtBuf, OUTPUT_DEPTH, 0.f, colBuf, COL_SIZE);
+			for (size_t n = 0; n < numImages; ++n)
+			{
+				col2im(colBuf + NUM_PIXELS * COL_SIZE * n, delOutBuf + DELTA_OUT_SIZE * n);
+			}
+		}
+	}
+
+	void Conv::backPropWinograd(size_t threadIdx, size_t numImages)
+	{
+		// Back propagation through Y = A^T [ U (.) V ] A with the adjoint transforms
+		const Winograd& wino = *mWinograd;
+		const size_t M = wino.M;
+		const size_t ALPHA = wino.ALPHA;
+		const size_t NUM_FREQ = ALPHA * ALPHA;
+		const size_t TILES_PER_IMAGE = mNumTileLen * mNumTileLen;
+		const size_t NUM_TILES = numImages * TILES_PER_IMAGE;
+		data_t* delBuf = mDelta[threadIdx];
+		data_t* wgtDiffBuf = mWgtDiff[threadIdx];
+		data_t* biasDiffBuf = mBiasDiff[threadIdx];
+		data_t* winoInBuf = mWinoIn[threadIdx];
+		data_t* winoOutBuf = mWinoOut[threadIdx];
+		data_t* winoWgtDiffBuf = mWinoWgtDiff[threadIdx];
+		data_t* tileBuf = mWinoTile[threadIdx];
+		data_t* transBuf = tileBuf + NUM_FREQ * std::max(INPUT_DEPTH, OUTPUT_DEPTH);
+
+		getGlobalDelta(threadIdx, numImages);
+
+		// Transform the delta tiles : dM = A delta A^T
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			const data_t* delImgBuf = delBuf + DELTA_SIZE * n;
+			for (size_t tY = 0; tY < mNumTileLen; ++tY)
+			{
+				for (size_t tX = 0; tX < mNumTileLen; ++tX)
 				{
-					for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+					const size_t t = TILES_PER_IMAGE * n + mNumTileLen * tY + tX;
+					for (size_t y = 0; y < M; ++y)
 					{
-						data_t deltaIn = delInBuf[getDInIdx(outX, outY, outD)];
-						data_t out = outBuf[getOutIdx(outX, outY, outD)];
-						data_t deriv = 0.f;
-						switch (meActFn)
+						for (size_t x = 0; x < M; ++x)
 						{
-						case EActFn::TANH:
-							deriv = 1 - out * out;
-							break;
-						case EActFn::RELU:
-							deriv = out > 0.f ? 1.f : 0.f;
-							break;
-						default:
-							Assert(false);
-							break;
+							const size_t outX = tX * M + x;
+							const size_t outY = tY * M + y;
+							data_t* dest = &tileBuf[(M * y + x) * OUTPUT_DEPTH];
+							if (outX < OUTPUT_LEN && outY < OUTPUT_LEN)
+							{
+								memcpy(dest, &delImgBuf[getDeltaIdx(outX, outY, 0)], sizeof(data_t) * OUTPUT_DEPTH);
+							}
+							else
+							{
+								memset(dest, 0, sizeof(data_t) * OUTPUT_DEPTH);
+							}
 						}
-						delBuf[getDeltaIdx(outX, outY, outD)] = deltaIn * deriv;
+					}
+					wino.TransformOutputGrad(tileBuf, transBuf, OUTPUT_DEPTH);
+					for (size_t f = 0; f < NUM_FREQ; ++f)
+					{
+						memcpy(&winoOutBuf[(f * NUM_TILES + t) * OUTPUT_DEPTH], &transBuf[f * OUTPUT_DEPTH], sizeof(data_t) * OUTPUT_DEPTH);
 					}
 				}
 			}
+		}
 
-			// Get Weights' gradient
+		// Get Weights' gradient : dU = V^T dM per frequency, then dW += G^T dU G
+		for (size_t f = 0; f < NUM_FREQ; ++f)
+		{
+			Sgemm(true, false, INPUT_DEPTH, OUTPUT_DEPTH, NUM_TILES,
+				&winoInBuf[f * NUM_TILES * INPUT_DEPTH], INPUT_DEPTH,
+				&winoOutBuf[f * NUM_TILES * OUTPUT_DEPTH], OUTPUT_DEPTH,
+				0.f, &winoWgtDiffBuf[f * INPUT_DEPTH * OUTPUT_DEPTH], OUTPUT_DEPTH);
+		}
+		for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+		{
+			for (size_t f = 0; f < NUM_FREQ; ++f)
+			{
+				memcpy(&transBuf[f * OUTPUT_DEPTH], &winoWgtDiffBuf[(f * INPUT_DEPTH + inD) * OUTPUT_DEPTH], sizeof(data_t) * OUTPUT_DEPTH);
+			}
+			wino.TransformFilterGrad(transBuf, tileBuf, OUTPUT_DEPTH);
 			for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
 			{
 				for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
 				{
-					for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+					const data_t* src = &tileBuf[(KERNEL_LEN * kY + kX) * OUTPUT_DEPTH];
+					data_t* dest = &wgtDiffBuf[getWgtIdx(kX, kY, inD, 0)];
+					for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
 					{
-						for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+						dest[outD] += src[outD];
+					}
+				}
+			}
+		}
+
+		// Get Biases' gradient
+		for (size_t i = 0; i < numImages * OUTPUT_LEN * OUTPUT_LEN; ++i)
+		{
+			const data_t* src = &delBuf[i * OUTPUT_DEPTH];
+			for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+			{
+				biasDiffBuf[outD] += src[outD];
+			}
+		}
+
+		// Get out gradient : dV = dM U^T per frequency, the transformed input is consumed so reuse its buffer
+		for (size_t f = 0; f < NUM_FREQ; ++f)
+		{
+			Sgemm(false, true, NUM_TILES, INPUT_DEPTH, OUTPUT_DEPTH,
+				&winoOutBuf[f * NUM_TILES * OUTPUT_DEPTH], OUTPUT_DEPTH,
+				&mWinoWgt[getCacheCopy(threadIdx)][f * INPUT_DEPTH * OUTPUT_DEPTH], OUTPUT_DEPTH,
+				0.f, &winoInBuf[f * NUM_TILES * INPUT_DEPTH], INPUT_DEPTH);
+		}
+		// Fold the overlapping tiles back : dX += B dV B^T, dropping the padding
+		memset(mDeltaOut[threadIdx], 0, sizeof(data_t) * DELTA_OUT_SIZE * numImages);
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			data_t* delOutBuf = mDeltaOut[threadIdx] + DELTA_OUT_SIZE * n;
+			for (size_t tY = 0; tY < mNumTileLen; ++tY)
+			{
+				for (size_t tX = 0; tX < mNumTileLen; ++tX)
+				{
+					const size_t t = TILES_PER_IMAGE * n + mNumTileLen * tY + tX;
+					for (size_t f = 0; f < NUM_FREQ; ++f)
+					{
+						memcpy(&transBuf[f * INPUT_DEPTH], &winoInBuf[(f * NUM_TILES + t) * INPUT_DEPTH], sizeof(data_t) * INPUT_DEPTH);
+					}
+					wino.TransformInputGrad(transBuf, tileBuf, INPUT_DEPTH);
+					for (size_t y = 0; y < ALPHA; ++y)
+					{
+						const size_t inY = tY * M + y - NUM_PAD;	// Wraps around inside the top padding
+						if (inY >= INPUT_LEN) { continue; }
+						for (size_t x = 0; x < ALPHA; ++x)
 						{
-							data_t sum = 0.f;
-							for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+							const size_t inX = tX * M + x - NUM_PAD;
+							if (inX >= INPUT_LEN) { continue; }
+							const data_t* src = &tileBuf[(ALPHA * y + x) * INPUT_DEPTH];
+							for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
 							{
-								for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
-								{
-									data_t delta = delBuf[getDeltaIdx(outX, outY, outD)];
-									data_t valIn = inBuf[getInIdx(outX + kX, outY + kY, inD)];
-									sum += delta * valIn;
-								}
+								delOutBuf[getDOutIdx(inX, inY, inD)] += src[inD];
 							}
-							wgtDiffBuf[getWgtIdx(kX, kY, inD, outD)] += sum;
 						}
 					}
 				}
 			}
-			// Get Biases' gradient
+		}
+	}
+
+	void Conv::backPropFft(size_t threadIdx, size_t numImages)
+	{
+		const size_t LEN = mFft->LEN;
+		const size_t PLANE_SIZE = LEN * LEN;
+		data_t* wgtDiffBuf = mWgtDiff[threadIdx];
+		data_t* biasDiffBuf = mBiasDiff[threadIdx];
+		data_t* fftInBuf = mFftIn[threadIdx];
+		data_t* fftDelBuf = mFftDelta[threadIdx];
+		data_t* accBuf = mFftAcc[threadIdx];
+		data_t* accRe = accBuf;
+		data_t* accIm = accBuf + PLANE_SIZE;
+
+		getGlobalDelta(threadIdx, numImages);
+
+		// Get Biases' gradient and the delta spectra
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			const data_t* delBuf = mDelta[threadIdx] + DELTA_SIZE * n;
 			for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
 			{
-				data_t sum = 0.f;
+				data_t* re = &fftDelBuf[(n * OUTPUT_DEPTH + outD) * mSpecSize];
+				data_t* im = re + PLANE_SIZE;
+				memset(re, 0, sizeof(data_t) * mSpecSize);
+				data_t biasDiff = 0.f;
 				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 				{
 					for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
 					{
-						sum += delBuf[getDeltaIdx(outX, outY, outD)];
+						const data_t delta = delBuf[getDeltaIdx(outX, outY, outD)];
+						re[LEN * outY + outX] = delta;
+						biasDiff += delta;
 					}
 				}
-				biasDiffBuf[outD] += sum;
+				biasDiffBuf[getBiasIdx(outD)] += biasDiff;
+				mFft->Forward2d(re, im);
 			}
+		}
 
-			// Get out gradient : prev layer's input gradient
-			const int IPAD = static_cast<int>(NUM_PAD);
-			for (int inY = 0; inY < INPUT_LEN; ++inY)
+		// Get Weights' gradient : correlation of the input with delta, wgtDiff^ = sum over images of in^ * conj(delta^)
+		// The transform is linear, so one inverse transform per kernel serves the whole mini-batch
+		for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+		{
+			for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
 			{
-				for (int inX = 0; inX < INPUT_LEN; ++inX)
+				memset(accBuf, 0, sizeof(data_t) * mSpecSize);
+				for (size_t n = 0; n < numImages; ++n)
 				{
-					const int BX = Max(IPAD - inX, 0);
-					const int BY = Max(IPAD - inY, 0);
-					const int EX = Min(OUTPUT_LEN, Min(INPUT_LEN + IPAD - inX, KERNEL_LEN));
-					const int EY = Min(OUTPUT_LEN, Min(INPUT_LEN + IPAD - inY, KERNEL_LEN));
-					for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
+					const data_t* inRe = &fftInBuf[(n * INPUT_DEPTH + inD) * mSpecSize];
+					const data_t* delRe = &fftDelBuf[(n * OUTPUT_DEPTH + outD) * mSpecSize];
+					Fft::MulConjAcc(PLANE_SIZE, inRe, inRe + PLANE_SIZE, delRe, delRe + PLANE_SIZE, accRe, accIm);
+				}
+				mFft->Inverse2d(accRe, accIm);
+				for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+				{
+					for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
 					{
-						data_t sum = 0.f;
-						for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
-						{
-							for (size_t kY = BY; kY < EY; ++kY)
-							{
-								for (size_t kX = BX; kX < EX; ++kX)
-								{
-									size_t rkx = KERNEL_LEN - 1 - kX;
-									size_t rky = KERNEL_LEN - 1 - kY;
-									size_t outX = Min(OUTPUT_LEN - 1, inX - IPAD + kX);
-									size_t outY = Min(OUTPUT_LEN - 1, inY - IPAD + kY);
-									data_t delta = delBuf[getDeltaIdx(outX, outY, outD)];
-									data_t wgt = wgtBuf[getWgtIdx(rkx, rky, inD, outD)];
-									sum += delta * wgt;
-								}
-							}
-						}
-						delOutBuf[getDOutIdx(inX, inY, inD)] = sum;
+						wgtDiffBuf[getWgtIdx(kX, kY, inD, outD)] += accRe[LEN * kY + kX];
 					}
 				}
 			}
 		}
-		else
+
+		// Get out gradient : full convolution of delta with the kernel, delOut^ = sum over outD of delta^ * wgt^
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			// Get global delta
-			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+			data_t* delOutBuf = mDeltaOut[threadIdx] + DELTA_OUT_SIZE * n;
+			for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
 			{
-				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+				memset(accBuf, 0, sizeof(data_t) * mSpecSize);
+				for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+				{
+					const data_t* delRe = &fftDelBuf[(n * OUTPUT_DEPTH + outD) * mSpecSize];
+					const data_t* wgtRe = &mFftWgt[getCacheCopy(threadIdx)][(inD * OUTPUT_DEPTH + outD) * mSpecSize];
+					Fft::MulAcc(PLANE_SIZE, delRe, delRe + PLANE_SIZE, wgtRe, wgtRe + PLANE_SIZE, accRe, accIm);
+				}
+				mFft->Inverse2d(accRe, accIm);
+				// Drop the padding
+				for (size_t inY = 0; inY < INPUT_LEN; ++inY)
 				{
-					for (size_t outD = 0; outD < OUTPUT_DEPTH; outD += MM_BLOCK)
+					for (size_t inX = 0; inX < INPUT_LEN; ++inX)
 					{
-						// Get delta in
-						MM_TYPE mmDIn = MM_LOAD(&delInBuf[getDInIdx(outX, outY, outD)]);
-						// Get deriv
-						MM_TYPE mmOut = MM_LOAD(&outBuf[getOutIdx(outX, outY, outD)]);
-						MM_TYPE mmZero = MM_SETZERO();
-						MM_TYPE mmOne = MM_SET1(1.f);
-						Assert(meActFn == EActFn::RELU);
-						MM_TYPE mmAnd = MM_CMPGT(mmOut, mmZero);
-						MM_TYPE mmDeriv = MM_AND(mmOne, mmAnd);
-						// Multyply
-						MM_TYPE mmMul = MM_MUL(mmDIn, mmDeriv);
-						// Store result
-						float* dest = &delBuf[getDeltaIdx(outX, outY, outD)];
-						MM_STORE(dest, mmMul);
+						delOutBuf[getDOutIdx(inX, inY, inD)] = accRe[LEN * (inY + NUM_PAD) + (inX + NUM_PAD)];
 					}
 				}
 			}
+		}
+	}
 
+	void Conv::backPropDirect(size_t threadIdx, size_t img)
+	{
+		data_t* inBuf = mIn[threadIdx] + INPUT_SIZE * img;
+		data_t* outBuf = mOut[threadIdx] + getOutPadSize() * img;
+		const data_t* wgtBuf = getWgt(threadIdx);
+		data_t* delInBuf = mDeltaIn[threadIdx] + DELTA_IN_SIZE * img;
+		data_t* delBuf = mDelta[threadIdx] + DELTA_SIZE * img;
+		data_t* delOutBuf = mDeltaOut[threadIdx] + DELTA_OUT_SIZE * img;
+		data_t* wgtDiffBuf = mWgtDiff[threadIdx];
+		data_t* biasDiffBuf = mBiasDiff[threadIdx];
+		// Get global delta
+		computeDelta(outBuf, delInBuf, delBuf);
+
+		if (mbUseAvx == false)
+		{
 			// Get Weights' gradient
 			for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
 			{
@@ -233,87 +966,73 @@ namespace cnn
 				{
 					for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
 					{
-						for (size_t outD = 0; outD < OUTPUT_DEPTH; outD += MM_BLOCK)
+						for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
 						{
-							// Get curr diff sum
-							MM_TYPE mmSum = MM_SETZERO();
+							data_t sum = 0.f;
 							for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 							{
 								for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
 								{
-									MM_TYPE mmDelta = MM_LOAD(&delBuf[getDeltaIdx(outX, outY, outD)]);
-									MM_TYPE mmXIn = MM_SET1(inBuf[getInIdx(outX + kX, outY + kY, inD)]);
-
-									MM_TYPE mmMul = MM_MUL(mmDelta, mmXIn);
-									mmSum = MM_ADD(mmSum, mmMul);
+									data_t delta = delBuf[getDeltaIdx(outX, outY, outD)];
+									data_t valIn = inBuf[getInIdx(outX + kX, outY + kY, inD)];
+									sum += delta * valIn;
 								}
 							}
-							// Add curr diff sum
-							float* dest = &wgtDiffBuf[getWgtIdx(kX, kY, inD, outD)];
-							MM_TYPE mmDest = MM_LOAD(dest);
-							mmDest = MM_ADD(mmDest, mmSum);
-							MM_STORE(dest, mmDest);
+							wgtDiffBuf[getWgtIdx(kX, kY, inD, outD)] += sum;
 						}
 					}
 				}
 			}
 			// Get Biases' gradient
-			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+			for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
 			{
-				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+				data_t sum = 0.f;
+				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 				{
-					for (size_t outD = 0; outD < OUTPUT_DEPTH; outD += MM_BLOCK)
+					for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
 					{
-						// Get curr diff sum
-						MM_TYPE mmSum = MM_LOAD(&delBuf[getDeltaIdx(outX, outY, outD)]);
-						// Add curr diff sum
-						float* dest = &biasDiffBuf[outD];
-						MM_TYPE mmDest = MM_LOAD(dest);
-						mmDest = MM_ADD(mmDest, mmSum);
-						MM_STORE(dest, mmDest);
+						sum += delBuf[getDeltaIdx(outX, outY, outD)];
 					}
 				}
+				biasDiffBuf[outD] += sum;
 			}
 
-			// Get out gradient : prev layer's input gradient
+			// Get out gradient : in(x) gathers delta(x + NUM_PAD - k) * wgt(k) over the outputs inside the image
 			const int IPAD = static_cast<int>(NUM_PAD);
-#pragma warning(push)
-#pragma warning(disable : 4018)
-			for (int inY = 0; inY < INPUT_LEN; ++inY)
+			const int OLEN = static_cast<int>(OUTPUT_LEN);
+			const int KLEN = static_cast<int>(KERNEL_LEN);
+			for (int inY = 0; inY < static_cast<int>(INPUT_LEN); ++inY)
 			{
-				for (int inX = 0; inX < INPUT_LEN; ++inX)
+				const int BY = Max(inY + IPAD - OLEN + 1, 0);
+				const int EY = Min(inY + IPAD + 1, KLEN);
+				for (int inX = 0; inX < static_cast<int>(INPUT_LEN); ++inX)
 				{
-					const int BX = Max(IPAD - inX, 0);
-					const int BY = Max(IPAD - inY, 0);
-					const int EX = Min(OUTPUT_LEN, Min(INPUT_LEN + IPAD - inX, KERNEL_LEN));
-					const int EY = Min(OUTPUT_LEN, Min(INPUT_LEN + IPAD - inY, KERNEL_LEN));
+					const int BX = Max(inX + IPAD - OLEN + 1, 0);
+					const int EX = Min(inX + IPAD + 1, KLEN);
 					for (size_t inD = 0; inD < INPUT_DEPTH; ++inD)
 					{
-						MM_TYPE mmSum = MM_SETZERO();
-						for (size_t outD = 0; outD < OUTPUT_DEPTH; outD += MM_BLOCK)
+						data_t sum = 0.f;
+						for (int kY = BY; kY < EY; ++kY)
 						{
-							for (size_t kY = BY; kY < EY; ++kY)
+							for (int kX = BX; kX < EX; ++kX)
 							{
-								for (size_t kX = BX; kX < EX; ++kX)
+								for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
 								{
-									size_t rkx = KERNEL_LEN - 1 - kX;
-									size_t rky = KERNEL_LEN - 1 - kY;
-									size_t outX = Min(OUTPUT_LEN - 1,inX - IPAD + kX);
-									size_t outY = Min(OUTPUT_LEN - 1, inY - IPAD + kY);
-									MM_TYPE mmDelta = MM_LOAD(&delBuf[getDeltaIdx(outX, outY, outD)]);
-									MM_TYPE mmWgt = MM_LOAD(&wgtBuf[getWgtIdx(rkx, rky, inD, outD)]);
-									MM_TYPE mmMul = MM_MUL(mmDelta, mmWgt);
-
-									mmSum = MM_ADD(mmSum, mmMul);
+									data_t delta = delBuf[getDeltaIdx(inX + IPAD - kX, inY + IPAD - kY, outD)];
+									data_t wgt = wgtBuf[getWgtIdx(kX, kY, inD, outD)];
+									sum += delta * wgt;
 								}
 							}
 						}
-						data_t sum = MM_HORIZ_SUM(mmSum);
 						delOutBuf[getDOutIdx(inX, inY, inD)] = sum;
 					}
 				}
 			}
-#pragma warning(pop)
+		}
+		else
+		{
+			DispatchSimd<ConvDirectBackPropKernel>(KERNEL_LEN, NUM_PAD, INPUT_LEN, OUTPUT_LEN, INPUT_DEPTH, OUTPUT_DEPTH, inBuf, getInShape(),
+				delBuf, wgtBuf, wgtDiffBuf, biasDiffBuf, delOutBuf, getDOutShape());
 		}
 	}
 }
\ No newline at end of file
@@ -1,15 +1,97 @@
 #pragma once
+#include <memory>
 #include "ILayer.h"
+#include "Winograd.h"
+#include "Fft.h"
 
 namespace cnn
 {
+	enum class EConvAlgo
+	{
+		DIRECT,				// Loop nest, scalar or vector by UseAvx
+		GEMM,				// im2col + blocked SGEMM
+		WINOGRAD_2X2_3X3,	// Winograd F(2x2, 3x3), 3x3 kernels only
+		WINOGRAD_4X4_3X3,	// Winograd F(4x4, 3x3), 3x3 kernels only
+		WINOGRAD_2X2_5X5,	// Winograd F(2x2, 5x5), 5x5 kernels only
+		FFT,				// Element-wise products of 2D spectra, pays off for large kernels
+	};
+
 	class Conv : public ILayer
 	{
 	public:
-		Conv(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn);
+		Conv(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn,
+			ELayout eLayout = ELayout::HWC);
 		~Conv();
 
-		void Forward(size_t threadIdx) override;
-		void BackProp(size_t threadIdx) override;
+		void Forward(size_t threadIdx, size_t numImages) override;
+		void BackProp(size_t threadIdx, size_t numImages) override;
+		ELayer GetType() const override { return ELayer::CONV; }
+		void InitBuffers(size_t numImages) override;
+
+		// Returns false and keeps the current algorithm if the layer's shape is not supported
+		bool SetAlgo(EConvAlgo eAlgo);
+		// Quantized layers run im2col + int8 GEMM whatever the algorithm
+		bool Quantize(data_t inMin, data_t inMax) override;
+	protected:
+		void refreshCache(size_t copy) override;
+		void setThreadCaches(bool b) override;
+		// GEMM, Winograd and FFT back propagate from the patches, transforms or spectra their Forward left
+		bool backPropReadsInput() const override
+		{
+			return meAlgo == EConvAlgo::DIRECT || (meAlgo == EConvAlgo::GEMM && mbPointwise);
+		}
+		// The algorithm's patches, transforms or spectra, not the Winograd weight gradients
+		size_t getScratchBytes() const override;
+	private:
+		// DIRECT works on one image at a time, the other algorithms on the whole mini-batch
+		void forwardDirect(size_t threadIdx, size_t img);
+		void forwardGemm(size_t threadIdx, size_t numImages);
+		void forwardWinograd(size_t threadIdx, size_t numImages);
+		void forwardFft(size_t threadIdx, size_t numImages);
+		void forwardInt8(size_t threadIdx, size_t numImages);
+		void backPropDirect(size_t threadIdx, size_t img);
+		// Uses the patch matrix left in mCol by forwardGemm of the same thread
+		void backPropGemm(size_t threadIdx, size_t numImages);
+		// Uses the transformed input left in mWinoIn by forwardWinograd of the same thread
+		void backPropWinograd(size_t threadIdx, size_t numImages);
+		// Uses the input spectra left in mFftIn by forwardFft of the same thread
+		void backPropFft(size_t threadIdx, size_t numImages);
+		// delta = deltaIn * f'(out)
+		void getGlobalDelta(size_t threadIdx, size_t numImages);
+		// Lower the padded input to a (OUTPUT_LEN^2 x COL_SIZE) patch matrix with rows of ldc values
+		// Column order matches the weight rows : (inD, kY, kX)
+		template <typename T>
+		void im2col(const T* inBuf, T* colBuf, size_t ldc) const;
+		// Scatter-add a patch matrix gradient back to the (unpadded) input gradient
+		void col2im(const data_t* colBuf, data_t* delOutBuf) const;
+		// Per-thread buffers of the current algorithm, sized for the mini-batch
+		void allocAlgoBuffers();
+		void freeAlgoBuffers();
+		// Copies of the current algorithm's transformed weights, see setThreadCaches
+		void allocWgtCaches();
+		void freeWgtCaches();
+	private:
+		EConvAlgo meAlgo;
+		// 1x1 kernel without padding in HWC layout : the input already is the patch matrix
+		const bool mbPointwise;
+		const size_t COL_SIZE;
+		// vector elements are buffers allocated to threads
+		std::vector<data_t*> mCol;
+		std::vector<data_t*> mGemmOut;
+		// Winograd : every ALPHA x ALPHA frequency is a (tiles x inD) * (inD x outD) GEMM
+		std::unique_ptr<Winograd> mWinograd;
+		size_t mNumTileLen;		// Tiles per row of the output
+		std::vector<data_t*> mWinoWgt;		// Cached G g G^T, ALPHA^2 x INPUT_DEPTH x OUTPUT_DEPTH
+		std::vector<data_t*> mWinoTile;		// Scratch for one tile of every channel
+		std::vector<data_t*> mWinoIn;		// ALPHA^2 x (images x tiles) x INPUT_DEPTH
+		std::vector<data_t*> mWinoOut;		// ALPHA^2 x (images x tiles) x OUTPUT_DEPTH
+		std::vector<data_t*> mWinoWgtDiff;	// ALPHA^2 x INPUT_DEPTH x OUTPUT_DEPTH
+		// FFT : planes are zero padded to LEN x LEN, a spectrum is LEN^2 real parts followed by LEN^2 imaginary parts
+		std::unique_ptr<Fft> mFft;
+		size_t mSpecSize;		// 2 * LEN^2
+		std::vector<data_t*> mFftWgt;		// Cached kernel spectra, INPUT_DEPTH x OUTPUT_DEPTH
+		std::vector<data_t*> mFftIn;		// images x INPUT_DEPTH input spectra
+		std::vector<data_t*> mFftDelta;		// images x OUTPUT_DEPTH delta spectra
+		std::vector<data_t*> mFftAcc;		// One spectrum accumulator
 	};
 }
\ No newline at end of file
@@ -0,0 +1,342 @@
+#include "Cpu.h"
+#include <atomic>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <cctype>
+#include <thread>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cpuid.h>
+#endif
+#ifdef __linux__
+#include <dirent.h>
+#include <sched.h>
+#endif
+
+namespace cnn
+{
+	namespace
+	{
+		struct CpuidRegs
+		{
+			unsigned int Eax;
+			unsigned int Ebx;
+			unsigned int Ecx;
+			unsigned int Edx;
+		};
+
+		CpuidRegs cpuid(unsigned int leaf, unsigned int subLeaf)
+		{
+			CpuidRegs regs = {};
+#ifdef _MSC_VER
+			int r[4];
+			__cpuidex(r, static_cast<int>(leaf), static_cast<int>(subLeaf));
+			regs = { static_cast<unsigned int>(r[0]), static_cast<unsigned int>(r[1]),
+				static_cast<unsigned int>(r[2]), static_cast<unsigned int>(r[3]) };
+#else
+			__cpuid_count(leaf, subLeaf, regs.Eax, regs.Ebx, regs.Ecx, regs.Edx);
+#endif
+			return regs;
+		}
+
+		// Register states the OS saves on context switches, XCR0
+		unsigned long long xgetbv0()
+		{
+#ifdef _MSC_VER
+			return _xgetbv(0);
+#else
+			unsigned int lo, hi;
+			__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+			return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+		}
+
+		bool hasBit(unsigned int reg, unsigned int bit)
+		{
+			return (reg >> bit) & 1u;
+		}
+
+		bool detectAvx512Vnni()
+		{
+			return cpuid(0, 0).Eax >= 7 && hasBit(cpuid(7, 0).Ecx, 11);
+		}
+
+		ESimd detectSimd()
+		{
+			const unsigned int MAX_LEAF = cpuid(0, 0).Eax;
+			if (MAX_LEAF < 1)
+			{
+				return ESimd::SCALAR;
+			}
+			const CpuidRegs leaf1 = cpuid(1, 0);
+			if (!hasBit(leaf1.Ecx, 19) || !hasBit(leaf1.Ecx, 20))
+			{
+				return ESimd::SCALAR;
+			}
+			// AVX needs the OS to save the ymm registers(XCR0 bits 1, 2)
+			const bool bOsXsave = hasBit(leaf1.Ecx, 27);
+			const unsigned long long XCR0 = bOsXsave ? xgetbv0() : 0;
+			const bool bAvx = bOsXsave && hasBit(leaf1.Ecx, 28) && (XCR0 & 0x6) == 0x6;
+			const bool bFma = hasBit(leaf1.Ecx, 12);
+			const CpuidRegs leaf7 = MAX_LEAF >= 7 ? cpuid(7, 0) : CpuidRegs{};
+			if (!bAvx || !bFma || !hasBit(leaf7.Ebx, 5))
+			{
+				return ESimd::SSE4;
+			}
+			// AVX-512 also needs the opmask and zmm states(XCR0 bits 5, 6, 7)
+			if (!hasBit(leaf7.Ebx, 16) || (XCR0 & 0xE0) != 0xE0)
+			{
+				return ESimd::AVX2;
+			}
+			return ESimd::AVX512;
+		}
+
+		struct NumaNode
+		{
+			size_t Id;
+			std::vector<size_t> Cpus;
+		};
+
+#ifdef __linux__
+		// "0-3,8-11"
+		std::vector<size_t> parseCpuList(const std::string& list)
+		{
+			std::vector<size_t> cpus;
+			size_t pos = 0;
+			while (pos < list.size())
+			{
+				size_t end = list.find(',', pos);
+				end = end == std::string::npos ? list.size() : end;
+				const std::string range = list.substr(pos, end - pos);
+				const size_t dash = range.find('-');
+				if (range.empty() == false && isdigit(static_cast<unsigned char>(range[0])))
+				{
+					const size_t first = std::stoul(range);
+					const size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+					for (size_t cpu = first; cpu <= last; ++cpu)
+					{
+						cpus.push_back(cpu);
+					}
+				}
+				pos = end + 1;
+			}
+			return cpus;
+		}
+#endif
+
+		std::vector<NumaNode> detectNodes()
+		{
+			std::vector<NumaNode> nodes;
+#ifdef __linux__
+			DIR* dir = opendir("/sys/devices/system/node");
+			if (dir != nullptr)
+			{
+				while (dirent* entry = readdir(dir))
+				{
+					const std::string name = entry->d_name;
+					if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit(static_cast<unsigned char>(name[4])))
+					{
+						continue;
+					}
+					std::ifstream file("/sys/devices/system/node/" + name + "/cpulist");
+					std::string list;
+					std::getline(file, list);
+					NumaNode node = { std::stoul(name.substr(4)), parseCpuList(list) };
+					// Memory-only nodes run no threads
+					if (node.Cpus.empty() == false)
+					{
+						nodes.push_back(node);
+					}
+				}
+				closedir(dir);
+			}
+#elif defined(_MSC_VER)
+			ULONG highest = 0;
+			if (GetNumaHighestNodeNumber(&highest))
+			{
+				for (USHORT id = 0; id <= highest; ++id)
+				{
+					GROUP_AFFINITY affinity = {};
+					if (!GetNumaNodeProcessorMaskEx(id, &affinity))
+					{
+						continue;
+					}
+					NumaNode node = { id, {} };
+					for (size_t bit = 0; bit < 8 * sizeof(affinity.Mask); ++bit)
+					{
+						if ((affinity.Mask >> bit) & 1)
+						{
+							node.Cpus.push_back(affinity.Group * 8 * sizeof(affinity.Mask) + bit);
+						}
+					}
+					if (node.Cpus.empty() == false)
+					{
+						nodes.push_back(node);
+					}
+				}
+			}
+#endif
+			if (nodes.empty())
+			{
+				NumaNode node = { 0, {} };
+				const size_t NUM_CPUS = std::max(std::thread::hardware_concurrency(), 1u);
+				for (size_t cpu = 0; cpu < NUM_CPUS; ++cpu)
+				{
+					node.Cpus.push_back(cpu);
+				}
+				nodes.push_back(node);
+			}
+			std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.Id < b.Id; });
+			return nodes;
+		}
+
+		const std::vector<NumaNode>& getNodes()
+		{
+			static const std::vector<NumaNode> NODES = detectNodes();
+			return NODES;
+		}
+
+		// Node of thread buffer threadIdx, cpu : its CPU's index in the node
+		size_t getThreadPlace(size_t threadIdx, size_t numThreads, size_t& cpu)
+		{
+			const std::vector<NumaNode>& nodes = getNodes();
+			size_t numCpus = 0;
+			for (const NumaNode& node : nodes)
+			{
+				numCpus += node.Cpus.size();
+			}
+			// Position of the thread among all CPUs
+			cpu = threadIdx * numCpus / std::max(numThreads, (size_t)1);
+			for (size_t i = 0; i < nodes.size(); ++i)
+			{
+				if (cpu < nodes[i].Cpus.size())
+				{
+					return i;
+				}
+				cpu -= nodes[i].Cpus.size();
+			}
+			cpu = nodes.back().Cpus.size() - 1;
+			return nodes.size() - 1;
+		}
+
+		std::atomic<ESimd>& selectedSimd()
+		{
+			static std::atomic<ESimd> eSimd(GetHostSimd());
+			return eSimd;
+		}
+	}
+
+	ESimd GetHostSimd()
+	{
+		static const ESimd HOST_SIMD = detectSimd();
+		return HOST_SIMD;
+	}
+
+	ESimd GetSimd()
+	{
+		return selectedSimd().load(std::memory_order_relaxed);
+	}
+
+	void SetSimd(ESimd eSimd)
+	{
+		const ESimd HOST_SIMD = GetHostSimd();
+		selectedSimd().store(eSimd < HOST_SIMD ? eSimd : HOST_SIMD, std::memory_order_relaxed);
+	}
+
+	bool HasAvx512Vnni()
+	{
+		static const bool HAS_VNNI = GetHostSimd() == ESimd::AVX512 && detectAvx512Vnni();
+		return HAS_VNNI;
+	}
+
+	const char* GetSimdName(ESimd eSimd)
+	{
+		switch (eSimd)
+		{
+		case ESimd::SCALAR:
+			return "scalar";
+		case ESimd::SSE4:
+			return "SSE4";
+		case ESimd::AVX2:
+			return "AVX2";
+		case ESimd::AVX512:
+			return "AVX-512";
+		default:
+			return "unknown";
+		}
+	}
+
+	size_t GetNumNodes()
+	{
+		return getNodes().size();
+	}
+
+	size_t GetNodeId(size_t node)
+	{
+		return getNodes()[node].Id;
+	}
+
+	const std::vector<size_t>& GetNodeCpus(size_t node)
+	{
+		return getNodes()[node].Cpus;
+	}
+
+	size_t GetThreadNode(size_t threadIdx, size_t numThreads)
+	{
+		size_t cpu;
+		return getThreadPlace(threadIdx, numThreads, cpu);
+	}
+
+	size_t GetThreadCpu(size_t threadIdx, size_t numThreads)
+	{
+		size_t cpu;
+		const size_t node = getThreadPlace(threadIdx, numThreads, cpu);
+		return getNodes()[node].Cpus[cpu];
+	}
+
+	bool PinThread(size_t cpu)
+	{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return sched_setaffinity(0, sizeof(set), &set) == 0;
+#elif defined(_MSC_VER)
+		GROUP_AFFINITY affinity = {};
+		affinity.Group = static_cast<WORD>(cpu / (8 * sizeof(KAFFINITY)));
+		affinity.Mask = static_cast<KAFFINITY>(1) << (cpu % (8 * sizeof(KAFFINITY)));
+		return SetThreadGroupAffinity(GetCurrentThread(), &affinity, nullptr) != 0;
+#else
+		return false;
+#endif
+	}
+
+	void UnpinThread()
+	{
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (const NumaNode& node : getNodes())
+		{
+			for (size_t cpu : node.Cpus)
+			{
+				CPU_SET(cpu, &set);
+			}
+		}
+		sched_setaffinity(0, sizeof(set), &set);
+#elif defined(_MSC_VER)
+		// Back to the process's CPUs of the thread's group
+		DWORD_PTR processMask = 0;
+		DWORD_PTR systemMask = 0;
+		if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+		{
+			SetThreadAffinityMask(GetCurrentThread(), processMask);
+		}
+#endif
+	}
+}
\ No newline at end of file
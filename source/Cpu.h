@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+namespace cnn
+{
+	// Instruction sets of the vector backends, each level includes the ones before it
+	enum class ESimd
+	{
+		SCALAR,
+		SSE4,		// SSE4.1 and SSE4.2, 4 floats
+		AVX2,		// AVX2 and FMA, 8 floats
+		AVX512,		// AVX-512F, 16 floats with mask registers
+	};
+
+	// Best level the CPU and the OS support, read once with cpuid
+	ESimd GetHostSimd();
+
+	// Level the shared kernels run at, the host's unless lowered by SetSimd
+	ESimd GetSimd();
+	// Levels above the host's are clamped to it
+	void SetSimd(ESimd eSimd);
+	// AVX-512 VNNI(vpdpbusd) for int8 dot products, only used while GetSimd is AVX512
+	bool HasAvx512Vnni();
+
+	const char* GetSimdName(ESimd eSimd);
+
+	// NUMA nodes with CPUs, read once from the OS
+	// A host without NUMA information is a single node 0 holding every CPU.
+	size_t GetNumNodes();
+	// OS node number of node, in [0, GetNumNodes())
+	size_t GetNodeId(size_t node);
+	// OS processor numbers of node's CPUs
+	const std::vector<size_t>& GetNodeCpus(size_t node);
+	// Node of thread buffer threadIdx out of numThreads : the buffers are spread over the nodes' CPUs in order,
+	// contiguous buffers on one node, as many per node as it has CPUs in proportion
+	size_t GetThreadNode(size_t threadIdx, size_t numThreads);
+	// CPU of thread buffer threadIdx in the same spread, on its GetThreadNode
+	size_t GetThreadCpu(size_t threadIdx, size_t numThreads);
+
+	// Restrict the calling thread to one CPU, false if the OS refused
+	bool PinThread(size_t cpu);
+	// Let the calling thread run on every CPU of the nodes again
+	void UnpinThread();
+}
\ No newline at end of file
@@ -2,30 +2,152 @@
 #include <iostream>
 #include <cassert>
 #include "DWConv.h"
+#include "Activation.h"
+#include "SimdKernels.h"
+#include "Quant.h"
 
 namespace cnn
 {
-	DwConv::DwConv(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, EActFn eActFn)
-		: ILayer(kernelLen, inLen, inDepth, outLen, inDepth, eActFn)
+	namespace
 	{
+		// acc[0, MM_BLOCK) = the sum over the kernelLen x kernelLen taps of in * wgt, the rows of wgt wgtStride apart
+		// A u8 x s8 product fits int16, the sum over the taps does not
+		TARGET("avx2") void sumTapsAvx2(const uint8_t* in, const TensorShape& inShape, const int8_t* wgt, size_t wgtStride, size_t kernelLen, int32_t* acc)
+		{
+			__m256i mmAcc = _mm256_setzero_si256();
+			for (size_t kY = 0; kY < kernelLen; ++kY)
+			{
+				for (size_t kX = 0; kX < kernelLen; ++kX)
+				{
+					const __m128i mmIn = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&in[inShape.Idx(kX, kY, 0)])));
+					const __m128i mmWgt = _mm_cvtepi8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&wgt[(kernelLen * kY + kX) * wgtStride])));
+					mmAcc = _mm256_add_epi32(mmAcc, _mm256_cvtepi16_epi32(_mm_mullo_epi16(mmIn, mmWgt)));
+				}
+			}
+			_mm256_store_si256(reinterpret_cast<__m256i*>(acc), mmAcc);
+		}
+	}
 
+	DwConv::DwConv(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, EActFn eActFn,
+		ELayout eLayout)
+		: ILayer(kernelLen, inLen, inDepth, outLen, inDepth, eActFn, eLayout, eLayout)
+		, mBlockWgt()
+		, mBlockBias()
+		, mBlockDelta()
+	{
+		allocBlockWgt();
+		onWeightsUpdated();
 	}
 
 	DwConv::~DwConv()
 	{
+		freeBlockWgt();
+		freeBlockDelta();
+	}
+
+	void DwConv::allocBlockWgt()
+	{
+		if (meOutLayout != ELayout::BLOCKED)
+		{
+			return;
+		}
+		for (size_t copy = 0; copy < getNumCacheCopies(); ++copy)
+		{
+			mBlockWgt.push_back(Alloc<data_t>(KERNEL_SIZE * OUTPUT_PAD_DEPTH));
+			mBlockBias.push_back(Alloc<data_t>(OUTPUT_PAD_DEPTH));
+			memset(mBlockWgt.back(), 0, sizeof(data_t) * KERNEL_SIZE * OUTPUT_PAD_DEPTH);
+			memset(mBlockBias.back(), 0, sizeof(data_t) * OUTPUT_PAD_DEPTH);
+		}
+	}
+
+	void DwConv::freeBlockWgt()
+	{
+		for (size_t copy = 0; copy < mBlockWgt.size(); ++copy)
+		{
+			Free(mBlockWgt[copy]);
+			Free(mBlockBias[copy]);
+		}
+		mBlockWgt.clear();
+		mBlockBias.clear();
+	}
+
+	void DwConv::setThreadCaches(bool b)
+	{
+		freeBlockWgt();
+		ILayer::setThreadCaches(b);
+		allocBlockWgt();
+		onWeightsUpdated();
+	}
+
+	void DwConv::InitBuffers(size_t numImages)
+	{
+		ILayer::InitBuffers(numImages);
+		freeBlockDelta();
+		if (meOutLayout == ELayout::BLOCKED && mbInference == false)
+		{
+			for (size_t i = 0; i < NUM_THREAD; i++)
+			{
+				mBlockDelta.push_back(Alloc<data_t>(DELTA_IN_SIZE * numImages));
+				memset(mBlockDelta[i], 0, sizeof(data_t) * DELTA_IN_SIZE * numImages);
+			}
+		}
+	}
+
+	void DwConv::freeBlockDelta()
+	{
+		for (size_t i = 0; i < mBlockDelta.size(); i++)
+		{
+			Free(mBlockDelta[i]);
+		}
+		mBlockDelta.clear();
+	}
 
+	void DwConv::refreshCache(size_t copy)
+	{
+		if (mBlockWgt.empty())
+		{
+			return;
+		}
+		for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+		{
+			for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
+			{
+				data_t* dest = &mBlockWgt[copy][(KERNEL_LEN * kY + kX) * OUTPUT_PAD_DEPTH];
+				for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+				{
+					dest[depth] = mWgt[getWgtIdx(kX, kY, 0, depth)];
+				}
+			}
+		}
+		for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+		{
+			mBlockBias[copy][depth] = mBias[getBiasIdx(depth)];
+		}
 	}
 
-	void DwConv::Forward(size_t threadIdx)
+	void DwConv::Forward(size_t threadIdx, size_t numImages)
 	{
-		data_t* inBuf = mIn[threadIdx];
-		data_t* outBuf = mOut[threadIdx];
-		data_t* wgtBuf = mWgt;
-		data_t* biasBuf = mBias;
-		if (mbUseAvx == false)
+		Assert(numImages <= mMiniBatch);
+		if (IsQuantized())
+		{
+			forwardInt8(threadIdx, numImages);
+			return;
+		}
+		if (mbUseAvx)
+		{
+			forwardAvx(threadIdx, numImages);
+			return;
+		}
+		const data_t* wgtBuf = getWgt(threadIdx);
+		const data_t* biasBuf = getBias(threadIdx);
+		const size_t OUT_STRIDE = getOutPadSize();
+		// A channel's kernel is used for all images before moving on
+		for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
 		{
-			for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+			for (size_t n = 0; n < numImages; ++n)
 			{
+				data_t* inBuf = mIn[threadIdx] + INPUT_SIZE * n;
+				data_t* outBuf = mOut[threadIdx] + OUT_STRIDE * n;
 				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 				{
 					for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
@@ -41,149 +163,215 @@ namespace cnn
 							}
 						}
 						sum += biasBuf[getBiasIdx(depth)];
-						outBuf[getOutIdx(outX, outY, depth)] = mActivate(sum);
+						outBuf[getOutIdx(outX, outY, depth)] = sum;
 					}
 				}
 			}
 		}
-		else
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+			activateOutput(mOut[threadIdx] + OUT_STRIDE * n);
+		}
+	}
+
+	bool DwConv::Quantize(data_t inMin, data_t inMax)
+	{
+		// The weights are a KERNEL_SIZE x OUTPUT_DEPTH matrix, one column per channel
+		std::unique_ptr<QuantWeights> quantWgt(new QuantWeights(mWgt, KERNEL_SIZE, OUTPUT_DEPTH, GetActQuant(inMin, inMax), EQuantPack::ROWS));
+		// The vector path reads whole blocks of MM_BLOCK bytes, past the end of the last HWC pixel too
+		initQuant(std::move(quantWgt), INPUT_SIZE + MM_BLOCK, 0);
+		return true;
+	}
+
+	void DwConv::forwardInt8(size_t threadIdx, size_t numImages)
+	{
+		const data_t* biasBuf = getBias(threadIdx);
+		const QuantWeights& quantWgt = *mQuantWgt;
+		const int8_t* wgtBuf = quantWgt.GetWgt();
+		const size_t PAD_N = quantWgt.GetPadN();
+		const size_t OUT_STRIDE = getOutPadSize();
+		const bool USE_SIMD = GetSimd() >= ESimd::AVX2;
+		const TensorShape IN_SHAPE = getInShape();
+		uint8_t* qInBuf = mQIn[threadIdx];
+		QuantizeActs(quantWgt.GetInQuant(), mIn[threadIdx], qInBuf, INPUT_SIZE * numImages);
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			const uint8_t* inBuf = qInBuf + INPUT_SIZE * n;
+			data_t* outBuf = mOut[threadIdx] + OUT_STRIDE * n;
+			for (size_t depth = 0; depth < OUTPUT_DEPTH; depth += MM_BLOCK)
 			{
-				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+				const size_t NUM_LANES = std::min((size_t)MM_BLOCK, OUTPUT_DEPTH - depth);
+				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 				{
-					for (size_t depth = 0; depth < OUTPUT_DEPTH; depth += MM_BLOCK)
+					for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
 					{
-						MM_TYPE mmSum = MM_SETZERO();
-						for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+						alignas(MM_ALIGNMENT) int32_t acc[MM_BLOCK] = {};
+						if (USE_SIMD)
 						{
-							for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
-							{
-								data_t in = inBuf[getInIdx(outX + kX, outY + kY, depth)];
-								MM_TYPE mmIn = MM_LOAD(&inBuf[getInIdx(outX + kX, outY + kY, 0)]);
-								MM_TYPE mmWgt = MM_LOAD(&wgtBuf[getWgtIdx(kX, kY, 0, depth)]);
-
-								MM_TYPE mmMul = MM_MUL(mmIn, mmWgt);
-								mmSum = MM_ADD(mmSum, mmMul);
-							}
+							sumTapsAvx2(&inBuf[getInIdx(outX, outY, depth)], IN_SHAPE, &wgtBuf[depth], PAD_N, KERNEL_LEN, acc);
 						}
-						MM_TYPE mmBias = MM_LOAD(&biasBuf[getBiasIdx(depth)]);
-						mmSum = MM_ADD(mmSum, mmBias);
-
-						float* dest = &outBuf[getOutIdx(outX, outY, depth)];
-						MM_STORE(dest, mmSum);
-						for (size_t i = 0; i < MM_BLOCK; ++i)
+						else
 						{
-							dest[i] = mActivate(dest[i]);
+							for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+							{
+								for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
+								{
+									const uint8_t* in = &inBuf[getInIdx(outX + kX, outY + kY, depth)];
+									const int8_t* wgt = &wgtBuf[(KERNEL_LEN * kY + kX) * PAD_N + depth];
+									for (size_t c = 0; c < NUM_LANES; ++c)
+									{
+										acc[c] += static_cast<int32_t>(in[c]) * wgt[c];
+									}
+								}
+							}
 						}
+						quantWgt.Requantize(acc, biasBuf, depth, depth + NUM_LANES, &outBuf[getOutIdx(outX, outY, depth)]);
 					}
 				}
 			}
+			activateOutput(outBuf);
 		}
 	}
 
-	void DwConv::BackProp(size_t threadIdx)
+	void DwConv::forwardAvx(size_t threadIdx, size_t numImages)
 	{
-		data_t* inBuf = mIn[threadIdx];
-		data_t* outBuf = mOut[threadIdx];
-		data_t* wgtBuf = mWgt;
-		data_t* delInBuf = mDeltaIn[threadIdx];
-		data_t* delBuf = mDelta[threadIdx];
-		data_t* delOutBuf = mDeltaOut[threadIdx];
+		const data_t* wgtBuf = getAvxWgt(threadIdx);
+		const data_t* biasBuf = getAvxBias(threadIdx);
+		const size_t OUT_STRIDE = getOutPadSize();
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			data_t* outBuf = mOut[threadIdx] + OUT_STRIDE * n;
+			DispatchSimd<DwConvForwardKernel>(KERNEL_LEN, OUTPUT_LEN, OUTPUT_PAD_DEPTH, mIn[threadIdx] + INPUT_SIZE * n, getInShape(),
+				wgtBuf, biasBuf, outBuf + getOutIdx(0, 0, 0), getOutShape());
+			activateOutput(outBuf);
+		}
+	}
+
+	void DwConv::BackProp(size_t threadIdx, size_t numImages)
+	{
+		Assert(numImages <= mMiniBatch);
+		if (mbUseAvx)
+		{
+			backPropAvx(threadIdx, numImages);
+			return;
+		}
+		const data_t* wgtBuf = getWgt(threadIdx);
 		data_t* wgtDiffBuf = mWgtDiff[threadIdx];
 		data_t* biasDiffBuf = mBiasDiff[threadIdx];
+		const size_t OUT_STRIDE = getOutPadSize();
 
-		// TODO: AVX impl
 		// Get global delta
-		for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			computeDelta(mOut[threadIdx] + OUT_STRIDE * n, mDeltaIn[threadIdx] + DELTA_IN_SIZE * n, mDelta[threadIdx] + DELTA_SIZE * n);
+		}
+		// Get Weights' and Biases' gradient, channels innermost
+		for (size_t n = 0; n < numImages; ++n)
 		{
+			data_t* inBuf = mIn[threadIdx] + INPUT_SIZE * n;
+			data_t* delBuf = mDelta[threadIdx] + DELTA_SIZE * n;
 			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 			{
 				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
 				{
-					data_t deltaIn = delInBuf[getDInIdx(outX, outY, depth)];
-					data_t out = outBuf[getOutIdx(outX, outY, depth)];
-					data_t deriv = 0.f;
-					switch (meActFn)
+					const data_t* delta = &delBuf[getDeltaIdx(outX, outY, 0)];
+					for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
 					{
-					case EActFn::TANH:
-						deriv = 1 - out * out;
-						break;
-					case EActFn::RELU:
-						deriv = out > 0.f ? 1.f : 0.f;
-						break;
-					default:
-						Assert(false);
-						break;
+						biasDiffBuf[getBiasIdx(depth)] += delta[depth];
 					}
-					delBuf[getDeltaIdx(outX, outY, depth)] = deltaIn * deriv;
-				}
-			}
-		}
-		// Get Weights' gradient
-		for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
-		{
-			for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
-			{
-				for (size_t depth = 0; depth < INPUT_DEPTH; ++depth)
-				{
-					data_t sum = 0.f;
-					for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+					for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
 					{
-						for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+						for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
 						{
-							data_t delta = delBuf[getDeltaIdx(outX, outY, depth)];
-							data_t valIn = inBuf[getInIdx(outX + kX, outY + kY, depth)];
-							sum += delta * valIn;
+							data_t* wgtDiff = &wgtDiffBuf[getWgtIdx(kX, kY, 0, 0)];
+							for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+							{
+								wgtDiff[depth] += delta[depth] * inBuf[getInIdx(outX + kX, outY + kY, depth)];
+							}
 						}
 					}
-					wgtDiffBuf[getWgtIdx(kX, kY, 0, depth)] += sum;
 				}
 			}
 		}
-		// Get Biases' gradient
-		for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+
+		// Get out gradient : in(x) gathers delta(x + NUM_PAD - k) * wgt(k) over the outputs inside the image
+		const int IPAD = static_cast<int>(NUM_PAD);
+		const int OLEN = static_cast<int>(OUTPUT_LEN);
+		const int KLEN = static_cast<int>(KERNEL_LEN);
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			data_t sum = 0.f;
-			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+			data_t* delBuf = mDelta[threadIdx] + DELTA_SIZE * n;
+			data_t* delOutBuf = mDeltaOut[threadIdx] + DELTA_OUT_SIZE * n;
+			for (int inY = 0; inY < static_cast<int>(INPUT_LEN); ++inY)
 			{
-				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+				const int BY = Max(inY + IPAD - OLEN + 1, 0);
+				const int EY = Min(inY + IPAD + 1, KLEN);
+				for (int inX = 0; inX < static_cast<int>(INPUT_LEN); ++inX)
 				{
-					sum += delBuf[getDeltaIdx(outX, outY, depth)];
+					const int BX = Max(inX + IPAD - OLEN + 1, 0);
+					const int EX = Min(inX + IPAD + 1, KLEN);
+					for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+					{
+						delOutBuf[getDOutIdx(inX, inY, depth)] = 0.f;
+					}
+					for (int kY = BY; kY < EY; ++kY)
+					{
+						for (int kX = BX; kX < EX; ++kX)
+						{
+							const data_t* delta = &delBuf[getDeltaIdx(inX + IPAD - kX, inY + IPAD - kY, 0)];
+							const data_t* wgt = &wgtBuf[getWgtIdx(kX, kY, 0, 0)];
+							for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+							{
+								delOutBuf[getDOutIdx(inX, inY, depth)] += delta[depth] * wgt[depth];
+							}
+						}
+					}
 				}
 			}
-			biasDiffBuf[depth] += sum;
 		}
+	}
 
-		// Get out gradient : prev layer's input gradient
-		const int IPAD = static_cast<int>(NUM_PAD);
-		for (size_t depth = 0; depth < OUTPUT_DEPTH; ++depth)
+	void DwConv::backPropAvx(size_t threadIdx, size_t numImages)
+	{
+		// Deltas stay in the output layout so every pass loads channel blocks.
+		// HWC : mDelta already is, DELTA_SIZE == DELTA_IN_SIZE.
+		// BLOCKED : mBlockDelta, the padded channels get zero weights' gradient and contribute nothing to delOut.
+		const bool BLOCKED = meOutLayout == ELayout::BLOCKED;
+		data_t* delBase = BLOCKED ? mBlockDelta[threadIdx] : mDelta[threadIdx];
+		const data_t* wgtBuf = getAvxWgt(threadIdx);
+		data_t* wgtDiffBuf = mWgtDiff[threadIdx];
+		data_t* biasDiffBuf = mBiasDiff[threadIdx];
+		const size_t OUT_STRIDE = getOutPadSize();
+
+		// Get global delta
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			for (int inY = 0; inY < INPUT_LEN; ++inY)
+			const data_t* outBuf = mOut[threadIdx] + OUT_STRIDE * n;
+			const data_t* delInBuf = mDeltaIn[threadIdx] + DELTA_IN_SIZE * n;
+			data_t* delBuf = delBase + DELTA_IN_SIZE * n;
+			if (BLOCKED)
 			{
-				for (int inX = 0; inX < INPUT_LEN; ++inX)
+				for (size_t depth = 0; depth < OUTPUT_PAD_DEPTH; depth += MM_BLOCK)
 				{
-					const int BX = Max(IPAD - inX, 0);
-					const int BY = Max(IPAD - inY, 0);
-					const int EX = Min(INPUT_LEN + IPAD - inX, KERNEL_LEN);
-					const int EY = Min(INPUT_LEN + IPAD - inY, KERNEL_LEN);
-					data_t sum = 0.f;
-					for (size_t kY = BY; kY < EY; ++kY)
+					for (size_t y = 0; y < OUTPUT_LEN; ++y)
 					{
-						for (size_t kX = BX; kX < EX; ++kX)
-						{
-							size_t rkx = KERNEL_LEN - 1 - kX;
-							size_t rky = KERNEL_LEN - 1 - kY;
-							size_t outX = inX - IPAD + kX;
-							size_t outY = inY - IPAD + kY;
-							data_t delta = delBuf[getDeltaIdx(outX, outY, depth)];
-							data_t wgt = wgtBuf[getWgtIdx(rkx, rky, 0, depth)];
-							sum += delta * wgt;
-						}
+						ActivateBackward(meActFn, &outBuf[getOutIdx(0, y, depth)], &delInBuf[getDInIdx(0, y, depth)],
+							&delBuf[getDInIdx(0, y, depth)], OUTPUT_LEN * MM_BLOCK);
 					}
-					delOutBuf[getDOutIdx(inX, inY, depth)] = sum;
 				}
 			}
+			else
+			{
+				computeDelta(outBuf, delInBuf, delBuf);
+			}
+		}
+
+		DispatchSimd<DwConvGradKernel>(KERNEL_LEN, OUTPUT_LEN, OUTPUT_DEPTH, numImages, mIn[threadIdx], getInShape(), INPUT_SIZE,
+			delBase, getDInShape(), DELTA_IN_SIZE, wgtDiffBuf, biasDiffBuf);
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			DispatchSimd<DwConvDeltaOutKernel>(KERNEL_LEN, NUM_PAD, INPUT_LEN, OUTPUT_LEN, OUTPUT_PAD_DEPTH, delBase + DELTA_IN_SIZE * n, getDInShape(),
+				wgtBuf, mDeltaOut[threadIdx] + DELTA_OUT_SIZE * n, getDOutShape());
 		}
 	}
-}
+}
\ No newline at end of file
@@ -6,10 +6,51 @@ namespace cnn
 	class DwConv : public ILayer
 	{
 	public:
-		DwConv(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, EActFn eActFn);
+		DwConv(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, EActFn eActFn,
+			ELayout eLayout = ELayout::HWC);
 		~DwConv();
 
-		void Forward(size_t threadIdx) override;
-		void BackProp(size_t threadIdx) override;
+		void Forward(size_t threadIdx, size_t numImages) override;
+		void BackProp(size_t threadIdx, size_t numImages) override;
+		ELayer GetType() const override { return ELayer::DWCONV; }
+		void InitBuffers(size_t numImages) override;
+		bool Quantize(data_t inMin, data_t inMax) override;
+	protected:
+		void refreshCache(size_t copy) override;
+		void setThreadCaches(bool b) override;
+		// BLOCKED output : the delta gathered in blocks
+		size_t getScratchBytes() const override
+		{
+			return (mBlockDelta.empty() ? 0 : sizeof(data_t) * DELTA_IN_SIZE * mMiniBatch) + ILayer::getScratchBytes();
+		}
+		size_t getNumMacs() const override
+		{
+			return OUTPUT_LEN * OUTPUT_LEN * KERNEL_SIZE * OUTPUT_DEPTH;
+		}
+	private:
+		// Both layouts, vectors of channels of the backend of GetSimd, see DwConvForwardKernel
+		void forwardAvx(size_t threadIdx, size_t numImages);
+		void backPropAvx(size_t threadIdx, size_t numImages);
+		// Int32 sums of a block of channels per pixel, too few taps per output for a GEMM
+		void forwardInt8(size_t threadIdx, size_t numImages);
+		void freeBlockDelta();
+		// BLOCKED layout : copies of the padded weights and biases, see setThreadCaches
+		void allocBlockWgt();
+		void freeBlockWgt();
+		// KERNEL_SIZE x OUTPUT_PAD_DEPTH weights and OUTPUT_PAD_DEPTH biases for the vector paths
+		const data_t* getAvxWgt(size_t threadIdx) const
+		{
+			return mBlockWgt.empty() ? getWgt(threadIdx) : mBlockWgt[getCacheCopy(threadIdx)];
+		}
+		const data_t* getAvxBias(size_t threadIdx) const
+		{
+			return mBlockBias.empty() ? getBias(threadIdx) : mBlockBias[getCacheCopy(threadIdx)];
+		}
+	private:
+		// BLOCKED layout : weights and biases zero padded to OUTPUT_PAD_DEPTH, KERNEL_SIZE x OUTPUT_PAD_DEPTH
+		std::vector<data_t*> mBlockWgt;
+		std::vector<data_t*> mBlockBias;
+		// BLOCKED layout : deltas in the output layout for the vector back propagation, DELTA_IN_SIZE per image
+		std::vector<data_t*> mBlockDelta;
 	};
 }
\ No newline at end of file
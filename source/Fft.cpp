@@ -0,0 +1,128 @@
+#include "Fft.h"
+#include "SimdKernels.h"
+#include <cmath>
+#include <algorithm>
+
+namespace cnn
+{
+	Fft::Fft(size_t len)
+		: LEN(len)
+		, mBitRev(len)
+		, mCos(len / 2)
+		, mSin(len / 2)
+	{
+		Assert(LEN > 0 && (LEN & (LEN - 1)) == 0);
+		size_t numBits = 0;
+		while ((static_cast<size_t>(1) << numBits) < LEN) { ++numBits; }
+		for (size_t i = 0; i < LEN; ++i)
+		{
+			size_t rev = 0;
+			for (size_t b = 0; b < numBits; ++b)
+			{
+				rev |= ((i >> b) & 1) << (numBits - 1 - b);
+			}
+			mBitRev[i] = rev;
+		}
+		const double PI = 3.14159265358979323846;
+		for (size_t k = 0; k < LEN / 2; ++k)
+		{
+			mCos[k] = static_cast<data_t>(cos(2.0 * PI * k / LEN));
+			mSin[k] = static_cast<data_t>(-sin(2.0 * PI * k / LEN));
+		}
+	}
+
+	Fft::~Fft()
+	{
+
+	}
+
+	size_t Fft::GetLen(size_t minLen)
+	{
+		size_t len = 1;
+		while (len < minLen) { len <<= 1; }
+		return len;
+	}
+
+	void Fft::Forward2d(data_t* re, data_t* im) const
+	{
+		transformRows(re, im, false);
+		transpose(re);
+		transpose(im);
+		transformRows(re, im, false);
+	}
+
+	void Fft::Inverse2d(data_t* re, data_t* im) const
+	{
+		transformRows(re, im, true);
+		transpose(re);
+		transpose(im);
+		transformRows(re, im, true);
+		const data_t SCALE = 1.f / (LEN * LEN);
+		for (size_t i = 0; i < LEN * LEN; ++i)
+		{
+			re[i] *= SCALE;
+			im[i] *= SCALE;
+		}
+	}
+
+	void Fft::transformRows(data_t* re, data_t* im, bool bInverse) const
+	{
+		const data_t SIGN = bInverse ? -1.f : 1.f;
+		for (size_t row = 0; row < LEN; ++row)
+		{
+			data_t* r = &re[row * LEN];
+			data_t* m = &im[row * LEN];
+			for (size_t i = 0; i < LEN; ++i)
+			{
+				const size_t j = mBitRev[i];
+				if (i < j)
+				{
+					std::swap(r[i], r[j]);
+					std::swap(m[i], m[j]);
+				}
+			}
+			// Iterative Cooley-Tukey butterflies
+			for (size_t half = 1; half < LEN; half <<= 1)
+			{
+				const size_t step = LEN / (2 * half);
+				for (size_t base = 0; base < LEN; base += 2 * half)
+				{
+					for (size_t k = 0; k < half; ++k)
+					{
+						const data_t wRe = mCos[k * step];
+						const data_t wIm = SIGN * mSin[k * step];
+						const size_t a = base + k;
+						const size_t b = a + half;
+						const data_t vRe = r[b] * wRe - m[b] * wIm;
+						const data_t vIm = r[b] * wIm + m[b] * wRe;
+						r[b] = r[a] - vRe;
+						m[b] = m[a] - vIm;
+						r[a] += vRe;
+						m[a] += vIm;
+					}
+				}
+			}
+		}
+	}
+
+	void Fft::transpose(data_t* plane) const
+	{
+		for (size_t y = 0; y < LEN; ++y)
+		{
+			for (size_t x = y + 1; x < LEN; ++x)
+			{
+				std::swap(plane[y * LEN + x], plane[x * LEN + y]);
+			}
+		}
+	}
+
+	void Fft::MulAcc(size_t n, const data_t* xRe, const data_t* xIm, const data_t* yRe, const data_t* yIm, data_t* accRe, data_t* accIm)
+	{
+		DispatchSimd<MulAccKernel>(n, xRe, xIm, yRe, yIm, accRe, accIm);
+	}
+
+	void Fft::MulConjAcc(size_t n, const data_t* xRe, const data_t* xIm, const data_t* yRe, const data_t* yIm, data_t* accRe, data_t* accIm)
+	{
+		DispatchSimd<MulConjAccKernel>(n, xRe, xIm, yRe, yIm, accRe, accIm);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Radix-2 complex FFT on LEN x LEN planes (LEN is a power of 2)
+	// Complex planes are stored split : real and imaginary parts in separate arrays.
+	// Forward2d leaves the spectrum transposed, which saves a transpose on both ways.
+	// Inverse2d expects that transposed spectrum and includes the 1 / LEN^2 scale,
+	// so element-wise products between spectra are unaffected.
+	class Fft
+	{
+	public:
+		Fft(size_t len);
+		~Fft();
+		Fft(const Fft&) = delete;
+		Fft& operator=(const Fft&) = delete;
+
+		void Forward2d(data_t* re, data_t* im) const;
+		void Inverse2d(data_t* re, data_t* im) const;
+
+		// acc += x * y over n elements
+		static void MulAcc(size_t n, const data_t* xRe, const data_t* xIm, const data_t* yRe, const data_t* yIm, data_t* accRe, data_t* accIm);
+		// acc += x * conj(y) over n elements
+		static void MulConjAcc(size_t n, const data_t* xRe, const data_t* xIm, const data_t* yRe, const data_t* yIm, data_t* accRe, data_t* accIm);
+
+		static size_t GetLen(size_t minLen);	// Smallest power of 2 >= minLen
+	public:
+		const size_t LEN;
+	private:
+		// FFT of every row of the plane
+		void transformRows(data_t* re, data_t* im, bool bInverse) const;
+		void transpose(data_t* plane) const;
+	private:
+		std::vector<size_t> mBitRev;
+		std::vector<data_t> mCos;	// Twiddle factors exp(-2 pi i k / LEN), k < LEN / 2
+		std::vector<data_t> mSin;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#include "Gemm.h"
+#include "SimdKernels.h"
+#include <algorithm>
+
+namespace cnn
+{
+	namespace
+	{
+		// Packing buffers owned by the calling thread
+		struct PackBuffer
+		{
+			PackBuffer()
+				: A(Alloc<data_t>(GEMM_MC* GEMM_KC))
+				, B(Alloc<data_t>(GEMM_KC* GEMM_NC))
+			{
+			}
+			~PackBuffer()
+			{
+				Free(A);
+				Free(B);
+			}
+			data_t* A;
+			data_t* B;
+		};
+		thread_local PackBuffer tPack;
+	}
+
+	void Sgemm(bool transA, bool transB, size_t M, size_t N, size_t K,
+		const data_t* A, size_t lda, const data_t* B, size_t ldb,
+		data_t beta, data_t* C, size_t ldc)
+	{
+		if (M == 0 || N == 0)
+		{
+			return;
+		}
+		if (K == 0)
+		{
+			for (size_t i = 0; i < M; ++i)
+			{
+				for (size_t j = 0; j < N; ++j)
+				{
+					C[i * ldc + j] = beta != 0.f ? beta * C[i * ldc + j] : 0.f;
+				}
+			}
+			return;
+		}
+
+		DispatchSimd<SgemmKernel>(tPack.A, tPack.B, transA, transB, M, N, K, A, lda, B, ldb, beta, C, ldc);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,14 @@
+#pragma once
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Single precision general matrix multiply on row-major matrices
+	//	C = op(A) * op(B) + beta * C
+	//	op(A) : M x K, op(B) : K x N, C : M x N
+	// If transA(transB) is true, A(B) is stored as K x M(N x K).
+	// beta == 0 never reads C, so C may be uninitialized.
+	void Sgemm(bool transA, bool transB, size_t M, size_t N, size_t K,
+		const data_t* A, size_t lda, const data_t* B, size_t ldb,
+		data_t beta, data_t* C, size_t ldc);
+}
\ No newline at end of file
@@ -1,190 +1,362 @@
 #include "ILayer.h"
+#include "Activation.h"
+#include "SimdKernels.h"
+#include "Quant.h"
+#include "Precision.h"
 #include <iostream>
 
 namespace cnn
 {
-	ILayer::ILayer(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn)
+	void InitGlorot(data_t* wgt, size_t size, size_t fan)
+	{
+		const data_t INIT_MAX = sqrt(6.f / fan);
+		srand(0);
+		// In double, RAND_MAX + 1 overflows int where RAND_MAX is 2^31 - 1
+		const double RAND_RANGE = RAND_MAX + 1.0;
+		for (size_t i = 0; i < size; ++i)
+		{
+			data_t val = (data_t)(rand() / RAND_RANGE * 2 - 1) * INIT_MAX;
+			wgt[i] = val;
+		}
+	}
+
+	ILayer::ILayer(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn,
+		ELayout eInLayout, ELayout eOutLayout)
 		: mIn()
 		, mOut()
 		, mWgt(nullptr)
 		, mBias(nullptr)
-		, mWgtGradSum(nullptr)
-		, mBiasGradSum(nullptr)
-		, mWgtVeloVec(nullptr)
-		, mBiasVeloVec(nullptr)
+		, mThreadWgt()
+		, mThreadBias()
 		, mWgtDiff()
 		, mBiasDiff()
 		, mDelta()
 		, mDeltaIn()
 		, mDeltaOut()
 		, meActFn(eActFn)
+		, mbUseAvx(false)
+		, mbInference(false)
+		, mbPlanned(false)
+		, meInLayout(eInLayout)
+		, meOutLayout(eOutLayout)
 		, NUM_PAD(inLen == outLen ? (kernelLen - 1) / 2 : 0)
 		, INPUT_LEN(inLen)
 		, INPUT_PAD_LEN(INPUT_LEN + 2 * NUM_PAD)
 		, INPUT_DEPTH(inDepth)
-		, INPUT_SIZE(INPUT_PAD_LEN* INPUT_PAD_LEN* INPUT_DEPTH)
+		, INPUT_PAD_DEPTH(GetPadDepth(eInLayout, inDepth))
+		, INPUT_SIZE(INPUT_PAD_LEN* INPUT_PAD_LEN* INPUT_PAD_DEPTH)
 		, OUTPUT_LEN(outLen)
 		, OUTPUT_DEPTH(outDepth)
-		, OUTPUT_SIZE(OUTPUT_LEN* OUTPUT_LEN* OUTPUT_DEPTH)
+		, OUTPUT_PAD_DEPTH(GetPadDepth(eOutLayout, outDepth))
+		, OUTPUT_SIZE(OUTPUT_LEN* OUTPUT_LEN* OUTPUT_PAD_DEPTH)
 		, KERNEL_LEN(kernelLen)
 		, KERNEL_SIZE(KERNEL_LEN* KERNEL_LEN)
-		, DELTA_SIZE(OUTPUT_SIZE)
+		, DELTA_SIZE(OUTPUT_LEN* OUTPUT_LEN* OUTPUT_DEPTH)
 		, DELTA_IN_SIZE(OUTPUT_SIZE)
-		, DELTA_OUT_SIZE(INPUT_LEN* INPUT_LEN* INPUT_DEPTH)
+		, DELTA_OUT_SIZE(INPUT_LEN* INPUT_LEN* INPUT_PAD_DEPTH)
 		, WGT_SIZE(KERNEL_SIZE* INPUT_DEPTH* OUTPUT_DEPTH)
 		, BIAS_SIZE(OUTPUT_DEPTH)
-		, mActivate(nullptr)
 		, mOutPad(0)
-		, mB1T(0.9f)
-		, mB2T(0.99f)
-		, mbUseAvx(false)
+		, mMiniBatch(0)
+		, mQuantWgt()
+		, mQIn()
+		, mQAcc()
+		, mQInSize(0)
+		, mQAccSize(0)
+		, meActPrecision(EPrecision::FP32)
+		, mInHalf()
+		, mbOwnParams(true)
+		, mbThreadCaches(false)
 	{
-		// Alloc buffers
+		// Gradient and activation buffers are allocated by InitBuffers or when a network binds the layer
+		mWgt = Alloc<data_t>(WGT_SIZE);
+		mBias = Alloc<data_t>(BIAS_SIZE);
+
+		// Initialize Weigths
+		InitGlorot(mWgt, WGT_SIZE, KERNEL_SIZE * (INPUT_DEPTH + OUTPUT_DEPTH));
+		// Initialize Bias to 0
+		memset(mBias, 0, sizeof(data_t) * BIAS_SIZE);
+
+		// Softmax is computed by the network on the last layer's outputs
+		Assert(eActFn != EActFn::SOFTMAX);
+	}
+
+	ILayer::~ILayer()
+	{
+		freeBuffers();
+		freeDiffs();
+		if (mbOwnParams)
+		{
+			Free(mWgt);
+			Free(mBias);
+		}
+	}
+
+	void ILayer::InitBuffers(size_t numImages)
+	{
+		freeBuffers();
+		mMiniBatch = numImages;
 		for (size_t i = 0; i < NUM_THREAD; ++i)
 		{
-			mIn.push_back(Alloc<data_t>(INPUT_SIZE));
-			mWgtDiff.push_back(Alloc<data_t>(WGT_SIZE));
-			mBiasDiff.push_back(Alloc<data_t>(BIAS_SIZE));
-			mDelta.push_back(Alloc<data_t>(DELTA_SIZE));
-			mDeltaOut.push_back(Alloc<data_t>(DELTA_OUT_SIZE));
+			if (mbPlanned)
+			{
+				// Bound by the network
+				mIn.push_back(nullptr);
+				if (mbInference == false)
+				{
+					mDelta.push_back(nullptr);
+					mDeltaOut.push_back(nullptr);
+				}
+				if (mbInference == false && meActPrecision != EPrecision::FP32)
+				{
+					mInHalf.push_back(nullptr);
+				}
+				continue;
+			}
+			mIn.push_back(Alloc<data_t>(INPUT_SIZE * numImages));
+			memset(mIn[i], 0, sizeof(data_t) * INPUT_SIZE * numImages);
+			if (mbInference)
+			{
+				continue;
+			}
+			mDelta.push_back(Alloc<data_t>(DELTA_SIZE * numImages));
+			mDeltaOut.push_back(Alloc<data_t>(DELTA_OUT_SIZE * numImages));
 			// Initialize to 0 , assert bit pattern 0x0000 means 0.0
-			memset(mIn[i], 0, sizeof(data_t) * INPUT_SIZE);
-			memset(mDelta[i], 0, sizeof(data_t) * DELTA_SIZE);
-			memset(mDeltaOut[i], 0, sizeof(data_t) * DELTA_OUT_SIZE);
+			memset(mDelta[i], 0, sizeof(data_t) * DELTA_SIZE * numImages);
+			memset(mDeltaOut[i], 0, sizeof(data_t) * DELTA_OUT_SIZE * numImages);
 		}
-		mWgt = Alloc<data_t>(WGT_SIZE);
-		mBias = Alloc<data_t>(BIAS_SIZE);
-		mWgtGradSum = Alloc<data_t>(WGT_SIZE);
-		mBiasGradSum = Alloc<data_t>(BIAS_SIZE);
-		mWgtVeloVec = Alloc<data_t>(WGT_SIZE);
-		mBiasVeloVec = Alloc<data_t>(BIAS_SIZE);
-		memset(mWgtGradSum, 0, sizeof(data_t) * WGT_SIZE);
-		memset(mBiasGradSum, 0, sizeof(data_t) * BIAS_SIZE);
-		memset(mWgtVeloVec, 0, sizeof(data_t) * WGT_SIZE);
-		memset(mBiasVeloVec, 0, sizeof(data_t) * BIAS_SIZE);
+		if (mbInference == false && mWgtDiff.empty())
+		{
+			allocDiffs(nullptr, nullptr);
+		}
+		if (IsQuantized())
+		{
+			allocQuantBuffers();
+		}
+	}
 
-		// Initialize Weigths
-		// Glorot2010
-		//		   sqrt(6)
-		//	m = -------------		-m < Init val < m	
-		//		sqrt(ni + no)
-		const size_t FAN = KERNEL_SIZE * (INPUT_DEPTH + OUTPUT_DEPTH);
-		const data_t INIT_MAX = sqrt(6.f / FAN);
-		srand(0);
-		const int RAND_HALF = (RAND_MAX + 1) / 2;
-		for (size_t i = 0; i < WGT_SIZE; ++i)
+	void ILayer::freeBuffers()
+	{
+		if (mbPlanned == false)
 		{
-			int num = rand();
-			data_t val = (data_t)(num - RAND_HALF) / RAND_HALF * INIT_MAX;
-			mWgt[i] = val;
+			for (size_t i = 0; i < mIn.size(); ++i)
+			{
+				Free(mIn[i]);
+			}
+			for (size_t i = 0; i < mDelta.size(); ++i)
+			{
+				Free(mDelta[i]);
+				Free(mDeltaOut[i]);
+			}
 		}
-		// Initialize Bias to 0
-		memset(mBias, 0, sizeof(data_t) * BIAS_SIZE);
+		mIn.clear();
+		mDelta.clear();
+		mDeltaOut.clear();
+		mInHalf.clear();
+		mMiniBatch = 0;
+		freeQuantBuffers();
+	}
+
+	void ILayer::setActPrecision(EPrecision ePrecision)
+	{
+		freeBuffers();
+		meActPrecision = ePrecision;
+	}
+
+	void ILayer::stashInput(size_t threadIdx, size_t numImages)
+	{
+		NarrowActs(meActPrecision, mIn[threadIdx], mInHalf[threadIdx], INPUT_SIZE * numImages);
+	}
+
+	void ILayer::restoreInput(size_t threadIdx, size_t numImages)
+	{
+		WidenActs(meActPrecision, mInHalf[threadIdx], mIn[threadIdx], INPUT_SIZE * numImages);
+	}
 
-		// Initialize activation function
-		switch (eActFn)
-		{
-		case EActFn::TANH:
-			mActivate = [](data_t val) { return tanh(val); };
-			break;
-		case EActFn::RELU:
-			mActivate = [](data_t val) { return val > 0.f ? val : 0.f; };
-			break;
-		case EActFn::SOFTMAX:
-			Assert(false);
-			break;
-		case EActFn::SIGMOID:
-			mActivate = [](data_t val) { return 1.f / (1.f + pow(2.7f, -val)); };
-			break;
-		case EActFn::IDEN:
-			mActivate = [](data_t val) { return val; };
-			break;
-		default:
-			Assert(false);
-			break;
+	void ILayer::onWeightsUpdated()
+	{
+		for (size_t copy = 0; copy < getNumCacheCopies(); ++copy)
+		{
+			refreshCache(copy);
 		}
 	}
 
-	ILayer::~ILayer()
+	void ILayer::Dequantize()
+	{
+		freeQuantBuffers();
+		mQuantWgt.reset();
+	}
+
+	void ILayer::initQuant(std::unique_ptr<QuantWeights> quantWgt, size_t qInSize, size_t qAccSize)
+	{
+		Assert(mMiniBatch > 0);
+		freeQuantBuffers();
+		mQuantWgt = std::move(quantWgt);
+		mQInSize = qInSize;
+		mQAccSize = qAccSize;
+		allocQuantBuffers();
+	}
+
+	size_t ILayer::getScratchBytes() const
+	{
+		return mQIn.empty() ? 0 : (sizeof(uint8_t) * mQInSize + sizeof(int32_t) * mQAccSize) * mMiniBatch;
+	}
+
+	void ILayer::allocQuantBuffers()
 	{
 		for (size_t i = 0; i < NUM_THREAD; ++i)
 		{
-			Free(mIn[i]);
-			Free(mWgtDiff[i]);
-			Free(mBiasDiff[i]);
-			Free(mDelta[i]);
-			Free(mDeltaOut[i]);
+			mQIn.push_back(Alloc<uint8_t>(mQInSize * mMiniBatch));
+			mQAcc.push_back(Alloc<int32_t>(mQAccSize * mMiniBatch));
+			memset(mQIn[i], 0, mQInSize * mMiniBatch);
 		}
-		Free(mWgt);
-		Free(mBias);
-		Free(mWgtGradSum);
-		Free(mBiasGradSum);
-		Free(mWgtVeloVec);
-		Free(mBiasVeloVec);
 	}
 
+	void ILayer::freeQuantBuffers()
+	{
+		for (size_t i = 0; i < mQIn.size(); ++i)
+		{
+			Free(mQIn[i]);
+			Free(mQAcc[i]);
+		}
+		mQIn.clear();
+		mQAcc.clear();
+	}
 
 	void ILayer::InitBatch()
 	{
 		for (size_t i = 0; i < NUM_THREAD; ++i)
 		{
-			memset(mWgtDiff[i], 0, sizeof(data_t) * WGT_SIZE);
-			memset(mBiasDiff[i], 0, sizeof(data_t) * BIAS_SIZE);
+			clearDiffs(i);
 		}
 	}
 
-	void ILayer::Update(const size_t batchSize, const data_t learningRate)
+	void ILayer::clearDiffs(size_t threadIdx)
 	{
-		data_t* wgtDiffBuf = mWgtDiff[0];
-		data_t* biasDiffBuf = mBiasDiff[0];
-		// Sum diffs
-		for (size_t i = 1; i < NUM_THREAD; ++i)
+		memset(mWgtDiff[threadIdx], 0, sizeof(data_t) * WGT_SIZE);
+		memset(mBiasDiff[threadIdx], 0, sizeof(data_t) * BIAS_SIZE);
+	}
+
+	void ILayer::activateOutput(data_t* outBuf) const
+	{
+		// Row by row, the rows of an image are not contiguous when the next layer pads it
+		if (meOutLayout == ELayout::HWC)
 		{
-			for (size_t j = 0; j < WGT_SIZE; ++j)
+			for (size_t y = 0; y < OUTPUT_LEN; ++y)
 			{
-				wgtDiffBuf[j] += mWgtDiff[i][j];
+				Activate(meActFn, &outBuf[getOutIdx(0, y, 0)], OUTPUT_LEN * OUTPUT_DEPTH);
 			}
+			return;
 		}
-		for (size_t i = 1; i < NUM_THREAD; ++i)
+		// The depth padding of BLOCKED outputs stays 0 only for functions with f(0) = 0
+		const size_t ROW_DEPTH = (meActFn == EActFn::SIGMOID) ? OUTPUT_DEPTH : OUTPUT_PAD_DEPTH;
+		for (size_t b = 0; b < ROW_DEPTH; b += MM_BLOCK)
 		{
-			for (size_t j = 0; j < BIAS_SIZE; ++j)
-				biasDiffBuf[j] += mBiasDiff[i][j];
+			for (size_t y = 0; y < OUTPUT_LEN; ++y)
+			{
+				const size_t n = std::min((size_t)MM_BLOCK, ROW_DEPTH - b);
+				data_t* row = &outBuf[getOutIdx(0, y, b)];
+				if (n == MM_BLOCK)
+				{
+					Activate(meActFn, row, OUTPUT_LEN * MM_BLOCK);
+					continue;
+				}
+				for (size_t x = 0; x < OUTPUT_LEN; ++x)
+				{
+					Activate(meActFn, &row[x * MM_BLOCK], n);
+				}
+			}
 		}
-		// Update parameters
-		// Adaptive Moment
-		const data_t EPS = 0.000001f;
-		const data_t INV = 1.f / batchSize;
-		const data_t B1 = 0.9f;
-		const data_t B2 = 0.999f;
-		mB1T = mB1T * B1;
-		mB2T = mB2T * B2;
+	}
 
-		data_t* mt = nullptr;
-		data_t* vt = nullptr;
-		data_t alpha = (0.001f * static_cast<data_t>(sqrt(batchSize)) * learningRate);
+	void ILayer::computeDelta(const data_t* outBuf, const data_t* delInBuf, data_t* delBuf) const
+	{
+		if (meOutLayout == ELayout::HWC)
+		{
+			for (size_t y = 0; y < OUTPUT_LEN; ++y)
+			{
+				ActivateBackward(meActFn, &outBuf[getOutIdx(0, y, 0)], &delInBuf[getDInIdx(0, y, 0)],
+					&delBuf[getDeltaIdx(0, y, 0)], OUTPUT_LEN * OUTPUT_DEPTH);
+			}
+			return;
+		}
+		// BLOCKED : compute a row of every channel block in place, then scatter it to the HWC delta
+		alignas(MM_ALIGNMENT) data_t row[MM_BLOCK * 64];
+		for (size_t b = 0; b < OUTPUT_PAD_DEPTH; b += MM_BLOCK)
+		{
+			const size_t n = std::min((size_t)MM_BLOCK, OUTPUT_DEPTH - b);
+			for (size_t y = 0; y < OUTPUT_LEN; ++y)
+			{
+				for (size_t x0 = 0; x0 < OUTPUT_LEN; x0 += 64)
+				{
+					const size_t NUM_X = std::min((size_t)64, OUTPUT_LEN - x0);
+					ActivateBackward(meActFn, &outBuf[getOutIdx(x0, y, b)], &delInBuf[getDInIdx(x0, y, b)],
+						row, NUM_X * MM_BLOCK);
+					for (size_t x = 0; x < NUM_X; ++x)
+					{
+						memcpy(&delBuf[getDeltaIdx(x0 + x, y, b)], &row[x * MM_BLOCK], sizeof(data_t) * n);
+					}
+				}
+			}
+		}
+	}
+
+	void ILayer::bindParams(data_t* wgt, data_t* bias, data_t* wgtDiff, data_t* biasDiff, bool bCopy)
+	{
+		if (bCopy)
+		{
+			memcpy(wgt, mWgt, sizeof(data_t) * WGT_SIZE);
+			memcpy(bias, mBias, sizeof(data_t) * BIAS_SIZE);
+		}
+		// Copies of the old parameters
+		mThreadWgt.clear();
+		mThreadBias.clear();
+		// The gradients are cleared by every batch, they are not carried over
+		freeDiffs();
+		freeBuffers();
+		mbPlanned = true;
+		if (mbOwnParams)
+		{
+			Free(mWgt);
+			Free(mBias);
+		}
+		mWgt = wgt;
+		mBias = bias;
+		mbOwnParams = false;
+		mbInference = wgtDiff == nullptr;
+		if (mbInference == false)
+		{
+			allocDiffs(wgtDiff, biasDiff);
+		}
+	}
 
-		mt = mWgtGradSum;
-		vt = mWgtVeloVec;
-		for (size_t i = 0; i < WGT_SIZE; ++i)
+	void ILayer::allocDiffs(data_t* wgtDiff, data_t* biasDiff)
+	{
+		// Padded so optimizers can step them with whole vectors
+		for (size_t i = 0; i < NUM_THREAD; ++i)
 		{
-			data_t dw = wgtDiffBuf[i];
-			dw = dw * INV;
-			mt[i] = mt[i] * B1 + (1 - B1) * dw;
-			vt[i] = vt[i] * B2 + (1 - B2) * dw * dw;
-			data_t sw = (alpha * (mt[i] / (1 - mB1T)) / sqrt(vt[i] / (1 - mB2T) + EPS));
-			mWgt[i] -= sw;
+			mWgtDiff.push_back(i == 0 && wgtDiff != nullptr ? wgtDiff : Alloc<data_t>(GetBlockPadSize(WGT_SIZE)));
+			mBiasDiff.push_back(i == 0 && biasDiff != nullptr ? biasDiff : Alloc<data_t>(GetBlockPadSize(BIAS_SIZE)));
+			memset(mWgtDiff[i], 0, sizeof(data_t) * GetBlockPadSize(WGT_SIZE));
+			memset(mBiasDiff[i], 0, sizeof(data_t) * GetBlockPadSize(BIAS_SIZE));
 		}
+	}
 
-		mt = mBiasGradSum;
-		vt = mBiasVeloVec;
-		for (size_t i = 0; i < BIAS_SIZE; ++i)
+	void ILayer::freeDiffs()
+	{
+		// Copy 0 belongs to the network's arena once bound
+		for (size_t i = mbOwnParams ? 0 : 1; i < mWgtDiff.size(); ++i)
 		{
-			data_t dw = biasDiffBuf[i];
-			dw = dw * INV;
-			mt[i] = mt[i] * B1 + (1 - B1) * dw;
-			vt[i] = vt[i] * B2 + (1 - B2) * dw * dw;
-			data_t sw = (alpha * (mt[i] / (1 - mB1T)) / sqrt(vt[i] / (1 - mB2T) + EPS));
-			mBias[i] -= sw;
+			Free(mWgtDiff[i]);
+			Free(mBiasDiff[i]);
 		}
+		mWgtDiff.clear();
+		mBiasDiff.clear();
+	}
+
+	void ILayer::reduceDiffs(const std::vector<data_t*>& diffs, size_t begin, size_t end)
+	{
+		Assert(begin % MM_BLOCK == 0);
+		DispatchSimd<ReduceKernel>(diffs, begin, end);
 	}
 }
\ No newline at end of file
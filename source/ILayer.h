@@ -1,15 +1,40 @@
 #pragma once
-#include <functional>
 #include <vector>
+#include <memory>
 #include <thread>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include "Cpu.h"
 
+#ifdef _MSC_VER
 #include <intrin.h>
+#else
+#include <immintrin.h>
+#endif
 
+#ifdef _MSC_VER
 #ifdef _DEBUG
 #define Assert(E) if(!(E)){ __debugbreak(); }
 #else
 #define Assert(E) __assume(E)
 #endif
+#else
+#ifndef NDEBUG
+#define Assert(E) if(!(E)){ __builtin_trap(); }
+#else
+#define Assert(E) if(!(E)){ __builtin_unreachable(); }
+#endif
+#endif
+
+// Functions using an instruction set above the build's, called only when the host has it
+// GCC and Clang compile intrinsics only in functions targeting their instruction set, MSVC in any function.
+#ifdef _MSC_VER
+#define TARGET(ISA)
+#else
+#define TARGET(ISA) __attribute__((target(ISA)))
+#endif
 
 inline float Max(float x, float y)
 {
@@ -26,27 +51,37 @@ inline float Min(float x, float y)
 #ifdef AVX
 #define MM_ALIGNMENT 32
 #define MM_BLOCK 8
+// The MM_ operations below are AVX2 : for the code built for it(SimdAvx2.cpp) or marked TARGET("avx2")
 // Types
 #define MM_TYPE __m256
 #define MM_TYPE_I __m256i
 // Load/Store
 #define MM_LOAD(X) _mm256_load_ps((X))
 #define MM_STORE(X,Y) _mm256_store_ps((X),(Y))
+#define MM_LOADU(X) _mm256_loadu_ps((X))
+#define MM_STOREU(X,Y) _mm256_storeu_ps((X),(Y))
 
 #define MM_STORE_I(X,Y) _mm256_store_si256((X),(Y))
 // Arithmetic operations
 #define MM_ADD(X,Y) _mm256_add_ps((X),(Y))
+#define MM_SUB(X,Y) _mm256_sub_ps((X),(Y))
 #define MM_MUL(X,Y) _mm256_mul_ps((X),(Y))
+#define MM_DIV(X,Y) _mm256_div_ps((X),(Y))
+#define MM_SQRT(X) _mm256_sqrt_ps((X))
+#define MM_FMADD(X,Y,Z) _mm256_fmadd_ps((X),(Y),(Z))	// X * Y + Z
 
 // Bit operations
 #define MM_AND(X,Y) _mm256_and_ps((X),(Y))
 #define MM_XOR(X,Y) _mm256_xor_ps((X),(Y))
 
-#define MM_AND_I(X,Y) _mm256_and_epi32((X),(Y))
-#define MM_XOR_I(X,Y) _mm256_xor_epi32((X),(Y))
+#define MM_AND_I(X,Y) _mm256_and_si256((X),(Y))
+#define MM_XOR_I(X,Y) _mm256_xor_si256((X),(Y))
 // Compare
 #define MM_CMPGT(X,Y) _mm256_cmp_ps((X),(Y),_CMP_GT_OQ)
 #define MM_CMPLT(X,Y) _mm256_cmp_ps((X),(Y),_CMP_LT_OQ)
+#define MM_MAX(X,Y) _mm256_max_ps((X),(Y))
+#define MM_MIN(X,Y) _mm256_min_ps((X),(Y))
+#define MM_ROUND(X) _mm256_round_ps((X),_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC)
 
 // Set
 #define MM_SETZERO() _mm256_setzero_ps()
@@ -55,7 +90,7 @@ inline float Min(float x, float y)
 #define MM_SETZERO_I() _mm256_setzero_si256()
 #define MM_SET1_I(X) _mm256_set1_epi32(X)
 // Horizontal sum
-inline float MMHorizSum(__m256 V)
+TARGET("avx2") inline float MMHorizSum(__m256 V)
 {
 	V = _mm256_hadd_ps(V, V);
 	V = _mm256_hadd_ps(V, V);
@@ -64,19 +99,53 @@ inline float MMHorizSum(__m256 V)
 	return x + y;
 }
 #define MM_HORIZ_SUM(X) MMHorizSum(X)
+// Integer operations
+#define MM_ADD_I(X,Y) _mm256_add_epi32((X),(Y))
+#define MM_SLLI_I(X,N) _mm256_slli_epi32((X),(N))
 // Casting
 #define MM_CAST_F2I(X) _mm256_castps_si256(X)
+#define MM_CAST_I2F(X) _mm256_castsi256_ps(X)
+#define MM_CVT_F2I(X) _mm256_cvtps_epi32(X)
+// Remainder channels : the first N(<= MM_BLOCK) lanes, masked-off lanes load as 0 and are not stored
+// A full vector takes the plain unaligned load/store.
+TARGET("avx2") inline __m256i MMTailMask(size_t n)
+{
+	return _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(n)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+TARGET("avx2") inline __m256 MMLoadN(const float* p, size_t n)
+{
+	return n == MM_BLOCK ? _mm256_loadu_ps(p) : _mm256_maskload_ps(p, MMTailMask(n));
+}
+TARGET("avx2") inline void MMStoreN(float* p, __m256 v, size_t n)
+{
+	if (n == MM_BLOCK) { _mm256_storeu_ps(p, v); }
+	else { _mm256_maskstore_ps(p, MMTailMask(n), v); }
+}
+TARGET("avx2") inline void MMStoreNI(unsigned int* p, __m256i v, size_t n)
+{
+	if (n == MM_BLOCK) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v); }
+	else { _mm256_maskstore_epi32(reinterpret_cast<int*>(p), MMTailMask(n), v); }
+}
+#define MM_LOADN(X,N) MMLoadN((X),(N))
+#define MM_STOREN(X,Y,N) MMStoreN((X),(Y),(N))
+#define MM_STOREN_I(X,Y,N) MMStoreNI((X),(Y),(N))
 
 #endif
 
 
+#define CACHE_LINE_SIZE 64
+
+// Buffers start and end on cache lines, so per-thread buffers never share one
 template <typename T>
 inline T* Alloc(size_t size)
 {
+	const size_t BYTES = (sizeof(T) * size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
 #ifndef AVX
-	return static_cast<T*>(malloc(sizeof(T) * size));
+	return static_cast<T*>(malloc(BYTES));
+#elif defined(_MSC_VER)
+	return static_cast<T*>(_aligned_malloc(BYTES, CACHE_LINE_SIZE));
 #else
-	return static_cast<T*>(_aligned_malloc(sizeof(T) * size, MM_ALIGNMENT));
+	return static_cast<T*>(_mm_malloc(BYTES, CACHE_LINE_SIZE));
 #endif
 }
 
@@ -84,8 +153,10 @@ inline void Free(void* ptr)
 {
 #ifndef AVX
 	free(ptr);
-#else
+#elif defined(_MSC_VER)
 	_aligned_free(ptr);
+#else
+	_mm_free(ptr);
 #endif
 }
 
@@ -107,40 +178,182 @@ namespace cnn
 
 	enum class ENet { END = 0 };
 
+	// Layer classes, recorded in model files
+	enum class ELayer
+	{
+		CONV,
+		PWCONV,
+		DWCONV,
+		POOL,
+		LINEAR,
+		REORDER,
+	};
+
+	// Memory layout of activation tensors
+	enum class ELayout
+	{
+		HWC,		// [y][x][d]
+		BLOCKED,	// nChw8c : [d / MM_BLOCK][y][x][d % MM_BLOCK], depth padded to MM_BLOCK
+	};
+
+	// Storage of the activations a layer keeps from Forward for BackProp, computation is always fp32
+	enum class EPrecision
+	{
+		FP32,
+		BF16,	// fp32 with the low 16 mantissa bits rounded off, same range
+		FP16,	// IEEE half, 11 bit significand, largest finite value 65504
+	};
+
+	// size rounded up to a multiple of MM_BLOCK
+	constexpr size_t GetBlockPadSize(size_t size)
+	{
+		return (size + MM_BLOCK - 1) / MM_BLOCK * MM_BLOCK;
+	}
+
+	inline size_t GetPadDepth(ELayout eLayout, size_t depth)
+	{
+		return eLayout == ELayout::BLOCKED ? GetBlockPadSize(depth) : depth;
+	}
+
+	// Index of (x, y, d) in a len x len x depth tensor
+	inline size_t GetTensorIdx(ELayout eLayout, size_t len, size_t depth, size_t x, size_t y, size_t d)
+	{
+		if (eLayout == ELayout::HWC)
+		{
+			return (len * y + x) * depth + d;
+		}
+		return ((d / MM_BLOCK * len + y) * len + x) * MM_BLOCK + d % MM_BLOCK;
+	}
+
+	// GetTensorIdx as strides, for the layer kernels of SimdKernels.h
+	// Channels are contiguous in runs of Run : the whole depth of a pixel in HWC, MM_BLOCK in BLOCKED.
+	struct TensorShape
+	{
+		size_t Len;
+		size_t PixelStep;	// Distance between horizontally adjacent pixels of a run
+		size_t Run;
+		size_t RunStride;	// Distance between the runs of a pixel
+		inline size_t Idx(size_t x, size_t y, size_t d) const
+		{
+			return d / Run * RunStride + d % Run + (Len * y + x) * PixelStep;
+		}
+	};
+
+	inline TensorShape GetTensorShape(ELayout eLayout, size_t len, size_t depth)
+	{
+		if (eLayout == ELayout::HWC)
+		{
+			return TensorShape{ len, depth, depth, 0 };
+		}
+		return TensorShape{ len, MM_BLOCK, MM_BLOCK, len * len * MM_BLOCK };
+	}
+
+	// Glorot2010
+	//		   sqrt(6)
+	//	m = -------------		-m < Init val < m
+	//		sqrt(ni + no)
+	// fan = kernel size * (ni + no), the sequence restarts at every call
+	void InitGlorot(data_t* wgt, size_t size, size_t fan);
+
 	class Network;
+	class QuantWeights;
 
 	class ILayer
 	{
 	public:
 		friend Network& operator>>(Network& net, ENet e);
+		friend class Network;
 	public:
-		ILayer(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn);
-		~ILayer();
+		ILayer(size_t kernelLen, size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn,
+			ELayout eInLayout = ELayout::HWC, ELayout eOutLayout = ELayout::HWC);
+		virtual ~ILayer();
 		ILayer(const ILayer&) = delete;
 		ILayer& operator=(const ILayer&) = delete;
 
-		virtual void Forward(size_t threadIdx) = 0;
-		virtual void BackProp(size_t threadIdx) = 0;
+		// Process numImages(<= mini-batch size) images stored back to back in the thread's buffers
+		virtual void Forward(size_t threadIdx, size_t numImages) = 0;
+		virtual void BackProp(size_t threadIdx, size_t numImages) = 0;
+		virtual ELayer GetType() const = 0;
 
-		void InitBatch();
+		// (Re)allocate per-thread activation buffers for mini-batches of up to numImages images
+		// Called by the network when it is wired, mOut and mDeltaIn are set by the network afterwards
+		virtual void InitBuffers(size_t numImages);
 
-		void Update(const size_t batchSize, const data_t learningRate);
+		// Set every thread's weight/bias diffs to 0
+		void InitBatch();
 
-		void UseAvx(bool b)
+		// Any depth uses the vector kernels, remainder channels are loaded and stored masked
+		// The layer kernels run on the backend of GetSimd, false takes the scalar reference loops.
+		virtual void UseAvx(bool b)
 		{
-			mbUseAvx = b && (OUTPUT_DEPTH % MM_BLOCK == 0);
+			mbUseAvx = b;
 		}
+
+		// INT8 inference : quantize the weights for inputs calibrated to [inMin, inMax]
+		// Forward runs in int8 until Dequantize, layers without an int8 path return false and stay in fp32.
+		virtual bool Quantize(data_t /*inMin*/, data_t /*inMax*/) { return false; }
+		void Dequantize();
+		bool IsQuantized() const { return mQuantWgt != nullptr; }
 	protected:
+		// Called after the parameters changed, refreshes every copy of the caches derived from mWgt
+		void onWeightsUpdated();
+		// Layers refresh their copy copy of the caches derived from mWgt here
+		virtual void refreshCache(size_t /*copy*/) {}
+		// HOGWILD : every thread buffer reads its own copy of the derived caches and refreshes it itself,
+		// other threads step the shared parameters meanwhile. Otherwise the threads share copy 0.
+		// Layers with caches reallocate them and call the base class.
+		virtual void setThreadCaches(bool b) { mbThreadCaches = b; }
+		size_t getNumCacheCopies() const { return mbThreadCaches ? NUM_THREAD : 1; }
+		size_t getCacheCopy(size_t threadIdx) const { return mbThreadCaches ? threadIdx : 0; }
+		// Activations BackProp reads, the network keeps the others only as long as other passes need them
+		// A layer reads its output for the activation's derivative.
+		virtual bool backPropReadsInput() const { return true; }
+		virtual bool backPropReadsOutput() const { return true; }
+		// Bytes per thread of the activation buffers the layer allocates itself, outside the network's arena
+		// Layers with such buffers add theirs to the base class's quantized inputs and sums.
+		virtual size_t getScratchBytes() const;
+		// Multiply-adds per image, used to balance pipeline stages
+		virtual size_t getNumMacs() const
+		{
+			return OUTPUT_LEN * OUTPUT_LEN * WGT_SIZE;
+		}
+
+		// Apply the activation function to one image's outputs in outBuf, the padding border is left untouched
+		void activateOutput(data_t* outBuf) const;
+		// delBuf(HWC) = delInBuf * f'(outBuf) for one image
+		void computeDelta(const data_t* outBuf, const data_t* delInBuf, data_t* delBuf) const;
+
+		// Take the quantized weights and allocate the per-thread int8 buffers, qInSize bytes and qAccSize sums per image
+		void initQuant(std::unique_ptr<QuantWeights> quantWgt, size_t qInSize, size_t qAccSize);
+
+		// Parameters read by the passes of thread buffer threadIdx : the copy on its NUMA node, see Network::SetTopology
+		inline const data_t* getWgt(size_t threadIdx) const
+		{
+			return mThreadWgt.empty() ? mWgt : mThreadWgt[threadIdx];
+		}
+		inline const data_t* getBias(size_t threadIdx) const
+		{
+			return mThreadBias.empty() ? mBias : mThreadBias[threadIdx];
+		}
+
+		// Size of one image in mOut, including the next layer's padding
+		inline size_t getOutPadSize() const
+		{
+			return (OUTPUT_LEN + 2 * mOutPad) * (OUTPUT_LEN + 2 * mOutPad) * OUTPUT_PAD_DEPTH;
+		}
+
+		// mIn and mDeltaOut are in meInLayout, mOut and mDeltaIn in meOutLayout
+		// mDelta is internal to the layer and always HWC
 		inline size_t getInIdx(size_t x, size_t y, size_t d) const
 		{
-			size_t idx = (INPUT_PAD_LEN * y + x) * INPUT_DEPTH + d;
+			size_t idx = GetTensorIdx(meInLayout, INPUT_PAD_LEN, INPUT_PAD_DEPTH, x, y, d);
 			Assert(idx < INPUT_SIZE);
 			return idx;
 		}
 		inline size_t getOutIdx(size_t x, size_t y, size_t d) const
 		{
-			size_t idx = ((OUTPUT_LEN + 2 * mOutPad) * (y + mOutPad) + (mOutPad + x)) * OUTPUT_DEPTH + d;
-			Assert(idx < (OUTPUT_LEN + 2 * mOutPad)* (OUTPUT_LEN + 2 * mOutPad)* OUTPUT_DEPTH);
+			size_t idx = GetTensorIdx(meOutLayout, OUTPUT_LEN + 2 * mOutPad, OUTPUT_PAD_DEPTH, mOutPad + x, mOutPad + y, d);
+			Assert(idx < getOutPadSize());
 			return idx;
 		}
 		inline size_t getWgtIdx(size_t x, size_t y, size_t inD, size_t outD) const
@@ -162,45 +375,68 @@ namespace cnn
 		}
 		inline size_t getDInIdx(size_t x, size_t y, size_t d) const
 		{
-			size_t idx = (OUTPUT_LEN * y + x) * OUTPUT_DEPTH + d;
+			size_t idx = GetTensorIdx(meOutLayout, OUTPUT_LEN, OUTPUT_PAD_DEPTH, x, y, d);
 			Assert(idx < DELTA_IN_SIZE);
 			return idx;
 		}
 		inline size_t getDOutIdx(size_t x, size_t y, size_t d) const
 		{
-			size_t idx = (INPUT_LEN * y + x) * INPUT_DEPTH + d;
+			size_t idx = GetTensorIdx(meInLayout, INPUT_LEN, INPUT_PAD_DEPTH, x, y, d);
 			Assert(idx < DELTA_OUT_SIZE);
 			return idx;
 		}
+		// The indices above as strides, the output's from getOutIdx(0, 0, 0)
+		inline TensorShape getInShape() const
+		{
+			return GetTensorShape(meInLayout, INPUT_PAD_LEN, INPUT_PAD_DEPTH);
+		}
+		inline TensorShape getOutShape() const
+		{
+			return GetTensorShape(meOutLayout, OUTPUT_LEN + 2 * mOutPad, OUTPUT_PAD_DEPTH);
+		}
+		inline TensorShape getDInShape() const
+		{
+			return GetTensorShape(meOutLayout, OUTPUT_LEN, OUTPUT_PAD_DEPTH);
+		}
+		inline TensorShape getDOutShape() const
+		{
+			return GetTensorShape(meInLayout, INPUT_LEN, INPUT_PAD_DEPTH);
+		}
 	protected:	// vector elements are buffers allocated to threads
 		std::vector<data_t*> mIn;
 		std::vector<data_t*> mOut;
 		data_t* mWgt;
 		data_t* mBias;
-		// Buffers for back propagation
+		// Read-only copies of mWgt/mBias per thread buffer, set by the network, empty when the passes read mWgt/mBias
+		// Caches derived from the weights, e.g. Winograd or blocked weights, stay single copies.
+		std::vector<const data_t*> mThreadWgt;
+		std::vector<const data_t*> mThreadBias;
+		// Buffers for back propagation, the diffs are padded to MM_BLOCK with zeros
+		// None of them exist in a layer bound to an inference network.
 		std::vector<data_t*> mWgtDiff;
 		std::vector<data_t*> mBiasDiff;
 		std::vector<data_t*> mDelta;
 		std::vector<data_t*> mDeltaIn;
 		std::vector<data_t*> mDeltaOut;
-		// Buffers for Adam
-		data_t* mWgtGradSum;
-		data_t* mBiasGradSum;
-		data_t* mWgtVeloVec;
-		data_t* mBiasVeloVec;
 		// Activation func
 		EActFn meActFn;
-		std::function<data_t(data_t)> mActivate;
 		// Flags
 		bool mbUseAvx;
+		bool mbInference;	// Bound to an inference network : Forward only
+		bool mbPlanned;		// Bound to a network : mIn, mDelta and mDeltaOut are placed in its per-thread activation arena
+		// Layouts of the input and output tensors
+		const ELayout meInLayout;
+		const ELayout meOutLayout;
 		// Constants for buffer sizes
 		const size_t NUM_PAD;
 		const size_t INPUT_LEN;
 		const size_t INPUT_PAD_LEN;
 		const size_t INPUT_DEPTH;
+		const size_t INPUT_PAD_DEPTH;	// Depth of the input buffers, padded in BLOCKED layout
 		const size_t INPUT_SIZE;
 		const size_t OUTPUT_LEN;
 		const size_t OUTPUT_DEPTH;
+		const size_t OUTPUT_PAD_DEPTH;
 		const size_t OUTPUT_SIZE;
 		const size_t KERNEL_LEN;
 		const size_t KERNEL_SIZE;
@@ -210,8 +446,40 @@ namespace cnn
 		const size_t WGT_SIZE;
 		const size_t BIAS_SIZE;
 		size_t mOutPad;
-	private:	// Constatns for Adam
-		data_t mB1T;
-		data_t mB2T;
+		size_t mMiniBatch;	// Images per thread buffer, 0 until the network is wired
+		// INT8 inference, see Quantize
+		std::unique_ptr<QuantWeights> mQuantWgt;	// nullptr while the layer runs in fp32
+		std::vector<uint8_t*> mQIn;		// Quantized inputs, mQInSize bytes per image
+		std::vector<int32_t*> mQAcc;	// Int32 sums, mQAccSize per image
+		size_t mQInSize;
+		size_t mQAccSize;
+		// Activations kept for BackProp, see Network::SetPrecision
+		// Below FP32 the network may keep mIn in mInHalf from Forward to BackProp, mInHalf is the start of mIn's memory, the rest is reused in between.
+		EPrecision meActPrecision;
+		std::vector<uint16_t*> mInHalf;
+	private:
+		void freeBuffers();
+		void allocQuantBuffers();
+		void freeQuantBuffers();
+		void clearDiffs(size_t threadIdx);
+		// Frees the activation buffers, InitBuffers allocates them for the new precision
+		void setActPrecision(EPrecision ePrecision);
+		// mInHalf = mIn for the thread's first numImages images, and back
+		void stashInput(size_t threadIdx, size_t numImages);
+		void restoreInput(size_t threadIdx, size_t numImages);
+		// Move the parameters and gradient copy 0 into the network's arena
+		// The layer keeps using mWgt, mBias, mWgtDiff[0] and mBiasDiff[0], the arena owns them afterwards.
+		// wgtDiff == nullptr : inference, the layer keeps no gradients and InitBuffers allocates forward buffers only.
+		// InitBuffers leaves mIn, mDelta and mDeltaOut to the network afterwards.
+		// bCopy == false : wgt and bias already hold the parameters, e.g. in a mapped model file
+		void bindParams(data_t* wgt, data_t* bias, data_t* wgtDiff, data_t* biasDiff, bool bCopy = true);
+		// Per-thread gradients, copy 0 is wgtDiff/biasDiff unless they are nullptr
+		void allocDiffs(data_t* wgtDiff, data_t* biasDiff);
+		void freeDiffs();
+		// diffs[0][begin, end) += diffs[1..][begin, end), begin is a multiple of MM_BLOCK
+		static void reduceDiffs(const std::vector<data_t*>& diffs, size_t begin, size_t end);
+	private:
+		bool mbOwnParams;	// False once bound to an arena
+		bool mbThreadCaches;
 	};
 }
\ No newline at end of file
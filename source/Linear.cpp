@@ -1,7 +1,14 @@
 #include "Linear.h"
+#include "Gemm.h"
+#include "SimdKernels.h"
+#include "Quant.h"
 
 namespace cnn
 {
+	// Below this many images LinearForwardKernel and LinearBackPropKernel stream the weights once per 4 images,
+	// packing them for Sgemm does not pay off
+	constexpr size_t LINEAR_SGEMM_MIN_IMAGES = 32;
+
 	Linear::Linear(size_t inSize, size_t outSize, EActFn eActFn)
 		: ILayer(1, 1, inSize, 1, outSize, eActFn)
 	{
@@ -13,79 +20,201 @@ namespace cnn
 
 	}
 
-	void Linear::Forward(size_t threadIdx)
+	void Linear::Forward(size_t threadIdx, size_t numImages)
 	{
+		Assert(numImages <= mMiniBatch);
+		if (IsQuantized())
+		{
+			forwardInt8(threadIdx, numImages);
+			return;
+		}
+		if (mbUseAvx)
+		{
+			forwardAvx(threadIdx, numImages);
+			return;
+		}
 		data_t* inBuf = mIn[threadIdx];
 		data_t* outBuf = mOut[threadIdx];
-		data_t* wgtBuf = mWgt;
+		const data_t* wgtBuf = getWgt(threadIdx);
+		const data_t* biasBuf = getBias(threadIdx);
+		const size_t OUT_STRIDE = getOutPadSize();
 
-		for (size_t y = 0; y < OUTPUT_SIZE; ++y)
+		// out(numImages x OUTPUT_SIZE) = in(numImages x INPUT_SIZE) * wgt(INPUT_SIZE x OUTPUT_SIZE)
+		// Every weight row is loaded once and used for all images
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			data_t sum = 0.f;
-			for (size_t x = 0; x < INPUT_SIZE; ++x)
+			data_t* out = &outBuf[n * OUT_STRIDE + getOutIdx(0, 0, 0)];
+			for (size_t y = 0; y < OUTPUT_SIZE; ++y)
 			{
-				sum += wgtBuf[getWgtIdx(0, 0, x, y)] * inBuf[x];
+				out[y] = biasBuf[getBiasIdx(y)];
 			}
-			sum += mBias[getBiasIdx(y)];
-			outBuf[getOutIdx(0, 0, y)] = mActivate(sum);
+		}
+		for (size_t x = 0; x < INPUT_SIZE; ++x)
+		{
+			const data_t* wgt = &wgtBuf[getWgtIdx(0, 0, x, 0)];
+			for (size_t n = 0; n < numImages; ++n)
+			{
+				const data_t in = inBuf[n * INPUT_SIZE + x];
+				data_t* out = &outBuf[n * OUT_STRIDE + getOutIdx(0, 0, 0)];
+				for (size_t y = 0; y < OUTPUT_SIZE; ++y)
+				{
+					out[y] += wgt[y] * in;
+				}
+			}
+		}
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			activateOutput(&outBuf[n * OUT_STRIDE]);
 		}
 	}
-	void Linear::BackProp(size_t threadIdx)
+
+	void Linear::BackProp(size_t threadIdx, size_t numImages)
 	{
+		Assert(numImages <= mMiniBatch);
+		if (mbUseAvx)
+		{
+			backPropAvx(threadIdx, numImages);
+			return;
+		}
 		data_t* inBuf = mIn[threadIdx];
 		data_t* outBuf = mOut[threadIdx];
-		data_t* wgtBuf = mWgt;
+		const data_t* wgtBuf = getWgt(threadIdx);
 		data_t* delInBuf = mDeltaIn[threadIdx];
 		data_t* delBuf = mDelta[threadIdx];
 		data_t* delOutBuf = mDeltaOut[threadIdx];
 		data_t* wgtDiffBuf = mWgtDiff[threadIdx];
 		data_t* biasDiffBuf = mBiasDiff[threadIdx];
+		const size_t OUT_STRIDE = getOutPadSize();
+
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			computeDelta(&outBuf[n * OUT_STRIDE], &delInBuf[n * DELTA_IN_SIZE], &delBuf[n * DELTA_SIZE]);
+		}
 
-		for (size_t y = 0; y < OUTPUT_SIZE; ++y)
+		// delOut = delta * wgt^T, wgtDiff += in^T * delta
+		// Every weight row is loaded once and used for all images
+		for (size_t x = 0; x < INPUT_SIZE; ++x)
 		{
-			data_t deltaIn = delInBuf[y];
-			data_t valOut = outBuf[y];
-			data_t deriv = 0.f;
-			switch (meActFn)
+			const data_t* wgt = &wgtBuf[getWgtIdx(0, 0, x, 0)];
+			data_t* wgtDiff = &wgtDiffBuf[getWgtIdx(0, 0, x, 0)];
+			for (size_t n = 0; n < numImages; ++n)
 			{
-			case EActFn::TANH:
-				deriv = 1 - valOut * valOut;
-				break;
-			case EActFn::RELU:
-				deriv = valOut > 0.f ? 1.f : 0.f;
-				break;
-			case EActFn::SOFTMAX:
-				deriv = 1.f;
-				break;
-			case EActFn::SIGMOID:
-				deriv = valOut * (1 - valOut);
-				break;
-			case EActFn::IDEN:
-				deriv = 1.f;
-				break;
-			default:
-				Assert(false);
-				break;
+				const data_t in = inBuf[n * INPUT_SIZE + getInIdx(0, 0, x)];
+				const data_t* delta = &delBuf[n * DELTA_SIZE + getDeltaIdx(0, 0, 0)];
+				data_t sum = 0.f;
+				for (size_t y = 0; y < OUTPUT_SIZE; ++y)
+				{
+					sum += wgt[y] * delta[y];
+					wgtDiff[y] += in * delta[y];
+				}
+				delOutBuf[n * DELTA_OUT_SIZE + getDOutIdx(0, 0, x)] = sum;
 			}
-			delBuf[getDeltaIdx(0, 0, y)] = deltaIn * deriv;
 		}
 
-		memset(delOutBuf, 0, sizeof(data_t) * INPUT_SIZE);
-		for (size_t y = 0; y < OUTPUT_SIZE; ++y)
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			data_t delta = delBuf[getDeltaIdx(0, 0, y)];
-			for (size_t x = 0; x < INPUT_SIZE; ++x)
+			for (size_t y = 0; y < OUTPUT_SIZE; ++y)
 			{
-				data_t in = inBuf[getInIdx(0, 0, x)];
-				data_t wgt = mWgt[getWgtIdx(0, 0, x, y)];
-				delOutBuf[getDOutIdx(0, 0, x)] += wgt * delta;
-				wgtDiffBuf[getWgtIdx(0, 0, x, y)] += in * delta;
+				biasDiffBuf[getBiasIdx(y)] += delBuf[n * DELTA_SIZE + getDeltaIdx(0, 0, y)];
 			}
 		}
+	}
+
+	void Linear::forwardAvx(size_t threadIdx, size_t numImages)
+	{
+		const data_t* wgtBuf = getWgt(threadIdx);
+		const data_t* biasBuf = getBias(threadIdx);
+		data_t* inBuf = mIn[threadIdx];
+		data_t* outBuf = mOut[threadIdx] + getOutIdx(0, 0, 0);
+		const size_t OUT_STRIDE = getOutPadSize();
 
-		for (size_t y = 0; y < OUTPUT_SIZE; ++y)
+		// out(numImages x OUTPUT_SIZE) = bias + in(numImages x INPUT_SIZE) * wgt(INPUT_SIZE x OUTPUT_SIZE)
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			memcpy(&outBuf[n * OUT_STRIDE], biasBuf, sizeof(data_t) * OUTPUT_SIZE);
+		}
+		if (numImages < LINEAR_SGEMM_MIN_IMAGES)
+		{
+			DispatchSimd<LinearForwardKernel>(numImages, OUTPUT_SIZE, INPUT_SIZE, inBuf, INPUT_SIZE, wgtBuf, OUTPUT_SIZE, outBuf, OUT_STRIDE);
+		}
+		else
+		{
+			Sgemm(false, false, numImages, OUTPUT_SIZE, INPUT_SIZE, inBuf, INPUT_SIZE, wgtBuf, OUTPUT_SIZE, 1.f, outBuf, OUT_STRIDE);
+		}
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			activateOutput(mOut[threadIdx] + n * OUT_STRIDE);
+		}
+	}
+
+	void Linear::backPropAvx(size_t threadIdx, size_t numImages)
+	{
+		const data_t* wgtBuf = getWgt(threadIdx);
+		data_t* inBuf = mIn[threadIdx];
+		data_t* delBuf = mDelta[threadIdx];
+		data_t* delOutBuf = mDeltaOut[threadIdx];
+		data_t* wgtDiffBuf = mWgtDiff[threadIdx];
+		data_t* biasDiffBuf = mBiasDiff[threadIdx];
+		const size_t OUT_STRIDE = getOutPadSize();
+
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			computeDelta(mOut[threadIdx] + n * OUT_STRIDE, mDeltaIn[threadIdx] + n * DELTA_IN_SIZE, &delBuf[n * DELTA_SIZE]);
+			for (size_t y = 0; y < OUTPUT_SIZE; ++y)
+			{
+				biasDiffBuf[y] += delBuf[n * DELTA_SIZE + y];
+			}
+		}
+
+		// delta of the mini-batch is a (numImages x OUTPUT_SIZE) matrix
+		// delOut(numImages x INPUT_SIZE) = delta * wgt^T, wgtDiff(INPUT_SIZE x OUTPUT_SIZE) += in^T * delta
+		if (numImages < LINEAR_SGEMM_MIN_IMAGES)
+		{
+			DispatchSimd<LinearBackPropKernel>(numImages, INPUT_SIZE, OUTPUT_SIZE, delBuf, DELTA_SIZE, wgtBuf, OUTPUT_SIZE, delOutBuf, DELTA_OUT_SIZE,
+				inBuf, INPUT_SIZE, wgtDiffBuf, OUTPUT_SIZE);
+		}
+		else
+		{
+			Sgemm(false, true, numImages, INPUT_SIZE, OUTPUT_SIZE, delBuf, DELTA_SIZE, wgtBuf, OUTPUT_SIZE, 0.f, delOutBuf, DELTA_OUT_SIZE);
+			Sgemm(true, false, INPUT_SIZE, OUTPUT_SIZE, numImages, inBuf, INPUT_SIZE, delBuf, DELTA_SIZE, 1.f, wgtDiffBuf, OUTPUT_SIZE);
+		}
+	}
+
+	bool Linear::Quantize(data_t inMin, data_t inMax)
+	{
+		std::unique_ptr<QuantWeights> quantWgt(new QuantWeights(mWgt, INPUT_SIZE, OUTPUT_SIZE, GetActQuant(inMin, inMax)));
+		const size_t PAD_K = quantWgt->GetPadK();
+		const size_t PAD_N = quantWgt->GetPadN();
+		initQuant(std::move(quantWgt), PAD_K, PAD_N);
+		return true;
+	}
+
+	void Linear::forwardInt8(size_t threadIdx, size_t numImages)
+	{
+		const data_t* biasBuf = getBias(threadIdx);
+		const QuantWeights& quantWgt = *mQuantWgt;
+		const size_t PAD_K = quantWgt.GetPadK();
+		const size_t PAD_N = quantWgt.GetPadN();
+		const size_t OUT_STRIDE = getOutPadSize();
+		uint8_t* qInBuf = mQIn[threadIdx];
+		int32_t* accBuf = mQAcc[threadIdx];
+		if (PAD_K == INPUT_SIZE)
+		{
+			QuantizeActs(quantWgt.GetInQuant(), mIn[threadIdx], qInBuf, INPUT_SIZE * numImages);
+		}
+		else
+		{
+			for (size_t n = 0; n < numImages; ++n)
+			{
+				QuantizeActs(quantWgt.GetInQuant(), mIn[threadIdx] + INPUT_SIZE * n, qInBuf + PAD_K * n, INPUT_SIZE);
+			}
+		}
+		quantWgt.Gemm(numImages, qInBuf, PAD_K, accBuf, PAD_N);
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			biasDiffBuf[getBiasIdx(y)] += delBuf[getDeltaIdx(0, 0, y)];
+			data_t* out = &mOut[threadIdx][n * OUT_STRIDE];
+			quantWgt.Requantize(accBuf + PAD_N * n, biasBuf, 0, OUTPUT_SIZE, out + getOutIdx(0, 0, 0));
+			activateOutput(out);
 		}
 	}
 }
\ No newline at end of file
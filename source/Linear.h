@@ -9,7 +9,16 @@ namespace cnn
 		Linear(size_t inSize, size_t outSize, EActFn eActFn);
 		~Linear();
 
-		void Forward(size_t threadIdx) override;
-		void BackProp(size_t threadIdx) override;
+		void Forward(size_t threadIdx, size_t numImages) override;
+		void BackProp(size_t threadIdx, size_t numImages) override;
+		ELayer GetType() const override { return ELayer::LINEAR; }
+		bool Quantize(data_t inMin, data_t inMax) override;
+	private:
+		// The weights are a row-major INPUT_SIZE x OUTPUT_SIZE matrix, images are rows of the mini-batch matrices.
+		// A few images are multiplied one by one with GEMV, more run as one GEMM over the mini-batch.
+		void forwardAvx(size_t threadIdx, size_t numImages);
+		void backPropAvx(size_t threadIdx, size_t numImages);
+		// The mini-batch as one int8 GEMM
+		void forwardInt8(size_t threadIdx, size_t numImages);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include "MemoryPlan.h"
+#include <numeric>
+
+namespace cnn
+{
+	MemoryPlan::MemoryPlan()
+		: mBuffers()
+		, mSize(0)
+	{
+
+	}
+
+	size_t MemoryPlan::AddBuffer(size_t size)
+	{
+		Buffer buffer = {};
+		buffer.Size = GetBlockPadSize(size);
+		mBuffers.push_back(buffer);
+		return mBuffers.size() - 1;
+	}
+
+	void MemoryPlan::AddUse(size_t id, size_t first, size_t last)
+	{
+		AddUse(id, first, last, mBuffers[id].Size);
+	}
+
+	void MemoryPlan::AddUse(size_t id, size_t first, size_t last, size_t size)
+	{
+		Assert(first <= last && size <= mBuffers[id].Size);
+		mBuffers[id].Uses.push_back({ first, last, GetBlockPadSize(size) });
+	}
+
+	size_t MemoryPlan::GetTotalSize() const
+	{
+		size_t size = 0;
+		for (const Buffer& buffer : mBuffers)
+		{
+			size += buffer.Size;
+		}
+		return size;
+	}
+
+	void MemoryPlan::Solve()
+	{
+		const size_t NUM_BUFFERS = mBuffers.size();
+		std::vector<size_t> order(NUM_BUFFERS);
+		std::iota(order.begin(), order.end(), 0);
+		// Largest first, the small buffers fill the gaps between them
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+			{
+				return mBuffers[a].Size > mBuffers[b].Size;
+			});
+		// Memory [Begin, End) a placed use holds while one of the buffer's uses, Size long, is live
+		struct Conflict
+		{
+			size_t Begin;
+			size_t End;
+			size_t Size;
+		};
+		mSize = 0;
+		std::vector<size_t> placed;
+		for (size_t i : order)
+		{
+			Buffer& buffer = mBuffers[i];
+			std::vector<Conflict> conflicts;
+			for (size_t j : placed)
+			{
+				const Buffer& other = mBuffers[j];
+				for (const Use& u : buffer.Uses)
+				{
+					for (const Use& v : other.Uses)
+					{
+						if (u.First <= v.Last && v.First <= u.Last)
+						{
+							conflicts.push_back({ other.Offset, other.Offset + v.Size, u.Size });
+						}
+					}
+				}
+			}
+			// The lowest offset is 0 or right after a conflict
+			std::vector<size_t> offsets(1, 0);
+			for (const Conflict& c : conflicts)
+			{
+				offsets.push_back(c.End);
+			}
+			std::sort(offsets.begin(), offsets.end());
+			size_t offset = 0;
+			for (size_t candidate : offsets)
+			{
+				offset = candidate;
+				bool bFree = true;
+				for (size_t c = 0; c < conflicts.size() && bFree; ++c)
+				{
+					bFree = offset + conflicts[c].Size <= conflicts[c].Begin || conflicts[c].End <= offset;
+				}
+				if (bFree)
+				{
+					break;
+				}
+			}
+			buffer.Offset = offset;
+			mSize = std::max(mSize, offset + buffer.Size);
+			placed.push_back(i);
+		}
+		for (size_t i = 0; i < NUM_BUFFERS; ++i)
+		{
+			Buffer& buffer = mBuffers[i];
+			buffer.bShared = false;
+			for (size_t j = 0; j < NUM_BUFFERS && buffer.bShared == false; ++j)
+			{
+				const Buffer& other = mBuffers[j];
+				buffer.bShared = j != i && buffer.Offset < other.Offset + other.Size && other.Offset < buffer.Offset + buffer.Size;
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+#include <vector>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Offsets of buffers with known lifetimes in one arena
+	// Steps are points of a fixed schedule, a buffer is live at the steps of its uses. Buffers never live at the same step
+	// may share memory : Solve places the largest first, each at the lowest offset clear of the placed uses it overlaps in time.
+	class MemoryPlan
+	{
+	public:
+		MemoryPlan();
+
+		// Returns the buffer's id, its size is rounded up to MM_BLOCK to keep the buffers aligned
+		size_t AddBuffer(size_t size);
+		// The buffer is live from step first to step last, both included, a buffer may have several uses
+		void AddUse(size_t id, size_t first, size_t last);
+		// Same, holding only the buffer's first size elements, the rest is free for other buffers meanwhile
+		void AddUse(size_t id, size_t first, size_t last, size_t size);
+		void Solve();
+
+		size_t GetOffset(size_t id) const { return mBuffers[id].Offset; }
+		// Arena size, the peak of the live buffers
+		size_t GetSize() const { return mSize; }
+		// Sum of the buffer sizes, the footprint when every buffer has memory of its own
+		size_t GetTotalSize() const;
+		// Another buffer overlaps the memory of id : its contents, padding included, do not survive from one use to the next
+		bool IsShared(size_t id) const { return mBuffers[id].bShared; }
+	private:
+		struct Use
+		{
+			size_t First;
+			size_t Last;
+			size_t Size;
+		};
+		struct Buffer
+		{
+			size_t Size;
+			size_t Offset;
+			bool bShared;
+			std::vector<Use> Uses;
+		};
+	private:
+		std::vector<Buffer> mBuffers;
+		size_t mSize;
+	};
+}
\ No newline at end of file
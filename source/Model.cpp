@@ -0,0 +1,147 @@
+#include "Model.h"
+#include "Conv.h"
+#include "PWConv.h"
+#include "DWConv.h"
+#include "Pool.h"
+#include "Linear.h"
+#include "Reorder.h"
+
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cnn
+{
+	namespace
+	{
+		// Output length of the record's kernel over its input padded as ILayer pads it, 0 if the kernel does not fit
+		uint64_t getConvOutLen(const LayerRecord& record)
+		{
+			const uint64_t PAD = record.InLen == record.OutLen ? (record.KernelLen - 1) / 2 : 0;
+			const uint64_t PAD_LEN = record.InLen + 2 * PAD;
+			return record.KernelLen <= PAD_LEN ? PAD_LEN - record.KernelLen + 1 : 0;
+		}
+	}
+
+	std::unique_ptr<ILayer> CreateLayer(const LayerRecord& record)
+	{
+		if (record.ActFn > static_cast<uint32_t>(EActFn::IDEN) || record.ActFn == static_cast<uint32_t>(EActFn::SOFTMAX)
+			|| record.InLayout > static_cast<uint32_t>(ELayout::BLOCKED) || record.OutLayout > static_cast<uint32_t>(ELayout::BLOCKED)
+			|| record.KernelLen == 0 || record.InLen == 0 || record.InDepth == 0 || record.OutLen == 0 || record.OutDepth == 0)
+		{
+			return nullptr;
+		}
+		const EActFn eActFn = static_cast<EActFn>(record.ActFn);
+		const ELayout eLayout = static_cast<ELayout>(record.InLayout);
+		std::unique_ptr<ILayer> layer;
+		switch (static_cast<ELayer>(record.Type))
+		{
+		case ELayer::CONV:
+			if (record.OutLen != getConvOutLen(record))
+			{
+				return nullptr;
+			}
+			layer = std::make_unique<Conv>(record.KernelLen, record.InLen, record.InDepth, record.OutLen, record.OutDepth, eActFn, eLayout);
+			break;
+		case ELayer::PWCONV:
+			if (record.KernelLen != 1 || record.OutLen != record.InLen)
+			{
+				return nullptr;
+			}
+			layer = std::make_unique<PWConv>(record.InLen, record.InDepth, record.OutLen, record.OutDepth, eActFn, eLayout);
+			break;
+		case ELayer::DWCONV:
+			if (record.OutLen != getConvOutLen(record))
+			{
+				return nullptr;
+			}
+			layer = std::make_unique<DwConv>(record.KernelLen, record.InLen, record.InDepth, record.OutLen, eActFn, eLayout);
+			break;
+		case ELayer::POOL:
+			// The scalar path pools 2 x 2 windows only
+			if (record.KernelLen != 2 || record.InLen % record.KernelLen != 0)
+			{
+				return nullptr;
+			}
+			layer = std::make_unique<Pool>(record.KernelLen, record.InLen, record.InDepth, eActFn, eLayout);
+			break;
+		case ELayer::LINEAR:
+			if (record.KernelLen != 1 || record.InLen != 1 || record.OutLen != 1)
+			{
+				return nullptr;
+			}
+			layer = std::make_unique<Linear>(record.InDepth, record.OutDepth, eActFn);
+			break;
+		case ELayer::REORDER:
+			layer = std::make_unique<Reorder>(record.InLen, record.InDepth, eLayout, static_cast<ELayout>(record.OutLayout));
+			break;
+		default:
+			return nullptr;
+		}
+		return layer;
+	}
+
+	MappedFile::MappedFile(const char* path)
+		: mData(nullptr)
+		, mSize(0)
+	{
+#ifdef __linux__
+		const int fd = open(path, O_RDONLY);
+		if (fd < 0)
+		{
+			return;
+		}
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			// Private : writes stay in this process, the file is never modified
+			void* ptr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED)
+			{
+				mData = static_cast<uint8_t*>(ptr);
+				mSize = static_cast<size_t>(st.st_size);
+			}
+		}
+		// The mapping keeps the file open
+		close(fd);
+#elif defined(_MSC_VER)
+		HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return;
+		}
+		LARGE_INTEGER size = {};
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		{
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+			if (mapping != nullptr)
+			{
+				mData = static_cast<uint8_t*>(MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0));
+				mSize = mData != nullptr ? static_cast<size_t>(size.QuadPart) : 0;
+				// The view keeps the mapping and the file open
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#endif
+	}
+
+	MappedFile::~MappedFile()
+	{
+		if (mData == nullptr)
+		{
+			return;
+		}
+#ifdef __linux__
+		munmap(mData, mSize);
+#elif defined(_MSC_VER)
+		UnmapViewOfFile(mData);
+#endif
+	}
+}
\ No newline at end of file
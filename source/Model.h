@@ -0,0 +1,65 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Binary model file, see Network::Save
+	//	ModelHeader
+	//	LayerRecord[NumLayers]	the layers added to the network, without the layout transforms it inserts
+	//	zeros up to ParamsOffset, a multiple of MODEL_ALIGN
+	//	data_t[NumParams]		the network's parameter region : every layer's weights then biases, each on a MODEL_ALIGN boundary
+	// Values are in the writing host's byte order, so a mapping of the file is used in place. Files of other hosts are rejected.
+	constexpr uint32_t MODEL_MAGIC = 0x4D4E4E43;	// "CNNM"
+	constexpr uint32_t MODEL_VERSION = 1;
+	constexpr uint32_t MODEL_BYTE_ORDER = 0x01020304;
+	constexpr size_t MODEL_ALIGN = CACHE_LINE_SIZE;
+
+	struct ModelHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t ByteOrder;
+		uint32_t ValueSize;		// sizeof(data_t)
+		uint64_t NumLayers;
+		uint64_t ParamsOffset;	// Bytes from the start of the file
+		uint64_t NumParams;
+	};
+
+	// Arguments of the layer's constructor
+	struct LayerRecord
+	{
+		uint32_t Type;		// ELayer
+		uint32_t ActFn;		// EActFn
+		uint32_t InLayout;	// ELayout
+		uint32_t OutLayout;
+		uint64_t KernelLen;
+		uint64_t InLen;
+		uint64_t InDepth;
+		uint64_t OutLen;
+		uint64_t OutDepth;
+		uint64_t ParamOffset;	// Values from the start of the parameters to the layer's weights
+	};
+
+	// New layer of the record's class and shapes, nullptr if the record describes none
+	std::unique_ptr<ILayer> CreateLayer(const LayerRecord& record);
+
+	// Read-write, copy-on-write mapping of a whole file
+	// Pages are shared with the page cache, and so with every process mapping the file, until they are written.
+	class MappedFile
+	{
+	public:
+		explicit MappedFile(const char* path);
+		~MappedFile();
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		// nullptr if the file could not be mapped
+		uint8_t* GetData() const { return mData; }
+		size_t GetSize() const { return mSize; }
+	private:
+		uint8_t* mData;
+		size_t mSize;
+	};
+}
\ No newline at end of file
@@ -3,10 +3,27 @@
 #include <algorithm>
 #include <iterator>
 #include <iostream>
-#include <ppl.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <numeric>
+#include "ThreadPool.h"
+#include "SpscQueue.h"
+#include "Train.h"
 
 namespace cnn
 {
+	// Every layer's weights and biases start on a cache line of the arena, and of a saved model's parameters
+	constexpr size_t PARAM_ALIGN = CACHE_LINE_SIZE / sizeof(data_t);
+
+	namespace
+	{
+		size_t getParamPadSize(size_t size)
+		{
+			return (size + PARAM_ALIGN - 1) / PARAM_ALIGN * PARAM_ALIGN;
+		}
+	}
+
 	Network& operator>>(Network& net, ILayer& layer)
 	{
 		net.mLayers.push_back(&layer);
@@ -16,8 +33,11 @@ namespace cnn
 	Network& operator>>(Network& net, ENet e)
 	{
 		Assert(e == ENet::END);
+		Assert(net.mLayers.size() > 0);
+
+		net.insertReorders();
 		size_t size = net.mLayers.size();
-		Assert(size > 0);
+		net.initArena();
 
 		ILayer& head = *(net.mLayers[0]);
 		ILayer& tail = *(net.mLayers[size - 1]);
@@ -27,44 +47,83 @@ namespace cnn
 		net.mOutputSize = tail.OUTPUT_SIZE;
 		net.mNumPad = head.NUM_PAD;
 		net.mInputSize = net.mInputLen * net.mInputLen * net.mInputDepth;
-		// Connect network's buffers and head,tail layers' buffers
-		for (size_t i = 0; i < NUM_THREAD; ++i)
+		net.mInputPadSize = head.INPUT_SIZE;
+		net.meInputLayout = head.meInLayout;
+		for (size_t i = 0; i < size - 1; ++i)
 		{
-			net.mInput.push_back(head.mIn[i]);
-			net.mOutput.push_back(Alloc<data_t>(tail.OUTPUT_SIZE));
-			tail.mOut.push_back(net.mOutput[i]);
-			net.mDeltaIn.push_back(Alloc<data_t>(tail.OUTPUT_SIZE));
-			tail.mDeltaIn.push_back(net.mDeltaIn[i]);
+			net.mLayers[i]->mOutPad = net.mLayers[i + 1]->NUM_PAD;
 		}
-		// Connect layers' buffers
-		for (size_t i = 0; i < size - 1; ++i)
+		net.initBuffers();
+
+		return net;
+	}
+
+	void Network::insertReorders()
+	{
+		std::vector<ILayer*> layers;
+		for (size_t i = 0; i < mLayers.size(); ++i)
 		{
-			ILayer& curr = *(net.mLayers[i]);
-			ILayer& next = *(net.mLayers[i + 1]);
-			curr.mOutPad = next.NUM_PAD;
-			for (size_t j = 0; j < NUM_THREAD; ++j)
+			ILayer& curr = *(mLayers[i]);
+			layers.push_back(&curr);
+			const ELayout eNextLayout = i + 1 < mLayers.size() ? mLayers[i + 1]->meInLayout : ELayout::HWC;
+			if (curr.meOutLayout != eNextLayout)
 			{
-				curr.mOut.push_back(next.mIn[j]);
-				curr.mDeltaIn.push_back(next.mDeltaOut[j]);
+				mReorders.push_back(std::make_unique<Reorder>(curr.OUTPUT_LEN, curr.OUTPUT_DEPTH, curr.meOutLayout, eNextLayout));
+				layers.push_back(mReorders.back().get());
 			}
 		}
-
-		return net;
+		mLayers = layers;
 	}
 
-	Network::Network()
-		: mInput()
+	Network::Network(EMode eMode)
+		: mReorders()
+		, mOwnedLayers()
+		, mModel()
+		, meMode(eMode)
+		, mArena(nullptr)
+		, mArenaSize(0)
+		, mParamOffsets()
+		, mReplicaArena()
+		, mReplicas()
+		, mNodeThreads()
+		, mOptimizer(IOptimizer::Create(EOptimizer::ADAM))
+		, mNumSteps(0)
+		, mEpoch(0)
+		, mValIdx(0)
+		, mRng(std::random_device()())
+		, mCheckpoint()
+		, mCheckpointEvery(1)
+		, mHogwild(nullptr)
+		, mHogwildSeconds(0.0)
+		, mInput()
 		, mOutput()
 		, mDeltaIn()
+		, mActArena()
+		, mActPlan()
+		, mbSharedIn()
+		, mbSharedDeltaOut()
+		, mRestoreBy()
+		, mbReadsIn()
 		, mData(nullptr)
 		, mLabels(nullptr)
 		, mNumImages(0)
 		, mBatchSize(0)
+		, mMiniBatchSize(8)
 		, mEpochSize(0)
 		, mLearningRate(0.01f)
+		, meParallel(EParallel::DATA)
+		, mNumStages(0)
+		, meSchedule(ESchedule::ONE_F_ONE_B)
+		, mStageDrivers()
+		, mStagePools()
+		, mStageCpus()
+		, mePrecision(EPrecision::FP32)
+		, meTopology(ETopology::FLAT)
 		, mInputLen(0)
 		, mInputSize(0)
 		, mInputDepth(0)
+		, mInputPadSize(0)
+		, meInputLayout(ELayout::HWC)
 		, mOutputSize(0)
 		, mNumPad(0)
 	{
@@ -72,175 +131,1008 @@ namespace cnn
 
 	Network::~Network()
 	{
-		for (size_t i = 0; i < NUM_THREAD; ++i)
+		freeBuffers();
+		freeArena();
+	}
+
+	void Network::layoutParams()
+	{
+		mParamOffsets.clear();
+		mArenaSize = 0;
+		for (size_t i = 0; i < mLayers.size(); ++i)
 		{
-			if (mOutput[i] != nullptr) { Free(mOutput[i]); }
-			if (mDeltaIn[i] != nullptr) { Free(mDeltaIn[i]); }
+			mParamOffsets.push_back(mArenaSize);
+			mArenaSize += getParamPadSize(mLayers[i]->WGT_SIZE) + getParamPadSize(mLayers[i]->BIAS_SIZE);
 		}
+		mParamOffsets.push_back(mArenaSize);
+	}
+
+	void Network::initArena()
+	{
+		const size_t NUM_LAYERS = mLayers.size();
+		layoutParams();
+		if (mModel != nullptr)
+		{
+			// Load checked the file holds this layout
+			ModelHeader header;
+			memcpy(&header, mModel->GetData(), sizeof(header));
+			mArena = reinterpret_cast<data_t*>(mModel->GetData() + header.ParamsOffset);
+			for (size_t i = 0; i < NUM_LAYERS; ++i)
+			{
+				ILayer& layer = *(mLayers[i]);
+				const size_t wgtOffset = mParamOffsets[i];
+				layer.bindParams(mArena + wgtOffset, mArena + wgtOffset + getParamPadSize(layer.WGT_SIZE), nullptr, nullptr, false);
+				// Caches derived from the constructor's weights
+				layer.onWeightsUpdated();
+			}
+			initReplicas();
+			return;
+		}
+		// The layers' parameters may live in the current arena, it is freed once they are copied
+		data_t* oldArena = mArena;
+
+		const bool bTrain = meMode == EMode::TRAIN;
+		const size_t NUM_REGIONS = bTrain ? 2 + NUM_OPT_STATES : 1;
+		mArena = Alloc<data_t>(NUM_REGIONS * mArenaSize);
+		memset(mArena, 0, sizeof(data_t) * NUM_REGIONS * mArenaSize);
+		data_t* params = mArena;
+		data_t* grads = mArena + mArenaSize;
+		for (size_t i = 0; i < NUM_LAYERS; ++i)
+		{
+			ILayer& layer = *(mLayers[i]);
+			const size_t wgtOffset = mParamOffsets[i];
+			const size_t biasOffset = wgtOffset + getParamPadSize(layer.WGT_SIZE);
+			layer.bindParams(params + wgtOffset, params + biasOffset,
+				bTrain ? grads + wgtOffset : nullptr, bTrain ? grads + biasOffset : nullptr);
+		}
+		if (oldArena != nullptr)
+		{
+			Free(oldArena);
+		}
+		initReplicas();
+	}
+
+	void Network::freeArena()
+	{
+		mReplicas.clear();
+		mReplicaArena.clear();
+		if (mArena != nullptr && mModel == nullptr)
+		{
+			Free(mArena);
+		}
+		mArena = nullptr;
+		mModel.reset();
+	}
+
+	void Network::initReplicas()
+	{
+		for (ILayer* layer : mLayers)
+		{
+			layer->mThreadWgt.clear();
+			layer->mThreadBias.clear();
+		}
+		mReplicas.clear();
+		mReplicaArena.clear();
+		mNodeThreads.clear();
+		const size_t NUM_NODES = GetNumNodes();
+		if (meTopology != ETopology::NUMA || NUM_NODES < 2 || meParallel == EParallel::HOGWILD || mArena == nullptr)
+		{
+			return;
+		}
+		for (size_t node = 0; node < NUM_NODES; ++node)
+		{
+			mReplicaArena.push_back(std::make_unique<PageArena>(sizeof(data_t) * mArenaSize, node));
+			mReplicas.push_back(mReplicaArena[node]->Alloc<data_t>(mArenaSize));
+		}
+		refreshReplicas(0, mArenaSize);
+		// Thread buffers of a node are contiguous
+		for (size_t node = 0, t = 0; node <= NUM_NODES; ++node)
+		{
+			while (t < NUM_THREAD && GetThreadNode(t, NUM_THREAD) < node)
+			{
+				++t;
+			}
+			mNodeThreads.push_back(t);
+		}
+		for (ILayer* layer : mLayers)
+		{
+			const size_t wgtOffset = static_cast<size_t>(layer->mWgt - mArena);
+			const size_t biasOffset = static_cast<size_t>(layer->mBias - mArena);
+			for (size_t t = 0; t < NUM_THREAD; ++t)
+			{
+				data_t* replica = mReplicas[GetThreadNode(t, NUM_THREAD)];
+				layer->mThreadWgt.push_back(replica + wgtOffset);
+				layer->mThreadBias.push_back(replica + biasOffset);
+			}
+		}
+	}
+
+	void Network::refreshReplicas(size_t begin, size_t end)
+	{
+		for (data_t* replica : mReplicas)
+		{
+			memcpy(replica + begin, mArena + begin, sizeof(data_t) * (end - begin));
+		}
+	}
+
+	void Network::forEachThread(const std::function<void(size_t)>& func)
+	{
+		if (meTopology == ETopology::NUMA)
+		{
+			ThreadPool::Get().RunOnEach(func);
+		}
+		else
+		{
+			ThreadPool::Get().ParallelFor(0, NUM_THREAD, func);
+		}
+	}
+
+	void Network::updateLayers(size_t begin, size_t end, const StepArgs& args, ThreadPool& pool)
+	{
+		const size_t FIRST = mParamOffsets[begin];
+		const size_t LAST = mParamOffsets[end];
+		const size_t NUM_CHUNKS = (LAST - FIRST + UPDATE_CHUNK - 1) / UPDATE_CHUNK;
+		data_t* params = mArena;
+		// Sum the gradient copies listed in copies into the first of them over [chunkBegin, chunkEnd), all copies when copies is empty
+		auto reduceRange = [&](size_t chunkBegin, size_t chunkEnd, const std::vector<size_t>& copies)
+		{
+			std::vector<data_t*> subset;
+			auto reduce = [&](const std::vector<data_t*>& diffs, size_t offset, size_t size)
+			{
+				const size_t lo = std::max(chunkBegin, offset);
+				const size_t hi = std::min(chunkEnd, offset + size);
+				if (lo >= hi)
+				{
+					return;
+				}
+				if (copies.empty())
+				{
+					ILayer::reduceDiffs(diffs, lo - offset, hi - offset);
+					return;
+				}
+				subset.clear();
+				for (size_t c : copies)
+				{
+					subset.push_back(diffs[c]);
+				}
+				ILayer::reduceDiffs(subset, lo - offset, hi - offset);
+			};
+			size_t i = std::upper_bound(mParamOffsets.begin(), mParamOffsets.end(), chunkBegin) - mParamOffsets.begin() - 1;
+			for (; i < end && mParamOffsets[i] < chunkEnd; ++i)
+			{
+				ILayer& layer = *(mLayers[i]);
+				reduce(layer.mWgtDiff, mParamOffsets[i], layer.WGT_SIZE);
+				reduce(layer.mBiasDiff, static_cast<size_t>(layer.mBias - params), layer.BIAS_SIZE);
+			}
+		};
+		// Data parallel with copies per node : every node first sums its threads' copies into its first thread's copy
+		// on its own threads, the nodes' sums are combined below. Pipeline stages update from their own threads, in one pass.
+		std::vector<size_t> leaders;
+		if (meParallel == EParallel::DATA && !mNodeThreads.empty())
+		{
+			forEachThread([&](size_t threadIdx)
+				{
+					const size_t node = GetThreadNode(threadIdx, NUM_THREAD);
+					const size_t first = mNodeThreads[node];
+					const size_t num = mNodeThreads[node + 1] - first;
+					std::vector<size_t> copies(num);
+					std::iota(copies.begin(), copies.end(), first);
+					for (size_t chunk = threadIdx - first; num > 1 && chunk < NUM_CHUNKS; chunk += num)
+					{
+						const size_t chunkBegin = FIRST + chunk * UPDATE_CHUNK;
+						reduceRange(chunkBegin, std::min(chunkBegin + UPDATE_CHUNK, LAST), copies);
+					}
+				});
+			for (size_t node = 0; node + 1 < mNodeThreads.size(); ++node)
+			{
+				if (mNodeThreads[node] < mNodeThreads[node + 1])
+				{
+					leaders.push_back(mNodeThreads[node]);
+				}
+			}
+		}
+		// Every task owns a range of the arena : it sums the gradient copies in its range
+		// and steps the range while it is still in cache, then copies it to the nodes
+		StepArena(pool, *mOptimizer, args, mArena, mArenaSize, FIRST, LAST,
+			[&](size_t chunkBegin, size_t chunkEnd) { reduceRange(chunkBegin, chunkEnd, leaders); },
+			[&](size_t chunkBegin, size_t chunkEnd) { refreshReplicas(chunkBegin, chunkEnd); });
+		pool.ParallelFor(begin, end, [&](size_t i)
+			{
+				mLayers[i]->onWeightsUpdated();
+			});
+	}
+
+	void Network::initBuffers()
+	{
+		const size_t NUM_LAYERS = mLayers.size();
+		ILayer& head = *(mLayers[0]);
+		ILayer& tail = *(mLayers[NUM_LAYERS - 1]);
+		const bool bTrain = meMode == EMode::TRAIN;
+		const EPrecision ePrecision = bTrain ? mePrecision : EPrecision::FP32;
+		freeBuffers();
+		for (size_t i = 0; i < NUM_LAYERS; ++i)
+		{
+			mLayers[i]->setActPrecision(ePrecision);
+			mLayers[i]->InitBuffers(mMiniBatchSize);
+			mLayers[i]->mOut.clear();
+			mLayers[i]->mDeltaIn.clear();
+		}
+		// Layer i runs Forward at step i and BackProp at step BACK - i,
+		// a buffer lives from the pass writing it to the last pass reading it
+		const size_t BACK = 2 * NUM_LAYERS - 1;
+		mActPlan = MemoryPlan();
+		// Layers' inputs followed by the network's output
+		std::vector<size_t> inIds;
+		mRestoreBy.assign(NUM_LAYERS, NUM_LAYERS);
+		mbReadsIn.clear();
+		for (size_t i = 0; i <= NUM_LAYERS; ++i)
+		{
+			const size_t size = (i < NUM_LAYERS ? mLayers[i]->INPUT_SIZE : tail.OUTPUT_SIZE) * mMiniBatchSize;
+			inIds.push_back(mActPlan.AddBuffer(size));
+			// Written by the previous layer's Forward, the network's input before the first
+			const size_t first = i > 0 ? i - 1 : 0;
+			if (bTrain == false)
+			{
+				// The output is read after the last Forward
+				mActPlan.AddUse(inIds[i], first, i);
+				continue;
+			}
+			if (i == NUM_LAYERS)
+			{
+				// The loss gradient and the last layer's BackProp read the output
+				mActPlan.AddUse(inIds[i], first, BACK - first);
+				continue;
+			}
+			// Read by the layer's BackProp and, as its output, by the previous layer's, unless they kept what they need
+			const bool bReadsIn = mLayers[i]->backPropReadsInput();
+			const bool bReadsOut = i > 0 && mLayers[i - 1]->backPropReadsOutput();
+			mbReadsIn.push_back(bReadsIn);
+			if (bReadsIn == false && bReadsOut == false)
+			{
+				mActPlan.AddUse(inIds[i], first, i);
+				continue;
+			}
+			const size_t backFirst = bReadsIn ? BACK - i : BACK - first;
+			const size_t backLast = bReadsOut ? BACK - first : BACK - i;
+			if (ePrecision != EPrecision::FP32 && i + 1 < NUM_LAYERS)
+			{
+				// Narrowed in place after the layer's Forward, the first half of the buffer holds it in 16 bits
+				// until the first BackProp reading it widens it back in place
+				mActPlan.AddUse(inIds[i], first, i);
+				mActPlan.AddUse(inIds[i], i + 1, backFirst - 1, (sizeof(uint16_t) * size + sizeof(data_t) - 1) / sizeof(data_t));
+				mActPlan.AddUse(inIds[i], backFirst, backLast);
+				mRestoreBy[i] = bReadsIn ? i : first;
+			}
+			else
+			{
+				mActPlan.AddUse(inIds[i], first, backLast);
+			}
+		}
+		// Layers' mDelta, and their mDeltaOut followed by the network's loss gradient
+		std::vector<size_t> deltaIds;
+		std::vector<size_t> deltaOutIds;
+		if (bTrain)
+		{
+			for (size_t i = 0; i < NUM_LAYERS; ++i)
+			{
+				deltaIds.push_back(mActPlan.AddBuffer(mLayers[i]->DELTA_SIZE * mMiniBatchSize));
+				mActPlan.AddUse(deltaIds[i], BACK - i, BACK - i);
+			}
+			for (size_t i = 0; i <= NUM_LAYERS; ++i)
+			{
+				const size_t size = (i < NUM_LAYERS ? mLayers[i]->DELTA_OUT_SIZE : tail.OUTPUT_SIZE) * mMiniBatchSize;
+				deltaOutIds.push_back(mActPlan.AddBuffer(size));
+				// Written by the layer's BackProp, the loss gradient right before the last layer's, read by the previous layer's
+				const size_t first = BACK - std::min(i, NUM_LAYERS - 1);
+				mActPlan.AddUse(deltaOutIds[i], first, BACK - (i > 0 ? i - 1 : 0));
+			}
+		}
+		mActPlan.Solve();
+		for (size_t i = 0; i < NUM_LAYERS; ++i)
+		{
+			mbSharedIn.push_back(mActPlan.IsShared(inIds[i]));
+			mbSharedDeltaOut.push_back(bTrain && mActPlan.IsShared(deltaOutIds[i]));
+		}
+		// Place the buffers of every thread and connect the network's buffers to the head and tail layers
+		const size_t ARENA_SIZE = mActPlan.GetSize();
+		for (size_t t = 0; t < NUM_THREAD; ++t)
+		{
+			mActArena.push_back(std::make_unique<PageArena>(sizeof(data_t) * ARENA_SIZE, GetThreadNode(t, NUM_THREAD)));
+			data_t* arena = mActArena[t]->Alloc<data_t>(ARENA_SIZE);
+			for (size_t i = 0; i < NUM_LAYERS; ++i)
+			{
+				ILayer& layer = *(mLayers[i]);
+				layer.mIn[t] = arena + mActPlan.GetOffset(inIds[i]);
+				if (mRestoreBy[i] < NUM_LAYERS)
+				{
+					layer.mInHalf[t] = reinterpret_cast<uint16_t*>(layer.mIn[t]);
+				}
+				if (bTrain)
+				{
+					layer.mDelta[t] = arena + mActPlan.GetOffset(deltaIds[i]);
+					layer.mDeltaOut[t] = arena + mActPlan.GetOffset(deltaOutIds[i]);
+				}
+			}
+			mInput.push_back(head.mIn[t]);
+			mOutput.push_back(arena + mActPlan.GetOffset(inIds[NUM_LAYERS]));
+			tail.mOut.push_back(mOutput[t]);
+			if (bTrain)
+			{
+				mDeltaIn.push_back(arena + mActPlan.GetOffset(deltaOutIds[NUM_LAYERS]));
+				tail.mDeltaIn.push_back(mDeltaIn[t]);
+			}
+		}
+		// Connect layers' buffers
+		for (size_t i = 0; i < NUM_LAYERS - 1; ++i)
+		{
+			ILayer& curr = *(mLayers[i]);
+			ILayer& next = *(mLayers[i + 1]);
+			for (size_t j = 0; j < NUM_THREAD; ++j)
+			{
+				curr.mOut.push_back(next.mIn[j]);
+				if (bTrain)
+				{
+					curr.mDeltaIn.push_back(next.mDeltaOut[j]);
+				}
+			}
+		}
+	}
+
+	void Network::freeBuffers()
+	{
+		mInput.clear();
+		mOutput.clear();
+		mDeltaIn.clear();
+		mActArena.clear();
+		mbSharedIn.clear();
+		mbSharedDeltaOut.clear();
+		mRestoreBy.clear();
+		mbReadsIn.clear();
 	}
 
 	void Network::Fit(EAvx eAvx)
 	{
-		std::vector<std::thread> threads;
+		Assert(meMode == EMode::TRAIN);
 		const size_t NUM_LAYERS = mLayers.size();
+		// What the layers' BackProp reads may have changed since the buffers were planned, e.g. by Conv::SetAlgo
+		for (size_t i = 0; i < NUM_LAYERS; ++i)
+		{
+			if (mLayers[i]->backPropReadsInput() != mbReadsIn[i])
+			{
+				initBuffers();
+				break;
+			}
+		}
 		// Clear input buffers
 		for (size_t i = 0; i < mInput.size(); ++i)
 		{
-			memset(mInput[i], 0, sizeof(data_t) * (mInputLen + 2 * mNumPad) * (mInputLen + 2 * mNumPad) * mInputDepth);
+			memset(mInput[i], 0, sizeof(data_t) * mInputPadSize * mMiniBatchSize);
 		}
 		//
 		for (size_t i = 0; i < NUM_LAYERS; ++i)
 		{
+			mLayers[i]->Dequantize();
 			mLayers[i]->UseAvx(eAvx == EAvx::TRUE);
 		}
 		//
+		if (meParallel == EParallel::HOGWILD)
+		{
+			mHogwild.reset(new HogwildCounter[NUM_LAYERS]);
+			for (size_t i = 0; i < NUM_LAYERS; ++i)
+			{
+				mHogwild[i].Version = 0;
+				mHogwild[i].StalenessSum = 0;
+				mHogwild[i].MaxStaleness = 0;
+			}
+			mHogwildSeconds = 0.0;
+		}
+		//
 		const data_t LR = mLearningRate;
-		for (size_t e = 0; e < mEpochSize; ++e)
-		{
-			// Shuffle datas
-			std::random_device rd;
-			std::mt19937 g(rd());
-			std::shuffle(mImages.begin(), mImages.end(), g);
-			// Print progress
-			std::cout << "EPOCH : " << e + 1 << "\n";
-			std::cout << "|";
-			// Initialize constants
-			const size_t BATCH = mBatchSize - mBatchSize % NUM_THREAD;
-			const size_t BATCH_PER_EPOCH = mNumImages / BATCH;
-			const size_t BATCH_DIV_THREAD = BATCH / NUM_THREAD;
-			// Train
+		RunEpochs(mEpoch, mEpochSize, mImages, mNumImages, mRng, mValIdx,
+			[&]()
+			{
+				if (meParallel == EParallel::PIPELINE)
+				{
+					fitEpochPipeline(LR);
+				}
+				else if (meParallel == EParallel::HOGWILD)
+				{
+					fitEpochHogwild(LR);
+				}
+				else
+				{
+					fitEpochData(LR);
+				}
+			},
+			[&](size_t first, size_t num)
+			{
+				return GetAccuracy(mData + mInputSize * first, mLabels + first, num);
+			},
+			[&]()
+			{
+				if (mCheckpoint != nullptr && (mEpoch % mCheckpointEvery == 0 || mEpoch == mEpochSize))
+				{
+					writeCheckpoint();
+				}
+			});
+		mEpoch = 0;
+		if (mCheckpoint != nullptr && mCheckpoint->Flush() == false)
+		{
+			std::cout << "Checkpoint " << mCheckpoint->GetPath() << " could not be written" << std::endl;
+		}
+	}
+
+	void Network::writeCheckpoint()
+	{
+		std::ostringstream rng;
+		rng << mRng;
+		const std::string RNG = rng.str();
+		const size_t NUM_STATES = mOptimizer->GetNumStates();
+		CheckpointHeader header = {};
+		header.Magic = CHECKPOINT_MAGIC;
+		header.Version = CHECKPOINT_VERSION;
+		header.ByteOrder = MODEL_BYTE_ORDER;
+		header.ValueSize = sizeof(data_t);
+		header.NumLayers = mLayers.size();
+		header.ArenaSize = mArenaSize;
+		header.NumStates = NUM_STATES;
+		header.NumImages = mNumImages;
+		header.Epoch = mEpoch;
+		header.NumSteps = mNumSteps;
+		header.ValIdx = mValIdx;
+		header.RngSize = RNG.size();
+
+		// The gradient region is cleared by every batch, the states follow it
+		const size_t PARAM_BYTES = sizeof(data_t) * mArenaSize;
+		const size_t STATE_BYTES = sizeof(data_t) * NUM_STATES * mArenaSize;
+		const size_t ORDER_BYTES = sizeof(uint64_t) * mNumImages;
+		uint8_t* buf = mCheckpoint->Acquire(sizeof(header) + PARAM_BYTES + STATE_BYTES + ORDER_BYTES + RNG.size());
+		memcpy(buf, &header, sizeof(header));
+		buf += sizeof(header);
+		memcpy(buf, mArena, PARAM_BYTES);
+		buf += PARAM_BYTES;
+		memcpy(buf, mArena + 2 * mArenaSize, STATE_BYTES);
+		buf += STATE_BYTES;
+		for (size_t i = 0; i < mNumImages; ++i)
+		{
+			const uint64_t idx = static_cast<uint64_t>((mImages[i].Data - mData) / mInputSize);
+			memcpy(buf + sizeof(idx) * i, &idx, sizeof(idx));
+		}
+		buf += ORDER_BYTES;
+		memcpy(buf, RNG.data(), RNG.size());
+		mCheckpoint->Submit();
+	}
+
+	void Network::SetCheckpoint(const std::string& path, size_t everyEpochs)
+	{
+		Assert(everyEpochs > 0);
+		mCheckpoint.reset();
+		if (path.empty() == false)
+		{
+			mCheckpoint = std::make_unique<CheckpointWriter>(path);
+		}
+		mCheckpointEvery = everyEpochs;
+	}
+
+	bool Network::Resume(const std::string& path)
+	{
+		Assert(meMode == EMode::TRAIN && mArena != nullptr);
+		const MappedFile file(path.c_str());
+		const uint8_t* data = file.GetData();
+		CheckpointHeader header;
+		if (data == nullptr || file.GetSize() < sizeof(header))
+		{
+			return false;
+		}
+		memcpy(&header, data, sizeof(header));
+		const size_t NUM_STATES = mOptimizer->GetNumStates();
+		if (header.Magic != CHECKPOINT_MAGIC || header.Version != CHECKPOINT_VERSION || header.ByteOrder != MODEL_BYTE_ORDER
+			|| header.ValueSize != sizeof(data_t) || header.NumLayers != mLayers.size() || header.ArenaSize != mArenaSize
+			|| header.NumStates != NUM_STATES || header.NumImages != mNumImages || header.RngSize > file.GetSize()
+			|| file.GetSize() != sizeof(header) + sizeof(data_t) * (1 + NUM_STATES) * mArenaSize + sizeof(uint64_t) * mNumImages + header.RngSize)
+		{
+			return false;
+		}
+		const uint8_t* ptr = data + sizeof(header);
+		const uint8_t* order = ptr + sizeof(data_t) * (1 + NUM_STATES) * mArenaSize;
+		std::vector<IM> images(mNumImages);
+		for (size_t i = 0; i < mNumImages; ++i)
+		{
+			uint64_t idx;
+			memcpy(&idx, order + sizeof(idx) * i, sizeof(idx));
+			if (idx >= mNumImages)
+			{
+				return false;
+			}
+			images[i].Data = mData + mInputSize * idx;
+			images[i].Class = static_cast<int>(mLabels[idx]);
+		}
+		std::istringstream rng(std::string(reinterpret_cast<const char*>(order + sizeof(uint64_t) * mNumImages), header.RngSize));
+		std::mt19937 rngState;
+		rng >> rngState;
+		if (rng.fail())
+		{
+			return false;
+		}
+
+		memcpy(mArena, ptr, sizeof(data_t) * mArenaSize);
+		ptr += sizeof(data_t) * mArenaSize;
+		memcpy(mArena + 2 * mArenaSize, ptr, sizeof(data_t) * NUM_STATES * mArenaSize);
+		mImages = images;
+		mRng = rngState;
+		mEpoch = header.Epoch;
+		mNumSteps = header.NumSteps;
+		mValIdx = header.ValIdx;
+		refreshReplicas(0, mArenaSize);
+		for (ILayer* layer : mLayers)
+		{
+			layer->onWeightsUpdated();
+		}
+		return true;
+	}
+
+	void Network::SetSeed(uint32_t seed)
+	{
+		mRng.seed(seed);
+	}
+
+	void Network::fitEpochData(data_t learningRate)
+	{
+		const size_t NUM_LAYERS = mLayers.size();
+		// Initialize constants
+		const size_t BATCH = mBatchSize - mBatchSize % NUM_THREAD;
+		const size_t BATCH_PER_EPOCH = mNumImages / BATCH;
+		const size_t BATCH_DIV_THREAD = BATCH / NUM_THREAD;
+		for (size_t be = 0; be < BATCH_PER_EPOCH; ++be)
+		{
+			PrintProgress(be, BATCH_PER_EPOCH);
+			// Initialize batch : set weight diff/bias diff to 0
+			for (size_t i = 0; i < NUM_LAYERS; ++i)
+			{
+				mLayers[i]->InitBatch();
+			}
+			// Get parameters' gradients
+			forEachThread([&](size_t threadIdx)
+				{
+					data_t* inputBuf = mInput[threadIdx];
+					const size_t firstImage = be * BATCH + threadIdx * BATCH_DIV_THREAD;
+
+					// Push the thread's share through the layers in mini-batches
+					for (size_t first = 0; first < BATCH_DIV_THREAD; first += mMiniBatchSize)
+					{
+						const size_t numImages = std::min(mMiniBatchSize, BATCH_DIV_THREAD - first);
+						// Copy input
+						for (size_t n = 0; n < numImages; ++n)
+						{
+							copyInput(mImages[firstImage + first + n].Data, inputBuf + mInputPadSize * n);
+						}
+						// Forward propagation
+						for (size_t i = 0; i < NUM_LAYERS; ++i)
+						{
+							forwardLayer(i, threadIdx, numImages, true);
+						}
+						setOutputDelta(threadIdx, firstImage + first, numImages);
+						// Back Propagation
+						for (size_t i = 0; i < NUM_LAYERS; i++)
+						{
+							size_t idx = NUM_LAYERS - i - 1;
+							backPropLayer(idx, threadIdx, numImages);
+						}
+					}
+				});
+			// Fit parameters
+			++mNumSteps;
+			updateLayers(0, NUM_LAYERS, StepArgs{ mNumSteps, BATCH, learningRate }, ThreadPool::Get());
+		}
+	}
+
+	void Network::fitEpochPipeline(data_t learningRate)
+	{
+		const size_t NUM_LAYERS = mLayers.size();
+		const size_t BATCH = mBatchSize;
+		const size_t BATCH_PER_EPOCH = mNumImages / BATCH;
+		const size_t NUM_MICRO = (BATCH + mMiniBatchSize - 1) / mMiniBatchSize;
+		// The layers' thread buffers serve as micro-batch slots, micro-batch m uses slot m % NUM_SLOTS.
+		// Stage 0 never has more than NUM_SLOTS micro-batches in flight, so a slot is free again
+		// once stage 0 has back propagated the micro-batch that used it.
+		const size_t NUM_SLOTS = NUM_THREAD;
+		const std::vector<size_t> stages = partitionStages(mNumStages == 0 ? std::min<size_t>(NUM_LAYERS, NUM_SLOTS) : mNumStages);
+		const size_t NUM_STAGES = stages.size() - 1;
+		// fwdQueues[s] hands micro-batches from stage s - 1 to s, bwdQueues[s] from stage s + 1 to s
+		std::vector<std::unique_ptr<SpscQueue<size_t>>> fwdQueues;
+		std::vector<std::unique_ptr<SpscQueue<size_t>>> bwdQueues;
+		for (size_t s = 0; s < NUM_STAGES; ++s)
+		{
+			fwdQueues.push_back(std::make_unique<SpscQueue<size_t>>(NUM_SLOTS));
+			bwdQueues.push_back(std::make_unique<SpscQueue<size_t>>(NUM_SLOTS));
+		}
+
+		initStagePools(NUM_STAGES);
+
+		auto runStage = [&](size_t s)
+		{
+			const size_t BEGIN = stages[s];
+			const size_t END = stages[s + 1];
+			const bool bFirst = s == 0;
+			const bool bLast = s == NUM_STAGES - 1;
+			ThreadPool& pool = *mStagePools[s];
+			// Micro-batches run at once, one per core of the stage's group
+			const size_t NUM_CORES = mStageCpus[s].size();
+			// Micro-batches this stage may have forwarded but not yet back propagated
+			// GPipe : every slot, 1F1B : one per core of this stage and the stages after it, which bounds the live activations
+			size_t numDownstream = 0;
+			for (size_t d = s; d < NUM_STAGES; ++d)
+			{
+				numDownstream += mStageCpus[d].size();
+			}
+			const size_t MAX_IN_FLIGHT = meSchedule == ESchedule::GPIPE ? NUM_SLOTS : std::min(NUM_SLOTS, numDownstream);
+			std::vector<size_t> fwd;
+			std::vector<size_t> bwd;
 			for (size_t be = 0; be < BATCH_PER_EPOCH; ++be)
 			{
-				// Print progress
-				if ((be + 1) % (BATCH_PER_EPOCH / 10) == 0)
+				if (bFirst)
 				{
-					std::cout << "--|";
+					PrintProgress(be, BATCH_PER_EPOCH);
 				}
-				// Initialize batch : set weight diff/bias diff to 0
-				for (size_t i = 0; i < NUM_LAYERS; ++i)
+				for (size_t i = BEGIN; i < END; ++i)
 				{
 					mLayers[i]->InitBatch();
 				}
-				// Get parameters' gradients
-				concurrency::parallel_for(0, static_cast<int>(NUM_THREAD), [&](int threadIdx)
+				size_t numFwd = 0;
+				size_t numBwd = 0;
+				while (numBwd < NUM_MICRO)
+				{
+					// Take the forward passes first : the in-flight bound counts finished back propagations only,
+					// so a forward pass never reuses the slot of a micro-batch back propagated in the same round
+					fwd.clear();
+					bwd.clear();
+					while (fwd.size() < NUM_CORES && numFwd + fwd.size() < NUM_MICRO && numFwd + fwd.size() - numBwd < MAX_IN_FLIGHT)
 					{
-						data_t* inputBuf = mInput[threadIdx];
-						data_t* outputBuf = mOutput[threadIdx];
-						data_t* delInBuf = mDeltaIn[threadIdx];
-
-						for (size_t n = 0; n < BATCH_DIV_THREAD; ++n)
+						size_t m = numFwd + fwd.size();
+						if (bFirst == false && fwdQueues[s]->TryPop(m) == false)
 						{
-							IM currIm = mImages[be * BATCH + threadIdx * (n + 1)];
-							const data_t* input = currIm.Data;
-							const int label = currIm.Class;
-							// Copy input
-							for (size_t y = 0; y < mInputLen; ++y)
+							break;
+						}
+						fwd.push_back(m);
+					}
+					size_t m = 0;
+					while (bLast == false && fwd.size() + bwd.size() < NUM_CORES && bwdQueues[s]->TryPop(m))
+					{
+						bwd.push_back(m);
+					}
+					if (fwd.empty() && bwd.empty())
+					{
+						std::this_thread::yield();
+						continue;
+					}
+					// Concurrent micro-batches are in flight together, so their slots differ
+					pool.ParallelFor(0, fwd.size() + bwd.size(), [&](size_t k)
+						{
+							const bool bForward = k < fwd.size();
+							const size_t m = bForward ? fwd[k] : bwd[k - fwd.size()];
+							const size_t slot = m % NUM_SLOTS;
+							const size_t firstImage = be * BATCH + m * mMiniBatchSize;
+							const size_t numImages = std::min(mMiniBatchSize, BATCH - m * mMiniBatchSize);
+							if (bForward)
 							{
-								for (size_t x = 0; x < mInputLen; ++x)
+								if (bFirst)
 								{
-									for (size_t d = 0; d < mInputDepth; ++d)
+									for (size_t n = 0; n < numImages; ++n)
 									{
-										inputBuf[getIdx(x, y, d)] = input[(mInputLen * y + x) * mInputDepth + d];
+										copyInput(mImages[firstImage + n].Data, mInput[slot] + mInputPadSize * n);
 									}
 								}
+								for (size_t i = BEGIN; i < END; ++i)
+								{
+									forwardLayer(i, slot, numImages, true);
+								}
+								if (bLast == false)
+								{
+									return;
+								}
+								// The last stage turns the micro-batch around at once
+								setOutputDelta(slot, firstImage, numImages);
 							}
-							// Forward propagation
-							for (size_t i = 0; i < NUM_LAYERS; ++i)
-							{
-								mLayers[i]->Forward(threadIdx);
-							}
-							// Set output delta
-							size_t truth = label;
-							for (size_t i = 0; i < mOutputSize; i++)
-							{
-								data_t y = outputBuf[i];
-								data_t yi = (label == i) ? 1.f : 0.f;
-								delInBuf[i] = 0.2f * (y - yi);
-							}
-							// Back Propagation
-							for (size_t i = 0; i < NUM_LAYERS; i++)
+							for (size_t i = END; i-- > BEGIN;)
 							{
-								size_t idx = NUM_LAYERS - i - 1;
-								mLayers[idx]->BackProp(threadIdx);
+								backPropLayer(i, slot, numImages);
 							}
-						}
-					});
-				// Fit parameters
-				int nl = NUM_LAYERS;
-				size_t ic = 0;
-				while (nl > 0)
-				{
-					int nt = nl < static_cast<int>(NUM_THREAD) ? nl : NUM_THREAD;
-					concurrency::parallel_for(0, nt, [&](int threadIdx)
-						{
-							mLayers[ic * NUM_THREAD + threadIdx]->Update(BATCH, LR);
 						});
-					nl -= NUM_THREAD;
-					ic += 1;
+					// Hand the micro-batches on in order, from this thread only
+					numFwd += fwd.size();
+					if (bLast)
+					{
+						bwd.swap(fwd);
+					}
+					for (size_t k : fwd)
+					{
+						while (fwdQueues[s + 1]->TryPush(k) == false) { std::this_thread::yield(); }
+					}
+					numBwd += bwd.size();
+					for (size_t k : bwd)
+					{
+						while (bFirst == false && bwdQueues[s - 1]->TryPush(k) == false) { std::this_thread::yield(); }
+					}
 				}
+				// This stage's gradients are complete, update its layers while the stages before it drain
+				updateLayers(BEGIN, END, StepArgs{ mNumSteps + be + 1, BATCH, learningRate }, pool);
 			}
-			// Print current accuracy
-			constexpr size_t NUM_FOLD = 10;
-			static size_t valIdx = 0;
-			const size_t NUM_VIMGES = mNumImages / NUM_FOLD;
-			const size_t OFFSET = valIdx * NUM_VIMGES;
-			std::cout << "\nACCURACY : "
-				<< GetAccuracy(mData + mInputSize * OFFSET, mLabels + OFFSET, NUM_VIMGES) << std::endl << std::endl;
-			valIdx++;
-			valIdx %= NUM_FOLD;
+		};
+
+		// Stage 0 runs on the calling thread, pinned to the first core of its group for the epoch
+		PinThread(mStageCpus[0][0]);
+		mStageDrivers->RunOnEach(runStage);
+		if (meTopology != ETopology::NUMA)
+		{
+			UnpinThread();
 		}
+		mNumSteps += BATCH_PER_EPOCH;
 	}
 
-	data_t Network::GetAccuracy(data_t* data, char* labels, size_t n)
+	void Network::fitEpochHogwild(data_t learningRate)
 	{
-		std::vector<std::thread> threads;
-		std::vector<size_t> correctCount(NUM_THREAD);
-		size_t imgIdx = 0;
-		size_t numLayers = mLayers.size();
-		n -= n % NUM_THREAD;
-		while (imgIdx < n)
+		const size_t NUM_LAYERS = mLayers.size();
+		const size_t NUM_PER_THREAD = mNumImages / NUM_THREAD;
+		const auto start = std::chrono::steady_clock::now();
+		// Caches derived from the weights are refreshed by the threads reading them, never while another thread reads them
+		for (ILayer* layer : mLayers)
 		{
-			// Get outputs
-			auto func = [this, &numLayers, &correctCount](size_t threadIdx, data_t* input, int label)
+			layer->setThreadCaches(true);
+		}
+		// Every thread trains on a contiguous share of the shuffled images,
+		// a layer is stepped as soon as the thread has back propagated through it
+		forEachThread([&](size_t threadIdx)
 			{
 				data_t* inputBuf = mInput[threadIdx];
-				data_t* outputBuf = mOutput[threadIdx];
-				data_t* delInBuf = mDeltaIn[threadIdx];
-				// Copy input
-				for (size_t y = 0; y < mInputLen; ++y)
+				const size_t firstImage = threadIdx * NUM_PER_THREAD;
+				std::vector<size_t> versions(NUM_LAYERS);
+				// Version of every layer the thread's caches were refreshed at
+				std::vector<size_t> cached(NUM_LAYERS, static_cast<size_t>(-1));
+				for (size_t first = 0; first < NUM_PER_THREAD; first += mMiniBatchSize)
 				{
-					for (size_t x = 0; x < mInputLen; ++x)
+					if (threadIdx == 0)
+					{
+						PrintProgress(first / mMiniBatchSize, NUM_PER_THREAD / mMiniBatchSize);
+					}
+					const size_t numImages = std::min(mMiniBatchSize, NUM_PER_THREAD - first);
+					for (size_t n = 0; n < numImages; ++n)
+					{
+						copyInput(mImages[firstImage + first + n].Data, inputBuf + mInputPadSize * n);
+					}
+					for (size_t i = 0; i < NUM_LAYERS; ++i)
 					{
-						for (size_t d = 0; d < mInputDepth; ++d)
+						versions[i] = mHogwild[i].Version.load(std::memory_order_relaxed);
+						if (versions[i] != cached[i])
 						{
-							inputBuf[getIdx(x, y, d)] = input[(mInputLen * y + x) * mInputDepth + d];
+							mLayers[i]->refreshCache(mLayers[i]->getCacheCopy(threadIdx));
+							cached[i] = versions[i];
 						}
+						forwardLayer(i, threadIdx, numImages, true);
+					}
+					setOutputDelta(threadIdx, firstImage + first, numImages);
+					for (size_t i = NUM_LAYERS; i-- > 0;)
+					{
+						mLayers[i]->clearDiffs(threadIdx);
+						backPropLayer(i, threadIdx, numImages);
+						hogwildStep(i, threadIdx, numImages, learningRate, versions[i]);
 					}
 				}
-				// Forward propagation
-				for (size_t i = 0; i < numLayers; ++i)
-				{
-					mLayers[i]->Forward(threadIdx);
-				}
-				//std::cout << label << "," << getPredict(threadIdx) << std::endl;
-				if (label == getPredict(threadIdx))
-				{
-					correctCount[threadIdx]++;
-				}
-			};
-			for (size_t idx = 0; idx < NUM_THREAD; ++idx)
+			});
+		mHogwildSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		// Back to one copy, refreshed from the final weights
+		for (ILayer* layer : mLayers)
+		{
+			layer->setThreadCaches(false);
+		}
+	}
+
+	void Network::hogwildStep(size_t i, size_t threadIdx, size_t numImages, data_t learningRate, size_t version)
+	{
+		ILayer& layer = *(mLayers[i]);
+		HogwildCounter& counter = mHogwild[i];
+		const size_t curr = counter.Version.fetch_add(1, std::memory_order_relaxed);
+		const size_t staleness = curr - version;
+		counter.StalenessSum.fetch_add(staleness, std::memory_order_relaxed);
+		size_t maxStaleness = counter.MaxStaleness.load(std::memory_order_relaxed);
+		while (staleness > maxStaleness
+			&& !counter.MaxStaleness.compare_exchange_weak(maxStaleness, staleness, std::memory_order_relaxed))
+		{
+		}
+
+		// Parameters and optimizer state are shared and written without locks, concurrent steps may interleave
+		const StepArgs args{ curr + 1, numImages, learningRate };
+		const size_t NUM_STATES = mOptimizer->GetNumStates();
+		auto step = [&](data_t* param, const data_t* diff, size_t size)
+		{
+			const size_t offset = static_cast<size_t>(param - mArena);
+			data_t* state0 = NUM_STATES > 0 ? mArena + 2 * mArenaSize + offset : nullptr;
+			data_t* state1 = NUM_STATES > 1 ? mArena + 3 * mArenaSize + offset : nullptr;
+			mOptimizer->Step(args, param, diff, state0, state1, GetBlockPadSize(size));
+		};
+		step(layer.mWgt, layer.mWgtDiff[threadIdx], layer.WGT_SIZE);
+		step(layer.mBias, layer.mBiasDiff[threadIdx], layer.BIAS_SIZE);
+	}
+
+	ActMemoryStats Network::GetActMemoryStats() const
+	{
+		ActMemoryStats stats;
+		stats.UnplannedBytes = sizeof(data_t) * mActPlan.GetTotalSize();
+		stats.PlannedBytes = sizeof(data_t) * mActPlan.GetSize();
+		stats.LayerBytes = 0;
+		for (const ILayer* layer : mLayers)
+		{
+			stats.LayerBytes += layer->getScratchBytes();
+		}
+		return stats;
+	}
+
+	std::vector<HogwildStats> Network::GetHogwildStats() const
+	{
+		std::vector<HogwildStats> stats;
+		if (mHogwild == nullptr)
+		{
+			return stats;
+		}
+		for (size_t i = 0; i < mLayers.size(); ++i)
+		{
+			const HogwildCounter& counter = mHogwild[i];
+			HogwildStats s;
+			s.NumUpdates = counter.Version.load();
+			s.UpdatesPerSec = mHogwildSeconds > 0.0 ? static_cast<data_t>(s.NumUpdates / mHogwildSeconds) : 0.f;
+			s.MeanStaleness = s.NumUpdates > 0 ? static_cast<data_t>(counter.StalenessSum.load()) / s.NumUpdates : 0.f;
+			s.MaxStaleness = counter.MaxStaleness.load();
+			stats.push_back(s);
+		}
+		return stats;
+	}
+
+	void Network::initStagePools(size_t numStages)
+	{
+		if (mStagePools.size() == numStages)
+		{
+			return;
+		}
+		mStagePools.clear();
+		mStageCpus.clear();
+		mStageDrivers = std::make_unique<ThreadPool>(numStages - 1);
+		for (size_t s = 0; s < numStages; ++s)
+		{
+			// Stage s gets the cores of thread buffers [first, last), at least one
+			const size_t first = s * NUM_THREAD / numStages;
+			const size_t last = std::max((s + 1) * NUM_THREAD / numStages, first + 1);
+			std::vector<size_t> cpus;
+			for (size_t t = first; t < last; ++t)
+			{
+				cpus.push_back(GetThreadCpu(t % NUM_THREAD, NUM_THREAD));
+			}
+			mStagePools.push_back(std::make_unique<ThreadPool>(cpus.size() - 1));
+			mStageCpus.push_back(cpus);
+		}
+		// Every stage's thread pins itself and the workers of its pool
+		mStageDrivers->RunOnEach([&](size_t s)
+			{
+				mStagePools[s]->Pin(mStageCpus[s]);
+			});
+	}
+
+	std::vector<size_t> Network::partitionStages(size_t numStages) const
+	{
+		const size_t NUM_LAYERS = mLayers.size();
+		numStages = std::max<size_t>(1, std::min(numStages, NUM_LAYERS));
+		std::vector<size_t> costs(NUM_LAYERS);
+		size_t total = 0;
+		for (size_t i = 0; i < NUM_LAYERS; ++i)
+		{
+			// Forward and backward passes both scale with the multiply-adds, add one so every layer counts
+			costs[i] = mLayers[i]->getNumMacs() + 1;
+			total += costs[i];
+		}
+		// Greedy contiguous split : close a stage once it reaches its share of the total,
+		// keeping at least one layer for every remaining stage
+		std::vector<size_t> stages(1, 0);
+		size_t acc = 0;
+		for (size_t i = 0; i < NUM_LAYERS && stages.size() < numStages; ++i)
+		{
+			acc += costs[i];
+			const size_t remainingStages = numStages - stages.size();
+			const bool bShare = acc * numStages >= total * stages.size();
+			if (bShare || NUM_LAYERS - (i + 1) == remainingStages)
+			{
+				stages.push_back(i + 1);
+			}
+		}
+		stages.push_back(NUM_LAYERS);
+		return stages;
+	}
+
+	void Network::forwardLayer(size_t i, size_t threadIdx, size_t numImages, bool bKeep)
+	{
+		ILayer& layer = *(mLayers[i]);
+		const bool bLast = i + 1 == mLayers.size();
+		// The output held another buffer of the arena, clear the padding the next layer reads as 0
+		if (bLast == false && mbSharedIn[i + 1])
+		{
+			ILayer& next = *(mLayers[i + 1]);
+			if (next.INPUT_SIZE != next.INPUT_LEN * next.INPUT_LEN * next.INPUT_DEPTH)
 			{
-				data_t* input = data + mInputSize * imgIdx;
-				int label = static_cast<int>(labels[imgIdx]);
-				threads.push_back(std::thread(func, idx, input, label));
-				imgIdx++;
+				memset(next.mIn[threadIdx], 0, sizeof(data_t) * next.INPUT_SIZE * numImages);
 			}
-			for (size_t i = 0; i < NUM_THREAD; ++i)
+		}
+		layer.Forward(threadIdx, numImages);
+		if (bKeep && mRestoreBy[i] < mLayers.size())
+		{
+			layer.stashInput(threadIdx, numImages);
+		}
+	}
+
+	void Network::backPropLayer(size_t i, size_t threadIdx, size_t numImages)
+	{
+		ILayer& layer = *(mLayers[i]);
+		// Widen the input and the output, the next layer's input, if this BackProp is the first to read them
+		if (mRestoreBy[i] == i)
+		{
+			layer.restoreInput(threadIdx, numImages);
+		}
+		if (i + 1 < mLayers.size() && mRestoreBy[i + 1] == i)
+		{
+			mLayers[i + 1]->restoreInput(threadIdx, numImages);
+		}
+		if (mbSharedDeltaOut[i] && layer.DELTA_OUT_SIZE != layer.INPUT_LEN * layer.INPUT_LEN * layer.INPUT_DEPTH)
+		{
+			memset(layer.mDeltaOut[threadIdx], 0, sizeof(data_t) * layer.DELTA_OUT_SIZE * numImages);
+		}
+		layer.BackProp(threadIdx, numImages);
+	}
+
+	void Network::setOutputDelta(size_t threadIdx, size_t firstImage, size_t numImages)
+	{
+		const data_t* outputBuf = mOutput[threadIdx];
+		data_t* delInBuf = mDeltaIn[threadIdx];
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			const size_t label = static_cast<size_t>(mImages[firstImage + n].Class);
+			for (size_t i = 0; i < mOutputSize; i++)
 			{
-				threads[i].join();
+				data_t y = outputBuf[mOutputSize * n + i];
+				data_t yi = (label == i) ? 1.f : 0.f;
+				delInBuf[mOutputSize * n + i] = 0.2f * (y - yi);
 			}
-			threads.clear();
 		}
+	}
+
+	data_t Network::GetAccuracy(data_t* data, char* labels, size_t n)
+	{
+		std::vector<size_t> correctCount(NUM_THREAD);
+		const size_t NUM_LAYERS = mLayers.size();
+		n -= n % NUM_THREAD;
+		const size_t NUM_PER_THREAD = n / NUM_THREAD;
+		// Every thread buffer evaluates a contiguous share of the images in mini-batches
+		forEachThread([&](size_t threadIdx)
+			{
+				data_t* inputBuf = mInput[threadIdx];
+				const size_t begin = threadIdx * NUM_PER_THREAD;
+				for (size_t first = begin; first < begin + NUM_PER_THREAD; first += mMiniBatchSize)
+				{
+					const size_t numImages = std::min(mMiniBatchSize, begin + NUM_PER_THREAD - first);
+					// Copy input
+					for (size_t img = 0; img < numImages; ++img)
+					{
+						copyInput(data + mInputSize * (first + img), inputBuf + mInputPadSize * img);
+					}
+					// Forward propagation
+					for (size_t i = 0; i < NUM_LAYERS; ++i)
+					{
+						forwardLayer(i, threadIdx, numImages, false);
+					}
+					for (size_t img = 0; img < numImages; ++img)
+					{
+						if (static_cast<int>(labels[first + img]) == getPredict(threadIdx, img))
+						{
+							correctCount[threadIdx]++;
+						}
+					}
+				}
+			});
 		// Sum num true positive
 		size_t sum = 0;
 		for (size_t i = 0; i < NUM_THREAD; ++i)
@@ -251,6 +1143,221 @@ namespace cnn
 		return static_cast<data_t>(sum) / n;
 	}
 
+	void Network::Quantize(data_t* data, size_t n)
+	{
+		const size_t NUM_LAYERS = mLayers.size();
+		for (size_t i = 0; i < NUM_LAYERS; ++i)
+		{
+			mLayers[i]->Dequantize();
+		}
+		// Input range of every layer seen by every thread, merged after the pass
+		std::vector<data_t> inMin(NUM_THREAD * NUM_LAYERS, 0.f);
+		std::vector<data_t> inMax(NUM_THREAD * NUM_LAYERS, 0.f);
+		const size_t NUM_PER_THREAD = (n + NUM_THREAD - 1) / NUM_THREAD;
+		forEachThread([&](size_t threadIdx)
+			{
+				data_t* inputBuf = mInput[threadIdx];
+				const size_t begin = std::min(threadIdx * NUM_PER_THREAD, n);
+				const size_t end = std::min(begin + NUM_PER_THREAD, n);
+				for (size_t first = begin; first < end; first += mMiniBatchSize)
+				{
+					const size_t numImages = std::min(mMiniBatchSize, end - first);
+					for (size_t img = 0; img < numImages; ++img)
+					{
+						copyInput(data + mInputSize * (first + img), inputBuf + mInputPadSize * img);
+					}
+					for (size_t i = 0; i < NUM_LAYERS; ++i)
+					{
+						ILayer& layer = *mLayers[i];
+						const data_t* in = layer.mIn[threadIdx];
+						data_t& lo = inMin[NUM_LAYERS * threadIdx + i];
+						data_t& hi = inMax[NUM_LAYERS * threadIdx + i];
+						for (size_t j = 0; j < layer.INPUT_SIZE * numImages; ++j)
+						{
+							lo = Min(lo, in[j]);
+							hi = Max(hi, in[j]);
+						}
+						forwardLayer(i, threadIdx, numImages, false);
+					}
+				}
+			});
+		for (size_t i = 0; i < NUM_LAYERS; ++i)
+		{
+			data_t lo = 0.f;
+			data_t hi = 0.f;
+			for (size_t t = 0; t < NUM_THREAD; ++t)
+			{
+				lo = Min(lo, inMin[NUM_LAYERS * t + i]);
+				hi = Max(hi, inMax[NUM_LAYERS * t + i]);
+			}
+			mLayers[i]->Quantize(lo, hi);
+		}
+	}
+
+	bool Network::Save(const char* path) const
+	{
+		Assert(mArena != nullptr);
+		std::vector<LayerRecord> records;
+		for (size_t i = 0; i < mLayers.size(); ++i)
+		{
+			const ILayer& layer = *(mLayers[i]);
+			// END inserts the layout transforms again
+			const bool bInserted = std::any_of(mReorders.begin(), mReorders.end(),
+				[&](const std::unique_ptr<Reorder>& reorder) { return reorder.get() == &layer; });
+			if (bInserted)
+			{
+				continue;
+			}
+			LayerRecord record = {};
+			record.Type = static_cast<uint32_t>(layer.GetType());
+			record.ActFn = static_cast<uint32_t>(layer.meActFn);
+			record.InLayout = static_cast<uint32_t>(layer.meInLayout);
+			record.OutLayout = static_cast<uint32_t>(layer.meOutLayout);
+			record.KernelLen = layer.KERNEL_LEN;
+			record.InLen = layer.INPUT_LEN;
+			record.InDepth = layer.INPUT_DEPTH;
+			record.OutLen = layer.OUTPUT_LEN;
+			record.OutDepth = layer.OUTPUT_DEPTH;
+			record.ParamOffset = mParamOffsets[i];
+			records.push_back(record);
+		}
+		ModelHeader header = {};
+		header.Magic = MODEL_MAGIC;
+		header.Version = MODEL_VERSION;
+		header.ByteOrder = MODEL_BYTE_ORDER;
+		header.ValueSize = sizeof(data_t);
+		header.NumLayers = records.size();
+		const size_t RECORDS_END = sizeof(header) + sizeof(LayerRecord) * records.size();
+		header.ParamsOffset = (RECORDS_END + MODEL_ALIGN - 1) / MODEL_ALIGN * MODEL_ALIGN;
+		header.NumParams = mArenaSize;
+
+		std::ofstream file(path, std::ios::binary);
+		if (!file.is_open())
+		{
+			return false;
+		}
+		const std::vector<char> zeros(header.ParamsOffset - RECORDS_END, 0);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(records.data()), sizeof(LayerRecord) * records.size());
+		file.write(zeros.data(), zeros.size());
+		file.write(reinterpret_cast<const char*>(mArena), sizeof(data_t) * mArenaSize);
+		file.close();
+		return !file.fail();
+	}
+
+	std::unique_ptr<Network> Network::Load(const char* path)
+	{
+		std::unique_ptr<MappedFile> model = std::make_unique<MappedFile>(path);
+		const uint8_t* data = model->GetData();
+		const size_t SIZE = model->GetSize();
+		ModelHeader header;
+		if (data == nullptr || SIZE < sizeof(header))
+		{
+			return nullptr;
+		}
+		memcpy(&header, data, sizeof(header));
+		if (header.Magic != MODEL_MAGIC || header.Version != MODEL_VERSION || header.ByteOrder != MODEL_BYTE_ORDER
+			|| header.ValueSize != sizeof(data_t) || header.NumLayers == 0
+			|| header.NumLayers > (SIZE - sizeof(header)) / sizeof(LayerRecord)
+			|| header.ParamsOffset % MODEL_ALIGN != 0 || header.ParamsOffset < sizeof(header) + sizeof(LayerRecord) * header.NumLayers
+			|| header.ParamsOffset > SIZE || header.NumParams > (SIZE - header.ParamsOffset) / sizeof(data_t))
+		{
+			return nullptr;
+		}
+
+		std::unique_ptr<Network> net = std::make_unique<Network>(EMode::INFERENCE);
+		std::vector<LayerRecord> records(header.NumLayers);
+		memcpy(records.data(), data + sizeof(header), sizeof(LayerRecord) * records.size());
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			const LayerRecord& record = records[i];
+			std::unique_ptr<ILayer> layer = CreateLayer(record);
+			if (layer == nullptr || layer->KERNEL_LEN != record.KernelLen || layer->INPUT_LEN != record.InLen
+				|| layer->INPUT_DEPTH != record.InDepth || layer->OUTPUT_LEN != record.OutLen || layer->OUTPUT_DEPTH != record.OutDepth
+				|| static_cast<uint32_t>(layer->meOutLayout) != record.OutLayout)
+			{
+				return nullptr;
+			}
+			// Every layer reads its predecessor's whole output
+			if (i > 0 && records[i - 1].OutLen * records[i - 1].OutLen * records[i - 1].OutDepth != record.InLen * record.InLen * record.InDepth)
+			{
+				return nullptr;
+			}
+			// The AVX kernels where the host has them, as Fit selects by default
+			layer->UseAvx(true);
+			*net >> *layer;
+			net->mOwnedLayers.push_back(std::move(layer));
+		}
+		// The parameters must be laid out as this network's arena, END finds the layout transforms in place
+		net->insertReorders();
+		net->layoutParams();
+		if (net->mArenaSize != header.NumParams)
+		{
+			return nullptr;
+		}
+		for (size_t i = 0, r = 0; i < net->mLayers.size(); ++i)
+		{
+			if (r < records.size() && net->mLayers[i] == net->mOwnedLayers[r].get() && net->mParamOffsets[i] != records[r++].ParamOffset)
+			{
+				return nullptr;
+			}
+		}
+		net->mModel = std::move(model);
+		*net >> ENet::END;
+		return net;
+	}
+
+	void Network::Freeze()
+	{
+		if (meMode == EMode::INFERENCE)
+		{
+			return;
+		}
+		meMode = EMode::INFERENCE;
+		mNumSteps = 0;
+		mHogwild.reset();
+		if (!mInput.empty())
+		{
+			initArena();
+			initBuffers();
+		}
+	}
+
+	void Network::Predict(const data_t* in, data_t* out, size_t n)
+	{
+		const size_t NUM_LAYERS = mLayers.size();
+		// Images [begin, end) in mini-batches through a thread's buffers
+		auto predict = [&](size_t threadIdx, size_t begin, size_t end)
+		{
+			data_t* inputBuf = mInput[threadIdx];
+			for (size_t first = begin; first < end; first += mMiniBatchSize)
+			{
+				const size_t numImages = std::min(mMiniBatchSize, end - first);
+				for (size_t img = 0; img < numImages; ++img)
+				{
+					copyInput(in + mInputSize * (first + img), inputBuf + mInputPadSize * img);
+				}
+				for (size_t i = 0; i < NUM_LAYERS; ++i)
+				{
+					forwardLayer(i, threadIdx, numImages, false);
+				}
+				memcpy(out + mOutputSize * first, mOutput[threadIdx], sizeof(data_t) * mOutputSize * numImages);
+			}
+		};
+		// A single mini-batch runs on the calling thread, more are shared by the thread buffers
+		if (n <= mMiniBatchSize)
+		{
+			predict(0, 0, n);
+			return;
+		}
+		const size_t NUM_PER_THREAD = (n + NUM_THREAD - 1) / NUM_THREAD;
+		forEachThread([&](size_t threadIdx)
+			{
+				const size_t begin = std::min(threadIdx * NUM_PER_THREAD, n);
+				predict(threadIdx, begin, std::min(begin + NUM_PER_THREAD, n));
+			});
+	}
+
 	void Network::SetData(data_t* td, char* ld, size_t n)
 	{
 		mData = td;
@@ -273,6 +1380,17 @@ namespace cnn
 		mBatchSize = b;
 	}
 
+	void Network::SetMiniBatchSize(size_t n)
+	{
+		Assert(n > 0);
+		mMiniBatchSize = n;
+		// Already wired : reallocate the layers' buffers
+		if (!mInput.empty())
+		{
+			initBuffers();
+		}
+	}
+
 	void Network::SetEpochSize(size_t e)
 	{
 		mEpochSize = e;
@@ -283,9 +1401,50 @@ namespace cnn
 		mLearningRate = l;
 	}
 
-	int Network::getPredict(size_t threadIdx)
+	void Network::SetParallel(EParallel eParallel, size_t numStages, ESchedule eSchedule)
+	{
+		meParallel = eParallel;
+		mNumStages = numStages;
+		meSchedule = eSchedule;
+		initReplicas();
+	}
+
+	void Network::SetTopology(ETopology eTopology)
+	{
+		meTopology = eTopology;
+		ThreadPool::Get().Pin(meTopology == ETopology::NUMA);
+		initReplicas();
+	}
+
+	void Network::SetPrecision(EPrecision ePrecision)
 	{
-		data_t* outBuf = mOutput[threadIdx];
+		mePrecision = ePrecision;
+		// Already wired : reallocate the layers' buffers
+		if (!mInput.empty())
+		{
+			initBuffers();
+		}
+	}
+
+	void Network::SetOptimizer(EOptimizer eOptimizer)
+	{
+		SetOptimizer(IOptimizer::Create(eOptimizer));
+	}
+
+	void Network::SetOptimizer(std::unique_ptr<IOptimizer> optimizer)
+	{
+		Assert(optimizer != nullptr && optimizer->GetNumStates() <= NUM_OPT_STATES);
+		mOptimizer = std::move(optimizer);
+		mNumSteps = 0;
+		if (mArena != nullptr && meMode == EMode::TRAIN)
+		{
+			memset(mArena + 2 * mArenaSize, 0, sizeof(data_t) * NUM_OPT_STATES * mArenaSize);
+		}
+	}
+
+	int Network::getPredict(size_t threadIdx, size_t img)
+	{
+		data_t* outBuf = mOutput[threadIdx] + mOutputSize * img;
 
 		int idx = 0;
 		data_t max = 0.f;
@@ -301,10 +1460,28 @@ namespace cnn
 		return idx;
 	}
 
+	void Network::copyInput(const data_t* src, data_t* dest) const
+	{
+		// The head's input may share the arena with later buffers, its padding is cleared every time
+		if (mbSharedIn[0] && mInputPadSize != mInputSize)
+		{
+			memset(dest, 0, sizeof(data_t) * mInputPadSize);
+		}
+		for (size_t y = 0; y < mInputLen; ++y)
+		{
+			for (size_t x = 0; x < mInputLen; ++x)
+			{
+				for (size_t d = 0; d < mInputDepth; ++d)
+				{
+					dest[getIdx(x, y, d)] = src[(mInputLen * y + x) * mInputDepth + d];
+				}
+			}
+		}
+	}
+
 	size_t Network::getIdx(size_t x, size_t y, size_t d) const
 	{
-		size_t idx = ((mInputLen + 2 * mNumPad) * (mNumPad + y) + (mNumPad + x)) * mInputDepth + d;
-		//size_t idx = (mInputLen + 2 * mNumPad) * (mInputLen + 2 * mNumPad) * d + (mInputLen + 2 * mNumPad) * (mNumPad + y) + (mNumPad + x);
+		size_t idx = GetTensorIdx(meInputLayout, mInputLen + 2 * mNumPad, GetPadDepth(meInputLayout, mInputDepth), mNumPad + x, mNumPad + y, d);
 		return idx;
 	};
 }
\ No newline at end of file
@@ -1,43 +1,235 @@
 #pragma once
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <random>
 #include "ILayer.h"
+#include "Reorder.h"
+#include "Optimizer.h"
+#include "MemoryPlan.h"
+#include "PageArena.h"
+#include "Model.h"
+#include "Checkpoint.h"
 
 namespace cnn
 {
+	class ThreadPool;
+
 	enum class EAvx
 	{
 		FALSE = 0,
 		TRUE = 1,
 	};
 
+	enum class EMode
+	{
+		TRAIN,
+		INFERENCE,	// Forward passes only : no gradients, optimizer states or back propagation buffers are allocated
+	};
+
+	enum class EParallel
+	{
+		DATA,		// Every thread runs all layers for its share of the batch
+		PIPELINE,	// Layers are split into stages on their own pinned groups of cores, micro-batches stream through them
+		HOGWILD,	// Every thread steps the shared parameters after each of its mini-batches, without locks or barriers
+	};
+
+	// Placement of the threads on the machine
+	enum class ETopology
+	{
+		FLAT,	// Threads run wherever the OS schedules them and share one copy of the parameters, pipeline stages stay pinned
+		NUMA,	// Thread buffer t is pinned to CPU GetThreadCpu(t, NUM_THREAD), every node reads a copy of the parameters in its own memory
+				// and sums its threads' gradients before the nodes' sums are combined. One node : pinning only.
+	};
+
+	// Order of forward and backward passes in a pipeline stage
+	enum class ESchedule
+	{
+		GPIPE,			// Forward as many micro-batches as there are thread buffers before back propagating
+		ONE_F_ONE_B,	// Stage s keeps at most one micro-batch per core of stages s and later in flight
+	};
+
+	// Per-layer counters of the HOGWILD mode, reset by Fit
+	struct HogwildStats
+	{
+		size_t NumUpdates;
+		data_t UpdatesPerSec;
+		// Updates by other threads between reading a layer's weights in Forward and stepping them
+		data_t MeanStaleness;
+		size_t MaxStaleness;
+	};
+
+	// Activation memory of one thread
+	// The arena holds every layer's mIn, with its 16 bits copy below FP32, mDelta and mDeltaOut, the network's output and its loss gradient.
+	struct ActMemoryStats
+	{
+		size_t UnplannedBytes;	// Every arena buffer in memory of its own
+		size_t PlannedBytes;	// The arena they share, buffers never live at the same time overlap
+		size_t LayerBytes;		// Buffers the layers allocate themselves : patches, transforms, pooling indices, quantized inputs
+	};
+
 	class Network
 	{
 	public:
 		friend Network& operator>>(Network& net, ILayer& layer);
 		friend Network& operator>>(Network& net, ENet e);
 	public:
-		Network();
+		explicit Network(EMode eMode = EMode::TRAIN);
 		~Network();
 
 		Network(const Network&) = delete;
 		Network& operator=(const Network&) = delete;
 
+		// EMode::TRAIN only, trains mEpochSize epochs, or the epochs left after Resume
 		void Fit(EAvx USE_AVX = EAvx::TRUE);
+		// Write the training state to path every everyEpochs epochs of Fit, the last checkpoint is on disk when Fit returns
+		// Fit copies the parameters, optimizer states, step and epoch counters, image order and shuffle generator into a buffer
+		// and goes on, a background thread writes it. An empty path stops checkpointing.
+		void SetCheckpoint(const std::string& path, size_t everyEpochs = 1);
+		// Restore the training state of a checkpoint of this network, false if path holds none
+		// The next Fit continues after the checkpoint's epoch and takes the same steps as the interrupted one.
+		// HOGWILD steps are racy, its runs resume close to the interrupted one only. Call after SetData.
+		bool Resume(const std::string& path);
+		// Seed of the generator shuffling the images every epoch, default : std::random_device
+		void SetSeed(uint32_t seed);
 		data_t GetAccuracy(data_t* data, char* labels, size_t n);
+		// Switch a trained network to EMode::INFERENCE, releasing its gradients, optimizer states and back propagation buffers
+		void Freeze();
+		// out = the last layer's outputs for n unpadded HWC images stored back to back in in, OUTPUT_SIZE values per image
+		// Uses the network's thread buffers, calls must not overlap.
+		void Predict(const data_t* in, data_t* out, size_t n = 1);
+		// Switch the layers with weights to INT8 inference, calibrated on the n images of data
+		// Every layer's input range is recorded in an fp32 forward pass over them.
+		// Layers without an int8 path stay in fp32, Fit returns every layer to fp32 before training.
+		void Quantize(data_t* data, size_t n);
+		// Write the layers and their fp32 parameters to a model file, false if it could not be written
+		bool Save(const char* path) const;
+		// Inference network of a model file, nullptr if the file is missing or not a model of this host
+		// The parameters are used in place in a private mapping of the file : nothing is read before the first Forward,
+		// and every process serving the file shares its pages. The network owns its layers.
+		static std::unique_ptr<Network> Load(const char* path);
 
 		void SetData(data_t* td, char* ld, size_t n);
 		void SetBatchSize(size_t b);
+		// Images each thread pushes through a layer at once, default : 8
+		void SetMiniBatchSize(size_t n);
 		void SetEpochSize(size_t e);
 		void SetLearningRate(data_t l);
+		// numStages == 0 : one stage per layer, up to NUM_THREAD stages
+		// Micro-batches have the mini-batch size.
+		void SetParallel(EParallel eParallel, size_t numStages = 0, ESchedule eSchedule = ESchedule::ONE_F_ONE_B);
+		// Default : ADAM, replacing the optimizer clears its state
+		void SetOptimizer(EOptimizer eOptimizer);
+		void SetOptimizer(std::unique_ptr<IOptimizer> optimizer);
+		// Storage of the activations kept from the forward pass for back propagation, default : FP32
+		// Below FP32 the layers still compute in fp32 and the inputs a BackProp reads are kept in 16 bits in the activation arena
+		// until the first BackProp reading them widens them back, so their fp32 memory is reused in between.
+		// Parameters, gradients and optimizer states stay fp32.
+		// An inference network keeps no activations, the precision is ignored.
+		void SetPrecision(EPrecision ePrecision);
+		// Default : FLAT, pins the shared thread pool's threads, NUMA replicates the parameters for DATA and PIPELINE
+		// HOGWILD threads step the shared parameters themselves, they read them without copies.
+		void SetTopology(ETopology eTopology);
+		// One entry per layer, including inserted layout transforms
+		std::vector<HogwildStats> GetHogwildStats() const;
+		// Per thread, for the current mode, precision and mini-batch size, PlannedBytes + LayerBytes in all
+		ActMemoryStats GetActMemoryStats() const;
+	private:
+		struct HogwildCounter
+		{
+			std::atomic<size_t> Version;		// Updates applied to the layer
+			std::atomic<size_t> StalenessSum;
+			std::atomic<size_t> MaxStaleness;
+		};
 	private:
-		int getPredict(size_t threadIdx);
+		void fitEpochData(data_t learningRate);
+		void fitEpochPipeline(data_t learningRate);
+		void fitEpochHogwild(data_t learningRate);
+		// Step layer i's parameters with the thread's own diffs, version is the layer's version read in Forward
+		void hogwildStep(size_t i, size_t threadIdx, size_t numImages, data_t learningRate, size_t version);
+		// Split the layers into contiguous stages of similar cost
+		// Returns the first layer of every stage followed by the number of layers.
+		std::vector<size_t> partitionStages(size_t numStages) const;
+		// Split the cores into one group per stage and start the stages' threads, unless they run already
+		void initStagePools(size_t numStages);
+		// Layer i's passes, clearing the padding of buffers shared in the arena and keeping inputs in 16 bits below FP32
+		// bKeep : the input is kept for BackProp
+		void forwardLayer(size_t i, size_t threadIdx, size_t numImages, bool bKeep);
+		void backPropLayer(size_t i, size_t threadIdx, size_t numImages);
+		// Loss gradient of the images mImages[firstImage, firstImage + numImages) in the thread's output buffers
+		void setOutputDelta(size_t threadIdx, size_t firstImage, size_t numImages);
+		// Copy the training state into a checkpoint buffer and queue it
+		void writeCheckpoint();
+		// Insert layout transforms where a layer's output layout differs from the next layer's input layout,
+		// the network's output is always HWC
+		void insertReorders();
+		// mParamOffsets and mArenaSize of the layers
+		void layoutParams();
+		// Move every layer's parameters and gradient copy 0 into the arena, only the parameters for inference
+		// A loaded network's layers are bound to the parameters in the model file instead.
+		void initArena();
+		void freeArena();
+		// Copy the parameters to every node in the NUMA topology and point the layers' thread buffers at their node's copy
+		void initReplicas();
+		// Parameters [begin, end) of the arena to every node's copy
+		void refreshReplicas(size_t begin, size_t end);
+		// func(threadIdx) for every thread buffer, on thread threadIdx of the pool in the NUMA topology
+		void forEachThread(const std::function<void(size_t)>& func);
+		// Reduce the gradients of layers [begin, end) and step their parameters in one pass over their arena range, on the pool's threads
+		void updateLayers(size_t begin, size_t end, const StepArgs& args, ThreadPool& pool);
+		int getPredict(size_t threadIdx, size_t img);
+		// Copy an unpadded HWC image into a padded input buffer in the head layer's layout
+		void copyInput(const data_t* src, data_t* dest) const;
 		size_t getIdx(size_t x, size_t y, size_t d) const;
+		// Allocate the layers' buffers for the mini-batch size and connect them
+		// The activation buffers are planned from their lifetimes over one training step, or one forward pass for inference.
+		void initBuffers();
+		void freeBuffers();
 	private:
 		std::vector<ILayer*> mLayers;
+		// Layout transforms inserted by END, owned by the network
+		std::vector<std::unique_ptr<Reorder>> mReorders;
+		// Layers created by Load and the file holding their parameters
+		std::vector<std::unique_ptr<ILayer>> mOwnedLayers;
+		std::unique_ptr<MappedFile> mModel;
+		EMode meMode;
+		// Parameter arena : regions of mArenaSize values for the parameters, gradients and NUM_OPT_STATES optimizer states
+		// An inference network has the parameters' region only.
+		// Every region holds the layers in order, weights then biases, each starting on a cache line.
+		data_t* mArena;
+		size_t mArenaSize;
+		std::vector<size_t> mParamOffsets;	// Offset of every layer in a region, followed by mArenaSize
+		// NUMA topology, more than one node : a copy of the parameters' region on every node
+		std::vector<std::unique_ptr<PageArena>> mReplicaArena;
+		std::vector<data_t*> mReplicas;
+		// First thread buffer of every node, followed by NUM_THREAD, empty without copies
+		std::vector<size_t> mNodeThreads;
+		std::unique_ptr<IOptimizer> mOptimizer;
+		size_t mNumSteps;
+		size_t mEpoch;		// Epochs of the current Fit completed
+		size_t mValIdx;		// Validation fold of the next epoch
+		std::mt19937 mRng;	// Shuffles the images
+		std::unique_ptr<CheckpointWriter> mCheckpoint;
+		size_t mCheckpointEvery;
+		// HOGWILD counters of every layer and the training time they were gathered over
+		std::unique_ptr<HogwildCounter[]> mHogwild;
+		double mHogwildSeconds;
 		// vector elements are buffers allocated to threads
 		std::vector<data_t*> mInput;
 		std::vector<data_t*> mOutput;
 		std::vector<data_t*> mDeltaIn;
+		// Activation arenas, every buffer of a thread at its offset in mActPlan
+		// Thread buffer t's arena is on node GetThreadNode(t, NUM_THREAD).
+		std::vector<std::unique_ptr<PageArena>> mActArena;
+		MemoryPlan mActPlan;
+		// Layer i's mIn / mDeltaOut shares memory with other buffers : the padding is cleared before every use
+		std::vector<bool> mbSharedIn;
+		std::vector<bool> mbSharedDeltaOut;
+		// Layer whose BackProp widens layer i's input back from its 16 bits copy, the number of layers when it is not kept in 16 bits
+		std::vector<size_t> mRestoreBy;
+		// Layer i's backPropReadsInput when the buffers were planned
+		std::vector<bool> mbReadsIn;
 
 		// Raw input images
 		struct IM
@@ -51,12 +243,25 @@ namespace cnn
 		size_t mNumImages;
 
 		size_t mBatchSize;
+		size_t mMiniBatchSize;
 		size_t mEpochSize;
 		data_t mLearningRate;	// Default : 0.01
+		EParallel meParallel;	// Default : DATA
+		size_t mNumStages;
+		ESchedule meSchedule;
+		// PIPELINE : thread s of mStageDrivers runs stage s, the workers of mStagePools[s] are the rest of its core group
+		// Kept across epochs and Fit calls, rebuilt when the number of stages changes.
+		std::unique_ptr<ThreadPool> mStageDrivers;
+		std::vector<std::unique_ptr<ThreadPool>> mStagePools;
+		std::vector<std::vector<size_t>> mStageCpus;
+		EPrecision mePrecision;	// Default : FP32
+		ETopology meTopology;	// Default : FLAT
 
 		size_t mInputLen;	// Not padded
 		size_t mInputSize;	// Not padded
 		size_t mInputDepth;
+		size_t mInputPadSize;	// Padded, in the head layer's layout
+		ELayout meInputLayout;
 		size_t mOutputSize; // Not padded
 		size_t mNumPad;		// Input's pad
 	};
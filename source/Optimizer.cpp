@@ -0,0 +1,71 @@
+#include "Optimizer.h"
+#include "SimdKernels.h"
+
+namespace cnn
+{
+	std::unique_ptr<IOptimizer> IOptimizer::Create(EOptimizer eOptimizer)
+	{
+		switch (eOptimizer)
+		{
+		case EOptimizer::SGD:
+			return std::make_unique<Sgd>();
+		case EOptimizer::ADAM:
+			return std::make_unique<Adam>();
+		case EOptimizer::ADAMW:
+			return std::make_unique<AdamW>();
+		case EOptimizer::RMSPROP:
+			return std::make_unique<RmsProp>();
+		default:
+			Assert(false);
+			return nullptr;
+		}
+	}
+
+	Sgd::Sgd(data_t momentum)
+		: MOMENTUM(momentum)
+	{
+	}
+
+	void Sgd::Step(const StepArgs& args, data_t* param, const data_t* grad, data_t* state0, data_t* /*state1*/, size_t n) const
+	{
+		Assert(n % MM_BLOCK == 0);
+		DispatchSimd<SgdKernel>(1.f / args.BatchSize, MOMENTUM, -args.LearningRate, param, grad, state0, n);
+	}
+
+	Adam::Adam(data_t beta1, data_t beta2, data_t eps)
+		: BETA1(beta1)
+		, BETA2(beta2)
+		, EPS(eps)
+		, mWeightDecay(0.f)
+	{
+	}
+
+	void Adam::Step(const StepArgs& args, data_t* param, const data_t* grad, data_t* state0, data_t* state1, size_t n) const
+	{
+		Assert(n % MM_BLOCK == 0);
+		const data_t alpha = 0.001f * static_cast<data_t>(sqrt(args.BatchSize)) * args.LearningRate;
+		// Bias corrections are folded into the constants : w -= alpha * m * C1 / sqrt(v * C2 + eps)
+		const data_t C1 = 1.f / (1.f - static_cast<data_t>(pow(BETA1, args.T)));
+		const data_t C2 = 1.f / (1.f - static_cast<data_t>(pow(BETA2, args.T)));
+		const AdamConsts consts{ 1.f / args.BatchSize, BETA1, BETA2, alpha * C1, C2, EPS, 1.f - alpha * mWeightDecay };
+		DispatchSimd<AdamKernel>(consts, param, grad, state0, state1, n);
+	}
+
+	AdamW::AdamW(data_t weightDecay, data_t beta1, data_t beta2, data_t eps)
+		: Adam(beta1, beta2, eps)
+	{
+		mWeightDecay = weightDecay;
+	}
+
+	RmsProp::RmsProp(data_t decay, data_t eps)
+		: DECAY(decay)
+		, EPS(eps)
+	{
+	}
+
+	void RmsProp::Step(const StepArgs& args, data_t* param, const data_t* grad, data_t* state0, data_t* /*state1*/, size_t n) const
+	{
+		Assert(n % MM_BLOCK == 0);
+		DispatchSimd<RmsPropKernel>(1.f / args.BatchSize, DECAY, args.LearningRate, EPS, param, grad, state0, n);
+	}
+}
\ No newline at end of file
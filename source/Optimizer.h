@@ -0,0 +1,87 @@
+#pragma once
+#include <memory>
+#include "ILayer.h"
+
+namespace cnn
+{
+	enum class EOptimizer
+	{
+		SGD,		// SGD with momentum
+		ADAM,
+		ADAMW,		// Adam with decoupled weight decay
+		RMSPROP,
+	};
+
+	// State arrays the network reserves per parameter, the most any optimizer uses
+	constexpr size_t NUM_OPT_STATES = 2;
+
+	// Arguments shared by every range of one optimizer step
+	struct StepArgs
+	{
+		size_t T;				// Step number, 1 for the first step
+		size_t BatchSize;		// Gradients are sums over BatchSize images
+		data_t LearningRate;
+	};
+
+	// Update rule applied to ranges of the network's parameter arena
+	// Ranges are aligned and a multiple of MM_BLOCK long. Step is called concurrently for disjoint ranges,
+	// so it must not modify the optimizer.
+	class IOptimizer
+	{
+	public:
+		virtual ~IOptimizer() = default;
+
+		// Number of state arrays read and written by Step, <= NUM_OPT_STATES
+		virtual size_t GetNumStates() const = 0;
+		// Update param[0, n) from grad[0, n), unused states are nullptr
+		virtual void Step(const StepArgs& args, data_t* param, const data_t* grad, data_t* state0, data_t* state1, size_t n) const = 0;
+
+		static std::unique_ptr<IOptimizer> Create(EOptimizer eOptimizer);
+	};
+
+	// v = momentum * v + g, w -= lr * v
+	class Sgd : public IOptimizer
+	{
+	public:
+		Sgd(data_t momentum = 0.9f);
+
+		size_t GetNumStates() const override { return 1; }
+		void Step(const StepArgs& args, data_t* param, const data_t* grad, data_t* state0, data_t* state1, size_t n) const override;
+	private:
+		const data_t MOMENTUM;
+	};
+
+	// Step size is 0.001 * sqrt(batch size) * lr, eps is added inside the square root
+	class Adam : public IOptimizer
+	{
+	public:
+		Adam(data_t beta1 = 0.9f, data_t beta2 = 0.999f, data_t eps = 0.000001f);
+
+		size_t GetNumStates() const override { return 2; }
+		void Step(const StepArgs& args, data_t* param, const data_t* grad, data_t* state0, data_t* state1, size_t n) const override;
+	protected:
+		const data_t BETA1;
+		const data_t BETA2;
+		const data_t EPS;
+		data_t mWeightDecay;	// Decoupled, 0 for Adam
+	};
+
+	class AdamW : public Adam
+	{
+	public:
+		AdamW(data_t weightDecay = 0.01f, data_t beta1 = 0.9f, data_t beta2 = 0.999f, data_t eps = 0.000001f);
+	};
+
+	// s = decay * s + (1 - decay) * g^2, w -= lr * g / sqrt(s + eps)
+	class RmsProp : public IOptimizer
+	{
+	public:
+		RmsProp(data_t decay = 0.9f, data_t eps = 0.000001f);
+
+		size_t GetNumStates() const override { return 1; }
+		void Step(const StepArgs& args, data_t* param, const data_t* grad, data_t* state0, data_t* state1, size_t n) const override;
+	private:
+		const data_t DECAY;
+		const data_t EPS;
+	};
+}
\ No newline at end of file
@@ -6,7 +6,10 @@ namespace cnn
 	class PWConv : public Conv
 	{
 	public:
-		PWConv(size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn);
+		PWConv(size_t inLen, size_t inDepth, size_t outLen, size_t outDepth, EActFn eActFn,
+			ELayout eLayout = ELayout::HWC);
 		~PWConv();
+
+		ELayer GetType() const override { return ELayer::PWCONV; }
 	};
 }
\ No newline at end of file
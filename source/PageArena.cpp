@@ -0,0 +1,148 @@
+#include "PageArena.h"
+
+#ifdef _MSC_VER
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace cnn
+{
+	namespace
+	{
+		size_t roundUp(size_t size, size_t unit)
+		{
+			return (size + unit - 1) / unit * unit;
+		}
+
+#ifdef __linux__
+		// Pages of [ptr, ptr + bytes) not touched yet are allocated on node when possible, on another one when it is full
+		void preferNode(void* ptr, size_t bytes, size_t node)
+		{
+			constexpr int MPOL_PREFERRED = 1;
+			constexpr size_t MAX_NODES = 1024;
+			constexpr size_t BITS = 8 * sizeof(unsigned long);
+			unsigned long mask[MAX_NODES / BITS] = {};
+			const size_t ID = GetNodeId(node);
+			if (ID >= MAX_NODES)
+			{
+				return;
+			}
+			mask[ID / BITS] = 1ul << (ID % BITS);
+			// Without libnuma, a failure leaves the first-touch placement
+			syscall(SYS_mbind, ptr, bytes, MPOL_PREFERRED, mask, MAX_NODES + 1, 0);
+		}
+#endif
+	}
+
+	PageArena::PageArena(size_t bytes, size_t node)
+		: mBase(nullptr)
+		, mSize(0)
+		, mUsed(0)
+		, mePages(EPages::HEAP)
+	{
+		Assert(node < GetNumNodes());
+		bytes = roundUp(std::max(bytes, (size_t)1), CACHE_LINE_SIZE);
+#ifdef __linux__
+		void* ptr = MAP_FAILED;
+		if (bytes >= HUGE_PAGE_SIZE)
+		{
+			mSize = roundUp(bytes, HUGE_PAGE_SIZE);
+			ptr = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			mePages = EPages::RESERVED_HUGE;
+			if (ptr == MAP_FAILED)
+			{
+				// No reserved huge pages : map one more to start the region on a huge page boundary, and trim it
+				uint8_t* raw = static_cast<uint8_t*>(mmap(nullptr, mSize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+				if (raw != MAP_FAILED)
+				{
+					uint8_t* aligned = reinterpret_cast<uint8_t*>(roundUp(reinterpret_cast<uintptr_t>(raw), HUGE_PAGE_SIZE));
+					if (aligned > raw)
+					{
+						munmap(raw, aligned - raw);
+					}
+					if (raw + HUGE_PAGE_SIZE > aligned)
+					{
+						munmap(aligned + mSize, raw + HUGE_PAGE_SIZE - aligned);
+					}
+					ptr = aligned;
+					mePages = EPages::SMALL;
+#ifdef MADV_HUGEPAGE
+					if (madvise(ptr, mSize, MADV_HUGEPAGE) == 0)
+					{
+						mePages = EPages::TRANSPARENT_HUGE;
+					}
+#endif
+				}
+			}
+		}
+		else
+		{
+			mSize = roundUp(bytes, static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+			ptr = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			mePages = EPages::SMALL;
+		}
+		if (ptr != MAP_FAILED)
+		{
+			// Before the first touch, which allocates the pages
+			if (GetNumNodes() > 1)
+			{
+				preferNode(ptr, mSize, node);
+			}
+			mBase = static_cast<uint8_t*>(ptr);
+			return;
+		}
+#elif defined(_MSC_VER)
+		const DWORD NODE_ID = static_cast<DWORD>(GetNodeId(node));
+		const size_t LARGE_PAGE_SIZE = GetLargePageMinimum();
+		void* ptr = nullptr;
+		// Large pages need the SeLockMemoryPrivilege
+		if (LARGE_PAGE_SIZE > 0 && bytes >= LARGE_PAGE_SIZE)
+		{
+			mSize = roundUp(bytes, LARGE_PAGE_SIZE);
+			ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, mSize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, NODE_ID);
+			mePages = EPages::RESERVED_HUGE;
+		}
+		if (ptr == nullptr)
+		{
+			mSize = bytes;
+			ptr = VirtualAllocExNuma(GetCurrentProcess(), nullptr, mSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, NODE_ID);
+			mePages = EPages::SMALL;
+		}
+		if (ptr != nullptr)
+		{
+			mBase = static_cast<uint8_t*>(ptr);
+			return;
+		}
+#endif
+		mSize = bytes;
+		mBase = ::Alloc<uint8_t>(mSize);
+		memset(mBase, 0, mSize);
+		mePages = EPages::HEAP;
+	}
+
+	PageArena::~PageArena()
+	{
+		if (mePages == EPages::HEAP)
+		{
+			Free(mBase);
+			return;
+		}
+#ifdef __linux__
+		munmap(mBase, mSize);
+#elif defined(_MSC_VER)
+		VirtualFree(mBase, 0, MEM_RELEASE);
+#endif
+	}
+
+	void* PageArena::carve(size_t bytes)
+	{
+		Assert(mUsed + bytes <= mSize);
+		void* ptr = mBase + mUsed;
+		mUsed = std::min(roundUp(mUsed + bytes, CACHE_LINE_SIZE), mSize);
+		return ptr;
+	}
+}
\ No newline at end of file
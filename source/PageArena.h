@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include "ILayer.h"
+
+namespace cnn
+{
+	constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	// Zero-filled memory for the buffers of one thread, placed on a NUMA node
+	// Arenas of HUGE_PAGE_SIZE and more are backed by 2MB pages : reserved huge pages when the OS has some,
+	// transparent huge pages otherwise. Where huge pages or the placement are not allowed the arena falls back
+	// to normal pages, which the OS puts on the node of the thread touching them first.
+	// Buffers are carved off in order, each starting on a cache line.
+	class PageArena
+	{
+	public:
+		// node in [0, GetNumNodes())
+		PageArena(size_t bytes, size_t node);
+		~PageArena();
+		PageArena(const PageArena&) = delete;
+		PageArena& operator=(const PageArena&) = delete;
+
+		// size values of T, the arena must have room for them
+		template <typename T>
+		T* Alloc(size_t size)
+		{
+			return static_cast<T*>(carve(sizeof(T) * size));
+		}
+
+		size_t GetSize() const { return mSize; }
+		bool IsHugePages() const { return mePages == EPages::RESERVED_HUGE || mePages == EPages::TRANSPARENT_HUGE; }
+	private:
+		enum class EPages
+		{
+			HEAP,				// ::Alloc, nothing else was available
+			SMALL,
+			TRANSPARENT_HUGE,	// Normal pages the OS was asked to merge into huge pages
+			RESERVED_HUGE,		// Pages of the OS's huge page reserve
+		};
+	private:
+		void* carve(size_t bytes);
+	private:
+		uint8_t* mBase;
+		size_t mSize;
+		size_t mUsed;
+		EPages mePages;
+	};
+}
\ No newline at end of file
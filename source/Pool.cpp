@@ -1,125 +1,109 @@
 #include "Pool.h"
+#include "SimdKernels.h"
 #include <iostream>
 
 namespace cnn
 {
-	Pool::Pool(size_t kernelSize, size_t inLen, size_t depth, EActFn eActFn)
-		: ILayer(kernelSize, inLen, depth, inLen / kernelSize, depth, eActFn)
+	Pool::Pool(size_t kernelSize, size_t inLen, size_t depth, EActFn eActFn, ELayout eLayout)
+		: ILayer(kernelSize, inLen, depth, inLen / kernelSize, depth, eActFn, eLayout, eLayout)
 		, mMaxIdxBuf()
 	{
-		for (size_t i = 0; i < NUM_THREAD; i++)
-		{
-			mMaxIdxBuf.push_back(Alloc<unsigned int>(OUTPUT_SIZE));
-		}
+
 	}
 
 	Pool::~Pool()
 	{
+		freeMaxIdxBuf();
+	}
+
+	void Pool::InitBuffers(size_t numImages)
+	{
+		ILayer::InitBuffers(numImages);
+		freeMaxIdxBuf();
 		for (size_t i = 0; i < NUM_THREAD; i++)
 		{
-			Free(mMaxIdxBuf[i]);
+			mMaxIdxBuf.push_back(Alloc<unsigned int>(OUTPUT_SIZE * numImages));
 		}
 	}
 
-	void Pool::Forward(size_t threadIdx)
+	void Pool::freeMaxIdxBuf()
 	{
-		data_t* inBuf = mIn[threadIdx];
-		data_t* outBuf = mOut[threadIdx];
-		unsigned int* maxIdxBuf = mMaxIdxBuf[threadIdx];
-		if (mbUseAvx == false)
+		for (size_t i = 0; i < mMaxIdxBuf.size(); i++)
 		{
-			for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
-			{
-				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
-				{
-					for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
-					{
-						// 2x2 kernel only
-						Assert(KERNEL_LEN == 2);
-						data_t v0 = inBuf[getInIdx(outX * 2 + 0, outY * 2 + 0, outD)];
-						data_t v1 = inBuf[getInIdx(outX * 2 + 1, outY * 2 + 0, outD)];
-						data_t v2 = inBuf[getInIdx(outX * 2 + 0, outY * 2 + 1, outD)];
-						data_t v3 = inBuf[getInIdx(outX * 2 + 1, outY * 2 + 1, outD)];
-						data_t maxVal = v0;
-						unsigned int maxIdx = 0x0;
-						if (v1 > maxVal) { maxVal = v1; maxIdx = 0x1; }
-						if (v2 > maxVal) { maxVal = v2; maxIdx = 0x2; }
-						if (v3 > maxVal) { maxVal = v3; maxIdx = 0x3; }
-						Assert(maxIdx < 4);
-						// Get output
-						outBuf[getOutIdx(outX, outY, outD)] = mActivate(maxVal);
-						// Store max val's idx
-						maxIdxBuf[getMIBufIdx(outX, outY, outD)] = maxIdx;
-					}
-				}
-			}
+			Free(mMaxIdxBuf[i]);
 		}
-		else
+		mMaxIdxBuf.clear();
+	}
+
+	void Pool::Forward(size_t threadIdx, size_t numImages)
+	{
+		Assert(numImages <= mMiniBatch);
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+			data_t* inBuf = mIn[threadIdx] + INPUT_SIZE * n;
+			data_t* outBuf = mOut[threadIdx] + getOutPadSize() * n;
+			unsigned int* maxIdxBuf = mMaxIdxBuf[threadIdx] + OUTPUT_SIZE * n;
+			if (mbUseAvx == false)
 			{
-				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
 				{
-					for (size_t outD = 0; outD < OUTPUT_DEPTH; outD += MM_BLOCK)
+					for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 					{
-						MM_TYPE mmMax = MM_LOAD(&inBuf[getInIdx(outX * KERNEL_LEN, outY * KERNEL_LEN, outD)]);
-						MM_TYPE_I mmMIdx = MM_SETZERO_I();
-						for (size_t kY = 0; kY < KERNEL_LEN; ++kY)
+						for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
 						{
-							for (size_t kX = 0; kX < KERNEL_LEN; ++kX)
-							{
-								MM_TYPE mmIn = MM_LOAD(&inBuf[getInIdx(outX * KERNEL_LEN + kX, outY * KERNEL_LEN + kY, outD)]);
-								MM_TYPE_I mmIdx = MM_SET1_I(static_cast<int>(kY * KERNEL_LEN + kX));
-
-								MM_TYPE mmCmpMask = MM_CMPLT(mmMax, mmIn);
-								// Get max value
-								MM_TYPE mmXorMask = MM_XOR(mmMax, mmIn);
-								mmXorMask = MM_AND(mmXorMask, mmCmpMask);
-								mmMax = MM_XOR(mmMax, mmXorMask);
-								// Get max index
-								MM_TYPE_I mmXorMaskIdx = MM_XOR_I(mmMIdx, mmIdx);
-								mmXorMaskIdx = MM_AND_I(mmXorMaskIdx, MM_CAST_F2I(mmCmpMask));
-								mmMIdx = MM_XOR_I(mmMIdx, mmXorMaskIdx);
-							}
-						}
-						// Get output
-						float* dest = &outBuf[getOutIdx(outX, outY, outD)];
-						MM_STORE(dest, mmMax);
-						for (size_t i = 0; i < MM_BLOCK; ++i)
-						{
-							dest[i] = mActivate(dest[i]);
+							// 2x2 kernel only
+							Assert(KERNEL_LEN == 2);
+							data_t v0 = inBuf[getInIdx(outX * 2 + 0, outY * 2 + 0, outD)];
+							data_t v1 = inBuf[getInIdx(outX * 2 + 1, outY * 2 + 0, outD)];
+							data_t v2 = inBuf[getInIdx(outX * 2 + 0, outY * 2 + 1, outD)];
+							data_t v3 = inBuf[getInIdx(outX * 2 + 1, outY * 2 + 1, outD)];
+							data_t maxVal = v0;
+							unsigned int maxIdx = 0x0;
+							if (v1 > maxVal) { maxVal = v1; maxIdx = 0x1; }
+							if (v2 > maxVal) { maxVal = v2; maxIdx = 0x2; }
+							if (v3 > maxVal) { maxVal = v3; maxIdx = 0x3; }
+							Assert(maxIdx < 4);
+							// Get output
+							outBuf[getOutIdx(outX, outY, outD)] = maxVal;
+							// Store max val's idx
+							maxIdxBuf[getMIBufIdx(outX, outY, outD)] = maxIdx;
 						}
-						//Store max val's idx
-						MM_STORE_I((MM_TYPE_I*)(&maxIdxBuf[getMIBufIdx(outX, outY, outD)]), mmMIdx);
 					}
 				}
 			}
+			else
+			{
+				DispatchSimd<PoolForwardKernel>(KERNEL_LEN, OUTPUT_LEN, OUTPUT_PAD_DEPTH, inBuf, getInShape(), outBuf + getOutIdx(0, 0, 0), getOutShape(),
+					maxIdxBuf, GetTensorShape(meOutLayout, OUTPUT_LEN, OUTPUT_PAD_DEPTH));
+			}
+			activateOutput(outBuf);
 		}
 	}
 
-	void Pool::BackProp(size_t threadIdx)
+	void Pool::BackProp(size_t threadIdx, size_t numImages)
 	{
-		data_t* inBuf = mIn[threadIdx];
-		data_t* outBuf = mOut[threadIdx];
-		data_t* delInBuf = mDeltaIn[threadIdx];
-		data_t* delOutBuf = mDeltaOut[threadIdx];
-		unsigned int* maxIdxBuf = mMaxIdxBuf[threadIdx];
-
-		memset(delOutBuf, 0, sizeof(data_t) * DELTA_OUT_SIZE);
-		for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+		Assert(numImages <= mMiniBatch);
+		for (size_t n = 0; n < numImages; ++n)
 		{
-			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+			data_t* outBuf = mOut[threadIdx] + getOutPadSize() * n;
+			data_t* delInBuf = mDeltaIn[threadIdx] + DELTA_IN_SIZE * n;
+			data_t* delBuf = mDelta[threadIdx] + DELTA_SIZE * n;
+			data_t* delOutBuf = mDeltaOut[threadIdx] + DELTA_OUT_SIZE * n;
+			unsigned int* maxIdxBuf = mMaxIdxBuf[threadIdx] + OUTPUT_SIZE * n;
+
+			computeDelta(outBuf, delInBuf, delBuf);
+			memset(delOutBuf, 0, sizeof(data_t) * DELTA_OUT_SIZE);
+			for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
 			{
-				for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+				for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
 				{
-					data_t outVal = outBuf[getOutIdx(outX, outY, outD)];
-					size_t maxIdx = maxIdxBuf[getMIBufIdx(outX, outY, outD)];
-					size_t inX = outX * 2 + (maxIdx & 1);
-					size_t inY = outY * 2 + (maxIdx >> 1);
-					data_t deltaIn = delInBuf[getDInIdx(outX, outY, outD)];
-					Assert(meActFn == EActFn::RELU);
-					data_t deriv = outVal > 0.f ? 1.f : 0.f;
-					delOutBuf[getDOutIdx(inX, inY, outD)] = deriv * deltaIn;
+					for (size_t outD = 0; outD < OUTPUT_DEPTH; ++outD)
+					{
+						size_t maxIdx = maxIdxBuf[getMIBufIdx(outX, outY, outD)];
+						size_t inX = outX * 2 + (maxIdx & 1);
+						size_t inY = outY * 2 + (maxIdx >> 1);
+						delOutBuf[getDOutIdx(inX, inY, outD)] = delBuf[getDeltaIdx(outX, outY, outD)];
+					}
 				}
 			}
 		}
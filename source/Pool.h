@@ -6,18 +6,32 @@ namespace cnn
 	class Pool : public ILayer
 	{
 	public:
-		Pool(size_t kernelSize, size_t inLen, size_t depth, EActFn eActFn);
+		Pool(size_t kernelSize, size_t inLen, size_t depth, EActFn eActFn, ELayout eLayout = ELayout::HWC);
 		~Pool();
 
-		void Forward(size_t threadIdx) override;
-		void BackProp(size_t threadIdx) override;
+		void Forward(size_t threadIdx, size_t numImages) override;
+		void BackProp(size_t threadIdx, size_t numImages) override;
+		ELayer GetType() const override { return ELayer::POOL; }
+		void InitBuffers(size_t numImages) override;
+	protected:
+		// The positions of the maxima are kept in mMaxIdxBuf
+		bool backPropReadsInput() const override { return false; }
+		size_t getScratchBytes() const override
+		{
+			return sizeof(unsigned int) * OUTPUT_SIZE * mMiniBatch + ILayer::getScratchBytes();
+		}
+		size_t getNumMacs() const override
+		{
+			return OUTPUT_LEN * OUTPUT_LEN * KERNEL_SIZE * OUTPUT_DEPTH;
+		}
 	private:
 		inline size_t getMIBufIdx(size_t x, size_t y, size_t d) const
 		{
-			size_t idx = (OUTPUT_LEN * y + x) * OUTPUT_DEPTH + d;
+			size_t idx = GetTensorIdx(meOutLayout, OUTPUT_LEN, OUTPUT_PAD_DEPTH, x, y, d);
 			Assert(idx < OUTPUT_SIZE);
 			return idx;
 		}
+		void freeMaxIdxBuf();
 	private:
 		std::vector<unsigned int*> mMaxIdxBuf;	// Buffer to store max value's idx
 	};
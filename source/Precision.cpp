@@ -0,0 +1,205 @@
+#include "Precision.h"
+
+namespace cnn
+{
+	namespace
+	{
+		inline uint32_t floatBits(float x)
+		{
+			uint32_t bits;
+			memcpy(&bits, &x, sizeof(bits));
+			return bits;
+		}
+
+		inline float bitsFloat(uint32_t bits)
+		{
+			float x;
+			memcpy(&x, &bits, sizeof(x));
+			return x;
+		}
+
+		// The dropped half is rounded into the kept one, ties to the even kept value
+		inline uint16_t toBf16(float x)
+		{
+			const uint32_t bits = floatBits(x);
+			return static_cast<uint16_t>((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+		}
+
+		inline float fromBf16(uint16_t h)
+		{
+			return bitsFloat(static_cast<uint32_t>(h) << 16);
+		}
+
+		// Magnitudes of 65520 and above become infinity, below 2^-14 subnormal halves
+		uint16_t toFp16(float x)
+		{
+			uint32_t bits = floatBits(x);
+			const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+			bits &= 0x7FFFFFFF;
+			uint16_t h;
+			if (bits >= 0x47800000)
+			{
+				// Out of range, infinity or NaN
+				h = bits > 0x7F800000 ? 0x7E00 : 0x7C00;
+			}
+			else if (bits < 0x38800000)
+			{
+				// Adding 0.5 leaves the subnormal's mantissa rounded in the low bits
+				h = static_cast<uint16_t>(floatBits(bitsFloat(bits) + 0.5f) - 0x3F000000);
+			}
+			else
+			{
+				// Rebias the exponent from 127 to 15 and round the 13 dropped bits, a carry may reach infinity
+				bits += 0xC8000FFF + ((bits >> 13) & 1);
+				h = static_cast<uint16_t>(bits >> 13);
+			}
+			return h | sign;
+		}
+
+		float fromFp16(uint16_t h)
+		{
+			const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+			uint32_t exp = (h >> 10) & 0x1F;
+			uint32_t mant = h & 0x3FF;
+			if (exp == 0x1F)
+			{
+				return bitsFloat(sign | 0x7F800000 | (mant << 13));
+			}
+			if (exp == 0)
+			{
+				if (mant == 0)
+				{
+					return bitsFloat(sign);
+				}
+				// Subnormal : shift the leading 1 into the implicit bit
+				exp = 1;
+				while ((mant & 0x400) == 0)
+				{
+					mant <<= 1;
+					--exp;
+				}
+				mant &= 0x3FF;
+			}
+			return bitsFloat(sign | ((exp + 112) << 23) | (mant << 13));
+		}
+
+		// F16C conversions, 8 values per step : the count done, the rest is left to the caller
+		TARGET("f16c") size_t narrowFp16F16c(const data_t* x, uint16_t* h, size_t n)
+		{
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8)
+			{
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(&h[i]), _mm256_cvtps_ph(_mm256_loadu_ps(&x[i]), _MM_FROUND_TO_NEAREST_INT));
+			}
+			return i;
+		}
+
+		// From the end, as WidenActs : the count left
+		TARGET("f16c") size_t widenFp16F16c(const uint16_t* h, data_t* x, size_t n)
+		{
+			size_t i = n;
+			for (; i >= 8; i -= 8)
+			{
+				_mm256_storeu_ps(&x[i - 8], _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&h[i - 8]))));
+			}
+			return i;
+		}
+
+		// bf16 rounding of toBf16 in integer lanes, 8 values
+		TARGET("avx2") inline __m256i narrowBf16x8(const data_t* p)
+		{
+			const __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(p));
+			const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+			return _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(_mm256_set1_epi32(0x7FFF), odd)), 16);
+		}
+
+		// AVX2 bf16 conversions, 16 and 8 values per step, counted as the F16C ones
+		TARGET("avx2") size_t narrowBf16Avx2(const data_t* x, uint16_t* h, size_t n)
+		{
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16)
+			{
+				// packus interleaves the 128 bit lanes, the permute restores the order
+				const __m256i v = _mm256_packus_epi32(narrowBf16x8(&x[i]), narrowBf16x8(&x[i + 8]));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(&h[i]), _mm256_permute4x64_epi64(v, 0xD8));
+			}
+			return i;
+		}
+
+		TARGET("avx2") size_t widenBf16Avx2(const uint16_t* h, data_t* x, size_t n)
+		{
+			size_t i = n;
+			for (; i >= 8; i -= 8)
+			{
+				const __m256i v = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&h[i - 8])));
+				_mm256_storeu_ps(&x[i - 8], _mm256_castsi256_ps(_mm256_slli_epi32(v, 16)));
+			}
+			return i;
+		}
+	}
+
+	void NarrowActs(EPrecision ePrecision, const data_t* x, uint16_t* h, size_t n)
+	{
+		Assert(ePrecision != EPrecision::FP32);
+		// From the start : in place, h[i] only overwrites x[i / 2], read already
+		size_t i = 0;
+		// Every AVX2 host has F16C
+		if (GetSimd() >= ESimd::AVX2)
+		{
+			if (ePrecision == EPrecision::BF16)
+			{
+				i = narrowBf16Avx2(x, h, n);
+			}
+			else
+			{
+				i = narrowFp16F16c(x, h, n);
+			}
+		}
+		if (ePrecision == EPrecision::BF16)
+		{
+			for (; i < n; ++i)
+			{
+				h[i] = toBf16(x[i]);
+			}
+		}
+		else
+		{
+			for (; i < n; ++i)
+			{
+				h[i] = toFp16(x[i]);
+			}
+		}
+	}
+
+	void WidenActs(EPrecision ePrecision, const uint16_t* h, data_t* x, size_t n)
+	{
+		Assert(ePrecision != EPrecision::FP32);
+		// From the end : in place, x[i] only overwrites h[2i] and h[2i + 1], read already
+		size_t i = n;
+		if (GetSimd() >= ESimd::AVX2)
+		{
+			if (ePrecision == EPrecision::BF16)
+			{
+				i = widenBf16Avx2(h, x, n);
+			}
+			else
+			{
+				i = widenFp16F16c(h, x, n);
+			}
+		}
+		if (ePrecision == EPrecision::BF16)
+		{
+			for (; i > 0; --i)
+			{
+				x[i - 1] = fromBf16(h[i - 1]);
+			}
+		}
+		else
+		{
+			for (; i > 0; --i)
+			{
+				x[i - 1] = fromFp16(h[i - 1]);
+			}
+		}
+	}
+}
\ No newline at end of file
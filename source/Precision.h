@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Conversions between fp32 tensors and their 16 bit storage
+	// Both round to nearest even as the hardware conversions do, so every SIMD level stores the same bits.
+
+	// h[0, n) = x[0, n) in ePrecision(BF16 or FP16), h may be the start of x's memory
+	void NarrowActs(EPrecision ePrecision, const data_t* x, uint16_t* h, size_t n);
+	// x[0, n) = h[0, n) widened from ePrecision, exact, h may be the start of x's memory
+	void WidenActs(EPrecision ePrecision, const uint16_t* h, data_t* x, size_t n);
+}
\ No newline at end of file
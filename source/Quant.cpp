@@ -0,0 +1,282 @@
+#include "Quant.h"
+
+namespace cnn
+{
+	namespace
+	{
+		inline int32_t load4(const uint8_t* p)
+		{
+			int32_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		// Packed GEMM layout : column block of QUANT_N_BLOCK, then groups of QUANT_K_BLOCK rows, then the column
+		inline size_t getPackedIdx(size_t padK, size_t k, size_t j)
+		{
+			return ((j / QUANT_N_BLOCK * (padK / QUANT_K_BLOCK) + k / QUANT_K_BLOCK) * QUANT_N_BLOCK + j % QUANT_N_BLOCK) * QUANT_K_BLOCK
+				+ k % QUANT_K_BLOCK;
+		}
+
+		void gemmScalar(size_t m, const uint8_t* A, size_t lda, const int8_t* W, size_t padK, size_t padN, int32_t* C, size_t ldc)
+		{
+			for (size_t i = 0; i < m; ++i)
+			{
+				for (size_t j = 0; j < padN; ++j)
+				{
+					int32_t sum = 0;
+					for (size_t k = 0; k < padK; ++k)
+					{
+						sum += static_cast<int32_t>(A[i * lda + k]) * W[getPackedIdx(padK, k, j)];
+					}
+					C[i * ldc + j] = sum;
+				}
+			}
+		}
+
+		// u8 x s8 pairs summed to s16 by maddubs, pairs of those summed to s32 by madd with ones
+		TARGET("avx2") inline __m256i dotAvx2(__m256i acc, __m256i a, __m256i b, __m256i ones)
+		{
+			return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_maddubs_epi16(a, b), ones));
+		}
+
+		// 4 rows x 16 columns per tile, every group of 4 bytes of a row is broadcast to all lanes
+		TARGET("avx2") void gemmAvx2(size_t m, const uint8_t* A, size_t lda, const int8_t* W, size_t padK, size_t padN, int32_t* C, size_t ldc)
+		{
+			const __m256i ONES = _mm256_set1_epi16(1);
+			const size_t NUM_QUADS = padK / QUANT_K_BLOCK;
+			for (size_t jb = 0; jb < padN; jb += QUANT_N_BLOCK)
+			{
+				const int8_t* wb = W + jb * padK;
+				size_t i = 0;
+				for (; i + 4 <= m; i += 4)
+				{
+					const uint8_t* a0 = A + i * lda;
+					const uint8_t* a1 = a0 + lda;
+					const uint8_t* a2 = a1 + lda;
+					const uint8_t* a3 = a2 + lda;
+					__m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+					__m256i c10 = _mm256_setzero_si256(), c11 = _mm256_setzero_si256();
+					__m256i c20 = _mm256_setzero_si256(), c21 = _mm256_setzero_si256();
+					__m256i c30 = _mm256_setzero_si256(), c31 = _mm256_setzero_si256();
+					for (size_t q = 0; q < NUM_QUADS; ++q)
+					{
+						const __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(wb + q * 64));
+						const __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(wb + q * 64 + 32));
+						__m256i a;
+						a = _mm256_set1_epi32(load4(a0 + 4 * q)); c00 = dotAvx2(c00, a, b0, ONES); c01 = dotAvx2(c01, a, b1, ONES);
+						a = _mm256_set1_epi32(load4(a1 + 4 * q)); c10 = dotAvx2(c10, a, b0, ONES); c11 = dotAvx2(c11, a, b1, ONES);
+						a = _mm256_set1_epi32(load4(a2 + 4 * q)); c20 = dotAvx2(c20, a, b0, ONES); c21 = dotAvx2(c21, a, b1, ONES);
+						a = _mm256_set1_epi32(load4(a3 + 4 * q)); c30 = dotAvx2(c30, a, b0, ONES); c31 = dotAvx2(c31, a, b1, ONES);
+					}
+					int32_t* c = C + i * ldc + jb;
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c), c00);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c + 8), c01);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c + ldc), c10);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c + ldc + 8), c11);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c + 2 * ldc), c20);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c + 2 * ldc + 8), c21);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c + 3 * ldc), c30);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c + 3 * ldc + 8), c31);
+				}
+				for (; i < m; ++i)
+				{
+					const uint8_t* a0 = A + i * lda;
+					__m256i c00 = _mm256_setzero_si256(), c01 = _mm256_setzero_si256();
+					for (size_t q = 0; q < NUM_QUADS; ++q)
+					{
+						const __m256i a = _mm256_set1_epi32(load4(a0 + 4 * q));
+						c00 = dotAvx2(c00, a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(wb + q * 64)), ONES);
+						c01 = dotAvx2(c01, a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(wb + q * 64 + 32)), ONES);
+					}
+					int32_t* c = C + i * ldc + jb;
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c), c00);
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(c + 8), c01);
+				}
+			}
+		}
+
+		// 6 rows x 16 columns per tile, vpdpbusd sums the 4 products of a lane into int32 directly
+		TARGET("avx512f,avx512vnni") void gemmVnni(size_t m, const uint8_t* A, size_t lda, const int8_t* W, size_t padK, size_t padN, int32_t* C, size_t ldc)
+		{
+			const size_t NUM_QUADS = padK / QUANT_K_BLOCK;
+			for (size_t jb = 0; jb < padN; jb += QUANT_N_BLOCK)
+			{
+				const int8_t* wb = W + jb * padK;
+				size_t i = 0;
+				for (; i + 6 <= m; i += 6)
+				{
+					const uint8_t* a0 = A + i * lda;
+					__m512i c0 = _mm512_setzero_si512(), c1 = _mm512_setzero_si512(), c2 = _mm512_setzero_si512();
+					__m512i c3 = _mm512_setzero_si512(), c4 = _mm512_setzero_si512(), c5 = _mm512_setzero_si512();
+					for (size_t q = 0; q < NUM_QUADS; ++q)
+					{
+						const __m512i b = _mm512_loadu_si512(wb + q * 64);
+						c0 = _mm512_dpbusd_epi32(c0, _mm512_set1_epi32(load4(a0 + 4 * q)), b);
+						c1 = _mm512_dpbusd_epi32(c1, _mm512_set1_epi32(load4(a0 + lda + 4 * q)), b);
+						c2 = _mm512_dpbusd_epi32(c2, _mm512_set1_epi32(load4(a0 + 2 * lda + 4 * q)), b);
+						c3 = _mm512_dpbusd_epi32(c3, _mm512_set1_epi32(load4(a0 + 3 * lda + 4 * q)), b);
+						c4 = _mm512_dpbusd_epi32(c4, _mm512_set1_epi32(load4(a0 + 4 * lda + 4 * q)), b);
+						c5 = _mm512_dpbusd_epi32(c5, _mm512_set1_epi32(load4(a0 + 5 * lda + 4 * q)), b);
+					}
+					int32_t* c = C + i * ldc + jb;
+					_mm512_storeu_si512(c, c0);
+					_mm512_storeu_si512(c + ldc, c1);
+					_mm512_storeu_si512(c + 2 * ldc, c2);
+					_mm512_storeu_si512(c + 3 * ldc, c3);
+					_mm512_storeu_si512(c + 4 * ldc, c4);
+					_mm512_storeu_si512(c + 5 * ldc, c5);
+				}
+				for (; i < m; ++i)
+				{
+					const uint8_t* a0 = A + i * lda;
+					__m512i c0 = _mm512_setzero_si512();
+					for (size_t q = 0; q < NUM_QUADS; ++q)
+					{
+						c0 = _mm512_dpbusd_epi32(c0, _mm512_set1_epi32(load4(a0 + 4 * q)), _mm512_loadu_si512(wb + q * 64));
+					}
+					_mm512_storeu_si512(C + i * ldc + jb, c0);
+				}
+			}
+		}
+
+		// 8 values rounded, offset and clamped as QuantizeActs, in int32 lanes
+		TARGET("avx2") inline __m256i quantize8Avx2(const data_t* p, __m256 mmInv, __m256 mmZero, __m256 mmMax)
+		{
+			__m256 v = _mm256_round_ps(_mm256_mul_ps(_mm256_loadu_ps(p), mmInv), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+			v = _mm256_min_ps(_mm256_max_ps(_mm256_add_ps(v, mmZero), _mm256_setzero_ps()), mmMax);
+			return _mm256_cvtps_epi32(v);
+		}
+
+		// QuantizeActs 32 values per step : the count done, the rest is left to the caller
+		TARGET("avx2") size_t quantizeActsAvx2(data_t invScale, data_t zeroPoint, const data_t* x, uint8_t* q, size_t n)
+		{
+			const __m256 mmInv = _mm256_set1_ps(invScale);
+			const __m256 mmZero = _mm256_set1_ps(zeroPoint);
+			const __m256 mmMax = _mm256_set1_ps(255.f);
+			// packs interleaves the 128 bit lanes, the permute restores the order
+			const __m256i PERM = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+			size_t i = 0;
+			for (; i + 32 <= n; i += 32)
+			{
+				const __m256i v01 = _mm256_packs_epi32(quantize8Avx2(&x[i], mmInv, mmZero, mmMax), quantize8Avx2(&x[i + 8], mmInv, mmZero, mmMax));
+				const __m256i v23 = _mm256_packs_epi32(quantize8Avx2(&x[i + 16], mmInv, mmZero, mmMax), quantize8Avx2(&x[i + 24], mmInv, mmZero, mmMax));
+				const __m256i v = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(v01, v23), PERM);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(&q[i]), v);
+			}
+			return i;
+		}
+	}
+
+	ActQuant GetActQuant(data_t min, data_t max)
+	{
+		min = Min(min, 0.f);
+		max = Max(max, 0.f);
+		if (max - min <= 0.f)
+		{
+			return ActQuant{ 1.f, 0 };
+		}
+		const data_t scale = (max - min) / 255.f;
+		const int32_t zeroPoint = static_cast<int32_t>(std::nearbyint(-min / scale));
+		return ActQuant{ scale, std::min(std::max(zeroPoint, 0), 255) };
+	}
+
+	void QuantizeActs(const ActQuant& aq, const data_t* x, uint8_t* q, size_t n)
+	{
+		// The scale's reciprocal, rounding to nearest even, then the zero point and the clamp in float on every path
+		const data_t INV_SCALE = 1.f / aq.Scale;
+		const data_t ZERO_POINT = static_cast<data_t>(aq.ZeroPoint);
+		size_t i = 0;
+		if (GetSimd() >= ESimd::AVX2)
+		{
+			i = quantizeActsAvx2(INV_SCALE, ZERO_POINT, x, q, n);
+		}
+		for (; i < n; ++i)
+		{
+			const data_t v = std::nearbyint(x[i] * INV_SCALE) + ZERO_POINT;
+			q[i] = static_cast<uint8_t>(Min(Max(v, 0.f), 255.f));
+		}
+	}
+
+	QuantWeights::QuantWeights(const data_t* wgt, size_t k, size_t n, const ActQuant& inQuant, EQuantPack ePack)
+		: K(k)
+		, N(n)
+		, PAD_K(GetQuantPadK(k))
+		, PAD_N(GetQuantPadN(n))
+		, mInQuant(inQuant)
+		, mWgt(Alloc<int8_t>(PAD_K * PAD_N))
+		, mScale(Alloc<data_t>(PAD_N))
+		, mOffset(Alloc<data_t>(PAD_N))
+	{
+		memset(mWgt, 0, PAD_K * PAD_N);
+		memset(mScale, 0, sizeof(data_t) * PAD_N);
+		memset(mOffset, 0, sizeof(data_t) * PAD_N);
+		for (size_t j = 0; j < N; ++j)
+		{
+			data_t maxAbs = 0.f;
+			for (size_t i = 0; i < K; ++i)
+			{
+				maxAbs = Max(maxAbs, std::fabs(wgt[i * N + j]));
+			}
+			const data_t wgtScale = maxAbs > 0.f ? maxAbs / QUANT_WGT_MAX : 1.f;
+			int32_t colSum = 0;
+			for (size_t i = 0; i < K; ++i)
+			{
+				int32_t q = static_cast<int32_t>(std::nearbyint(wgt[i * N + j] / wgtScale));
+				q = std::min(std::max(q, -QUANT_WGT_MAX), QUANT_WGT_MAX);
+				colSum += q;
+				mWgt[ePack == EQuantPack::GEMM ? getPackedIdx(PAD_K, i, j) : i * PAD_N + j] = static_cast<int8_t>(q);
+			}
+			// sum((q - z) * w) = sum(q * w) - z * colSum
+			mScale[j] = inQuant.Scale * wgtScale;
+			mOffset[j] = -mScale[j] * static_cast<data_t>(inQuant.ZeroPoint * colSum);
+		}
+	}
+
+	QuantWeights::~QuantWeights()
+	{
+		Free(mWgt);
+		Free(mScale);
+		Free(mOffset);
+	}
+
+	void QuantWeights::Gemm(size_t m, const uint8_t* A, size_t lda, int32_t* C, size_t ldc) const
+	{
+		Assert(lda >= PAD_K && ldc >= PAD_N);
+		if (GetSimd() == ESimd::AVX512 && HasAvx512Vnni())
+		{
+			gemmVnni(m, A, lda, mWgt, PAD_K, PAD_N, C, ldc);
+		}
+		else if (GetSimd() >= ESimd::AVX2)
+		{
+			gemmAvx2(m, A, lda, mWgt, PAD_K, PAD_N, C, ldc);
+		}
+		else
+		{
+			gemmScalar(m, A, lda, mWgt, PAD_K, PAD_N, C, ldc);
+		}
+	}
+
+	void QuantWeights::Requantize(const int32_t* acc, const data_t* bias, size_t begin, size_t end, data_t* out) const
+	{
+		Assert(begin <= end && end <= N);
+		const data_t* scale = mScale + begin;
+		const data_t* offset = mOffset + begin;
+		const size_t NUM = end - begin;
+		if (bias == nullptr)
+		{
+			for (size_t j = 0; j < NUM; ++j)
+			{
+				out[j] = scale[j] * static_cast<data_t>(acc[j]) + offset[j];
+			}
+		}
+		else
+		{
+			bias += begin;
+			for (size_t j = 0; j < NUM; ++j)
+			{
+				out[j] = scale[j] * static_cast<data_t>(acc[j]) + (offset[j] + bias[j]);
+			}
+		}
+	}
+}
\ No newline at end of file
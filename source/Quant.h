@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Post-training INT8 quantization for inference
+	// Activations are asymmetric uint8 with one scale per tensor, weights symmetric int8 with one scale per output channel.
+	// Products are summed in int32 and converted back to fp32 with the bias in one pass, so layers still exchange fp32 tensors.
+
+	// Weights are limited to [-QUANT_WGT_MAX, QUANT_WGT_MAX] : a pair of uint8 x int8 products then fits
+	// the int16 sums of AVX2 maddubs without saturating, and every kernel gives the same integers.
+	constexpr int32_t QUANT_WGT_MAX = 63;
+	// Dot products consume 4 bytes of K per 32 bit lane, packed columns come in blocks of 16
+	constexpr size_t QUANT_K_BLOCK = 4;
+	constexpr size_t QUANT_N_BLOCK = 16;
+
+	constexpr size_t GetQuantPadK(size_t k)
+	{
+		return (k + QUANT_K_BLOCK - 1) / QUANT_K_BLOCK * QUANT_K_BLOCK;
+	}
+	constexpr size_t GetQuantPadN(size_t n)
+	{
+		return (n + QUANT_N_BLOCK - 1) / QUANT_N_BLOCK * QUANT_N_BLOCK;
+	}
+
+	// x = Scale * (q - ZeroPoint), q in [0, 255]
+	struct ActQuant
+	{
+		data_t Scale;
+		int32_t ZeroPoint;
+	};
+
+	// Covers [min, max] widened to include 0, so zero padding quantizes exactly
+	ActQuant GetActQuant(data_t min, data_t max);
+	// q[0, n) = clamp(round(x / Scale) + ZeroPoint, 0, 255)
+	void QuantizeActs(const ActQuant& aq, const data_t* x, uint8_t* q, size_t n);
+
+	enum class EQuantPack
+	{
+		GEMM,	// Blocks of QUANT_N_BLOCK columns, QUANT_K_BLOCK rows interleaved per column, for Gemm
+		ROWS,	// Row-major K x GetQuantPadN(N), for kernels of their own
+	};
+
+	// A K x N fp32 weight matrix(N output channels, row-major) quantized for inputs quantized by inQuant
+	// The input's zero point and both scales are folded into one multiplier and offset per channel.
+	class QuantWeights
+	{
+	public:
+		QuantWeights(const data_t* wgt, size_t k, size_t n, const ActQuant& inQuant, EQuantPack ePack = EQuantPack::GEMM);
+		~QuantWeights();
+		QuantWeights(const QuantWeights&) = delete;
+		QuantWeights& operator=(const QuantWeights&) = delete;
+
+		// C(M x N) = A(M x K) * W in int32
+		// A is uint8 with rows of lda >= GetPadK() bytes, the bytes between K and GetPadK() may hold anything.
+		// C rows are ldc >= GetPadN() values, the columns past N are written too.
+		void Gemm(size_t m, const uint8_t* A, size_t lda, int32_t* C, size_t ldc) const;
+		// out[0, end - begin) = fp32 of the channels [begin, end) from their int32 sums acc[0, end - begin), plus bias[begin, end)
+		// bias may be nullptr.
+		void Requantize(const int32_t* acc, const data_t* bias, size_t begin, size_t end, data_t* out) const;
+
+		const ActQuant& GetInQuant() const { return mInQuant; }
+		// EQuantPack::ROWS only
+		const int8_t* GetWgt() const { return mWgt; }
+		size_t GetPadK() const { return PAD_K; }
+		size_t GetPadN() const { return PAD_N; }
+	private:
+		const size_t K;
+		const size_t N;
+		const size_t PAD_K;
+		const size_t PAD_N;
+		const ActQuant mInQuant;
+		int8_t* mWgt;
+		// channel j = mScale[j] * sum + mOffset[j]
+		data_t* mScale;
+		data_t* mOffset;
+	};
+}
\ No newline at end of file
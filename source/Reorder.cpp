@@ -0,0 +1,57 @@
+#include "Reorder.h"
+
+namespace cnn
+{
+	Reorder::Reorder(size_t len, size_t depth, ELayout eInLayout, ELayout eOutLayout)
+		: ILayer(1, len, depth, len, depth, EActFn::IDEN, eInLayout, eOutLayout)
+	{
+
+	}
+
+	Reorder::~Reorder()
+	{
+
+	}
+
+	void Reorder::Forward(size_t threadIdx, size_t numImages)
+	{
+		Assert(numImages <= mMiniBatch);
+		const size_t OUT_STRIDE = getOutPadSize();
+		// Padded channels of a BLOCKED output stay zero
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			const data_t* inBuf = mIn[threadIdx] + INPUT_SIZE * n;
+			data_t* outBuf = mOut[threadIdx] + OUT_STRIDE * n;
+			for (size_t y = 0; y < OUTPUT_LEN; ++y)
+			{
+				for (size_t x = 0; x < OUTPUT_LEN; ++x)
+				{
+					for (size_t d = 0; d < OUTPUT_DEPTH; ++d)
+					{
+						outBuf[getOutIdx(x, y, d)] = inBuf[getInIdx(x, y, d)];
+					}
+				}
+			}
+		}
+	}
+
+	void Reorder::BackProp(size_t threadIdx, size_t numImages)
+	{
+		Assert(numImages <= mMiniBatch);
+		for (size_t n = 0; n < numImages; ++n)
+		{
+			const data_t* delInBuf = mDeltaIn[threadIdx] + DELTA_IN_SIZE * n;
+			data_t* delOutBuf = mDeltaOut[threadIdx] + DELTA_OUT_SIZE * n;
+			for (size_t y = 0; y < INPUT_LEN; ++y)
+			{
+				for (size_t x = 0; x < INPUT_LEN; ++x)
+				{
+					for (size_t d = 0; d < INPUT_DEPTH; ++d)
+					{
+						delOutBuf[getDOutIdx(x, y, d)] = delInBuf[getDInIdx(x, y, d)];
+					}
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,24 @@
+#pragma once
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Layout transform stage, inserted by the network between layers whose layouts differ
+	class Reorder : public ILayer
+	{
+	public:
+		Reorder(size_t len, size_t depth, ELayout eInLayout, ELayout eOutLayout);
+		~Reorder();
+
+		void Forward(size_t threadIdx, size_t numImages) override;
+		void BackProp(size_t threadIdx, size_t numImages) override;
+		ELayer GetType() const override { return ELayer::REORDER; }
+	protected:
+		bool backPropReadsInput() const override { return false; }
+		bool backPropReadsOutput() const override { return false; }
+		size_t getNumMacs() const override
+		{
+			return OUTPUT_SIZE;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,215 @@
+#pragma once
+#include "ILayer.h"
+#include "Cpu.h"
+
+namespace cnn
+{
+	// Vector backends of the shared kernels(GEMM, activations, optimizers, reductions)
+	// Every backend has the same static interface over its register type V holding WIDTH floats,
+	// a kernel is written once as a template over the backend and DispatchSimd runs the one GetSimd selects.
+	// Loads and stores are unaligned, LoadN/StoreN touch only the first n(<= WIDTH) lanes and load the rest as 0.
+	// Fmadd(x, y, z) = x * y + z is fused on AVX2 and AVX-512 only.
+
+	struct SimdScalar
+	{
+		using V = float;
+		static constexpr size_t WIDTH = 1;
+
+		static V Zero() { return 0.f; }
+		static V Set1(float x) { return x; }
+		static V Load(const float* p) { return *p; }
+		static void Store(float* p, V v) { *p = v; }
+		static V LoadN(const float* p, size_t n) { return n > 0 ? *p : 0.f; }
+		static void StoreN(float* p, V v, size_t n) { if (n > 0) { *p = v; } }
+
+		static V Add(V x, V y) { return x + y; }
+		static V Sub(V x, V y) { return x - y; }
+		static V Mul(V x, V y) { return x * y; }
+		static V Div(V x, V y) { return x / y; }
+		static V Sqrt(V x) { return std::sqrt(x); }
+		static V Fmadd(V x, V y, V z) { return x * y + z; }
+		static V Max(V x, V y) { return x > y ? x : y; }
+		static V Min(V x, V y) { return x < y ? x : y; }
+		static V Neg(V x) { return -x; }
+		static V Round(V x) { return std::nearbyint(x); }
+		// 1 where x > 0, else 0
+		static V Positive(V x) { return x > 0.f ? 1.f : 0.f; }
+		// 1 where x > y, else 0
+		static V Greater(V x, V y) { return x > y ? 1.f : 0.f; }
+		// x * 2^k for integral k, by adding k to the exponent bits
+		static V Scale2(V x, V k)
+		{
+			int bits;
+			memcpy(&bits, &x, sizeof(bits));
+			bits += static_cast<int>(k) << 23;
+			memcpy(&x, &bits, sizeof(x));
+			return x;
+		}
+		static float HorizSum(V x) { return x; }
+	};
+
+	// SimdSse4 and SimdAvx2 are defined here for the header templates too, see DispatchSimdLocal :
+	// marked for their instruction set, the kernels using them are built by SimdSse4.cpp and SimdAvx2.cpp.
+	struct SimdSse4
+	{
+		using V = __m128;
+		static constexpr size_t WIDTH = 4;
+
+		TARGET("sse4.2") static V Zero() { return _mm_setzero_ps(); }
+		TARGET("sse4.2") static V Set1(float x) { return _mm_set1_ps(x); }
+		TARGET("sse4.2") static V Load(const float* p) { return _mm_loadu_ps(p); }
+		TARGET("sse4.2") static void Store(float* p, V v) { _mm_storeu_ps(p, v); }
+		// No masked moves before AVX, partial vectors go through the stack
+		TARGET("sse4.2") static V LoadN(const float* p, size_t n)
+		{
+			if (n == WIDTH) { return _mm_loadu_ps(p); }
+			alignas(16) float tail[WIDTH] = {};
+			memcpy(tail, p, sizeof(float) * n);
+			return _mm_load_ps(tail);
+		}
+		TARGET("sse4.2") static void StoreN(float* p, V v, size_t n)
+		{
+			if (n == WIDTH) { _mm_storeu_ps(p, v); return; }
+			alignas(16) float tail[WIDTH];
+			_mm_store_ps(tail, v);
+			memcpy(p, tail, sizeof(float) * n);
+		}
+
+		TARGET("sse4.2") static V Add(V x, V y) { return _mm_add_ps(x, y); }
+		TARGET("sse4.2") static V Sub(V x, V y) { return _mm_sub_ps(x, y); }
+		TARGET("sse4.2") static V Mul(V x, V y) { return _mm_mul_ps(x, y); }
+		TARGET("sse4.2") static V Div(V x, V y) { return _mm_div_ps(x, y); }
+		TARGET("sse4.2") static V Sqrt(V x) { return _mm_sqrt_ps(x); }
+		TARGET("sse4.2") static V Fmadd(V x, V y, V z) { return _mm_add_ps(_mm_mul_ps(x, y), z); }
+		TARGET("sse4.2") static V Max(V x, V y) { return _mm_max_ps(x, y); }
+		TARGET("sse4.2") static V Min(V x, V y) { return _mm_min_ps(x, y); }
+		TARGET("sse4.2") static V Neg(V x) { return _mm_xor_ps(x, _mm_set1_ps(-0.f)); }
+		TARGET("sse4.2") static V Round(V x) { return _mm_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+		TARGET("sse4.2") static V Positive(V x) { return _mm_and_ps(_mm_set1_ps(1.f), _mm_cmpgt_ps(x, _mm_setzero_ps())); }
+		TARGET("sse4.2") static V Greater(V x, V y) { return _mm_and_ps(_mm_set1_ps(1.f), _mm_cmpgt_ps(x, y)); }
+		TARGET("sse4.2") static V Scale2(V x, V k)
+		{
+			return _mm_castsi128_ps(_mm_add_epi32(_mm_castps_si128(x), _mm_slli_epi32(_mm_cvtps_epi32(k), 23)));
+		}
+		TARGET("sse4.2") static float HorizSum(V x)
+		{
+			x = _mm_hadd_ps(x, x);
+			x = _mm_hadd_ps(x, x);
+			return _mm_cvtss_f32(x);
+		}
+	};
+
+	struct SimdAvx2
+	{
+		using V = __m256;
+		static constexpr size_t WIDTH = 8;
+
+		TARGET("avx2,fma") static V Zero() { return _mm256_setzero_ps(); }
+		TARGET("avx2,fma") static V Set1(float x) { return _mm256_set1_ps(x); }
+		TARGET("avx2,fma") static V Load(const float* p) { return _mm256_loadu_ps(p); }
+		TARGET("avx2,fma") static void Store(float* p, V v) { _mm256_storeu_ps(p, v); }
+		TARGET("avx2,fma") static V LoadN(const float* p, size_t n) { return MMLoadN(p, n); }
+		TARGET("avx2,fma") static void StoreN(float* p, V v, size_t n) { MMStoreN(p, v, n); }
+
+		TARGET("avx2,fma") static V Add(V x, V y) { return _mm256_add_ps(x, y); }
+		TARGET("avx2,fma") static V Sub(V x, V y) { return _mm256_sub_ps(x, y); }
+		TARGET("avx2,fma") static V Mul(V x, V y) { return _mm256_mul_ps(x, y); }
+		TARGET("avx2,fma") static V Div(V x, V y) { return _mm256_div_ps(x, y); }
+		TARGET("avx2,fma") static V Sqrt(V x) { return _mm256_sqrt_ps(x); }
+		TARGET("avx2,fma") static V Fmadd(V x, V y, V z) { return _mm256_fmadd_ps(x, y, z); }
+		TARGET("avx2,fma") static V Max(V x, V y) { return _mm256_max_ps(x, y); }
+		TARGET("avx2,fma") static V Min(V x, V y) { return _mm256_min_ps(x, y); }
+		TARGET("avx2,fma") static V Neg(V x) { return _mm256_xor_ps(x, _mm256_set1_ps(-0.f)); }
+		TARGET("avx2,fma") static V Round(V x) { return _mm256_round_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+		TARGET("avx2,fma") static V Positive(V x) { return _mm256_and_ps(_mm256_set1_ps(1.f), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ)); }
+		TARGET("avx2,fma") static V Greater(V x, V y) { return _mm256_and_ps(_mm256_set1_ps(1.f), _mm256_cmp_ps(x, y, _CMP_GT_OQ)); }
+		TARGET("avx2,fma") static V Scale2(V x, V k)
+		{
+			return _mm256_castsi256_ps(_mm256_add_epi32(_mm256_castps_si256(x), _mm256_slli_epi32(_mm256_cvtps_epi32(k), 23)));
+		}
+		TARGET("avx2,fma") static float HorizSum(V x) { return MMHorizSum(x); }
+	};
+
+	// Defined in SimdAvx512.cpp, the one translation unit compiled for AVX-512, with the kernels using it
+	struct SimdAvx512
+	{
+		using V = __m512;
+		static constexpr size_t WIDTH = 16;
+
+		TARGET("avx512f") static V Zero();
+		TARGET("avx512f") static V Set1(float x);
+		TARGET("avx512f") static V Load(const float* p);
+		TARGET("avx512f") static void Store(float* p, V v);
+		TARGET("avx512f") static V LoadN(const float* p, size_t n);
+		TARGET("avx512f") static void StoreN(float* p, V v, size_t n);
+
+		TARGET("avx512f") static V Add(V x, V y);
+		TARGET("avx512f") static V Sub(V x, V y);
+		TARGET("avx512f") static V Mul(V x, V y);
+		TARGET("avx512f") static V Div(V x, V y);
+		TARGET("avx512f") static V Sqrt(V x);
+		TARGET("avx512f") static V Fmadd(V x, V y, V z);
+		TARGET("avx512f") static V Max(V x, V y);
+		TARGET("avx512f") static V Min(V x, V y);
+		TARGET("avx512f") static V Neg(V x);
+		TARGET("avx512f") static V Round(V x);
+		TARGET("avx512f") static V Positive(V x);
+		TARGET("avx512f") static V Greater(V x, V y);
+		TARGET("avx512f") static V Scale2(V x, V k);
+		TARGET("avx512f") static float HorizSum(V x);
+	};
+
+	// K<Backend>::Run(args...) with the backend of GetSimd
+	// K<SimdSse4>, K<SimdAvx2> and K<SimdAvx512> must be instantiated in SimdSse4.cpp, SimdAvx2.cpp and SimdAvx512.cpp
+	// and declared extern where K is defined, see SimdKernels.h : the other translation units are built for baseline x86-64.
+	template <template <class> class K, class... Args>
+	inline void DispatchSimd(Args&&... args)
+	{
+		switch (GetSimd())
+		{
+		case ESimd::AVX512:
+			K<SimdAvx512>::Run(std::forward<Args>(args)...);
+			break;
+		case ESimd::AVX2:
+			K<SimdAvx2>::Run(std::forward<Args>(args)...);
+			break;
+		case ESimd::SSE4:
+			K<SimdSse4>::Run(std::forward<Args>(args)...);
+			break;
+		default:
+			K<SimdScalar>::Run(std::forward<Args>(args)...);
+			break;
+		}
+	}
+
+	// The backends the including translation unit can build inline, see DispatchSimdLocal
+	// MSVC compiles any intrinsic, GCC and Clang those of the translation unit's flags only(-msse4.2, -mavx2 -mfma).
+#if defined(_MSC_VER) || (defined(__AVX2__) && defined(__FMA__))
+#define SIMD_LOCAL_AVX2
+#endif
+#if defined(_MSC_VER) || defined(__SSE4_2__)
+#define SIMD_LOCAL_SSE4
+#endif
+
+	// DispatchSimd for the kernels instantiated where they are used, header templates of the including translation unit :
+	// they run on the highest backend of GetSimd the translation unit can build, AVX2 at most.
+	template <template <class> class K, class... Args>
+	inline void DispatchSimdLocal(Args&&... args)
+	{
+#ifdef SIMD_LOCAL_AVX2
+		if (GetSimd() >= ESimd::AVX2)
+		{
+			K<SimdAvx2>::Run(std::forward<Args>(args)...);
+			return;
+		}
+#endif
+#ifdef SIMD_LOCAL_SSE4
+		if (GetSimd() >= ESimd::SSE4)
+		{
+			K<SimdSse4>::Run(std::forward<Args>(args)...);
+			return;
+		}
+#endif
+		K<SimdScalar>::Run(std::forward<Args>(args)...);
+	}
+}
\ No newline at end of file
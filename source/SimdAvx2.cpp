@@ -0,0 +1,43 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "ILayer.h"
+#include "Simd.h"
+
+// Everything below is compiled for AVX2 and FMA, run only when GetSimd() returns ESimd::AVX2
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+#include "SimdKernels.h"
+
+namespace cnn
+{
+	template struct SgemmKernel<SimdAvx2>;
+	template struct ActivateKernel<SimdAvx2>;
+	template struct ActivateBackwardKernel<SimdAvx2>;
+	template struct MulAccKernel<SimdAvx2>;
+	template struct MulConjAccKernel<SimdAvx2>;
+	template struct SgdKernel<SimdAvx2>;
+	template struct AdamKernel<SimdAvx2>;
+	template struct RmsPropKernel<SimdAvx2>;
+	template struct AxpyKernel<SimdAvx2>;
+	template struct ReduceKernel<SimdAvx2>;
+	template struct LinearForwardKernel<SimdAvx2>;
+	template struct LinearBackPropKernel<SimdAvx2>;
+	template struct ConvDirectForwardKernel<SimdAvx2>;
+	template struct ConvDirectBackPropKernel<SimdAvx2>;
+	template struct DwConvForwardKernel<SimdAvx2>;
+	template struct DwConvGradKernel<SimdAvx2>;
+	template struct DwConvDeltaOutKernel<SimdAvx2>;
+	template struct PoolForwardKernel<SimdAvx2>;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
\ No newline at end of file
@@ -0,0 +1,88 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "ILayer.h"
+#include "Simd.h"
+
+// Everything below is compiled for AVX-512, run only when GetSimd() returns ESimd::AVX512
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// The intrinsics leaving lanes undefined(_mm512_max_ps, _mm512_reduce_add_ps ...) self-initialize a register,
+// which GCC reports outside -mavx512f builds
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+#include "SimdKernels.h"
+
+namespace cnn
+{
+	namespace
+	{
+		inline __mmask16 tailMask(size_t n) { return static_cast<__mmask16>((1u << n) - 1); }
+	}
+
+	inline SimdAvx512::V SimdAvx512::Zero() { return _mm512_setzero_ps(); }
+	inline SimdAvx512::V SimdAvx512::Set1(float x) { return _mm512_set1_ps(x); }
+	inline SimdAvx512::V SimdAvx512::Load(const float* p) { return _mm512_loadu_ps(p); }
+	inline void SimdAvx512::Store(float* p, V v) { _mm512_storeu_ps(p, v); }
+	inline SimdAvx512::V SimdAvx512::LoadN(const float* p, size_t n) { return _mm512_maskz_loadu_ps(tailMask(n), p); }
+	inline void SimdAvx512::StoreN(float* p, V v, size_t n) { _mm512_mask_storeu_ps(p, tailMask(n), v); }
+
+	inline SimdAvx512::V SimdAvx512::Add(V x, V y) { return _mm512_add_ps(x, y); }
+	inline SimdAvx512::V SimdAvx512::Sub(V x, V y) { return _mm512_sub_ps(x, y); }
+	inline SimdAvx512::V SimdAvx512::Mul(V x, V y) { return _mm512_mul_ps(x, y); }
+	inline SimdAvx512::V SimdAvx512::Div(V x, V y) { return _mm512_div_ps(x, y); }
+	inline SimdAvx512::V SimdAvx512::Sqrt(V x) { return _mm512_sqrt_ps(x); }
+	inline SimdAvx512::V SimdAvx512::Fmadd(V x, V y, V z) { return _mm512_fmadd_ps(x, y, z); }
+	inline SimdAvx512::V SimdAvx512::Max(V x, V y) { return _mm512_max_ps(x, y); }
+	inline SimdAvx512::V SimdAvx512::Min(V x, V y) { return _mm512_min_ps(x, y); }
+	inline SimdAvx512::V SimdAvx512::Neg(V x)
+	{
+		return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x), _mm512_set1_epi32(0x80000000)));
+	}
+	inline SimdAvx512::V SimdAvx512::Round(V x) { return _mm512_roundscale_ps(x, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	inline SimdAvx512::V SimdAvx512::Positive(V x)
+	{
+		return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_GT_OQ), _mm512_set1_ps(1.f));
+	}
+	inline SimdAvx512::V SimdAvx512::Greater(V x, V y)
+	{
+		return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(x, y, _CMP_GT_OQ), _mm512_set1_ps(1.f));
+	}
+	inline SimdAvx512::V SimdAvx512::Scale2(V x, V k)
+	{
+		return _mm512_castsi512_ps(_mm512_add_epi32(_mm512_castps_si512(x), _mm512_slli_epi32(_mm512_cvtps_epi32(k), 23)));
+	}
+	inline float SimdAvx512::HorizSum(V x) { return _mm512_reduce_add_ps(x); }
+
+	template struct SgemmKernel<SimdAvx512>;
+	template struct ActivateKernel<SimdAvx512>;
+	template struct ActivateBackwardKernel<SimdAvx512>;
+	template struct MulAccKernel<SimdAvx512>;
+	template struct MulConjAccKernel<SimdAvx512>;
+	template struct SgdKernel<SimdAvx512>;
+	template struct AdamKernel<SimdAvx512>;
+	template struct RmsPropKernel<SimdAvx512>;
+	template struct AxpyKernel<SimdAvx512>;
+	template struct ReduceKernel<SimdAvx512>;
+	template struct LinearForwardKernel<SimdAvx512>;
+	template struct LinearBackPropKernel<SimdAvx512>;
+	template struct ConvDirectForwardKernel<SimdAvx512>;
+	template struct ConvDirectBackPropKernel<SimdAvx512>;
+	template struct DwConvForwardKernel<SimdAvx512>;
+	template struct DwConvGradKernel<SimdAvx512>;
+	template struct DwConvDeltaOutKernel<SimdAvx512>;
+	template struct PoolForwardKernel<SimdAvx512>;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
\ No newline at end of file
@@ -0,0 +1,1303 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include "Simd.h"
+
+namespace cnn
+{
+	// The shared kernels, templates over the vector backends of Simd.h run by DispatchSimd
+	// Run is defined out of the class : the translation units including this header instantiate the kernels for SimdScalar only,
+	// SimdSse4.cpp, SimdAvx2.cpp and SimdAvx512.cpp those of their backend, see the extern declarations at the end.
+
+	// Register tile : GEMM_MR rows x 2 vectors of accumulators, GEMM_NR = 2 * WIDTH columns of the backend
+	// 6 x 16 with AVX2, 6 x 32 with AVX-512.
+	constexpr size_t GEMM_MR = 6;
+	// Cache blocks : a packed A block fits in L2, a packed B panel(GEMM_KC x GEMM_NR) fits in L1
+	constexpr size_t GEMM_MC = 120;
+	constexpr size_t GEMM_KC = 256;
+	constexpr size_t GEMM_NC = 1024;
+	// Zero padded B panels of every backend fit in the GEMM_KC x GEMM_NC buffer
+	static_assert(GEMM_NC % (2 * SimdAvx512::WIDTH) == 0, "GEMM_NC must be a multiple of every GEMM_NR");
+
+	// packedA : GEMM_MC x GEMM_KC, packedB : GEMM_KC x GEMM_NC, see Sgemm
+	template <class S>
+	struct SgemmKernel
+	{
+		using V = typename S::V;
+		static constexpr size_t GEMM_NR = 2 * S::WIDTH;
+
+		// Pack mc x kc block of op(A) into panels of GEMM_MR rows, column by column
+		// Rows past mc are zero filled so the micro kernel never branches
+		static void packA(bool transA, const data_t* A, size_t lda, size_t mc, size_t kc, data_t* dest)
+		{
+			for (size_t ir = 0; ir < mc; ir += GEMM_MR)
+			{
+				const size_t mr = std::min(GEMM_MR, mc - ir);
+				if (transA)
+				{
+					for (size_t p = 0; p < kc; ++p)
+					{
+						const data_t* src = &A[p * lda + ir];
+						for (size_t i = 0; i < mr; ++i) { dest[p * GEMM_MR + i] = src[i]; }
+						for (size_t i = mr; i < GEMM_MR; ++i) { dest[p * GEMM_MR + i] = 0.f; }
+					}
+				}
+				else if (mr == GEMM_MR)
+				{
+					const data_t* src = &A[ir * lda];
+					for (size_t p = 0; p < kc; ++p)
+					{
+						dest[p * GEMM_MR + 0] = src[0 * lda + p];
+						dest[p * GEMM_MR + 1] = src[1 * lda + p];
+						dest[p * GEMM_MR + 2] = src[2 * lda + p];
+						dest[p * GEMM_MR + 3] = src[3 * lda + p];
+						dest[p * GEMM_MR + 4] = src[4 * lda + p];
+						dest[p * GEMM_MR + 5] = src[5 * lda + p];
+					}
+				}
+				else
+				{
+					for (size_t p = 0; p < kc; ++p)
+					{
+						for (size_t i = 0; i < mr; ++i) { dest[p * GEMM_MR + i] = A[(ir + i) * lda + p]; }
+						for (size_t i = mr; i < GEMM_MR; ++i) { dest[p * GEMM_MR + i] = 0.f; }
+					}
+				}
+				dest += GEMM_MR * kc;
+			}
+		}
+
+		// Pack kc x nc block of op(B) into panels of GEMM_NR columns, row by row
+		static void packB(bool transB, const data_t* B, size_t ldb, size_t kc, size_t nc, data_t* dest)
+		{
+			for (size_t jr = 0; jr < nc; jr += GEMM_NR)
+			{
+				const size_t nr = std::min((size_t)GEMM_NR, nc - jr);
+				if (transB)
+				{
+					for (size_t j = 0; j < nr; ++j)
+					{
+						const data_t* src = &B[(jr + j) * ldb];
+						for (size_t p = 0; p < kc; ++p) { dest[p * GEMM_NR + j] = src[p]; }
+					}
+					for (size_t j = nr; j < GEMM_NR; ++j)
+					{
+						for (size_t p = 0; p < kc; ++p) { dest[p * GEMM_NR + j] = 0.f; }
+					}
+				}
+				else
+				{
+					for (size_t p = 0; p < kc; ++p)
+					{
+						const data_t* src = &B[p * ldb + jr];
+						for (size_t j = 0; j < nr; ++j) { dest[p * GEMM_NR + j] = src[j]; }
+						for (size_t j = nr; j < GEMM_NR; ++j) { dest[p * GEMM_NR + j] = 0.f; }
+					}
+				}
+				dest += GEMM_NR * kc;
+			}
+		}
+
+		static void storeRow(data_t* dest, V v0, V v1, data_t beta)
+		{
+			if (beta != 0.f)
+			{
+				V mmBeta = S::Set1(beta);
+				v0 = S::Fmadd(S::Load(dest), mmBeta, v0);
+				v1 = S::Fmadd(S::Load(dest + S::WIDTH), mmBeta, v1);
+			}
+			S::Store(dest, v0);
+			S::Store(dest + S::WIDTH, v1);
+		}
+
+		// C(GEMM_MR x GEMM_NR) = packed A panel * packed B panel + beta * C
+		static void microKernel(size_t kc, const data_t* pa, const data_t* pb, data_t* C, size_t ldc, data_t beta)
+		{
+			V c00 = S::Zero(), c01 = S::Zero();
+			V c10 = S::Zero(), c11 = S::Zero();
+			V c20 = S::Zero(), c21 = S::Zero();
+			V c30 = S::Zero(), c31 = S::Zero();
+			V c40 = S::Zero(), c41 = S::Zero();
+			V c50 = S::Zero(), c51 = S::Zero();
+			for (size_t p = 0; p < kc; ++p)
+			{
+				V b0 = S::Load(pb);
+				V b1 = S::Load(pb + S::WIDTH);
+				V a;
+				a = S::Set1(pa[0]); c00 = S::Fmadd(a, b0, c00); c01 = S::Fmadd(a, b1, c01);
+				a = S::Set1(pa[1]); c10 = S::Fmadd(a, b0, c10); c11 = S::Fmadd(a, b1, c11);
+				a = S::Set1(pa[2]); c20 = S::Fmadd(a, b0, c20); c21 = S::Fmadd(a, b1, c21);
+				a = S::Set1(pa[3]); c30 = S::Fmadd(a, b0, c30); c31 = S::Fmadd(a, b1, c31);
+				a = S::Set1(pa[4]); c40 = S::Fmadd(a, b0, c40); c41 = S::Fmadd(a, b1, c41);
+				a = S::Set1(pa[5]); c50 = S::Fmadd(a, b0, c50); c51 = S::Fmadd(a, b1, c51);
+				pa += GEMM_MR;
+				pb += GEMM_NR;
+			}
+			storeRow(C + 0 * ldc, c00, c01, beta);
+			storeRow(C + 1 * ldc, c10, c11, beta);
+			storeRow(C + 2 * ldc, c20, c21, beta);
+			storeRow(C + 3 * ldc, c30, c31, beta);
+			storeRow(C + 4 * ldc, c40, c41, beta);
+			storeRow(C + 5 * ldc, c50, c51, beta);
+		}
+
+		// Partial tile at the bottom/right border of C
+		static void edgeKernel(size_t kc, const data_t* pa, const data_t* pb, data_t* C, size_t ldc, data_t beta, size_t mr, size_t nr)
+		{
+			alignas(MM_ALIGNMENT) data_t tile[GEMM_MR * GEMM_NR];
+			microKernel(kc, pa, pb, tile, GEMM_NR, 0.f);
+			for (size_t i = 0; i < mr; ++i)
+			{
+				for (size_t j = 0; j < nr; ++j)
+				{
+					data_t& dest = C[i * ldc + j];
+					dest = beta != 0.f ? tile[i * GEMM_NR + j] + beta * dest : tile[i * GEMM_NR + j];
+				}
+			}
+		}
+
+		static void Run(data_t* packedA, data_t* packedB, bool transA, bool transB, size_t M, size_t N, size_t K,
+			const data_t* A, size_t lda, const data_t* B, size_t ldb,
+			data_t beta, data_t* C, size_t ldc);
+	};
+
+	template <class S>
+	void SgemmKernel<S>::Run(data_t* packedA, data_t* packedB, bool transA, bool transB, size_t M, size_t N, size_t K,
+		const data_t* A, size_t lda, const data_t* B, size_t ldb,
+		data_t beta, data_t* C, size_t ldc)
+	{
+		for (size_t jc = 0; jc < N; jc += GEMM_NC)
+		{
+			const size_t nc = std::min(GEMM_NC, N - jc);
+			for (size_t pc = 0; pc < K; pc += GEMM_KC)
+			{
+				const size_t kc = std::min(GEMM_KC, K - pc);
+				// Later K blocks accumulate onto the first one
+				const data_t currBeta = pc == 0 ? beta : 1.f;
+				packB(transB, transB ? &B[jc * ldb + pc] : &B[pc * ldb + jc], ldb, kc, nc, packedB);
+				for (size_t ic = 0; ic < M; ic += GEMM_MC)
+				{
+					const size_t mc = std::min(GEMM_MC, M - ic);
+					packA(transA, transA ? &A[pc * lda + ic] : &A[ic * lda + pc], lda, mc, kc, packedA);
+					for (size_t jr = 0; jr < nc; jr += GEMM_NR)
+					{
+						const size_t nr = std::min((size_t)GEMM_NR, nc - jr);
+						const data_t* pb = &packedB[jr * kc];
+						for (size_t ir = 0; ir < mc; ir += GEMM_MR)
+						{
+							const size_t mr = std::min(GEMM_MR, mc - ir);
+							const data_t* pa = &packedA[ir * kc];
+							data_t* c = &C[(ic + ir) * ldc + jc + jr];
+							if (mr == GEMM_MR && nr == GEMM_NR)
+							{
+								microKernel(kc, pa, pb, c, ldc, currBeta);
+							}
+							else
+							{
+								edgeKernel(kc, pa, pb, c, ldc, currBeta, mr, nr);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// exp(x) = 2^k * exp(r), k = round(x / ln2), r = x - k * ln2 in [-ln2 / 2, ln2 / 2]
+	template <class S>
+	inline typename S::V mmExp(typename S::V x)
+	{
+		using V = typename S::V;
+		// Outside of this range exp under/overflows, clamping keeps 2^k a normal float
+		x = S::Min(S::Max(x, S::Set1(-87.3f)), S::Set1(88.3f));
+		V k = S::Round(S::Mul(x, S::Set1(1.44269504f)));
+		// ln2 split in two so k * ln2 is exact in the first part
+		V r = S::Fmadd(k, S::Set1(-0.693359375f), x);
+		r = S::Fmadd(k, S::Set1(2.12194440e-4f), r);
+		// Taylor coefficients of exp(r)
+		V p = S::Set1(1.f / 720.f);
+		p = S::Fmadd(p, r, S::Set1(1.f / 120.f));
+		p = S::Fmadd(p, r, S::Set1(1.f / 24.f));
+		p = S::Fmadd(p, r, S::Set1(1.f / 6.f));
+		p = S::Fmadd(p, r, S::Set1(0.5f));
+		p = S::Fmadd(p, r, S::Set1(1.f));
+		p = S::Fmadd(p, r, S::Set1(1.f));
+		return S::Scale2(p, k);
+	}
+
+	template <class S, EActFn E>
+	inline typename S::V mmActivate(typename S::V x)
+	{
+		using V = typename S::V;
+		const V mmOne = S::Set1(1.f);
+		switch (E)
+		{
+		case EActFn::RELU:
+			return S::Max(x, S::Zero());
+		case EActFn::SIGMOID:
+			// 1 / (1 + e^-x)
+			return S::Div(mmOne, S::Add(mmOne, mmExp<S>(S::Neg(x))));
+		case EActFn::TANH:
+			// 1 - 2 / (e^2x + 1)
+			return S::Sub(mmOne, S::Div(S::Set1(2.f), S::Add(mmExp<S>(S::Add(x, x)), mmOne)));
+		case EActFn::IDEN:
+			return x;
+		default:
+			Assert(false);
+			return x;
+		}
+	}
+
+	template <class S, EActFn E>
+	inline typename S::V mmDeriv(typename S::V out)
+	{
+		using V = typename S::V;
+		const V mmOne = S::Set1(1.f);
+		switch (E)
+		{
+		case EActFn::RELU:
+			return S::Positive(out);
+		case EActFn::SIGMOID:
+			return S::Mul(out, S::Sub(mmOne, out));
+		case EActFn::TANH:
+			return S::Sub(mmOne, S::Mul(out, out));
+		case EActFn::IDEN:
+			return mmOne;
+		default:
+			Assert(false);
+			return mmOne;
+		}
+	}
+
+	// The switch is hoisted out of the loops : every function gets its own loop
+	// The tail is a masked vector, so every element gets the same approximation.
+	template <class S>
+	struct ActivateKernel
+	{
+		template <EActFn E>
+		static void activate(data_t* x, size_t n)
+		{
+			size_t i = 0;
+			for (; i + S::WIDTH <= n; i += S::WIDTH)
+			{
+				S::Store(&x[i], mmActivate<S, E>(S::Load(&x[i])));
+			}
+			if (i < n)
+			{
+				S::StoreN(&x[i], mmActivate<S, E>(S::LoadN(&x[i], n - i)), n - i);
+			}
+		}
+
+		static void Run(EActFn eActFn, data_t* x, size_t n);
+	};
+
+	template <class S>
+	void ActivateKernel<S>::Run(EActFn eActFn, data_t* x, size_t n)
+	{
+		switch (eActFn)
+		{
+		case EActFn::RELU:
+			activate<EActFn::RELU>(x, n);
+			break;
+		case EActFn::SIGMOID:
+			activate<EActFn::SIGMOID>(x, n);
+			break;
+		case EActFn::TANH:
+			activate<EActFn::TANH>(x, n);
+			break;
+		case EActFn::IDEN:
+			break;
+		default:
+			Assert(false);
+			break;
+		}
+	}
+
+	template <class S>
+	struct ActivateBackwardKernel
+	{
+		template <EActFn E>
+		static void activateBackward(const data_t* out, const data_t* deltaIn, data_t* delta, size_t n)
+		{
+			size_t i = 0;
+			for (; i + S::WIDTH <= n; i += S::WIDTH)
+			{
+				S::Store(&delta[i], S::Mul(S::Load(&deltaIn[i]), mmDeriv<S, E>(S::Load(&out[i]))));
+			}
+			if (i < n)
+			{
+				S::StoreN(&delta[i], S::Mul(S::LoadN(&deltaIn[i], n - i), mmDeriv<S, E>(S::LoadN(&out[i], n - i))), n - i);
+			}
+		}
+
+		static void Run(EActFn eActFn, const data_t* out, const data_t* deltaIn, data_t* delta, size_t n);
+	};
+
+	template <class S>
+	void ActivateBackwardKernel<S>::Run(EActFn eActFn, const data_t* out, const data_t* deltaIn, data_t* delta, size_t n)
+	{
+		switch (eActFn)
+		{
+		case EActFn::RELU:
+			activateBackward<EActFn::RELU>(out, deltaIn, delta, n);
+			break;
+		case EActFn::SIGMOID:
+			activateBackward<EActFn::SIGMOID>(out, deltaIn, delta, n);
+			break;
+		case EActFn::TANH:
+			activateBackward<EActFn::TANH>(out, deltaIn, delta, n);
+			break;
+		case EActFn::IDEN:
+			if (delta != deltaIn)
+			{
+				memmove(delta, deltaIn, sizeof(data_t) * n);
+			}
+			break;
+		default:
+			Assert(false);
+			break;
+		}
+	}
+
+	template <class S>
+	struct MulAccKernel
+	{
+		static void Run(size_t n, const data_t* xRe, const data_t* xIm, const data_t* yRe, const data_t* yIm, data_t* accRe, data_t* accIm);
+	};
+
+	template <class S>
+	void MulAccKernel<S>::Run(size_t n, const data_t* xRe, const data_t* xIm, const data_t* yRe, const data_t* yIm, data_t* accRe, data_t* accIm)
+	{
+		using V = typename S::V;
+		size_t i = 0;
+		for (; i + S::WIDTH <= n; i += S::WIDTH)
+		{
+			V mmXRe = S::Load(&xRe[i]);
+			V mmXIm = S::Load(&xIm[i]);
+			V mmYRe = S::Load(&yRe[i]);
+			V mmYIm = S::Load(&yIm[i]);
+			// (a + bi)(c + di) = (ac - bd) + (ad + bc)i
+			V mmRe = S::Fmadd(mmXRe, mmYRe, S::Load(&accRe[i]));
+			mmRe = S::Fmadd(S::Neg(mmXIm), mmYIm, mmRe);
+			V mmIm = S::Fmadd(mmXRe, mmYIm, S::Load(&accIm[i]));
+			mmIm = S::Fmadd(mmXIm, mmYRe, mmIm);
+			S::Store(&accRe[i], mmRe);
+			S::Store(&accIm[i], mmIm);
+		}
+		for (; i < n; ++i)
+		{
+			accRe[i] += xRe[i] * yRe[i] - xIm[i] * yIm[i];
+			accIm[i] += xRe[i] * yIm[i] + xIm[i] * yRe[i];
+		}
+	}
+
+	template <class S>
+	struct MulConjAccKernel
+	{
+		static void Run(size_t n, const data_t* xRe, const data_t* xIm, const data_t* yRe, const data_t* yIm, data_t* accRe, data_t* accIm);
+	};
+
+	template <class S>
+	void MulConjAccKernel<S>::Run(size_t n, const data_t* xRe, const data_t* xIm, const data_t* yRe, const data_t* yIm, data_t* accRe, data_t* accIm)
+	{
+		using V = typename S::V;
+		size_t i = 0;
+		for (; i + S::WIDTH <= n; i += S::WIDTH)
+		{
+			V mmXRe = S::Load(&xRe[i]);
+			V mmXIm = S::Load(&xIm[i]);
+			V mmYRe = S::Load(&yRe[i]);
+			V mmYIm = S::Load(&yIm[i]);
+			// (a + bi)(c - di) = (ac + bd) + (bc - ad)i
+			V mmRe = S::Fmadd(mmXRe, mmYRe, S::Load(&accRe[i]));
+			mmRe = S::Fmadd(mmXIm, mmYIm, mmRe);
+			V mmIm = S::Fmadd(mmXIm, mmYRe, S::Load(&accIm[i]));
+			mmIm = S::Fmadd(S::Neg(mmXRe), mmYIm, mmIm);
+			S::Store(&accRe[i], mmRe);
+			S::Store(&accIm[i], mmIm);
+		}
+		for (; i < n; ++i)
+		{
+			accRe[i] += xRe[i] * yRe[i] + xIm[i] * yIm[i];
+			accIm[i] += xIm[i] * yRe[i] - xRe[i] * yIm[i];
+		}
+	}
+
+	// Update rules over the vector backends, a chunk's tail is one masked vector
+	template <class S>
+	struct SgdKernel
+	{
+		static void Run(data_t inv, data_t momentum, data_t negLr, data_t* param, const data_t* grad, data_t* velo, size_t n);
+	};
+
+	template <class S>
+	void SgdKernel<S>::Run(data_t inv, data_t momentum, data_t negLr, data_t* param, const data_t* grad, data_t* velo, size_t n)
+	{
+		using V = typename S::V;
+		const V mmInv = S::Set1(inv);
+		const V mmMomentum = S::Set1(momentum);
+		const V mmNegLr = S::Set1(negLr);
+		for (size_t i = 0; i < n; i += S::WIDTH)
+		{
+			const size_t NUM_LANES = std::min((size_t)S::WIDTH, n - i);
+			V mmGrad = S::Mul(S::LoadN(&grad[i], NUM_LANES), mmInv);
+			V mmVelo = S::Fmadd(S::LoadN(&velo[i], NUM_LANES), mmMomentum, mmGrad);
+			S::StoreN(&velo[i], mmVelo, NUM_LANES);
+			S::StoreN(&param[i], S::Fmadd(mmVelo, mmNegLr, S::LoadN(&param[i], NUM_LANES)), NUM_LANES);
+		}
+	}
+
+	struct AdamConsts
+	{
+		data_t Inv;
+		data_t B1;
+		data_t B2;
+		data_t Step;
+		data_t C2;
+		data_t Eps;
+		data_t Keep;
+	};
+
+	template <class S>
+	struct AdamKernel
+	{
+		static void Run(const AdamConsts& k, data_t* param, const data_t* grad, data_t* mt, data_t* vt, size_t n);
+	};
+
+	template <class S>
+	void AdamKernel<S>::Run(const AdamConsts& k, data_t* param, const data_t* grad, data_t* mt, data_t* vt, size_t n)
+	{
+		using V = typename S::V;
+		const V mmInv = S::Set1(k.Inv);
+		const V mmB1 = S::Set1(k.B1);
+		const V mmB2 = S::Set1(k.B2);
+		const V mmOneMinusB1 = S::Set1(1.f - k.B1);
+		const V mmOneMinusB2 = S::Set1(1.f - k.B2);
+		const V mmStep = S::Set1(k.Step);
+		const V mmC2 = S::Set1(k.C2);
+		const V mmEps = S::Set1(k.Eps);
+		const V mmKeep = S::Set1(k.Keep);
+		for (size_t i = 0; i < n; i += S::WIDTH)
+		{
+			const size_t NUM_LANES = std::min((size_t)S::WIDTH, n - i);
+			V mmGrad = S::Mul(S::LoadN(&grad[i], NUM_LANES), mmInv);
+			V mmM = S::Fmadd(S::LoadN(&mt[i], NUM_LANES), mmB1, S::Mul(mmGrad, mmOneMinusB1));
+			V mmV = S::Fmadd(S::LoadN(&vt[i], NUM_LANES), mmB2, S::Mul(S::Mul(mmGrad, mmGrad), mmOneMinusB2));
+			S::StoreN(&mt[i], mmM, NUM_LANES);
+			S::StoreN(&vt[i], mmV, NUM_LANES);
+			V mmDenom = S::Sqrt(S::Fmadd(mmV, mmC2, mmEps));
+			V mmParam = S::Mul(S::LoadN(&param[i], NUM_LANES), mmKeep);
+			S::StoreN(&param[i], S::Sub(mmParam, S::Div(S::Mul(mmM, mmStep), mmDenom)), NUM_LANES);
+		}
+	}
+
+	template <class S>
+	struct RmsPropKernel
+	{
+		static void Run(data_t inv, data_t decay, data_t lr, data_t eps, data_t* param, const data_t* grad, data_t* sq, size_t n);
+	};
+
+	template <class S>
+	void RmsPropKernel<S>::Run(data_t inv, data_t decay, data_t lr, data_t eps, data_t* param, const data_t* grad, data_t* sq, size_t n)
+	{
+		using V = typename S::V;
+		const V mmInv = S::Set1(inv);
+		const V mmDecay = S::Set1(decay);
+		const V mmOneMinusDecay = S::Set1(1.f - decay);
+		const V mmLr = S::Set1(lr);
+		const V mmEps = S::Set1(eps);
+		for (size_t i = 0; i < n; i += S::WIDTH)
+		{
+			const size_t NUM_LANES = std::min((size_t)S::WIDTH, n - i);
+			V mmGrad = S::Mul(S::LoadN(&grad[i], NUM_LANES), mmInv);
+			V mmSq = S::Fmadd(S::LoadN(&sq[i], NUM_LANES), mmDecay, S::Mul(S::Mul(mmGrad, mmGrad), mmOneMinusDecay));
+			S::StoreN(&sq[i], mmSq, NUM_LANES);
+			V mmDelta = S::Div(S::Mul(mmGrad, mmLr), S::Sqrt(S::Add(mmSq, mmEps)));
+			S::StoreN(&param[i], S::Sub(S::LoadN(&param[i], NUM_LANES), mmDelta), NUM_LANES);
+		}
+	}
+
+	// y += a * x
+	template <class S>
+	struct AxpyKernel
+	{
+		static void Run(data_t a, const data_t* x, data_t* y, size_t n);
+	};
+
+	template <class S>
+	void AxpyKernel<S>::Run(data_t a, const data_t* x, data_t* y, size_t n)
+	{
+		size_t i = 0;
+		typename S::V mmA = S::Set1(a);
+		for (; i + S::WIDTH <= n; i += S::WIDTH)
+		{
+			S::Store(&y[i], S::Fmadd(mmA, S::Load(&x[i]), S::Load(&y[i])));
+		}
+		for (; i < n; ++i)
+		{
+			y[i] += a * x[i];
+		}
+	}
+
+	template <class S>
+	struct ReduceKernel
+	{
+		static void Run(const std::vector<data_t*>& diffs, size_t begin, size_t end);
+	};
+
+	template <class S>
+	void ReduceKernel<S>::Run(const std::vector<data_t*>& diffs, size_t begin, size_t end)
+	{
+		using V = typename S::V;
+		const size_t NUM_COPIES = diffs.size();
+		data_t* dest = diffs[0];
+		size_t i = begin;
+		// Four vectors per pass, accumulated in registers over all copies : one read of every copy, one write
+		for (; i + 4 * S::WIDTH <= end; i += 4 * S::WIDTH)
+		{
+			V mmSum0 = S::Load(&dest[i]);
+			V mmSum1 = S::Load(&dest[i + S::WIDTH]);
+			V mmSum2 = S::Load(&dest[i + 2 * S::WIDTH]);
+			V mmSum3 = S::Load(&dest[i + 3 * S::WIDTH]);
+			for (size_t c = 1; c < NUM_COPIES; ++c)
+			{
+				const data_t* src = diffs[c];
+				mmSum0 = S::Add(mmSum0, S::Load(&src[i]));
+				mmSum1 = S::Add(mmSum1, S::Load(&src[i + S::WIDTH]));
+				mmSum2 = S::Add(mmSum2, S::Load(&src[i + 2 * S::WIDTH]));
+				mmSum3 = S::Add(mmSum3, S::Load(&src[i + 3 * S::WIDTH]));
+			}
+			S::Store(&dest[i], mmSum0);
+			S::Store(&dest[i + S::WIDTH], mmSum1);
+			S::Store(&dest[i + 2 * S::WIDTH], mmSum2);
+			S::Store(&dest[i + 3 * S::WIDTH], mmSum3);
+		}
+		for (; i < end; ++i)
+		{
+			data_t sum = dest[i];
+			for (size_t c = 1; c < NUM_COPIES; ++c)
+			{
+				sum += diffs[c][i];
+			}
+			dest[i] = sum;
+		}
+	}
+
+	// Linear layers of a few images, too few rows for packing them into Sgemm, see Linear
+	// Y(m x n) += X(m x k) * A(k x n) : rows 4 at a time with A streamed once for them, the rest one by one
+	template <class S>
+	struct LinearForwardKernel
+	{
+		using V = typename S::V;
+
+		// Y(4 x n) += X(4 x k) * A(k x n), A is streamed once in strips of 2 vectors
+		static void gemmRows4(size_t n, size_t k, const data_t* X, size_t ldx, const data_t* A, size_t lda, data_t* Y, size_t ldy)
+		{
+			const data_t* x0 = X;
+			const data_t* x1 = X + ldx;
+			const data_t* x2 = X + 2 * ldx;
+			const data_t* x3 = X + 3 * ldx;
+			data_t* y0 = Y;
+			data_t* y1 = Y + ldy;
+			data_t* y2 = Y + 2 * ldy;
+			data_t* y3 = Y + 3 * ldy;
+			size_t j = 0;
+			for (; j + 2 * S::WIDTH <= n; j += 2 * S::WIDTH)
+			{
+				V c00 = S::Load(&y0[j]), c01 = S::Load(&y0[j + S::WIDTH]);
+				V c10 = S::Load(&y1[j]), c11 = S::Load(&y1[j + S::WIDTH]);
+				V c20 = S::Load(&y2[j]), c21 = S::Load(&y2[j + S::WIDTH]);
+				V c30 = S::Load(&y3[j]), c31 = S::Load(&y3[j + S::WIDTH]);
+				for (size_t p = 0; p < k; ++p)
+				{
+					V b0 = S::Load(&A[p * lda + j]);
+					V b1 = S::Load(&A[p * lda + j + S::WIDTH]);
+					V a;
+					a = S::Set1(x0[p]); c00 = S::Fmadd(a, b0, c00); c01 = S::Fmadd(a, b1, c01);
+					a = S::Set1(x1[p]); c10 = S::Fmadd(a, b0, c10); c11 = S::Fmadd(a, b1, c11);
+					a = S::Set1(x2[p]); c20 = S::Fmadd(a, b0, c20); c21 = S::Fmadd(a, b1, c21);
+					a = S::Set1(x3[p]); c30 = S::Fmadd(a, b0, c30); c31 = S::Fmadd(a, b1, c31);
+				}
+				S::Store(&y0[j], c00); S::Store(&y0[j + S::WIDTH], c01);
+				S::Store(&y1[j], c10); S::Store(&y1[j + S::WIDTH], c11);
+				S::Store(&y2[j], c20); S::Store(&y2[j + S::WIDTH], c21);
+				S::Store(&y3[j], c30); S::Store(&y3[j + S::WIDTH], c31);
+			}
+			for (; j + S::WIDTH <= n; j += S::WIDTH)
+			{
+				V c0 = S::Load(&y0[j]);
+				V c1 = S::Load(&y1[j]);
+				V c2 = S::Load(&y2[j]);
+				V c3 = S::Load(&y3[j]);
+				for (size_t p = 0; p < k; ++p)
+				{
+					V b = S::Load(&A[p * lda + j]);
+					c0 = S::Fmadd(S::Set1(x0[p]), b, c0);
+					c1 = S::Fmadd(S::Set1(x1[p]), b, c1);
+					c2 = S::Fmadd(S::Set1(x2[p]), b, c2);
+					c3 = S::Fmadd(S::Set1(x3[p]), b, c3);
+				}
+				S::Store(&y0[j], c0);
+				S::Store(&y1[j], c1);
+				S::Store(&y2[j], c2);
+				S::Store(&y3[j], c3);
+			}
+			for (; j < n; ++j)
+			{
+				for (size_t p = 0; p < k; ++p)
+				{
+					const data_t b = A[p * lda + j];
+					y0[j] += x0[p] * b;
+					y1[j] += x1[p] * b;
+					y2[j] += x2[p] * b;
+					y3[j] += x3[p] * b;
+				}
+			}
+		}
+
+		// y(n) += x(k) * A(k x n), a strip of 4 vectors is accumulated over all rows of A
+		static void gemv(size_t n, size_t k, const data_t* x, const data_t* A, size_t lda, data_t* y)
+		{
+			size_t j = 0;
+			for (; j + 4 * S::WIDTH <= n; j += 4 * S::WIDTH)
+			{
+				V c0 = S::Load(&y[j]);
+				V c1 = S::Load(&y[j + S::WIDTH]);
+				V c2 = S::Load(&y[j + 2 * S::WIDTH]);
+				V c3 = S::Load(&y[j + 3 * S::WIDTH]);
+				for (size_t p = 0; p < k; ++p)
+				{
+					const data_t* row = &A[p * lda + j];
+					V a = S::Set1(x[p]);
+					c0 = S::Fmadd(a, S::Load(row), c0);
+					c1 = S::Fmadd(a, S::Load(row + S::WIDTH), c1);
+					c2 = S::Fmadd(a, S::Load(row + 2 * S::WIDTH), c2);
+					c3 = S::Fmadd(a, S::Load(row + 3 * S::WIDTH), c3);
+				}
+				S::Store(&y[j], c0);
+				S::Store(&y[j + S::WIDTH], c1);
+				S::Store(&y[j + 2 * S::WIDTH], c2);
+				S::Store(&y[j + 3 * S::WIDTH], c3);
+			}
+			for (; j + S::WIDTH <= n; j += S::WIDTH)
+			{
+				V c = S::Load(&y[j]);
+				for (size_t p = 0; p < k; ++p)
+				{
+					c = S::Fmadd(S::Set1(x[p]), S::Load(&A[p * lda + j]), c);
+				}
+				S::Store(&y[j], c);
+			}
+			for (; j < n; ++j)
+			{
+				data_t sum = y[j];
+				for (size_t p = 0; p < k; ++p)
+				{
+					sum += x[p] * A[p * lda + j];
+				}
+				y[j] = sum;
+			}
+		}
+
+		static void Run(size_t m, size_t n, size_t k, const data_t* X, size_t ldx, const data_t* A, size_t lda, data_t* Y, size_t ldy);
+	};
+
+	template <class S>
+	void LinearForwardKernel<S>::Run(size_t m, size_t n, size_t k, const data_t* X, size_t ldx, const data_t* A, size_t lda, data_t* Y, size_t ldy)
+	{
+		size_t i = 0;
+		for (; i + 4 <= m; i += 4)
+		{
+			gemmRows4(n, k, &X[i * ldx], ldx, A, lda, &Y[i * ldy], ldy);
+		}
+		for (; i < m; ++i)
+		{
+			gemv(n, k, &X[i * ldx], A, lda, &Y[i * ldy]);
+		}
+	}
+
+	// Y(m x k) = D(m x n) * A(k x n)^T, then C(k x n) += X(m x k)^T * D(m x n)
+	template <class S>
+	struct LinearBackPropKernel
+	{
+		using V = typename S::V;
+
+		// Returns a(n) . b(n)
+		static data_t dot(size_t n, const data_t* a, const data_t* b)
+		{
+			V mmSum = S::Zero();
+			size_t j = 0;
+			for (; j + S::WIDTH <= n; j += S::WIDTH)
+			{
+				mmSum = S::Fmadd(S::Load(&a[j]), S::Load(&b[j]), mmSum);
+			}
+			data_t sum = S::HorizSum(mmSum);
+			for (; j < n; ++j)
+			{
+				sum += a[j] * b[j];
+			}
+			return sum;
+		}
+
+		// Y(4 x k) = D(4 x n) * A(k x n)^T, two rows of A are dotted with the 4 rows of D at once
+		static void gemmRows4TransB(size_t k, size_t n, const data_t* D, size_t ldd, const data_t* A, size_t lda, data_t* Y, size_t ldy)
+		{
+			const data_t* d0 = D;
+			const data_t* d1 = D + ldd;
+			const data_t* d2 = D + 2 * ldd;
+			const data_t* d3 = D + 3 * ldd;
+			size_t p = 0;
+			for (; p + 2 <= k; p += 2)
+			{
+				const data_t* a0 = &A[p * lda];
+				const data_t* a1 = a0 + lda;
+				V c00 = S::Zero(), c01 = S::Zero();
+				V c10 = S::Zero(), c11 = S::Zero();
+				V c20 = S::Zero(), c21 = S::Zero();
+				V c30 = S::Zero(), c31 = S::Zero();
+				size_t j = 0;
+				for (; j + S::WIDTH <= n; j += S::WIDTH)
+				{
+					V b0 = S::Load(&a0[j]);
+					V b1 = S::Load(&a1[j]);
+					V d;
+					d = S::Load(&d0[j]); c00 = S::Fmadd(d, b0, c00); c01 = S::Fmadd(d, b1, c01);
+					d = S::Load(&d1[j]); c10 = S::Fmadd(d, b0, c10); c11 = S::Fmadd(d, b1, c11);
+					d = S::Load(&d2[j]); c20 = S::Fmadd(d, b0, c20); c21 = S::Fmadd(d, b1, c21);
+					d = S::Load(&d3[j]); c30 = S::Fmadd(d, b0, c30); c31 = S::Fmadd(d, b1, c31);
+				}
+				data_t s00 = S::HorizSum(c00), s01 = S::HorizSum(c01);
+				data_t s10 = S::HorizSum(c10), s11 = S::HorizSum(c11);
+				data_t s20 = S::HorizSum(c20), s21 = S::HorizSum(c21);
+				data_t s30 = S::HorizSum(c30), s31 = S::HorizSum(c31);
+				for (; j < n; ++j)
+				{
+					s00 += d0[j] * a0[j]; s01 += d0[j] * a1[j];
+					s10 += d1[j] * a0[j]; s11 += d1[j] * a1[j];
+					s20 += d2[j] * a0[j]; s21 += d2[j] * a1[j];
+					s30 += d3[j] * a0[j]; s31 += d3[j] * a1[j];
+				}
+				Y[p] = s00; Y[p + 1] = s01;
+				Y[ldy + p] = s10; Y[ldy + p + 1] = s11;
+				Y[2 * ldy + p] = s20; Y[2 * ldy + p + 1] = s21;
+				Y[3 * ldy + p] = s30; Y[3 * ldy + p + 1] = s31;
+			}
+			for (; p < k; ++p)
+			{
+				const data_t* a0 = &A[p * lda];
+				Y[p] = dot(n, d0, a0);
+				Y[ldy + p] = dot(n, d1, a0);
+				Y[2 * ldy + p] = dot(n, d2, a0);
+				Y[3 * ldy + p] = dot(n, d3, a0);
+			}
+		}
+
+		// y(k) = A(k x n) * d(n), 4 rows of A at once
+		static void gemvTrans(size_t k, size_t n, const data_t* d, const data_t* A, size_t lda, data_t* y)
+		{
+			size_t p = 0;
+			for (; p + 4 <= k; p += 4)
+			{
+				const data_t* a0 = &A[p * lda];
+				const data_t* a1 = a0 + lda;
+				const data_t* a2 = a1 + lda;
+				const data_t* a3 = a2 + lda;
+				V c0 = S::Zero(), c1 = S::Zero(), c2 = S::Zero(), c3 = S::Zero();
+				size_t j = 0;
+				for (; j + S::WIDTH <= n; j += S::WIDTH)
+				{
+					V b = S::Load(&d[j]);
+					c0 = S::Fmadd(S::Load(&a0[j]), b, c0);
+					c1 = S::Fmadd(S::Load(&a1[j]), b, c1);
+					c2 = S::Fmadd(S::Load(&a2[j]), b, c2);
+					c3 = S::Fmadd(S::Load(&a3[j]), b, c3);
+				}
+				data_t s0 = S::HorizSum(c0), s1 = S::HorizSum(c1), s2 = S::HorizSum(c2), s3 = S::HorizSum(c3);
+				for (; j < n; ++j)
+				{
+					s0 += a0[j] * d[j];
+					s1 += a1[j] * d[j];
+					s2 += a2[j] * d[j];
+					s3 += a3[j] * d[j];
+				}
+				y[p] = s0;
+				y[p + 1] = s1;
+				y[p + 2] = s2;
+				y[p + 3] = s3;
+			}
+			for (; p < k; ++p)
+			{
+				y[p] = dot(n, d, &A[p * lda]);
+			}
+		}
+
+		// C(k x n) += X(m x k)^T * D(m x n), two rows of C are read and written once
+		static void gemmTransA(size_t m, size_t k, size_t n, const data_t* X, size_t ldx, const data_t* D, size_t ldd, data_t* C, size_t ldc)
+		{
+			size_t p = 0;
+			for (; p + 2 <= k; p += 2)
+			{
+				data_t* r0 = &C[p * ldc];
+				data_t* r1 = r0 + ldc;
+				size_t j = 0;
+				for (; j + 2 * S::WIDTH <= n; j += 2 * S::WIDTH)
+				{
+					V c00 = S::Load(&r0[j]), c01 = S::Load(&r0[j + S::WIDTH]);
+					V c10 = S::Load(&r1[j]), c11 = S::Load(&r1[j + S::WIDTH]);
+					for (size_t i = 0; i < m; ++i)
+					{
+						V d0 = S::Load(&D[i * ldd + j]);
+						V d1 = S::Load(&D[i * ldd + j + S::WIDTH]);
+						V a;
+						a = S::Set1(X[i * ldx + p]); c00 = S::Fmadd(a, d0, c00); c01 = S::Fmadd(a, d1, c01);
+						a = S::Set1(X[i * ldx + p + 1]); c10 = S::Fmadd(a, d0, c10); c11 = S::Fmadd(a, d1, c11);
+					}
+					S::Store(&r0[j], c00); S::Store(&r0[j + S::WIDTH], c01);
+					S::Store(&r1[j], c10); S::Store(&r1[j + S::WIDTH], c11);
+				}
+				for (; j + S::WIDTH <= n; j += S::WIDTH)
+				{
+					V c0 = S::Load(&r0[j]);
+					V c1 = S::Load(&r1[j]);
+					for (size_t i = 0; i < m; ++i)
+					{
+						V d = S::Load(&D[i * ldd + j]);
+						c0 = S::Fmadd(S::Set1(X[i * ldx + p]), d, c0);
+						c1 = S::Fmadd(S::Set1(X[i * ldx + p + 1]), d, c1);
+					}
+					S::Store(&r0[j], c0);
+					S::Store(&r1[j], c1);
+				}
+				for (; j < n; ++j)
+				{
+					for (size_t i = 0; i < m; ++i)
+					{
+						r0[j] += X[i * ldx + p] * D[i * ldd + j];
+						r1[j] += X[i * ldx + p + 1] * D[i * ldd + j];
+					}
+				}
+			}
+			for (; p < k; ++p)
+			{
+				for (size_t i = 0; i < m; ++i)
+				{
+					const data_t a = X[i * ldx + p];
+					for (size_t j = 0; j < n; ++j)
+					{
+						C[p * ldc + j] += a * D[i * ldd + j];
+					}
+				}
+			}
+		}
+
+		static void Run(size_t m, size_t k, size_t n, const data_t* D, size_t ldd, const data_t* A, size_t lda, data_t* Y, size_t ldy,
+			const data_t* X, size_t ldx, data_t* C, size_t ldc);
+	};
+
+	template <class S>
+	void LinearBackPropKernel<S>::Run(size_t m, size_t k, size_t n, const data_t* D, size_t ldd, const data_t* A, size_t lda, data_t* Y, size_t ldy,
+		const data_t* X, size_t ldx, data_t* C, size_t ldc)
+	{
+		size_t i = 0;
+		for (; i + 4 <= m; i += 4)
+		{
+			gemmRows4TransB(k, n, &D[i * ldd], ldd, A, lda, &Y[i * ldy], ldy);
+		}
+		for (; i < m; ++i)
+		{
+			gemvTrans(k, n, &D[i * ldd], A, lda, &Y[i * ldy]);
+		}
+		gemmTransA(m, k, n, X, ldx, D, ldd, C, ldc);
+	}
+
+	// The layer kernels below address the activations through TensorShape, a vector of channels never leaves a run.
+	// Direct convolution of one image, see Conv : every output pixel sums the KERNEL_LEN x KERNEL_LEN x inDepth taps
+	// into vectors of channels, the input is read one value at a time.
+	template <class S>
+	struct ConvDirectForwardKernel
+	{
+		static void Run(size_t kernelLen, size_t outLen, size_t inDepth, size_t outDepth, const data_t* in, const TensorShape& inShape,
+			const data_t* wgt, const data_t* bias, data_t* out, const TensorShape& outShape);
+	};
+
+	template <class S>
+	void ConvDirectForwardKernel<S>::Run(size_t kernelLen, size_t outLen, size_t inDepth, size_t outDepth, const data_t* in, const TensorShape& inShape,
+		const data_t* wgt, const data_t* bias, data_t* out, const TensorShape& outShape)
+	{
+		using V = typename S::V;
+		const size_t WIDTH = S::WIDTH;
+		const size_t STEP = std::min(WIDTH, outShape.Run);
+		for (size_t outY = 0; outY < outLen; ++outY)
+		{
+			for (size_t outX = 0; outX < outLen; ++outX)
+			{
+				for (size_t outD = 0; outD < outDepth; outD += STEP)
+				{
+					const size_t NUM_LANES = std::min(STEP, outDepth - outD);
+					V mmSum = S::Zero();
+					for (size_t kY = 0; kY < kernelLen; ++kY)
+					{
+						for (size_t kX = 0; kX < kernelLen; ++kX)
+						{
+							const data_t* inPixel = &in[inShape.Idx(outX + kX, outY + kY, 0)];
+							for (size_t run = 0; run < inDepth; run += inShape.Run)
+							{
+								const data_t* inRun = inPixel + run / inShape.Run * inShape.RunStride;
+								const size_t RUN_END = std::min(run + inShape.Run, inDepth);
+								for (size_t inD = run; inD < RUN_END; ++inD)
+								{
+									V mmIn = S::Set1(inRun[inD - run]);
+									V mmWgt = S::LoadN(&wgt[((kernelLen * inD + kY) * kernelLen + kX) * outDepth + outD], NUM_LANES);
+									mmSum = S::Add(mmSum, S::Mul(mmIn, mmWgt));
+								}
+							}
+						}
+					}
+					mmSum = S::Add(mmSum, S::LoadN(&bias[outD], NUM_LANES));
+					S::StoreN(&out[outShape.Idx(outX, outY, outD)], mmSum, NUM_LANES);
+				}
+			}
+		}
+	}
+
+	// Weights' and biases' gradient and the input's delta of one image for ConvDirectForwardKernel, delta is HWC
+	template <class S>
+	struct ConvDirectBackPropKernel
+	{
+		static void Run(size_t kernelLen, size_t numPad, size_t inLen, size_t outLen, size_t inDepth, size_t outDepth,
+			const data_t* in, const TensorShape& inShape, const data_t* delta, const data_t* wgt, data_t* wgtDiff, data_t* biasDiff,
+			data_t* delOut, const TensorShape& delOutShape);
+	};
+
+	template <class S>
+	void ConvDirectBackPropKernel<S>::Run(size_t kernelLen, size_t numPad, size_t inLen, size_t outLen, size_t inDepth, size_t outDepth,
+		const data_t* in, const TensorShape& inShape, const data_t* delta, const data_t* wgt, data_t* wgtDiff, data_t* biasDiff,
+		data_t* delOut, const TensorShape& delOutShape)
+	{
+		using V = typename S::V;
+		const size_t WIDTH = S::WIDTH;
+		// Get Weights' gradient
+		for (size_t kY = 0; kY < kernelLen; ++kY)
+		{
+			for (size_t kX = 0; kX < kernelLen; ++kX)
+			{
+				for (size_t inD = 0; inD < inDepth; ++inD)
+				{
+					const data_t* inChan = &in[inShape.Idx(kX, kY, inD)];
+					for (size_t outD = 0; outD < outDepth; outD += WIDTH)
+					{
+						const size_t NUM_LANES = std::min(WIDTH, outDepth - outD);
+						V mmSum = S::Zero();
+						for (size_t outY = 0; outY < outLen; ++outY)
+						{
+							for (size_t outX = 0; outX < outLen; ++outX)
+							{
+								V mmDelta = S::LoadN(&delta[(outLen * outY + outX) * outDepth + outD], NUM_LANES);
+								V mmIn = S::Set1(inChan[(inShape.Len * outY + outX) * inShape.PixelStep]);
+								mmSum = S::Add(mmSum, S::Mul(mmDelta, mmIn));
+							}
+						}
+						data_t* dest = &wgtDiff[((kernelLen * inD + kY) * kernelLen + kX) * outDepth + outD];
+						S::StoreN(dest, S::Add(S::LoadN(dest, NUM_LANES), mmSum), NUM_LANES);
+					}
+				}
+			}
+		}
+		// Get Biases' gradient
+		for (size_t pixel = 0; pixel < outLen * outLen; ++pixel)
+		{
+			for (size_t outD = 0; outD < outDepth; outD += WIDTH)
+			{
+				const size_t NUM_LANES = std::min(WIDTH, outDepth - outD);
+				data_t* dest = &biasDiff[outD];
+				S::StoreN(dest, S::Add(S::LoadN(dest, NUM_LANES), S::LoadN(&delta[pixel * outDepth + outD], NUM_LANES)), NUM_LANES);
+			}
+		}
+		// Get out gradient : in(x) gathers delta(x + numPad - k) * wgt(k) over the outputs inside the image
+		const int IPAD = static_cast<int>(numPad);
+		const int OLEN = static_cast<int>(outLen);
+		const int KLEN = static_cast<int>(kernelLen);
+		for (int inY = 0; inY < static_cast<int>(inLen); ++inY)
+		{
+			const int BY = std::max(inY + IPAD - OLEN + 1, 0);
+			const int EY = std::min(inY + IPAD + 1, KLEN);
+			for (int inX = 0; inX < static_cast<int>(inLen); ++inX)
+			{
+				const int BX = std::max(inX + IPAD - OLEN + 1, 0);
+				const int EX = std::min(inX + IPAD + 1, KLEN);
+				for (size_t inD = 0; inD < inDepth; ++inD)
+				{
+					V mmSum = S::Zero();
+					for (int kY = BY; kY < EY; ++kY)
+					{
+						for (int kX = BX; kX < EX; ++kX)
+						{
+							const data_t* delPixel = &delta[(outLen * (inY + IPAD - kY) + inX + IPAD - kX) * outDepth];
+							const data_t* wgtTap = &wgt[((kernelLen * inD + kY) * kernelLen + kX) * outDepth];
+							for (size_t outD = 0; outD < outDepth; outD += WIDTH)
+							{
+								const size_t NUM_LANES = std::min(WIDTH, outDepth - outD);
+								mmSum = S::Add(mmSum, S::Mul(S::LoadN(delPixel + outD, NUM_LANES), S::LoadN(wgtTap + outD, NUM_LANES)));
+							}
+						}
+					}
+					delOut[delOutShape.Idx(inX, inY, inD)] = S::HorizSum(mmSum);
+				}
+			}
+		}
+	}
+
+	// Depthwise convolution of one image, see DwConv : every kernel tap is one load of a vector of channels of the input and of the weights.
+	// wgt is KERNEL_LEN x KERNEL_LEN x padDepth, the padded channels of BLOCKED tensors are computed along.
+	template <class S>
+	struct DwConvForwardKernel
+	{
+		static void Run(size_t kernelLen, size_t outLen, size_t padDepth, const data_t* in, const TensorShape& inShape,
+			const data_t* wgt, const data_t* bias, data_t* out, const TensorShape& outShape);
+	};
+
+	template <class S>
+	void DwConvForwardKernel<S>::Run(size_t kernelLen, size_t outLen, size_t padDepth, const data_t* in, const TensorShape& inShape,
+		const data_t* wgt, const data_t* bias, data_t* out, const TensorShape& outShape)
+	{
+		using V = typename S::V;
+		const size_t WIDTH = S::WIDTH;
+		const size_t STEP = std::min(WIDTH, std::min(inShape.Run, outShape.Run));
+		const size_t IN_STEP = inShape.PixelStep;
+		for (size_t depth = 0; depth < padDepth; depth += STEP)
+		{
+			const size_t NUM_LANES = std::min(STEP, padDepth - depth);
+			V mmBias = S::LoadN(&bias[depth], NUM_LANES);
+			for (size_t outY = 0; outY < outLen; ++outY)
+			{
+				for (size_t outX = 0; outX < outLen; ++outX)
+				{
+					V mmSum = mmBias;
+					for (size_t kY = 0; kY < kernelLen; ++kY)
+					{
+						const data_t* inRow = &in[inShape.Idx(outX, outY + kY, depth)];
+						const data_t* wgtRow = &wgt[kernelLen * kY * padDepth + depth];
+						for (size_t kX = 0; kX < kernelLen; ++kX)
+						{
+							mmSum = S::Fmadd(S::LoadN(inRow + kX * IN_STEP, NUM_LANES), S::LoadN(wgtRow + kX * padDepth, NUM_LANES), mmSum);
+						}
+					}
+					S::StoreN(&out[outShape.Idx(outX, outY, depth)], mmSum, NUM_LANES);
+				}
+			}
+		}
+	}
+
+	// Weights' and biases' gradient of DwConvForwardKernel over numImages images, one tap of a vector summed over every pixel in a register
+	// delta is in the output's layout, wgtDiff KERNEL_LEN x KERNEL_LEN x depth. Only the depth real channels are read.
+	template <class S>
+	struct DwConvGradKernel
+	{
+		static void Run(size_t kernelLen, size_t outLen, size_t depth, size_t numImages, const data_t* in, const TensorShape& inShape, size_t inSize,
+			const data_t* delta, const TensorShape& delShape, size_t delSize, data_t* wgtDiff, data_t* biasDiff);
+	};
+
+	template <class S>
+	void DwConvGradKernel<S>::Run(size_t kernelLen, size_t outLen, size_t depth, size_t numImages, const data_t* in, const TensorShape& inShape, size_t inSize,
+		const data_t* delta, const TensorShape& delShape, size_t delSize, data_t* wgtDiff, data_t* biasDiff)
+	{
+		using V = typename S::V;
+		const size_t WIDTH = S::WIDTH;
+		const size_t STEP = std::min(WIDTH, std::min(inShape.Run, delShape.Run));
+		const size_t IN_STEP = inShape.PixelStep;
+		const size_t DEL_STEP = delShape.PixelStep;
+		for (size_t d = 0; d < depth; d += STEP)
+		{
+			const size_t NUM_LANES = std::min(STEP, depth - d);
+			// Get Biases' gradient
+			V mmBiasSum = S::Zero();
+			for (size_t n = 0; n < numImages; ++n)
+			{
+				for (size_t outY = 0; outY < outLen; ++outY)
+				{
+					const data_t* delRow = &delta[delSize * n + delShape.Idx(0, outY, d)];
+					for (size_t outX = 0; outX < outLen; ++outX)
+					{
+						mmBiasSum = S::Add(mmBiasSum, S::LoadN(delRow + outX * DEL_STEP, NUM_LANES));
+					}
+				}
+			}
+			S::StoreN(&biasDiff[d], S::Add(S::LoadN(&biasDiff[d], NUM_LANES), mmBiasSum), NUM_LANES);
+			// Get Weights' gradient
+			for (size_t kY = 0; kY < kernelLen; ++kY)
+			{
+				for (size_t kX = 0; kX < kernelLen; ++kX)
+				{
+					V mmSum = S::Zero();
+					for (size_t n = 0; n < numImages; ++n)
+					{
+						for (size_t outY = 0; outY < outLen; ++outY)
+						{
+							const data_t* inRow = &in[inSize * n + inShape.Idx(kX, outY + kY, d)];
+							const data_t* delRow = &delta[delSize * n + delShape.Idx(0, outY, d)];
+							for (size_t outX = 0; outX < outLen; ++outX)
+							{
+								mmSum = S::Fmadd(S::LoadN(inRow + outX * IN_STEP, NUM_LANES), S::LoadN(delRow + outX * DEL_STEP, NUM_LANES), mmSum);
+							}
+						}
+					}
+					data_t* dest = &wgtDiff[(kernelLen * kY + kX) * depth + d];
+					S::StoreN(dest, S::Add(S::LoadN(dest, NUM_LANES), mmSum), NUM_LANES);
+				}
+			}
+		}
+	}
+
+	// Input's delta of one image for DwConvForwardKernel : in(x) gathers delta(x + numPad - k) * wgt(k) over the outputs inside the image
+	template <class S>
+	struct DwConvDeltaOutKernel
+	{
+		static void Run(size_t kernelLen, size_t numPad, size_t inLen, size_t outLen, size_t padDepth,
+			const data_t* delta, const TensorShape& delShape, const data_t* wgt, data_t* delOut, const TensorShape& delOutShape);
+	};
+
+	template <class S>
+	void DwConvDeltaOutKernel<S>::Run(size_t kernelLen, size_t numPad, size_t inLen, size_t outLen, size_t padDepth,
+		const data_t* delta, const TensorShape& delShape, const data_t* wgt, data_t* delOut, const TensorShape& delOutShape)
+	{
+		using V = typename S::V;
+		const size_t WIDTH = S::WIDTH;
+		const size_t STEP = std::min(WIDTH, std::min(delShape.Run, delOutShape.Run));
+		const size_t DEL_STEP = delShape.PixelStep;
+		const int IPAD = static_cast<int>(numPad);
+		const int OLEN = static_cast<int>(outLen);
+		const int KLEN = static_cast<int>(kernelLen);
+		for (size_t depth = 0; depth < padDepth; depth += STEP)
+		{
+			const size_t NUM_LANES = std::min(STEP, padDepth - depth);
+			for (int inY = 0; inY < static_cast<int>(inLen); ++inY)
+			{
+				const int BY = std::max(inY + IPAD - OLEN + 1, 0);
+				const int EY = std::min(inY + IPAD + 1, KLEN);
+				for (int inX = 0; inX < static_cast<int>(inLen); ++inX)
+				{
+					const int BX = std::max(inX + IPAD - OLEN + 1, 0);
+					const int EX = std::min(inX + IPAD + 1, KLEN);
+					V mmSum = S::Zero();
+					for (int kY = BY; kY < EY; ++kY)
+					{
+						const data_t* delRow = &delta[delShape.Idx(0, inY + IPAD - kY, depth)];
+						const data_t* wgtRow = &wgt[kernelLen * kY * padDepth + depth];
+						for (int kX = BX; kX < EX; ++kX)
+						{
+							mmSum = S::Fmadd(S::LoadN(delRow + (inX + IPAD - kX) * DEL_STEP, NUM_LANES), S::LoadN(wgtRow + kX * padDepth, NUM_LANES), mmSum);
+						}
+					}
+					S::StoreN(&delOut[delOutShape.Idx(inX, inY, depth)], mmSum, NUM_LANES);
+				}
+			}
+		}
+	}
+
+	// Max pooling of one image, see Pool : the maxima of the windows and their positions kY * KERNEL_LEN + kX in maxIdx
+	// The first of equal maxima is kept. The padded channels of BLOCKED tensors are pooled along.
+	template <class S>
+	struct PoolForwardKernel
+	{
+		static void Run(size_t kernelLen, size_t outLen, size_t padDepth, const data_t* in, const TensorShape& inShape,
+			data_t* out, const TensorShape& outShape, unsigned int* maxIdx, const TensorShape& idxShape);
+	};
+
+	template <class S>
+	void PoolForwardKernel<S>::Run(size_t kernelLen, size_t outLen, size_t padDepth, const data_t* in, const TensorShape& inShape,
+		data_t* out, const TensorShape& outShape, unsigned int* maxIdx, const TensorShape& idxShape)
+	{
+		using V = typename S::V;
+		const size_t WIDTH = S::WIDTH;
+		const size_t STEP = std::min(WIDTH, std::min(inShape.Run, outShape.Run));
+		for (size_t outX = 0; outX < outLen; ++outX)
+		{
+			for (size_t outY = 0; outY < outLen; ++outY)
+			{
+				for (size_t depth = 0; depth < padDepth; depth += STEP)
+				{
+					const size_t NUM_LANES = std::min(STEP, padDepth - depth);
+					V mmMax = S::LoadN(&in[inShape.Idx(outX * kernelLen, outY * kernelLen, depth)], NUM_LANES);
+					// Positions as floats, exact for small integers
+					V mmMaxIdx = S::Zero();
+					for (size_t kY = 0; kY < kernelLen; ++kY)
+					{
+						for (size_t kX = 0; kX < kernelLen; ++kX)
+						{
+							V mmIn = S::LoadN(&in[inShape.Idx(outX * kernelLen + kX, outY * kernelLen + kY, depth)], NUM_LANES);
+							V mmAbove = S::Greater(mmIn, mmMax);
+							mmMax = S::Max(mmIn, mmMax);
+							V mmIdx = S::Set1(static_cast<data_t>(kY * kernelLen + kX));
+							mmMaxIdx = S::Fmadd(mmAbove, S::Sub(mmIdx, mmMaxIdx), mmMaxIdx);
+						}
+					}
+					S::StoreN(&out[outShape.Idx(outX, outY, depth)], mmMax, NUM_LANES);
+					data_t lanes[S::WIDTH];
+					S::StoreN(lanes, mmMaxIdx, NUM_LANES);
+					unsigned int* dest = &maxIdx[idxShape.Idx(outX, outY, depth)];
+					for (size_t i = 0; i < NUM_LANES; ++i)
+					{
+						dest[i] = static_cast<unsigned int>(lanes[i]);
+					}
+				}
+			}
+		}
+	}
+
+	extern template struct SgemmKernel<SimdSse4>;
+	extern template struct ActivateKernel<SimdSse4>;
+	extern template struct ActivateBackwardKernel<SimdSse4>;
+	extern template struct MulAccKernel<SimdSse4>;
+	extern template struct MulConjAccKernel<SimdSse4>;
+	extern template struct SgdKernel<SimdSse4>;
+	extern template struct AdamKernel<SimdSse4>;
+	extern template struct RmsPropKernel<SimdSse4>;
+	extern template struct AxpyKernel<SimdSse4>;
+	extern template struct ReduceKernel<SimdSse4>;
+	extern template struct LinearForwardKernel<SimdSse4>;
+	extern template struct LinearBackPropKernel<SimdSse4>;
+	extern template struct ConvDirectForwardKernel<SimdSse4>;
+	extern template struct ConvDirectBackPropKernel<SimdSse4>;
+	extern template struct DwConvForwardKernel<SimdSse4>;
+	extern template struct DwConvGradKernel<SimdSse4>;
+	extern template struct DwConvDeltaOutKernel<SimdSse4>;
+	extern template struct PoolForwardKernel<SimdSse4>;
+
+	extern template struct SgemmKernel<SimdAvx2>;
+	extern template struct ActivateKernel<SimdAvx2>;
+	extern template struct ActivateBackwardKernel<SimdAvx2>;
+	extern template struct MulAccKernel<SimdAvx2>;
+	extern template struct MulConjAccKernel<SimdAvx2>;
+	extern template struct SgdKernel<SimdAvx2>;
+	extern template struct AdamKernel<SimdAvx2>;
+	extern template struct RmsPropKernel<SimdAvx2>;
+	extern template struct AxpyKernel<SimdAvx2>;
+	extern template struct ReduceKernel<SimdAvx2>;
+	extern template struct LinearForwardKernel<SimdAvx2>;
+	extern template struct LinearBackPropKernel<SimdAvx2>;
+	extern template struct ConvDirectForwardKernel<SimdAvx2>;
+	extern template struct ConvDirectBackPropKernel<SimdAvx2>;
+	extern template struct DwConvForwardKernel<SimdAvx2>;
+	extern template struct DwConvGradKernel<SimdAvx2>;
+	extern template struct DwConvDeltaOutKernel<SimdAvx2>;
+	extern template struct PoolForwardKernel<SimdAvx2>;
+
+	extern template struct SgemmKernel<SimdAvx512>;
+	extern template struct ActivateKernel<SimdAvx512>;
+	extern template struct ActivateBackwardKernel<SimdAvx512>;
+	extern template struct MulAccKernel<SimdAvx512>;
+	extern template struct MulConjAccKernel<SimdAvx512>;
+	extern template struct SgdKernel<SimdAvx512>;
+	extern template struct AdamKernel<SimdAvx512>;
+	extern template struct RmsPropKernel<SimdAvx512>;
+	extern template struct AxpyKernel<SimdAvx512>;
+	extern template struct ReduceKernel<SimdAvx512>;
+	extern template struct LinearForwardKernel<SimdAvx512>;
+	extern template struct LinearBackPropKernel<SimdAvx512>;
+	extern template struct ConvDirectForwardKernel<SimdAvx512>;
+	extern template struct ConvDirectBackPropKernel<SimdAvx512>;
+	extern template struct DwConvForwardKernel<SimdAvx512>;
+	extern template struct DwConvGradKernel<SimdAvx512>;
+	extern template struct DwConvDeltaOutKernel<SimdAvx512>;
+	extern template struct PoolForwardKernel<SimdAvx512>;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "ILayer.h"
+#include "Simd.h"
+
+// Everything below is compiled for SSE4.2, run only when GetSimd() returns ESimd::SSE4
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("sse4.2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.2")
+#endif
+
+#include "SimdKernels.h"
+
+namespace cnn
+{
+	template struct SgemmKernel<SimdSse4>;
+	template struct ActivateKernel<SimdSse4>;
+	template struct ActivateBackwardKernel<SimdSse4>;
+	template struct MulAccKernel<SimdSse4>;
+	template struct MulConjAccKernel<SimdSse4>;
+	template struct SgdKernel<SimdSse4>;
+	template struct AdamKernel<SimdSse4>;
+	template struct RmsPropKernel<SimdSse4>;
+	template struct AxpyKernel<SimdSse4>;
+	template struct ReduceKernel<SimdSse4>;
+	template struct LinearForwardKernel<SimdSse4>;
+	template struct LinearBackPropKernel<SimdSse4>;
+	template struct ConvDirectForwardKernel<SimdSse4>;
+	template struct ConvDirectBackPropKernel<SimdSse4>;
+	template struct DwConvForwardKernel<SimdSse4>;
+	template struct DwConvGradKernel<SimdSse4>;
+	template struct DwConvDeltaOutKernel<SimdSse4>;
+	template struct PoolForwardKernel<SimdSse4>;
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
\ No newline at end of file
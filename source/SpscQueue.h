@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <vector>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Bounded lock-free queue between exactly one producer thread and one consumer thread
+	// The producer only writes mTail and the consumer only writes mHead, so no locks or CAS are needed.
+	template <typename T>
+	class SpscQueue
+	{
+	public:
+		SpscQueue(size_t capacity)
+			: mItems(capacity + 1)
+			, mHead(0)
+			, mTail(0)
+		{
+		}
+		SpscQueue(const SpscQueue&) = delete;
+		SpscQueue& operator=(const SpscQueue&) = delete;
+
+		// Producer side, false if the queue is full
+		bool TryPush(const T& item)
+		{
+			const size_t tail = mTail.load(std::memory_order_relaxed);
+			const size_t next = tail + 1 == mItems.size() ? 0 : tail + 1;
+			if (next == mHead.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			mItems[tail] = item;
+			mTail.store(next, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer side, false if the queue is empty
+		bool TryPop(T& item)
+		{
+			const size_t head = mHead.load(std::memory_order_relaxed);
+			if (head == mTail.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			item = mItems[head];
+			mHead.store(head + 1 == mItems.size() ? 0 : head + 1, std::memory_order_release);
+			return true;
+		}
+	private:
+		std::vector<T> mItems;
+		// Head and tail on separate cache lines, each is written by one side only
+		alignas(64) std::atomic<size_t> mHead;
+		alignas(64) std::atomic<size_t> mTail;
+	};
+}
\ No newline at end of file
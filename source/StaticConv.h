@@ -0,0 +1,218 @@
+#pragma once
+#include "ILayer.h"
+#include "Activation.h"
+#include "Simd.h"
+
+namespace cnn
+{
+	// Convolution with its shape fixed at compile time, used by StaticNet
+	// Every loop bound and index is a constant, so the compiler can unroll the kernel loops and fold the index math.
+	// Tensors are unpadded HWC, the parameters are laid out as in Conv : weights ((inD * K + kY) * K + kX) * OUT_D + outD
+	// followed by the biases, each padded to MM_BLOCK.
+	template <size_t K, size_t IN_LEN, size_t IN_D, size_t OUT_LEN, size_t OUT_D, EActFn ACT>
+	class StaticConv
+	{
+	public:
+		static_assert(ACT != EActFn::SOFTMAX, "Softmax is not a layer activation");
+
+		static constexpr size_t KERNEL_LEN = K;
+		static constexpr size_t INPUT_LEN = IN_LEN;
+		static constexpr size_t INPUT_DEPTH = IN_D;
+		static constexpr size_t OUTPUT_LEN = OUT_LEN;
+		static constexpr size_t OUTPUT_DEPTH = OUT_D;
+		static constexpr size_t NUM_PAD = IN_LEN == OUT_LEN ? (K - 1) / 2 : 0;
+		static constexpr size_t INPUT_PAD_LEN = IN_LEN + 2 * NUM_PAD;
+		static_assert(INPUT_PAD_LEN + 1 == OUT_LEN + K, "Output length must be the valid or the same convolution's");
+
+		static constexpr size_t INPUT_SIZE = IN_LEN * IN_LEN * IN_D;
+		static constexpr size_t INPUT_PAD_SIZE = INPUT_PAD_LEN * INPUT_PAD_LEN * IN_D;
+		static constexpr size_t OUTPUT_SIZE = OUT_LEN * OUT_LEN * OUT_D;
+		static constexpr size_t WGT_SIZE = K * K * IN_D * OUT_D;
+		static constexpr size_t BIAS_SIZE = OUT_D;
+		static constexpr size_t PARAM_SIZE = GetBlockPadSize(WGT_SIZE) + GetBlockPadSize(BIAS_SIZE);
+		// Padded input and its gradient
+		static constexpr size_t SCRATCH_SIZE = NUM_PAD > 0 ? 2 * INPUT_PAD_SIZE : 0;
+
+		// Glorot weights, zero biases
+		static void Init(data_t* param)
+		{
+			InitGlorot(param, WGT_SIZE, K * K * (IN_D + OUT_D));
+			memset(param + GetBlockPadSize(WGT_SIZE), 0, sizeof(data_t) * BIAS_SIZE);
+		}
+
+		// out = f(in * wgt + bias) for one image, with the vector backend S
+		template <class S>
+		static void Forward(const data_t* param, const data_t* in, data_t* out, data_t* scratch)
+		{
+			const data_t* wgtBuf = param;
+			const data_t* biasBuf = param + GetBlockPadSize(WGT_SIZE);
+			const data_t* inBuf = padInput(in, scratch);
+			constexpr size_t NUM_BLOCKS = getNumBlocks(S::WIDTH);
+			for (size_t outY = 0; outY < OUT_LEN; ++outY)
+			{
+				for (size_t outX = 0; outX < OUT_LEN; ++outX)
+				{
+					// Every output channel of the pixel is accumulated at once, each weight row is read contiguously
+					data_t* dest = &out[getOutIdx(outX, outY)];
+					typename S::V mmSum[NUM_BLOCKS];
+					for (size_t b = 0; b < NUM_BLOCKS; ++b)
+					{
+						mmSum[b] = S::LoadN(&biasBuf[b * S::WIDTH], getNumLanes(b, S::WIDTH));
+					}
+					for (size_t inD = 0; inD < IN_D; ++inD)
+					{
+						for (size_t kY = 0; kY < K; ++kY)
+						{
+							for (size_t kX = 0; kX < K; ++kX)
+							{
+								typename S::V mmIn = S::Set1(inBuf[getInIdx(outX + kX, outY + kY, inD)]);
+								const data_t* wgt = &wgtBuf[getWgtIdx(kX, kY, inD, 0)];
+								for (size_t b = 0; b < NUM_BLOCKS; ++b)
+								{
+									mmSum[b] = S::Fmadd(mmIn, S::LoadN(&wgt[b * S::WIDTH], getNumLanes(b, S::WIDTH)), mmSum[b]);
+								}
+							}
+						}
+					}
+					for (size_t b = 0; b < NUM_BLOCKS; ++b)
+					{
+						S::StoreN(&dest[b * S::WIDTH], mmSum[b], getNumLanes(b, S::WIDTH));
+					}
+				}
+			}
+			Activate(ACT, out, OUTPUT_SIZE);
+		}
+
+		// deltaIn : loss gradient of out, overwritten with the gradient before the activation
+		// grad += parameters' gradient, deltaOut = gradient of in unless it is nullptr
+		template <class S>
+		static void BackProp(const data_t* param, data_t* grad, const data_t* in, const data_t* out,
+			data_t* deltaIn, data_t* deltaOut, data_t* scratch)
+		{
+			const data_t* wgtBuf = param;
+			data_t* wgtDiffBuf = grad;
+			data_t* biasDiffBuf = grad + GetBlockPadSize(WGT_SIZE);
+			ActivateBackward(ACT, out, deltaIn, deltaIn, OUTPUT_SIZE);
+			const data_t* delBuf = deltaIn;
+			const data_t* inBuf = padInput(in, scratch);
+			constexpr size_t NUM_BLOCKS = getNumBlocks(S::WIDTH);
+			for (size_t p = 0; p < OUT_LEN * OUT_LEN; ++p)
+			{
+				for (size_t outD = 0; outD < OUT_D; ++outD)
+				{
+					biasDiffBuf[outD] += delBuf[p * OUT_D + outD];
+				}
+			}
+			// wgtDiff += in * delta, every weight row is summed over the pixels in registers
+			for (size_t inD = 0; inD < IN_D; ++inD)
+			{
+				for (size_t kY = 0; kY < K; ++kY)
+				{
+					for (size_t kX = 0; kX < K; ++kX)
+					{
+						data_t* wgtDiff = &wgtDiffBuf[getWgtIdx(kX, kY, inD, 0)];
+						typename S::V mmSum[NUM_BLOCKS];
+						for (size_t b = 0; b < NUM_BLOCKS; ++b)
+						{
+							mmSum[b] = S::LoadN(&wgtDiff[b * S::WIDTH], getNumLanes(b, S::WIDTH));
+						}
+						for (size_t outY = 0; outY < OUT_LEN; ++outY)
+						{
+							for (size_t outX = 0; outX < OUT_LEN; ++outX)
+							{
+								typename S::V mmIn = S::Set1(inBuf[getInIdx(outX + kX, outY + kY, inD)]);
+								const data_t* delta = &delBuf[getOutIdx(outX, outY)];
+								for (size_t b = 0; b < NUM_BLOCKS; ++b)
+								{
+									mmSum[b] = S::Fmadd(mmIn, S::LoadN(&delta[b * S::WIDTH], getNumLanes(b, S::WIDTH)), mmSum[b]);
+								}
+							}
+						}
+						for (size_t b = 0; b < NUM_BLOCKS; ++b)
+						{
+							S::StoreN(&wgtDiff[b * S::WIDTH], mmSum[b], getNumLanes(b, S::WIDTH));
+						}
+					}
+				}
+			}
+			if (deltaOut == nullptr)
+			{
+				return;
+			}
+			// delOut += wgt . delta, into the padded input's gradient whose border is dropped at the end
+			data_t* delPadBuf = NUM_PAD > 0 ? scratch + INPUT_PAD_SIZE : deltaOut;
+			memset(delPadBuf, 0, sizeof(data_t) * INPUT_PAD_SIZE);
+			for (size_t outY = 0; outY < OUT_LEN; ++outY)
+			{
+				for (size_t outX = 0; outX < OUT_LEN; ++outX)
+				{
+					const data_t* delta = &delBuf[getOutIdx(outX, outY)];
+					for (size_t inD = 0; inD < IN_D; ++inD)
+					{
+						for (size_t kY = 0; kY < K; ++kY)
+						{
+							for (size_t kX = 0; kX < K; ++kX)
+							{
+								const data_t* wgt = &wgtBuf[getWgtIdx(kX, kY, inD, 0)];
+								typename S::V mmSum = S::Zero();
+								for (size_t b = 0; b < NUM_BLOCKS; ++b)
+								{
+									mmSum = S::Fmadd(S::LoadN(&wgt[b * S::WIDTH], getNumLanes(b, S::WIDTH)), S::LoadN(&delta[b * S::WIDTH], getNumLanes(b, S::WIDTH)), mmSum);
+								}
+								delPadBuf[getInIdx(outX + kX, outY + kY, inD)] += S::HorizSum(mmSum);
+							}
+						}
+					}
+				}
+			}
+			if (NUM_PAD > 0)
+			{
+				for (size_t y = 0; y < IN_LEN; ++y)
+				{
+					memcpy(&deltaOut[IN_LEN * IN_D * y], &delPadBuf[getInIdx(NUM_PAD, NUM_PAD + y, 0)], sizeof(data_t) * IN_LEN * IN_D);
+				}
+			}
+		}
+	private:
+		// Output channels in vectors of width floats, the last one masked when OUT_D is not a multiple of width
+		static constexpr size_t getNumBlocks(size_t width)
+		{
+			return (OUT_D + width - 1) / width;
+		}
+		static constexpr size_t getNumLanes(size_t b, size_t width)
+		{
+			return (b + 1) * width <= OUT_D ? width : OUT_D - b * width;
+		}
+		static constexpr size_t getInIdx(size_t x, size_t y, size_t d)
+		{
+			return (INPUT_PAD_LEN * y + x) * IN_D + d;
+		}
+		static constexpr size_t getOutIdx(size_t x, size_t y)
+		{
+			return (OUT_LEN * y + x) * OUT_D;
+		}
+		static constexpr size_t getWgtIdx(size_t x, size_t y, size_t inD, size_t outD)
+		{
+			return ((K * inD + y) * K + x) * OUT_D + outD;
+		}
+		// Returns in itself when there is no padding
+		static const data_t* padInput(const data_t* in, data_t* scratch)
+		{
+			if (NUM_PAD == 0)
+			{
+				return in;
+			}
+			memset(scratch, 0, sizeof(data_t) * INPUT_PAD_SIZE);
+			for (size_t y = 0; y < IN_LEN; ++y)
+			{
+				memcpy(&scratch[getInIdx(NUM_PAD, NUM_PAD + y, 0)], &in[IN_LEN * IN_D * y], sizeof(data_t) * IN_LEN * IN_D);
+			}
+			return scratch;
+		}
+	};
+
+	// Fully connected layer, a 1 x 1 convolution of a 1 x 1 input as Linear
+	// A previous layer's output is flattened in HWC order.
+	template <size_t IN_SIZE, size_t OUT_SIZE, EActFn ACT>
+	using StaticLinear = StaticConv<1, 1, IN_SIZE, 1, OUT_SIZE, ACT>;
+}
\ No newline at end of file
@@ -0,0 +1,317 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <tuple>
+#include <random>
+#include <iostream>
+#include "ILayer.h"
+#include "Optimizer.h"
+#include "ThreadPool.h"
+#include "Train.h"
+#include "StaticConv.h"
+#include "StaticPool.h"
+#include "Simd.h"
+
+namespace cnn
+{
+	// Layers of a StaticNet, resolved at compile time
+	// Every layer's parameters and outputs follow the previous layer's in one buffer.
+	template <typename... Layers>
+	struct StaticLayerList
+	{
+		static constexpr size_t PARAM_SIZE = 0;
+		static constexpr size_t ACT_SIZE = 0;
+		static constexpr size_t SCRATCH_SIZE = 0;
+		static constexpr size_t OUTPUT_SIZE = 0;
+
+		static constexpr bool Accepts(size_t /*len*/, size_t /*depth*/) { return true; }
+		static void Init(data_t* /*param*/) {}
+		template <class S>
+		static void Forward(const data_t* /*param*/, const data_t* /*in*/, data_t* /*acts*/, data_t* /*scratch*/) {}
+		template <class S>
+		static void BackProp(const data_t* /*param*/, data_t* /*grad*/, const data_t* /*in*/, const data_t* /*acts*/,
+			data_t* /*deltas*/, data_t* /*deltaOut*/, data_t* /*scratch*/) {}
+	};
+
+	template <typename L, typename... Rest>
+	struct StaticLayerList<L, Rest...>
+	{
+		using Next = StaticLayerList<Rest...>;
+
+		static constexpr size_t PARAM_SIZE = L::PARAM_SIZE + Next::PARAM_SIZE;
+		static constexpr size_t ACT_SIZE = L::OUTPUT_SIZE + Next::ACT_SIZE;
+		static constexpr size_t SCRATCH_SIZE = L::SCRATCH_SIZE > Next::SCRATCH_SIZE ? L::SCRATCH_SIZE : Next::SCRATCH_SIZE;
+		static constexpr size_t OUTPUT_SIZE = sizeof...(Rest) == 0 ? L::OUTPUT_SIZE : Next::OUTPUT_SIZE;
+
+		// A layer takes the previous layer's output as it is, or flattened when its input is 1 x 1
+		static constexpr bool Accepts(size_t len, size_t depth)
+		{
+			return ((len == L::INPUT_LEN && depth == L::INPUT_DEPTH) || (L::INPUT_LEN == 1 && len * len * depth == L::INPUT_DEPTH))
+				&& Next::Accepts(L::OUTPUT_LEN, L::OUTPUT_DEPTH);
+		}
+		static void Init(data_t* param)
+		{
+			L::Init(param);
+			Next::Init(param + L::PARAM_SIZE);
+		}
+		// acts receives every layer's output, every layer runs with the vector backend S
+		template <class S>
+		static void Forward(const data_t* param, const data_t* in, data_t* acts, data_t* scratch)
+		{
+			L::template Forward<S>(param, in, acts, scratch);
+			Next::template Forward<S>(param + L::PARAM_SIZE, acts, acts + L::OUTPUT_SIZE, scratch);
+		}
+		// deltas mirrors acts, the last layer's part holds the loss gradient
+		// deltaOut is the gradient of in, nullptr for the first layer.
+		template <class S>
+		static void BackProp(const data_t* param, data_t* grad, const data_t* in, const data_t* acts,
+			data_t* deltas, data_t* deltaOut, data_t* scratch)
+		{
+			Next::template BackProp<S>(param + L::PARAM_SIZE, grad + L::PARAM_SIZE, acts, acts + L::OUTPUT_SIZE, deltas + L::OUTPUT_SIZE, deltas, scratch);
+			L::template BackProp<S>(param, grad, in, acts, deltas, deltaOut, scratch);
+		}
+	};
+
+	// Network whose layers are fixed at compile time, for models that do not change
+	// Layer calls are not virtual and every shape is a constant, the runtime Network stays for flexible models.
+	// Training is data parallel over images with the loss and the optimizers of Network.
+	//
+	//	StaticNet<
+	//		StaticConv<5, 28, 1, 28, 6, EActFn::RELU>,
+	//		StaticPool<2, 28, 6, EActFn::RELU>,
+	//		StaticConv<5, 14, 6, 10, 16, EActFn::RELU>,
+	//		StaticPool<2, 10, 16, EActFn::RELU>,
+	//		StaticConv<5, 5, 16, 1, 120, EActFn::RELU>,
+	//		StaticLinear<120, 10, EActFn::SIGMOID>> net;
+	template <typename... Layers>
+	class StaticNet
+	{
+		using List = StaticLayerList<Layers...>;
+		using Head = typename std::tuple_element<0, std::tuple<Layers...>>::type;
+	public:
+		static_assert(List::Accepts(Head::INPUT_LEN, Head::INPUT_DEPTH), "A layer's input shape differs from the previous layer's output");
+
+		static constexpr size_t INPUT_SIZE = Head::INPUT_SIZE;
+		static constexpr size_t OUTPUT_SIZE = List::OUTPUT_SIZE;
+	public:
+		StaticNet()
+			: mArena(nullptr)
+			, mGrads()
+			, mActs()
+			, mDeltas()
+			, mScratch()
+			, mOptimizer(IOptimizer::Create(EOptimizer::ADAM))
+			, mNumSteps(0)
+			, mData(nullptr)
+			, mLabels(nullptr)
+			, mNumImages(0)
+			, mOrder()
+			, mBatchSize(0)
+			, mEpochSize(0)
+			, mLearningRate(0.01f)
+			, mValIdx(0)
+			, mRng(std::random_device()())
+		{
+			const size_t SCRATCH_SIZE = List::SCRATCH_SIZE > MM_BLOCK ? List::SCRATCH_SIZE : MM_BLOCK;
+			mArena = Alloc<data_t>(NUM_REGIONS * List::PARAM_SIZE);
+			memset(mArena, 0, sizeof(data_t) * NUM_REGIONS * List::PARAM_SIZE);
+			List::Init(mArena);
+			for (size_t i = 0; i < NUM_THREAD; ++i)
+			{
+				mGrads.push_back(i == 0 ? mArena + List::PARAM_SIZE : Alloc<data_t>(List::PARAM_SIZE));
+				mActs.push_back(Alloc<data_t>(List::ACT_SIZE));
+				mDeltas.push_back(Alloc<data_t>(List::ACT_SIZE));
+				mScratch.push_back(Alloc<data_t>(SCRATCH_SIZE));
+			}
+		}
+		~StaticNet()
+		{
+			for (size_t i = 0; i < NUM_THREAD; ++i)
+			{
+				if (i != 0)
+				{
+					Free(mGrads[i]);
+				}
+				Free(mActs[i]);
+				Free(mDeltas[i]);
+				Free(mScratch[i]);
+			}
+			Free(mArena);
+		}
+
+		StaticNet(const StaticNet&) = delete;
+		StaticNet& operator=(const StaticNet&) = delete;
+
+		void Fit()
+		{
+			const size_t BATCH = mBatchSize - mBatchSize % NUM_THREAD;
+			const size_t BATCH_PER_EPOCH = mNumImages / BATCH;
+			size_t epoch = 0;
+			RunEpochs(epoch, mEpochSize, mOrder, mNumImages, mRng, mValIdx,
+				[&]()
+				{
+					for (size_t be = 0; be < BATCH_PER_EPOCH; ++be)
+					{
+						PrintProgress(be, BATCH_PER_EPOCH);
+						fitBatch(be * BATCH, BATCH);
+					}
+				},
+				[&](size_t first, size_t num)
+				{
+					return GetAccuracy(mData + INPUT_SIZE * first, mLabels + first, num);
+				},
+				[]() {});
+		}
+
+		data_t GetAccuracy(data_t* data, char* labels, size_t n)
+		{
+			std::vector<size_t> correctCount(NUM_THREAD);
+			n -= n % NUM_THREAD;
+			const size_t NUM_PER_THREAD = n / NUM_THREAD;
+			ThreadPool::Get().ParallelFor(0, NUM_THREAD, [&](size_t threadIdx)
+				{
+					const size_t begin = threadIdx * NUM_PER_THREAD;
+					for (size_t img = begin; img < begin + NUM_PER_THREAD; ++img)
+					{
+						if (static_cast<int>(labels[img]) == getPredict(threadIdx, data + INPUT_SIZE * img))
+						{
+							correctCount[threadIdx]++;
+						}
+					}
+				});
+			size_t sum = 0;
+			for (size_t i = 0; i < NUM_THREAD; ++i)
+			{
+				sum += correctCount[i];
+			}
+			return static_cast<data_t>(sum) / n;
+		}
+
+		void SetData(data_t* td, char* ld, size_t n)
+		{
+			mData = td;
+			mLabels = ld;
+			mNumImages = n;
+			mOrder.resize(n);
+			for (size_t i = 0; i < n; ++i)
+			{
+				mOrder[i] = i;
+			}
+		}
+		void SetBatchSize(size_t b) { mBatchSize = b; }
+		void SetEpochSize(size_t e) { mEpochSize = e; }
+		void SetLearningRate(data_t l) { mLearningRate = l; }
+		// Seed of the shuffles, default : random
+		void SetSeed(uint32_t seed) { mRng.seed(seed); }
+		// Default : ADAM, replacing the optimizer clears its state
+		void SetOptimizer(EOptimizer eOptimizer)
+		{
+			mOptimizer = IOptimizer::Create(eOptimizer);
+			memset(mArena + 2 * List::PARAM_SIZE, 0, sizeof(data_t) * NUM_OPT_STATES * List::PARAM_SIZE);
+			mNumSteps = 0;
+		}
+	private:
+		// Parameters, gradients and NUM_OPT_STATES optimizer states
+		static constexpr size_t NUM_REGIONS = 2 + NUM_OPT_STATES;
+
+		// The layers and the gradient reduction with the vector backend of GetSimd, up to AVX2
+		template <class S>
+		struct ForwardKernel
+		{
+			static void Run(const data_t* param, const data_t* in, data_t* acts, data_t* scratch)
+			{
+				List::template Forward<S>(param, in, acts, scratch);
+			}
+		};
+		template <class S>
+		struct BackPropKernel
+		{
+			static void Run(const data_t* param, data_t* grad, const data_t* in, const data_t* acts, data_t* deltas, data_t* scratch)
+			{
+				List::template BackProp<S>(param, grad, in, acts, deltas, nullptr, scratch);
+			}
+		};
+		// grads[0][begin, end) += grads[1..][begin, end)
+		template <class S>
+		struct ReduceKernel
+		{
+			static void Run(const std::vector<data_t*>& grads, size_t begin, size_t end)
+			{
+				data_t* dest = grads[0];
+				for (size_t i = begin; i < end; i += S::WIDTH)
+				{
+					const size_t NUM_LANES = std::min((size_t)S::WIDTH, end - i);
+					typename S::V mmSum = S::LoadN(&dest[i], NUM_LANES);
+					for (size_t c = 1; c < grads.size(); ++c)
+					{
+						mmSum = S::Add(mmSum, S::LoadN(&grads[c][i], NUM_LANES));
+					}
+					S::StoreN(&dest[i], mmSum, NUM_LANES);
+				}
+			}
+		};
+
+		// Gradients of the images mOrder[first, first + batch) and one optimizer step
+		void fitBatch(size_t first, size_t batch)
+		{
+			ThreadPool& pool = ThreadPool::Get();
+			const size_t BATCH_DIV_THREAD = batch / NUM_THREAD;
+			const data_t* params = mArena;
+			pool.ParallelFor(0, NUM_THREAD, [&](size_t threadIdx)
+				{
+					data_t* grad = mGrads[threadIdx];
+					data_t* acts = mActs[threadIdx];
+					data_t* deltas = mDeltas[threadIdx];
+					memset(grad, 0, sizeof(data_t) * List::PARAM_SIZE);
+					const size_t begin = first + threadIdx * BATCH_DIV_THREAD;
+					for (size_t i = begin; i < begin + BATCH_DIV_THREAD; ++i)
+					{
+						const size_t img = mOrder[i];
+						const data_t* in = mData + INPUT_SIZE * img;
+						DispatchSimdLocal<ForwardKernel>(params, in, acts, mScratch[threadIdx]);
+						// Loss gradient, as Network
+						const int label = static_cast<int>(mLabels[img]);
+						const data_t* out = acts + List::ACT_SIZE - OUTPUT_SIZE;
+						data_t* delIn = deltas + List::ACT_SIZE - OUTPUT_SIZE;
+						for (size_t o = 0; o < OUTPUT_SIZE; ++o)
+						{
+							delIn[o] = 0.2f * (out[o] - (label == static_cast<int>(o) ? 1.f : 0.f));
+						}
+						DispatchSimdLocal<BackPropKernel>(params, grad, in, acts, deltas, mScratch[threadIdx]);
+					}
+				});
+			// Sum the thread copies of every chunk and step it
+			++mNumSteps;
+			StepArena(pool, *mOptimizer, StepArgs{ mNumSteps, batch, mLearningRate }, mArena, List::PARAM_SIZE, 0, List::PARAM_SIZE,
+				[&](size_t chunkBegin, size_t chunkEnd) { DispatchSimdLocal<ReduceKernel>(mGrads, chunkBegin, chunkEnd); });
+		}
+
+		int getPredict(size_t threadIdx, const data_t* in)
+		{
+			data_t* acts = mActs[threadIdx];
+			DispatchSimdLocal<ForwardKernel>(mArena, in, acts, mScratch[threadIdx]);
+			const data_t* out = acts + List::ACT_SIZE - OUTPUT_SIZE;
+			return static_cast<int>(std::max_element(out, out + OUTPUT_SIZE) - out);
+		}
+	private:
+		data_t* mArena;
+		// vector elements are buffers allocated to threads
+		std::vector<data_t*> mGrads;	// Element 0 is the arena's gradient region
+		std::vector<data_t*> mActs;		// Outputs of every layer
+		std::vector<data_t*> mDeltas;	// Gradients of every layer's output
+		std::vector<data_t*> mScratch;
+		std::unique_ptr<IOptimizer> mOptimizer;
+		size_t mNumSteps;
+
+		data_t* mData;
+		char* mLabels;
+		size_t mNumImages;
+		std::vector<size_t> mOrder;	// Shuffled image indices
+
+		size_t mBatchSize;
+		size_t mEpochSize;
+		data_t mLearningRate;	// Default : 0.01
+		size_t mValIdx;
+		std::mt19937 mRng;	// Shuffles the images
+	};
+}
\ No newline at end of file
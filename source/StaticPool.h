@@ -0,0 +1,100 @@
+#pragma once
+#include "ILayer.h"
+#include "Activation.h"
+#include "Simd.h"
+
+namespace cnn
+{
+	// Max pooling with its shape fixed at compile time, used by StaticNet
+	// Stride is the kernel length, tensors are unpadded HWC.
+	template <size_t K, size_t IN_LEN, size_t D, EActFn ACT>
+	class StaticPool
+	{
+	public:
+		static_assert(ACT != EActFn::SOFTMAX, "Softmax is not a layer activation");
+		static_assert(IN_LEN % K == 0, "Input length must be a multiple of the kernel length");
+
+		static constexpr size_t KERNEL_LEN = K;
+		static constexpr size_t INPUT_LEN = IN_LEN;
+		static constexpr size_t INPUT_DEPTH = D;
+		static constexpr size_t OUTPUT_LEN = IN_LEN / K;
+		static constexpr size_t OUTPUT_DEPTH = D;
+		static constexpr size_t INPUT_SIZE = IN_LEN * IN_LEN * D;
+		static constexpr size_t OUTPUT_SIZE = OUTPUT_LEN * OUTPUT_LEN * D;
+		static constexpr size_t PARAM_SIZE = 0;
+		static constexpr size_t SCRATCH_SIZE = 0;
+
+		static void Init(data_t* /*param*/) {}
+
+		template <class S>
+		static void Forward(const data_t* /*param*/, const data_t* in, data_t* out, data_t* /*scratch*/)
+		{
+			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+			{
+				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+				{
+					data_t* dest = &out[getOutIdx(outX, outY, 0)];
+					for (size_t d = 0; d < D; d += S::WIDTH)
+					{
+						// The last block is masked when D is not a multiple of the vector width
+						const size_t NUM_LANES = d + S::WIDTH <= D ? S::WIDTH : D - d;
+						typename S::V mmMax = S::LoadN(&in[getInIdx(outX * K, outY * K, d)], NUM_LANES);
+						for (size_t kY = 0; kY < K; ++kY)
+						{
+							for (size_t kX = 0; kX < K; ++kX)
+							{
+								mmMax = S::Max(mmMax, S::LoadN(&in[getInIdx(outX * K + kX, outY * K + kY, d)], NUM_LANES));
+							}
+						}
+						S::StoreN(&dest[d], mmMax, NUM_LANES);
+					}
+				}
+			}
+			Activate(ACT, out, OUTPUT_SIZE);
+		}
+
+		// The max of every window is found again from the input, ties go to the first as in Pool
+		template <class S>
+		static void BackProp(const data_t* /*param*/, data_t* /*grad*/, const data_t* in, const data_t* out,
+			data_t* deltaIn, data_t* deltaOut, data_t* /*scratch*/)
+		{
+			if (deltaOut == nullptr)
+			{
+				return;
+			}
+			ActivateBackward(ACT, out, deltaIn, deltaIn, OUTPUT_SIZE);
+			memset(deltaOut, 0, sizeof(data_t) * INPUT_SIZE);
+			for (size_t outY = 0; outY < OUTPUT_LEN; ++outY)
+			{
+				for (size_t outX = 0; outX < OUTPUT_LEN; ++outX)
+				{
+					for (size_t d = 0; d < D; ++d)
+					{
+						size_t maxIdx = getInIdx(outX * K, outY * K, d);
+						for (size_t kY = 0; kY < K; ++kY)
+						{
+							for (size_t kX = 0; kX < K; ++kX)
+							{
+								const size_t idx = getInIdx(outX * K + kX, outY * K + kY, d);
+								if (in[idx] > in[maxIdx])
+								{
+									maxIdx = idx;
+								}
+							}
+						}
+						deltaOut[maxIdx] = deltaIn[getOutIdx(outX, outY, d)];
+					}
+				}
+			}
+		}
+	private:
+		static constexpr size_t getInIdx(size_t x, size_t y, size_t d)
+		{
+			return (IN_LEN * y + x) * D + d;
+		}
+		static constexpr size_t getOutIdx(size_t x, size_t y, size_t d)
+		{
+			return (OUTPUT_LEN * y + x) * D + d;
+		}
+	};
+}
\ No newline at end of file
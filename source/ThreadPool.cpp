@@ -0,0 +1,241 @@
+#include "ThreadPool.h"
+#include "Cpu.h"
+
+namespace cnn
+{
+	namespace
+	{
+		constexpr size_t NOT_WORKER = static_cast<size_t>(-1);
+		// Index of the calling thread in the pool which owns it
+		thread_local const void* tOwner = nullptr;
+		thread_local size_t tWorkerIdx = NOT_WORKER;
+	}
+
+	ThreadPool::ThreadPool(size_t numWorkers)
+		: mWorkers()
+		, mQueues()
+		, mWakeMutex()
+		, mWake()
+		, mNumQueued(0)
+		, mbStop(false)
+	{
+		for (size_t i = 0; i < numWorkers; ++i)
+		{
+			mQueues.push_back(std::make_unique<WorkQueue>());
+			mQueues.back()->NumPinned = 0;
+		}
+		for (size_t i = 0; i < numWorkers; ++i)
+		{
+			mWorkers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mWakeMutex);
+			mbStop = true;
+		}
+		mWake.notify_all();
+		for (size_t i = 0; i < mWorkers.size(); ++i)
+		{
+			mWorkers[i].join();
+		}
+	}
+
+	ThreadPool& ThreadPool::Get()
+	{
+		static ThreadPool pool(NUM_THREAD > 1 ? NUM_THREAD - 1 : 0);
+		return pool;
+	}
+
+	void ThreadPool::ParallelFor(size_t begin, size_t end, const std::function<void(size_t)>& func)
+	{
+		if (begin >= end)
+		{
+			return;
+		}
+		const size_t NUM_QUEUES = mQueues.size();
+		if (NUM_QUEUES == 0 || end - begin == 1)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				func(i);
+			}
+			return;
+		}
+
+		Group group;
+		group.Pending = end - begin;
+		// Workers push onto their own deque, other threads spread the tasks over all deques
+		const size_t workerIdx = tOwner == this ? tWorkerIdx : NOT_WORKER;
+		for (size_t i = begin; i < end; ++i)
+		{
+			const size_t q = workerIdx != NOT_WORKER ? workerIdx : (i - begin) % NUM_QUEUES;
+			std::lock_guard<std::mutex> lock(mQueues[q]->Mutex);
+			mQueues[q]->Tasks.push_back(Task{ &func, i, &group });
+		}
+		{
+			std::lock_guard<std::mutex> lock(mWakeMutex);
+			mNumQueued += end - begin;
+		}
+		mWake.notify_all();
+		wait(group, workerIdx);
+	}
+
+	void ThreadPool::RunOnEach(const std::function<void(size_t)>& func)
+	{
+		Assert(tOwner != this);
+		const size_t NUM_QUEUES = mQueues.size();
+		Group group;
+		group.Pending = NUM_QUEUES;
+		for (size_t q = 0; q < NUM_QUEUES; ++q)
+		{
+			std::lock_guard<std::mutex> lock(mQueues[q]->Mutex);
+			mQueues[q]->Pinned.push_back(Task{ &func, q + 1, &group });
+		}
+		if (NUM_QUEUES != 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mWakeMutex);
+				for (size_t q = 0; q < NUM_QUEUES; ++q)
+				{
+					++mQueues[q]->NumPinned;
+				}
+			}
+			mWake.notify_all();
+		}
+		func(0);
+		wait(group, NOT_WORKER);
+	}
+
+	void ThreadPool::Pin(bool bPin)
+	{
+		const size_t NUM_THREADS = mWorkers.size() + 1;
+		RunOnEach([&](size_t t)
+			{
+				if (bPin)
+				{
+					PinThread(GetThreadCpu(t, NUM_THREADS));
+				}
+				else
+				{
+					UnpinThread();
+				}
+			});
+	}
+
+	void ThreadPool::Pin(const std::vector<size_t>& cpus)
+	{
+		Assert(cpus.empty() == false);
+		RunOnEach([&](size_t t)
+			{
+				PinThread(cpus[t % cpus.size()]);
+			});
+	}
+
+	void ThreadPool::wait(Group& group, size_t workerIdx)
+	{
+		// Help instead of blocking while tasks are left
+		while (group.Pending.load() != 0)
+		{
+			if (!tryRunOne(workerIdx))
+			{
+				std::unique_lock<std::mutex> lock(group.Mutex);
+				group.Done.wait(lock, [&group] { return group.Pending.load() == 0; });
+			}
+		}
+		// The last task may still hold the lock
+		std::lock_guard<std::mutex> lock(group.Mutex);
+	}
+
+	void ThreadPool::workerLoop(size_t workerIdx)
+	{
+		tOwner = this;
+		tWorkerIdx = workerIdx;
+		while (true)
+		{
+			if (tryRunOne(workerIdx))
+			{
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mWakeMutex);
+			const WorkQueue& queue = *mQueues[workerIdx];
+			mWake.wait(lock, [&] { return mbStop || mNumQueued.load() != 0 || queue.NumPinned.load() != 0; });
+			if (mbStop && mNumQueued.load() == 0)
+			{
+				return;
+			}
+		}
+	}
+
+	bool ThreadPool::tryRunOne(size_t workerIdx)
+	{
+		const size_t NUM_QUEUES = mQueues.size();
+		Task task;
+		if (workerIdx != NOT_WORKER && (tryPopPinned(workerIdx, task) || tryPop(workerIdx, true, task)))
+		{
+			run(task);
+			return true;
+		}
+		const size_t first = workerIdx != NOT_WORKER ? workerIdx + 1 : 0;
+		for (size_t i = 0; i < NUM_QUEUES; ++i)
+		{
+			const size_t victim = (first + i) % NUM_QUEUES;
+			if (victim != workerIdx && tryPop(victim, false, task))
+			{
+				run(task);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool ThreadPool::tryPop(size_t queueIdx, bool bBack, Task& task)
+	{
+		WorkQueue& queue = *mQueues[queueIdx];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (queue.Tasks.empty())
+		{
+			return false;
+		}
+		if (bBack)
+		{
+			task = queue.Tasks.back();
+			queue.Tasks.pop_back();
+		}
+		else
+		{
+			task = queue.Tasks.front();
+			queue.Tasks.pop_front();
+		}
+		--mNumQueued;
+		return true;
+	}
+
+	bool ThreadPool::tryPopPinned(size_t workerIdx, Task& task)
+	{
+		WorkQueue& queue = *mQueues[workerIdx];
+		std::lock_guard<std::mutex> lock(queue.Mutex);
+		if (queue.Pinned.empty())
+		{
+			return false;
+		}
+		task = queue.Pinned.front();
+		queue.Pinned.pop_front();
+		--queue.NumPinned;
+		return true;
+	}
+
+	void ThreadPool::run(const Task& task)
+	{
+		(*task.Func)(task.Idx);
+		// Decrement under the lock, the waiter may destroy the group as soon as it is released
+		Group& group = *task.Owner;
+		std::lock_guard<std::mutex> lock(group.Mutex);
+		if (--group.Pending == 0)
+		{
+			group.Done.notify_all();
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <memory>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Persistent worker threads, each owning a task deque
+	// Workers pop their own deque from the back and steal from the front of the others.
+	// A thread waiting for its tasks runs queued tasks instead of sleeping, so ParallelFor may nest.
+	class ThreadPool
+	{
+	public:
+		ThreadPool(size_t numWorkers);
+		~ThreadPool();
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		// Call func(i) for every i in [begin, end) and return after all calls finished
+		// The calling thread takes part, so the pool adds numWorkers threads of parallelism to it.
+		void ParallelFor(size_t begin, size_t end, const std::function<void(size_t)>& func);
+
+		// Call func(t) once on every thread of the pool and return after all calls finished, t = 0 on the calling thread,
+		// t = w + 1 on worker w. The calls are never stolen, so each keeps to its thread. Not from inside the pool.
+		void RunOnEach(const std::function<void(size_t)>& func);
+		// Pin thread t of RunOnEach to CPU GetThreadCpu(t, numWorkers + 1), or let every thread run anywhere again
+		void Pin(bool bPin);
+		// Pin thread t of RunOnEach to CPU cpus[t % cpus.size()]
+		void Pin(const std::vector<size_t>& cpus);
+
+		size_t GetNumWorkers() const { return mWorkers.size(); }
+
+		// Shared pool with NUM_THREAD - 1 workers, created on first use
+		static ThreadPool& Get();
+	private:
+		// Tasks of one ParallelFor call
+		struct Group
+		{
+			std::atomic<size_t> Pending;
+			std::mutex Mutex;
+			std::condition_variable Done;
+		};
+		struct Task
+		{
+			const std::function<void(size_t)>* Func;
+			size_t Idx;
+			Group* Owner;
+		};
+		struct WorkQueue
+		{
+			std::mutex Mutex;
+			std::deque<Task> Tasks;
+			// RunOnEach calls, only the owner pops them
+			std::deque<Task> Pinned;
+			std::atomic<size_t> NumPinned;
+		};
+	private:
+		void workerLoop(size_t workerIdx);
+		// Pop(pinned calls first, then own deque) or steal one task and run it, false if every deque is empty
+		bool tryRunOne(size_t workerIdx);
+		// Help with queued tasks until the group's tasks finished
+		void wait(Group& group, size_t workerIdx);
+		bool tryPop(size_t queueIdx, bool bBack, Task& task);
+		bool tryPopPinned(size_t workerIdx, Task& task);
+		void run(const Task& task);
+	private:
+		std::vector<std::thread> mWorkers;
+		std::vector<std::unique_ptr<WorkQueue>> mQueues;
+		// Sleeping workers wait here until tasks are queued
+		std::mutex mWakeMutex;
+		std::condition_variable mWake;
+		std::atomic<size_t> mNumQueued;	// Tasks any worker may run, pinned calls are counted by their queue
+		bool mbStop;
+	};
+}
\ No newline at end of file
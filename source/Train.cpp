@@ -0,0 +1,27 @@
+#include "Train.h"
+#include "ThreadPool.h"
+
+namespace cnn
+{
+	void StepArena(ThreadPool& pool, const IOptimizer& optimizer, const StepArgs& args, data_t* arena, size_t size, size_t first, size_t last,
+		const std::function<void(size_t, size_t)>& reduce, const std::function<void(size_t, size_t)>& done)
+	{
+		const size_t NUM_CHUNKS = (last - first + UPDATE_CHUNK - 1) / UPDATE_CHUNK;
+		const size_t NUM_STATES = optimizer.GetNumStates();
+		data_t* grads = arena + size;
+		data_t* state0 = NUM_STATES > 0 ? arena + 2 * size : nullptr;
+		data_t* state1 = NUM_STATES > 1 ? arena + 3 * size : nullptr;
+		pool.ParallelFor(0, NUM_CHUNKS, [&](size_t chunk)
+			{
+				const size_t chunkBegin = first + chunk * UPDATE_CHUNK;
+				const size_t chunkEnd = std::min(chunkBegin + UPDATE_CHUNK, last);
+				reduce(chunkBegin, chunkEnd);
+				optimizer.Step(args, arena + chunkBegin, grads + chunkBegin,
+					state0 != nullptr ? state0 + chunkBegin : nullptr, state1 != nullptr ? state1 + chunkBegin : nullptr, chunkEnd - chunkBegin);
+				if (done)
+				{
+					done(chunkBegin, chunkEnd);
+				}
+			});
+	}
+}
\ No newline at end of file
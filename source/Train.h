@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include "ILayer.h"
+#include "Optimizer.h"
+
+namespace cnn
+{
+	class ThreadPool;
+
+	// Training loop shared by Network and StaticNet
+
+	// Arena values per task of the parallel update, a multiple of MM_BLOCK
+	constexpr size_t UPDATE_CHUNK = 16 * 1024;
+	// Epoch e reports the accuracy on fold e % NUM_FOLD of the images
+	constexpr size_t NUM_FOLD = 10;
+
+	// Tick of the epoch's progress bar after batch be, ten per epoch
+	inline void PrintProgress(size_t be, size_t numBatches)
+	{
+		if ((be + 1) % std::max<size_t>(numBatches / 10, 1) == 0)
+		{
+			std::cout << "--|";
+		}
+	}
+
+	// Run the epochs [epoch, numEpochs) : shuffle images with rng, fitEpoch(), print the accuracy on validation fold valIdx
+	// of the numImages images and move to the next fold, then endEpoch() once epoch counts the epoch
+	// accuracy(first, num) : accuracy on the images [first, first + num) in data order
+	template <typename T, typename FitEpoch, typename Accuracy, typename EndEpoch>
+	void RunEpochs(size_t& epoch, size_t numEpochs, std::vector<T>& images, size_t numImages, std::mt19937& rng, size_t& valIdx,
+		FitEpoch fitEpoch, Accuracy accuracy, EndEpoch endEpoch)
+	{
+		while (epoch < numEpochs)
+		{
+			// Shuffle datas
+			std::shuffle(images.begin(), images.end(), rng);
+			// Print progress
+			std::cout << "EPOCH : " << epoch + 1 << "\n";
+			std::cout << "|";
+			fitEpoch();
+			// Print current accuracy
+			const size_t NUM_VIMGES = numImages / NUM_FOLD;
+			std::cout << "\nACCURACY : " << accuracy(valIdx * NUM_VIMGES, NUM_VIMGES) << std::endl << std::endl;
+			valIdx = (valIdx + 1) % NUM_FOLD;
+			++epoch;
+			endEpoch();
+		}
+	}
+
+	// Step the parameters [first, last) of an arena of regions of size values : parameters, gradients, then the optimizer's states
+	// Every task takes UPDATE_CHUNK values : reduce(begin, end) completes their gradients in the gradients' region,
+	// the optimizer steps them while they are still in cache, then done(begin, end) if it is set.
+	void StepArena(ThreadPool& pool, const IOptimizer& optimizer, const StepArgs& args, data_t* arena, size_t size, size_t first, size_t last,
+		const std::function<void(size_t, size_t)>& reduce, const std::function<void(size_t, size_t)>& done = nullptr);
+}
\ No newline at end of file
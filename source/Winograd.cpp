@@ -0,0 +1,184 @@
+#include "Winograd.h"
+#include "SimdKernels.h"
+#include <cmath>
+#include <algorithm>
+
+namespace cnn
+{
+	namespace
+	{
+		// y += a * x
+		inline void axpy(data_t a, const data_t* x, data_t* y, size_t n)
+		{
+			DispatchSimd<AxpyKernel>(a, x, y, n);
+		}
+	}
+
+	Winograd::Winograd(size_t m, size_t r)
+		: M(m)
+		, R(r)
+		, ALPHA(m + r - 1)
+		, mAT(M* ALPHA)
+		, mA(ALPHA* M)
+		, mG(ALPHA* R)
+		, mGT(R* ALPHA)
+		, mBT(ALPHA* ALPHA)
+		, mB(ALPHA* ALPHA)
+	{
+		Assert(ALPHA >= 2 && ALPHA <= 8);
+		// Interpolation points, the last one is infinity
+		const double POINTS[] = { 0.0, 1.0, -1.0, 2.0, -2.0, 0.5, -0.5 };
+		const size_t N = ALPHA;
+		// Row j of a Vandermonde-like matrix evaluates a polynomial of degree < len at point j
+		// The infinity row picks the leading coefficient
+		auto eval = [&](size_t j, size_t k, size_t len) -> double
+		{
+			if (j == N - 1)
+			{
+				return k == len - 1 ? 1.0 : 0.0;
+			}
+			return pow(POINTS[j], static_cast<double>(k));
+		};
+
+		// Linear convolution s = g * h (deg s = N - 1) is computed as
+		//	s = V^-1 [ (Vg g) (.) (Vh h) ]
+		// Correlation is its transpose : y = Vh^T diag(Vg g) V^-T d
+		// so A^T = Vh^T, G = Vg, B^T = V^-T
+		std::vector<double> v(N * N);
+		std::vector<double> inv(N * N, 0.0);
+		for (size_t j = 0; j < N; ++j)
+		{
+			for (size_t k = 0; k < N; ++k)
+			{
+				v[j * N + k] = eval(j, k, N);
+			}
+			inv[j * N + j] = 1.0;
+		}
+		// Gauss-Jordan elimination with partial pivoting
+		for (size_t c = 0; c < N; ++c)
+		{
+			size_t pivot = c;
+			for (size_t i = c + 1; i < N; ++i)
+			{
+				if (fabs(v[i * N + c]) > fabs(v[pivot * N + c])) { pivot = i; }
+			}
+			for (size_t k = 0; k < N; ++k)
+			{
+				std::swap(v[c * N + k], v[pivot * N + k]);
+				std::swap(inv[c * N + k], inv[pivot * N + k]);
+			}
+			const double scale = 1.0 / v[c * N + c];
+			for (size_t k = 0; k < N; ++k)
+			{
+				v[c * N + k] *= scale;
+				inv[c * N + k] *= scale;
+			}
+			for (size_t i = 0; i < N; ++i)
+			{
+				const double f = v[i * N + c];
+				if (i == c || f == 0.0) { continue; }
+				for (size_t k = 0; k < N; ++k)
+				{
+					v[i * N + k] -= f * v[c * N + k];
+					inv[i * N + k] -= f * inv[c * N + k];
+				}
+			}
+		}
+
+		for (size_t j = 0; j < N; ++j)
+		{
+			for (size_t i = 0; i < M; ++i)
+			{
+				mAT[i * N + j] = static_cast<data_t>(eval(j, i, M));
+				mA[j * M + i] = mAT[i * N + j];
+			}
+			for (size_t k = 0; k < R; ++k)
+			{
+				mG[j * R + k] = static_cast<data_t>(eval(j, k, R));
+				mGT[k * N + j] = mG[j * R + k];
+			}
+			for (size_t i = 0; i < N; ++i)
+			{
+				mBT[j * N + i] = static_cast<data_t>(inv[i * N + j]);
+				mB[i * N + j] = mBT[j * N + i];
+			}
+		}
+	}
+
+	Winograd::~Winograd()
+	{
+
+	}
+
+	void Winograd::TransformFilter(const data_t* g, data_t* u, size_t count) const
+	{
+		sandwich(mG.data(), ALPHA, R, g, u, count);
+	}
+
+	void Winograd::TransformInput(const data_t* d, data_t* v, size_t count) const
+	{
+		sandwich(mBT.data(), ALPHA, ALPHA, d, v, count);
+	}
+
+	void Winograd::TransformOutput(const data_t* m, data_t* y, size_t count) const
+	{
+		sandwich(mAT.data(), M, ALPHA, m, y, count);
+	}
+
+	void Winograd::TransformOutputGrad(const data_t* dy, data_t* dm, size_t count) const
+	{
+		sandwich(mA.data(), ALPHA, M, dy, dm, count);
+	}
+
+	void Winograd::TransformInputGrad(const data_t* dv, data_t* dd, size_t count) const
+	{
+		sandwich(mB.data(), ALPHA, ALPHA, dv, dd, count);
+	}
+
+	void Winograd::TransformFilterGrad(const data_t* du, data_t* dg, size_t count) const
+	{
+		sandwich(mGT.data(), R, ALPHA, du, dg, count);
+	}
+
+	void Winograd::sandwich(const data_t* L, size_t rows, size_t cols, const data_t* x, data_t* y, size_t count)
+	{
+		// Channels are processed in chunks so the intermediate stays on the stack
+		// The inner loops run over contiguous channels, zero coefficients are skipped
+		constexpr size_t CHUNK = 64;
+		data_t tmp[8 * 8 * CHUNK];
+		for (size_t c0 = 0; c0 < count; c0 += CHUNK)
+		{
+			const size_t n = std::min(CHUNK, count - c0);
+			// tmp = L x
+			for (size_t i = 0; i < rows; ++i)
+			{
+				for (size_t j = 0; j < cols; ++j)
+				{
+					data_t* dest = &tmp[(i * cols + j) * CHUNK];
+					memset(dest, 0, sizeof(data_t) * n);
+					for (size_t k = 0; k < cols; ++k)
+					{
+						const data_t l = L[i * cols + k];
+						if (l == 0.f) { continue; }
+						axpy(l, &x[(k * cols + j) * count + c0], dest, n);
+					}
+				}
+			}
+			// y = tmp L^T
+			for (size_t i = 0; i < rows; ++i)
+			{
+				for (size_t j = 0; j < rows; ++j)
+				{
+					data_t* dest = &y[(i * rows + j) * count + c0];
+					memset(dest, 0, sizeof(data_t) * n);
+					for (size_t k = 0; k < cols; ++k)
+					{
+						const data_t l = L[j * cols + k];
+						if (l == 0.f) { continue; }
+						axpy(l, &tmp[(i * cols + k) * CHUNK], dest, n);
+					}
+				}
+			}
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include "ILayer.h"
+
+namespace cnn
+{
+	// Winograd minimal filtering F(m x m, r x r)
+	//	Y = A^T [ (G g G^T) (.) (B^T d B) ] A
+	// The transform matrices are generated by Toom-Cook interpolation on the points
+	// 0, 1, -1, 2, -2, ... and infinity, so any (m, r) with m + r - 1 <= 8 is available.
+	// Every transform works on 'count' interleaved channels at once :
+	// element (i, j) of channel c is at [(i * len + j) * count + c]
+	class Winograd
+	{
+	public:
+		Winograd(size_t m, size_t r);
+		~Winograd();
+		Winograd(const Winograd&) = delete;
+		Winograd& operator=(const Winograd&) = delete;
+
+		// g(r x r) -> u(ALPHA x ALPHA) = G g G^T
+		void TransformFilter(const data_t* g, data_t* u, size_t count) const;
+		// d(ALPHA x ALPHA) -> v(ALPHA x ALPHA) = B^T d B
+		void TransformInput(const data_t* d, data_t* v, size_t count) const;
+		// m(ALPHA x ALPHA) -> y(M x M) = A^T m A
+		void TransformOutput(const data_t* m, data_t* y, size_t count) const;
+
+		// Adjoints of the transforms above, used by back propagation
+		// dy(M x M) -> dm(ALPHA x ALPHA) = A dy A^T
+		void TransformOutputGrad(const data_t* dy, data_t* dm, size_t count) const;
+		// dv(ALPHA x ALPHA) -> dd(ALPHA x ALPHA) = B dv B^T
+		void TransformInputGrad(const data_t* dv, data_t* dd, size_t count) const;
+		// du(ALPHA x ALPHA) -> dg(r x r) = G^T du G
+		void TransformFilterGrad(const data_t* du, data_t* dg, size_t count) const;
+	public:
+		const size_t M;
+		const size_t R;
+		const size_t ALPHA;
+	private:
+		// y(rows x rows) = L(rows x cols) x(cols x cols) L^T
+		static void sandwich(const data_t* L, size_t rows, size_t cols, const data_t* x, data_t* y, size_t count);
+	private:
+		std::vector<data_t> mAT;	// M x ALPHA
+		std::vector<data_t> mA;		// ALPHA x M
+		std::vector<data_t> mG;		// ALPHA x R
+		std::vector<data_t> mGT;	// R x ALPHA
+		std::vector<data_t> mBT;	// ALPHA x ALPHA
+		std::vector<data_t> mB;		// ALPHA x ALPHA
+	};
+}
\ No newline at end of file